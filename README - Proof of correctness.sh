@@ -6,7 +6,7 @@ CLIENTS_PER_THREAD 1
 CACHE_SIZE 3" > "KVServer.conf"
 
 make debug
-g++ -DDEBUGGING_ON TestingDatabase.cpp KVStoreFileNames_DEBUG.obj -o "a.out"
+g++ -std=c++20 -DDEBUGGING_ON TestingDatabase.cpp -o "a.out"
 
 # ---------------------------------------------------------------------------------------
 
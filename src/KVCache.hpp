@@ -4,11 +4,20 @@
 #include <shared_mutex>
 #include <atomic>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <algorithm>
 
+#include "MyCoroutine.hpp"
 #include "MyDebugger.hpp"
 #include "MyMemoryPool.hpp"
+#include "MySharedLock.hpp"
 #include "KVMessage.hpp"
 #include "KVStore.hpp"
+#include "KVKeyIndex.hpp"
+#include "KVReplication.hpp"
 
 /*
 
@@ -47,18 +56,21 @@ REFER: cachelib
 	- https://github.com/ksholla20/cachelib/tree/V1.0
 */
 
+/*
+ * NOTE: the LRU metadata is kept before "message" so that it shares the first cache line of the CacheNode,
+ *       and the Key-Value payload (~530 bytes) is only touched when the Key is actually compared/copied.
+ *       Layer 1 (i.e. Hash Table) does NOT link the CacheNodes, refer "CacheBucket"
+ * */
 struct CacheNode {
     enum EnumDirtyBit {
         DirtyBit_ALLGOOD = 0,
         DirtyBit_DIRTY = 1,
         DirtyBit_NOT_IN_CACHE = 2,
-        DirtyBit_TODELETE = 3
+        DirtyBit_TODELETE = 3,
+        DirtyBit_PENDING = 4
     };
 
-    struct KVMessage message;
-
     // Doubly Linked List (NOT circular)
-    struct CacheNode *l1_left, *l1_right;  // Doubly Linked List - layer 1 of Cache
     struct CacheNode *l2_prev, *l2_next;  // Doubly Linked List - layer 2 to maintain LRU info
 
     int32_t lru_idx;
@@ -67,12 +79,23 @@ struct CacheNode {
     // if 1, it needs to be written back/updated to the Persistent Storage
     // if 2, this CacheNode has been invalidated by someone  // MOSTLY this is not required as it would be put back in to Memory Pool
     // if 3, delete this entry from Persistent Storage as well when removing it from cache
+    // if 4, the Value is being read from the Persistent Storage, refer "KVCache::cache_GET_join(...)"
+
+    // Number of responses being sent directly from "message.value", refer "KVCache::cache_GET_pinned(...)"
+    // A pinned CacheNode is neither evicted nor is its "message.value" modified
+    std::atomic_uint32_t pin_count;
 
-    CacheNode() : message(), l1_left{nullptr}, l1_right{nullptr}, l2_prev{nullptr}, l2_next{nullptr},
-                  lru_idx{0}, dirty_bit{2} {}
+    // Only used while the CacheNode is pending: the read of the Persistent Storage which will fill it, and the
+    // requests waiting for that read
+    uint64_t fill_id;
+    struct CacheFillWaiter *fill_waiters;
+
+    struct KVMessage message;
+
+    CacheNode() : l2_prev{nullptr}, l2_next{nullptr}, lru_idx{0}, dirty_bit{2}, pin_count(0), fill_id{0},
+                  fill_waiters{nullptr}, message() {}
 
     void set_all(KVMessage *message1,
-                 CacheNode *l1Left, CacheNode *l1Right,
                  CacheNode *l2Prev, CacheNode *l2Next,
                  int32_t lruIdx,
                  int dirtyBit) {
@@ -80,8 +103,8 @@ struct CacheNode {
         message.hash2 = message1->hash2;
         message.set_key_fast(message1->key);
         message.set_value_fast(message1->value);
-        l1_left = l1Left;
-        l1_right = l1Right;
+        message.expires_at = message1->expires_at;
+        message.version = message1->version;
         l2_prev = l2Prev;
         l2_next = l2Next;
         lru_idx = lruIdx;
@@ -108,6 +131,30 @@ struct CacheNode {
     [[nodiscard]] inline bool is_cache_node_deleted() const {
         return dirty_bit == EnumDirtyBit::DirtyBit_TODELETE;
     }
+
+    [[nodiscard]] inline bool is_cache_node_pending() const {
+        return dirty_bit == EnumDirtyBit::DirtyBit_PENDING;
+    }
+
+    [[nodiscard]] inline bool is_cache_node_pinned() const {
+        return pin_count.load(std::memory_order_acquire) != 0;
+    }
+};
+
+/* Result of "KVCache::cache_GET_join(...)", to be passed to "KVCache::cache_GET_fill(...)" */
+struct CacheFillTicket {
+    int lookup_result;  // KVCache::EnumLookupResult
+    uint64_t fill_id;  // non-zero if this request has to fill the pending CacheNode of the Key
+    uint64_t write_version;  // "KVCache::write_version(...)" before the Persistent Storage is read
+};
+
+/* A GET waiting for the pending CacheNode of its Key, part of the coroutine frame of the request */
+struct CacheFillWaiter {
+    struct KVMessage *message;
+    CoroutineResumeQueue *resume_queue;
+    std::coroutine_handle<> handle;
+    CacheFillTicket ticket;
+    CacheFillWaiter *next;
 };
 
 struct CacheNodeQueuePtr {
@@ -122,6 +169,91 @@ struct CacheNodeQueuePtr {
     CacheNodeQueuePtr() : rw_lock(), head{nullptr}, tail{nullptr} {}
 };
 
+/* One overflow entry of a "CacheBucket", refer "CacheBucket::fingerprint_of(...)" */
+struct CacheBucketEntry {
+    uint32_t fingerprint;
+    struct CacheNode *node;
+};
+
+/*
+ * Bucket of the Hash Table (layer 1 of Cache), one cache line
+ *
+ * Instead of a linked list of CacheNodes, each bucket stores a compact array of (fingerprint, CacheNode *).
+ * So, a lookup compares the fingerprints stored next to each other in the bucket and only dereferences
+ * the CacheNode whose fingerprint matches. The first "INLINE_LEN" entries are stored in the bucket itself
+ * and the rest go to "overflowEntries" (rarely used as the load factor of the Hash Table is kept at 1)
+ *
+ * Layout = lock (4 bytes), n (4), fingerprints (4 x 4), CacheNode pointers (4 x 8), overflow pointer (8)
+ *     - The lock is a "SharedLock" (4 bytes) instead of std::shared_mutex (56 bytes)
+ *     - A fingerprint is 32 bits of hash2, so a CacheNode is dereferenced for ~1 in 4 billion other Keys of the
+ *       bucket, and then "KVCache::entry_equals(...)" compares the complete hashes and the Key
+ *     - The buckets are aligned to the cache line, so a lookup reads one cache line, and a lock taken on a bucket
+ *       does NOT invalidate the cache line of its neighbours
+ * */
+struct alignas(64) CacheBucket {
+    static constexpr uint32_t INLINE_LEN = 4;
+
+    SharedLock rw_lock;
+    uint32_t n;
+    uint32_t fingerprints[INLINE_LEN];
+    struct CacheNode *nodes[INLINE_LEN];
+    std::unique_ptr<std::vector<CacheBucketEntry>> overflowEntries;  // allocated on the first overflow
+
+    CacheBucket() : rw_lock(), n{0}, fingerprints{}, nodes{}, overflowEntries() {}
+
+    static inline uint32_t fingerprint_of(uint64_t hash2) {
+        return static_cast<uint32_t>(hash2);
+    }
+
+    [[nodiscard]] inline uint32_t size() const { return n; }
+
+    [[nodiscard]] inline uint32_t fingerprint_at(uint32_t idx) const {
+        return (idx < INLINE_LEN) ? fingerprints[idx] : (*overflowEntries)[idx - INLINE_LEN].fingerprint;
+    }
+
+    [[nodiscard]] inline struct CacheNode *node_at(uint32_t idx) const {
+        return (idx < INLINE_LEN) ? nodes[idx] : (*overflowEntries)[idx - INLINE_LEN].node;
+    }
+
+    inline void push_back(struct CacheNode *ptr) {
+        const uint32_t fingerprint = fingerprint_of(ptr->message.hash2);
+        if (n < INLINE_LEN) {
+            fingerprints[n] = fingerprint;
+            nodes[n] = ptr;
+        } else {
+            if (overflowEntries == nullptr) overflowEntries = std::make_unique<std::vector<CacheBucketEntry>>();
+            overflowEntries->push_back({fingerprint, ptr});
+        }
+        ++n;
+    }
+
+    /* Order of the entries is NOT maintained, the last entry takes the place of the removed entry */
+    inline void erase(uint32_t idx) {
+        const uint32_t fingerprint = fingerprint_at(n - 1);
+        struct CacheNode *node = node_at(n - 1);
+        if (idx < INLINE_LEN) {
+            fingerprints[idx] = fingerprint;
+            nodes[idx] = node;
+        } else {
+            (*overflowEntries)[idx - INLINE_LEN] = {fingerprint, node};
+        }
+        --n;
+        if (n >= INLINE_LEN) overflowEntries->pop_back();
+    }
+
+    /* Returns: true if ptr was found and removed from the bucket */
+    inline bool erase(const struct CacheNode *ptr) {
+        for (uint32_t i = 0; i < n; ++i) {
+            if (node_at(i) == ptr) {
+                erase(i);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+static_assert(sizeof(CacheBucket) == 64);
+
 /*
  * • It is assumed that KVMessage pointer has proper values for both Key and Value
  * • Cache size is at-least 𝟭𝟬𝟮𝟰 otherwise, there is performance loss
@@ -130,174 +262,471 @@ struct CacheNodeQueuePtr {
  *      - If cache is full, remove 5 % entries and save them to Persistent Storage
  *      - In the initial implementation, only 1 entry will be removed if cache is full
  *
+ * Hash Table (Layer 1) uses Linear Hashing
+ *     REFER: https://en.wikipedia.org/wiki/Linear_hashing
+ *     - Number of buckets starts from "HASH_TABLE_MIN_LEN" and grows one bucket at a time (i.e. "split")
+ *       whenever the average chain length goes above "HASH_TABLE_LOAD_FACTOR", till it reaches the upper
+ *       limit computed from the cache size. So, there is never a stop-the-world rehash
+ *     - Buckets are allocated in segments of "HASH_TABLE_SEGMENT_LEN" so that a bucket never moves in memory
+ *     - A bucket may be split by some other thread between computing its index and acquiring its lock,
+ *       so always use "lock_bucket(...)" which verifies the index once the lock is held
  * */
 struct KVCache {
-#define CACHE_TABLE_LEN 16384
+    // Result of the cache-only lookups, i.e. "cache_GET_cached(...)" and "cache_DELETE_cached(...)"
+    enum EnumLookupResult {
+        Lookup_HIT = 0,        // Key found in cache
+        Lookup_NOT_FOUND = 1,  // Key found in cache, but it has been deleted
+        Lookup_MISS = 2,       // Key not in cache, the Persistent Storage has to be checked
+        Lookup_BUSY = 3        // only "cache_GET_pinned(..., true)": the bucket is locked, nothing has been done
+    };
+
+    static constexpr uint64_t HASH_TABLE_MIN_LEN = 1024;
+    static constexpr uint64_t HASH_TABLE_SEGMENT_LEN = 1024;
+    static constexpr uint64_t HASH_TABLE_LOAD_FACTOR = 1;
+    static constexpr uint64_t WRITE_VERSION_STRIPES = 1024;
+
+    // One cache line each, so that a write to one Key does NOT invalidate the write versions of the others
+    struct alignas(64) WriteVersion {
+        std::atomic_uint64_t value{0};
+    };
+
     uint64_t nMax;
 
-    // NOTE: CacheNodeQueuePtr->tail will NOT be used in hastTable
-    std::vector<CacheNodeQueuePtr> hashTable, lruEvictionTable;
+    std::vector<std::unique_ptr<CacheBucket[]>> hashTableSegments;
+    std::vector<CacheNodeQueuePtr> lruEvictionTable;
     MemoryPool<CacheNode> cacheNodeMemoryPool;
 
     // REFER: https://stackoverflow.com/questions/31978324/what-exactly-is-stdatomic
     std::atomic_uint64_t lruTableInsertIdx, lruEvictionIdx;
 
+    // Linear Hashing state = (levelLen << 32) | splitIdx
+    //     - Buckets [0, splitIdx) and [levelLen, levelLen + splitIdx) use "2 * levelLen" as the modulo
+    //     - Buckets [splitIdx, levelLen) use "levelLen" as the modulo
+    std::atomic_uint64_t hashTableState;
+    std::atomic_uint64_t hashTableEntries;
+    uint64_t hashTableMaxLen;
+    std::mutex hashTableSplitMutex;
+
+    // Incremented by every write, while the bucket of the Key is locked, refer "write_version(...)"
+    std::unique_ptr<WriteVersion[]> writeVersions;
+
+    // Pending CacheNodes, refer "cache_GET_join(...)"
+    std::atomic_uint64_t pendingNodes;
+    std::atomic_uint64_t fillIdClock;
+    std::atomic_uint64_t coalescedMisses;  // GETs which waited for the read of some other GET
+
+    // Source of the versions of the entries, refer "next_version(...)". Shared by all the KVCache instances and
+    // seeded with the current time in microseconds, so that the versions keep increasing across restarts and a
+    // Key which is deleted and written again never gets back an old version (i.e. no ABA problem for CAS)
+    inline static std::atomic_uint64_t versionClock{KVMessage::current_time_ms() * 1000};
+
     explicit KVCache(uint64_t cache_size) :
             nMax{cache_size},
-            hashTable(CACHE_TABLE_LEN),  // = 16384
+            hashTableSegments(),
             lruEvictionTable((cache_size >= 10240) ? 128 : ((10240 > cache_size && cache_size >= 1024) ? 32 : 1)),
             cacheNodeMemoryPool(true),
             lruTableInsertIdx(0),
-            lruEvictionIdx(0) {
+            lruEvictionIdx(0),
+            hashTableState(0),
+            hashTableEntries(0),
+            hashTableMaxLen{HASH_TABLE_MIN_LEN},
+            hashTableSplitMutex(),
+            writeVersions(new WriteVersion[WRITE_VERSION_STRIPES]),
+            pendingNodes(0),
+            fillIdClock(0),
+            coalescedMisses(0) {
         // TODO - verify if anything more is required - implement the constructor
         cacheNodeMemoryPool.init(cache_size, 2);
+
+        // The cache never holds more than "cache_size" entries, so the Hash Table is never
+        // required to grow beyond the below size
+        while (hashTableMaxLen * HASH_TABLE_LOAD_FACTOR < cache_size) hashTableMaxLen *= 2;
+
+        // Space for all segment pointers is reserved in advance, as the vector must never re-allocate
+        // while other threads are reading it. Segments are allocated lazily as the buckets are split
+        hashTableSegments.resize(hashTableMaxLen / HASH_TABLE_SEGMENT_LEN);
+        for (uint64_t i = 0; i < HASH_TABLE_MIN_LEN / HASH_TABLE_SEGMENT_LEN; ++i)
+            hashTableSegments.at(i).reset(new CacheBucket[HASH_TABLE_SEGMENT_LEN]);
+        hashTableState = (HASH_TABLE_MIN_LEN << 32U);
     }
 
-    /* ASSUMED: ptr->key is correctly filled in ptr
+    /* Returns: a counter which changes whenever the Value of a Key with this "hash1" is written or deleted (many Keys
+     *          share a counter). A copy of the Value read after this is stale once the counter changes, refer
+     *          "HotKeyCache" */
+    [[nodiscard]] inline uint64_t write_version(uint64_t hash1) const {
+        return writeVersions[hash1 % WRITE_VERSION_STRIPES].value.load(std::memory_order_acquire);
+    }
+
+    /* ASSUMED: the writer lock of the bucket of the Key is held (or the Key is NOT in the KVCache) */
+    inline void bump_write_version(uint64_t hash1) {
+        writeVersions[hash1 % WRITE_VERSION_STRIPES].value.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    /* Same as "cache_GET(...)", but the Persistent Storage is NOT read on a cache miss. This is for callers
+     * which read the Persistent Storage asynchronously, refer "cache_GET_join(...)"
      *
      * IMPORTANT: Will calculate hash1 and hash2 in this method
-     *          : Dirty Bit remain UNCHANGED
+     * Returns: EnumLookupResult, and the "Value" is stored in "ptr->value" if it is Lookup_HIT
+     *          The Value, the version and the expiry time (in "*expiresAtPtr", if it is NOT nullptr) are copied
+     *          under the reader lock of the bucket, so they are consistent with each other
+     * NOTE: "ptr->expires_at" is NOT set by default, as the callers take a non-zero "ptr->expires_at" to mean
+     *       that the Key was read from the Persistent Storage (i.e. its expiry has to be scheduled)
+     * */
+    int cache_GET_cached(struct KVMessage *ptr, uint64_t *expiresAtPtr = nullptr) {
+        return cache_GET_lookup(ptr, nullptr, expiresAtPtr, false, false);
+    }
+
+    /* Same as "cache_GET_cached(...)", but the Value is NOT copied to "ptr->value". Instead, on Lookup_HIT the
+     * CacheNode is pinned and stored in "*cacheNodePtr", so the response can be sent directly from
+     * "(*cacheNodePtr)->message.value" without holding any lock, refer "KVConnection::append_pinned(...)"
      *
-     * Returns: true if GET was successful (i.e. Key was either present in Cache or Persistent Storage)
-     *              - The "Value" corresponding to "ptr->key" will be stored in "ptr->value"
-     *        : false if "Key" is not present
+     * "holdsPins": the thread holds pins of some other CacheNodes. A writer waits for the pins of a CacheNode
+     *              while holding the writer locks of its bucket and LRU list, so such a thread must NOT wait for
+     *              those locks: Lookup_BUSY is returned (and nothing is done) if the bucket is locked by a writer,
+     *              and the LRU list is NOT updated if it is locked
+     * IMPORTANT: "pin_count" of the CacheNode MUST be decremented once the Value has been sent (or copied). Till
+     *            then, the thread must NOT call any other method of KVCache except "cache_GET_pinned(..., true)"
+     *            (e.g. a PUT of the same Key waits for the CacheNode to be unpinned)
      * */
+    int cache_GET_pinned(struct KVMessage *ptr, CacheNode **cacheNodePtr, bool holdsPins) {
+        return cache_GET_lookup(ptr, cacheNodePtr, nullptr, true, holdsPins);
+    }
 
-    CacheNode *cache_GET_ptr(struct KVMessage *ptr) {
+    /* Body of "cache_GET_cached(...)" and "cache_GET_pinned(...)" */
+    int cache_GET_lookup(struct KVMessage *ptr, CacheNode **cacheNodePtr, uint64_t *expiresAtPtr, bool pinNode,
+                         bool noWait) {
         ptr->calculate_key_hash();
 
-        uint64_t hashTableIdx = (ptr->hash1) % CACHE_TABLE_LEN;
-        std::shared_lock reader_lock(hashTable.at(hashTableIdx).rw_lock);
+        uint64_t hashTableIdx;
+        std::shared_lock<SharedLock> reader_lock;
+        if (noWait) {
+            hashTableIdx = get_bucket_idx(ptr->hash1);
+            reader_lock = std::shared_lock(get_bucket(hashTableIdx).rw_lock, std::try_to_lock);
+            // A split of the bucket is treated the same as a writer, it is rare
+            if ((not reader_lock.owns_lock()) || hashTableIdx != get_bucket_idx(ptr->hash1)) return Lookup_BUSY;
+        } else {
+            reader_lock = lock_bucket<std::shared_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+        }
 
         // Search through the cache
         // a. entry found - return the value in ptr->value
-        // b. entry not found - search Persistent storage and do eviction if the cache is full
+        // b. entry not found - the caller has to search the Persistent storage
 
-        struct CacheNode *cacheNodeIter = hashTable.at(hashTableIdx).head;
+        struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+        if (cacheNodeIter == nullptr || cacheNodeIter->is_cache_node_pending()) return Lookup_MISS;
 
-        while (cacheNodeIter != nullptr) {
-            if (not entry_equals(&(cacheNodeIter->message), ptr)) {
-                cacheNodeIter = cacheNodeIter->l1_right;
-                continue;
-            }
+        // MATCH FOUND :)
+        log_info("cache_GET_cached(...) --> Cache HIT");
 
-            // MATCH FOUND :)
-            log_info("cache_GET_ptr(...) --> Cache HIT");
+        // Expired entries are treated as deleted, they are reclaimed by "cache_EXPIRE(...)" or on eviction
+        if (cacheNodeIter->message.is_expired()) return Lookup_NOT_FOUND;
 
-            if (not cacheNodeIter->is_cache_node_deleted()) {
+        if (not cacheNodeIter->is_cache_node_deleted()) {
+            // The reader lock of the bucket is held, so no writer can be waiting on the pin at this point
+            if (pinNode) cacheNodeIter->pin_count.fetch_add(1, std::memory_order_acq_rel);
+            else {
                 std::copy(cacheNodeIter->message.value, cacheNodeIter->message.value + 256, ptr->value);
+                ptr->version = cacheNodeIter->message.version;
+                if (expiresAtPtr != nullptr) *expiresAtPtr = cacheNodeIter->message.expires_at;
             }
+        }
 
-            // Update the LRU list
-            std::unique_lock write_lock(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
+        // Update the LRU list
+        // IMPORTANT: this is same as the one in "cache_PUT"
+        // NOTE: if "noWait" and the LRU list is locked, only the recency of this one HIT is lost
+        std::unique_lock write_lock(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock, std::defer_lock);
+        if (noWait) write_lock.try_lock();
+        else write_lock.lock();
+        if (write_lock.owns_lock()) move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+
+        if (cacheNodeIter->is_cache_node_deleted()) return Lookup_NOT_FOUND;
+        if (cacheNodePtr != nullptr) *cacheNodePtr = cacheNodeIter;
+        return Lookup_HIT;
+    }
 
-            // IMPORTANT: this is same as the one in "cache_PUT"
-            // Update the LRU list
-            move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+    /* Returned by "cache_GET_join(...)", the coroutine is suspended only if it has to wait for some other read */
+    struct FillAwaitable {
+        KVCache *cache;
+        CacheFillWaiter waiter;
+
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
 
-            if (cacheNodeIter->is_cache_node_deleted()) return nullptr;
-            return cacheNodeIter;
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter.handle = handle;
+            return cache->join_fill(&waiter);
         }
 
+        [[nodiscard]] CacheFillTicket await_resume() const noexcept { return waiter.ticket; }
+    };
 
-        log_info("cache_GET_ptr(...) --> Cache MISS");
-        if (kvPersistentStore.read_from_db(ptr)) {
-            // Get the Key-Value pair in Cache
-            reader_lock.unlock();
-            return cache_PUT_new_entry(ptr, hashTableIdx);
+    /* ASSUMED: "cache_GET_cached(ptr)" or "cache_GET_pinned(ptr, ...)" returned Lookup_MISS
+     * Usage (inside a coroutine): CacheFillTicket ticket = co_await kvCache->cache_GET_join(ptr, &resumeQueue);
+     *
+     * Single flight of the cache misses of a Key: the first GET which misses inserts a pending CacheNode of the Key
+     * (it is NOT in the LRU lists, so it is never evicted) and reads the Persistent Storage. The GETs of the same
+     * Key which miss meanwhile wait for that read instead of reading the Key again, so a burst of GETs of a cold
+     * Key costs one read and one CacheNode. The ticket tells what the request has to do:
+     *     - Lookup_MISS: read the Persistent Storage and call "cache_GET_fill(...)", which resumes the waiting
+     *       requests if "ticket.fill_id" is NOT 0 (it is 0 if half of the CacheNodes are already pending, so that
+     *       "acquire_cache_node()" always has some CacheNode to evict)
+     *     - Lookup_HIT or Lookup_NOT_FOUND: the result, given by the cache or by the read of some other request.
+     *       The Value and the version are copied to "ptr" on Lookup_HIT
+     * A PUT or DELETE of a pending Key fills its CacheNode (and resumes the waiting requests) without waiting for
+     * the read, which is then ignored by "cache_GET_fill(...)"
+     * */
+    FillAwaitable cache_GET_join(struct KVMessage *ptr, CoroutineResumeQueue *resumeQueue) {
+        return {this, {ptr, resumeQueue, {}, {Lookup_MISS, 0, 0}, nullptr}};
+    }
+
+    /* Body of "FillAwaitable::await_suspend(...)"
+     * Returns: true if "waiter" waits for the pending CacheNode of its Key, otherwise "waiter->ticket" is set */
+    bool join_fill(CacheFillWaiter *waiter) {
+        struct KVMessage *ptr = waiter->message;
+        CacheNode *newNode = nullptr;
+        while (true) {
+            uint64_t hashTableIdx;
+            auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+            struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+
+            if (cacheNodeIter != nullptr && cacheNodeIter->is_cache_node_pending()) {
+                waiter->next = cacheNodeIter->fill_waiters;
+                cacheNodeIter->fill_waiters = waiter;
+                ++coalescedMisses;
+                writer_lock1.unlock();
+                release_reserved_node(newNode);
+                return true;
+            }
+            if (cacheNodeIter != nullptr) {
+                // Brought in the cache after the lookup of the caller
+                waiter->ticket = {(copy_if_alive(cacheNodeIter, ptr)) ? Lookup_HIT : Lookup_NOT_FOUND, 0, 0};
+                writer_lock1.unlock();
+                release_reserved_node(newNode);
+                return false;
+            }
+
+            waiter->ticket = {Lookup_MISS, 0, write_version(ptr->hash1)};
+            if (newNode != nullptr) {
+                newNode->message.hash1 = ptr->hash1;
+                newNode->message.hash2 = ptr->hash2;
+                newNode->message.set_key_fast(ptr->key);
+                newNode->message.expires_at = 0;
+                newNode->message.version = 0;
+                newNode->l2_prev = newNode->l2_next = nullptr;
+                newNode->lru_idx = static_cast<int32_t>(get_next_lru_queue_idx());
+                newNode->dirty_bit = CacheNode::DirtyBit_PENDING;
+                newNode->fill_id = ++fillIdClock;
+                newNode->fill_waiters = nullptr;
+                get_bucket(hashTableIdx).push_back(newNode);
+                ++hashTableEntries;
+                waiter->ticket.fill_id = newNode->fill_id;
+
+                writer_lock1.unlock();
+                hash_table_split_if_required();
+                return false;
+            }
+            writer_lock1.unlock();
+
+            // The CacheNode is acquired without holding the lock, as it may have to be evicted
+            if (pendingNodes.fetch_add(1) >= nMax / 2) {
+                --pendingNodes;
+                return false;
+            }
+            newNode = (is_full()) ? cache_eviction() : cacheNodeMemoryPool.acquire_instance();
+            if (newNode == nullptr) {
+                --pendingNodes;
+                return false;
+            }
         }
+    }
 
-        return nullptr;  // "Key" neither found in cache nor in persistent storage
+    /* ASSUMED: "ticket" was given by "cache_GET_join(ptr, ...)" (or the caller read "write_version(ptr->hash1)"
+     *          after "cache_GET_cached(ptr)" returned Lookup_MISS), and then the Persistent Storage was read
+     *          into "ptr", "found" being the result
+     *
+     * Some other request may have brought the Key in the cache while the Persistent Storage was being read.
+     * In that case the cached "Value" is the latest one, so it is copied to "ptr->value" instead of
+     * inserting the Key again. If the Key was written meanwhile (i.e. its write version has changed), the Value
+     * which was read may already be stale, so it is NOT cached.
+     *
+     * Returns: true if the Key exists
+     * */
+    bool cache_GET_fill(struct KVMessage *ptr, bool found, const CacheFillTicket &ticket) {
+        uint64_t hashTableIdx;
+        auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+        struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+
+        if (cacheNodeIter != nullptr && cacheNodeIter->is_cache_node_pending()) {
+            // The CacheNode of some other request, which may have been inserted after a write of the Key
+            if (cacheNodeIter->fill_id != ticket.fill_id && write_version(ptr->hash1) != ticket.write_version)
+                return found;
+
+            if (found) {
+                cacheNodeIter->message.set_value_fast(ptr->value);
+                cacheNodeIter->message.expires_at = ptr->expires_at;
+                cacheNodeIter->message.version = ptr->version;
+                cacheNodeIter->dirty_bit = CacheNode::DirtyBit_ALLGOOD;
+                std::unique_lock writer_lock2(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
+                insert_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+            } else {
+                get_bucket(hashTableIdx).erase(cacheNodeIter);
+                --hashTableEntries;
+                cacheNodeIter->dirty_bit = CacheNode::DirtyBit_NOT_IN_CACHE;
+            }
+            settle_pending(cacheNodeIter, found);
+            writer_lock1.unlock();
+            if (not found) cacheNodeMemoryPool.release_instance(cacheNodeIter);
+            return found;
+        }
+        if (cacheNodeIter != nullptr) return copy_if_alive(cacheNodeIter, ptr);
+        writer_lock1.unlock();
+
+        // The Value is same as the one in the Persistent Storage, so it need not be written back
+        // NOTE: the pending CacheNode of this request (if any) was filled by a write and then evicted
+        if (found && ticket.fill_id == 0)
+            cache_PUT_new_entry_if_absent(ptr, CacheNode::DirtyBit_ALLGOOD, &ticket.write_version);
+        return found;
     }
 
+    /* ASSUMED: ptr->key is correctly filled in ptr
+     *
+     * IMPORTANT: Will calculate hash1 and hash2 in this method
+     *          : Dirty Bit remain UNCHANGED
+     *
+     * Returns: true if GET was successful (i.e. Key was either present in Cache or Persistent Storage)
+     *              - The "Value" corresponding to "ptr->key" will be stored in "ptr->value"
+     *        : false if "Key" is not present
+     *
+     * NOTE: the calling thread can NOT be suspended, so it reads the Persistent Storage itself instead of waiting
+     *       for a pending CacheNode of the Key, refer "cache_GET_join(...)"
+     * */
     bool cache_GET(struct KVMessage *ptr) {
-        auto res = cache_GET_ptr(ptr);
-        return res != nullptr;
+        const int lookupResult = cache_GET_cached(ptr);
+        if (lookupResult != Lookup_MISS) return lookupResult == Lookup_HIT;
+
+        log_info("cache_GET(...) --> Cache MISS");
+        const CacheFillTicket ticket{Lookup_MISS, 0, write_version(ptr->hash1)};
+        return cache_GET_fill(ptr, kvPersistentStore.read_from_db(ptr), ticket);
     }
 
-    CacheNode *cache_PUT_new_entry(struct KVMessage *ptr, uint64_t hashTableIdx) {
+    /* Returns: the inserted CacheNode, nullptr if some other request brought the Key in the cache (e.g. a pending
+     *          CacheNode, refer "cache_GET_join(...)") after the caller missed it, nothing is inserted then */
+    CacheNode *cache_PUT_new_entry(struct KVMessage *ptr, int dirtyBit = CacheNode::DirtyBit_DIRTY) {
         // IMPORTANT ACTION
-        CacheNode *new_cacheNode;
-
-        if (is_full())
-            new_cacheNode = cache_eviction();
-        else
-            new_cacheNode = cacheNodeMemoryPool.acquire_instance();
+        CacheNode *new_cacheNode = acquire_cache_node();
 
         // mostly there is no possibility of creating any problem
         uint64_t lru_insert_idx = get_next_lru_queue_idx();
         new_cacheNode->set_all(
                 ptr,
                 nullptr, nullptr,
-                nullptr, nullptr,
-                lru_insert_idx, CacheNode::DirtyBit_DIRTY
+                lru_insert_idx, dirtyBit
         );
 
-        std::unique_lock write_lock1(hashTable.at(hashTableIdx).rw_lock);
+        uint64_t hashTableIdx;
+        auto write_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+        if (find_in_bucket(get_bucket(hashTableIdx), ptr) != nullptr) {
+            write_lock1.unlock();
+            new_cacheNode->dirty_bit = CacheNode::DirtyBit_NOT_IN_CACHE;
+            cacheNodeMemoryPool.release_instance(new_cacheNode);
+            return nullptr;
+        }
         std::unique_lock write_lock2(lruEvictionTable.at(lru_insert_idx).rw_lock);
 
-        insert_to_head_HT(&hashTable.at(hashTableIdx), new_cacheNode);
+        get_bucket(hashTableIdx).push_back(new_cacheNode);
         insert_to_head_LRU(&lruEvictionTable.at(lru_insert_idx), new_cacheNode);
+        ++hashTableEntries;
+
+        // A DIRTY entry is a PUT of a Key which may NOT exist yet, others are read from the Persistent Storage
+        if (dirtyBit == CacheNode::DirtyBit_DIRTY) {
+            kvKeyIndex.insert(ptr);
+            kvReplicationLog.append_PUT(ptr);
+            bump_write_version(ptr->hash1);
+        }
+
+        write_lock1.unlock();
+        write_lock2.unlock();
+        hash_table_split_if_required();
         return new_cacheNode;
     }
 
     /* ASSUMED: ptr->key and ptr->value are correctly filled in ptr
+     *        : ptr->expires_at is 0 unless the Key is to expire (the TTL of an existing Key is replaced, NOT kept)
      * IMPORTANT: will calculate hash1 and hash2 here
+     *          : the version of the Key changes only if its Value or expiry changes, and it is stored in ptr->version
+     *
+     * "version" = 0 assigns a new version, otherwise the Key gets exactly this version (used by a replica to keep
+     * the version given by the primary, refer "KVReplication.hpp")
      * */
-    void cache_PUT(struct KVMessage *ptr) {
+    void cache_PUT(struct KVMessage *ptr, uint64_t version = 0) {
         ptr->calculate_key_hash();
 
-        uint64_t hashTableIdx = (ptr->hash1) % CACHE_TABLE_LEN;
+        uint64_t hashTableIdx;
 
         // Search through the cache
         // a. entry found - then update the value in ptr->value and update the dirty bit
         // b. entry not found - do eviction if the cache is full and set the dirty bit
-        std::shared_lock reader_lock(hashTable.at(hashTableIdx).rw_lock);
-
-        struct CacheNode *cacheNodeIter = hashTable.at(hashTableIdx).head;
+        auto reader_lock = lock_bucket<std::shared_lock<SharedLock>>(ptr->hash1, hashTableIdx);
 
-        while (cacheNodeIter != nullptr) {
-            if (not entry_equals(&(cacheNodeIter->message), ptr)) {
-                cacheNodeIter = cacheNodeIter->l1_right;
-                continue;
-            }
+        struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
 
+        if (cacheNodeIter != nullptr) {
             // MATCH FOUND, we just update the "Value"
             log_info("cache_PUT(...) --> Cache HIT");
 
             reader_lock.unlock();
-            std::unique_lock writer_lock1(hashTable.at(hashTableIdx).rw_lock);
+            auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+
+            // The Key may have been evicted from the cache (and the CacheNode reused for some other Key)
+            // between the unlocking of reader lock and acquiring the writer lock, so search the bucket again
+            cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+            if (cacheNodeIter == nullptr) {
+                writer_lock1.unlock();
+                log_info("cache_PUT(...) --> Cache entry evicted before acquiring the writer lock");
+                ptr->version = (version != 0) ? version : next_version(0);
+                if (cache_PUT_new_entry(ptr) == nullptr) cache_PUT(ptr, version);
+                return;
+            }
             std::unique_lock writer_lock2(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
 
-            if (not(cacheNodeIter->is_cache_node_presentInCache())) {
-                // The Key has either been deleted or has been evicted from the cache
-                // between the unlocking of reader lock and acquiring the writer lock
-                // There is a possibility that this CacheNode has been reused for some other cache entry. Hence
-                // we acquire a new instance or do cache eviction and work on the new CacheNode object
-                if (is_full())
-                    cacheNodeIter = cache_eviction();
-                else
-                    cacheNodeIter = cacheNodeMemoryPool.acquire_instance();
-
-                cacheNodeIter->message.hash1 = ptr->hash1;
-                cacheNodeIter->message.hash2 = ptr->hash2;
-                cacheNodeIter->message.set_key_fast(ptr->key);
-
-                // It is just an assumption that if the entry was not present in Cache,
-                // then we just assume that a new value is being assigned for the key
-                cacheNodeIter->dirty_bit = CacheNode::DirtyBit_DIRTY;
-            } else if (std::equal(ptr->value, ptr->value + 256, cacheNodeIter->message.value)) {
-                // NO change in the dirty_bit as the new and old values match
-                if (cacheNodeIter->is_cache_node_deleted()) cacheNodeIter->dirty_bit = CacheNode::DirtyBit_DIRTY;
-            } else {
+            // Some response may be sent from "message.value" right now. New pins can NOT be taken as the
+            // writer lock of the bucket is held, and a pin lasts till the batch of responses is written by a
+            // thread which waits for no lock meanwhile (refer "cache_GET_pinned(...)"), so just wait
+            while (cacheNodeIter->is_cache_node_pinned()) std::this_thread::yield();
+
+            // A pending CacheNode gets this Value, and the GETs waiting for it are resumed below
+            const bool pending = cacheNodeIter->is_cache_node_pending();
+            const bool modified = pending
+                                  || (not std::equal(ptr->value, ptr->value + 256, cacheNodeIter->message.value))
+                                  || ptr->expires_at != cacheNodeIter->message.expires_at
+                                  || cacheNodeIter->is_cache_node_deleted()
+                                  || (version != 0 && version != cacheNodeIter->message.version);
+            if (modified) {
+                // The Key is (re)created or its TTL changes
+                if (pending || cacheNodeIter->is_cache_node_deleted() || cacheNodeIter->message.is_expired()
+                    || ptr->expires_at != cacheNodeIter->message.expires_at)
+                    kvKeyIndex.insert(ptr);
                 cacheNodeIter->dirty_bit = CacheNode::DirtyBit_DIRTY;
+                cacheNodeIter->message.version = (version != 0) ? version
+                                                                : next_version(cacheNodeIter->message.version);
             }
+            // NOTE: NO change in the dirty_bit (and version) if the new and old values match
 
             cacheNodeIter->message.set_value_fast(ptr->value);
+            cacheNodeIter->message.expires_at = ptr->expires_at;
+            ptr->version = cacheNodeIter->message.version;
+            if (modified) {
+                kvReplicationLog.append_PUT(&(cacheNodeIter->message));
+                bump_write_version(ptr->hash1);
+            }
 
             // IMPORTANT: this is same as the one in "cache_GET"
             // Update the LRU list
-            move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+            if (pending) {
+                insert_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+                settle_pending(cacheNodeIter, true);
+            } else {
+                move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+            }
 
             return;
         }
@@ -310,38 +739,250 @@ struct KVCache {
         // Get the Key-Value pair in Cache
 
         log_info("cache_PUT(...) --> Cache MISS");
-        cache_PUT_new_entry(ptr, hashTableIdx);
+        ptr->version = (version != 0) ? version : next_version(0);
+        // The Key may have been brought in the cache meanwhile, it is then updated in place
+        if (cache_PUT_new_entry(ptr) == nullptr) cache_PUT(ptr, version);
+    }
+
+    /* ASSUMED: ptr->key, ptr->value and ptr->request_arg (i.e. the expected version) are correctly filled in ptr
+     * IMPORTANT: will calculate hash1 and hash2 here
+     *
+     * Compare-And-Swap: the Value is written (and the TTL removed) ONLY if the current version of the Key is
+     * "ptr->request_arg", where version 0 means that the Key must NOT exist
+     *
+     * Returns: true if the Value was written
+     *        : ptr->version = new version of the Key if successful, otherwise its current version (0 = NOT exists)
+     * */
+    bool cache_CAS(struct KVMessage *ptr) {
+        bool swapped = false;
+        cache_UPDATE(ptr, [ptr, &swapped](KVMessage &entry, bool exists) {
+            const uint64_t currentVersion = (exists) ? entry.version : 0;
+            if (currentVersion != ptr->request_arg) {
+                ptr->version = currentVersion;
+                return false;
+            }
+            entry.set_value_fast(ptr->value);
+            entry.expires_at = 0;
+            swapped = true;
+            return true;
+        });
+        return swapped;
+    }
+
+    /* ASSUMED: ptr->key and ptr->request_arg (i.e. the delta as int64_t) are correctly filled in ptr
+     * IMPORTANT: will calculate hash1 and hash2 here
+     *
+     * Add the delta to the Value, which is stored as a decimal integer. A Key which does NOT exist is taken as 0,
+     * and the TTL (if any) of an existing Key is kept
+     *
+     * Returns: true if successful, and the new Value is stored in ptr->request_arg (as int64_t)
+     *        : false if the Value is NOT a decimal integer or the result overflows int64_t
+     * */
+    bool cache_INCR(struct KVMessage *ptr) {
+        const auto delta = static_cast<int64_t>(ptr->request_arg);
+        bool updated = false;
+        cache_UPDATE(ptr, [ptr, delta, &updated](KVMessage &entry, bool exists) {
+            int64_t number = 0;
+            if (exists && (not parse_int64(entry.value, number))) return false;
+            if (__builtin_add_overflow(number, delta, &number)) return false;
+
+            const std::string newValue = std::to_string(number);
+            std::fill(entry.value, entry.value + 256, '\0');
+            std::copy(newValue.begin(), newValue.end(), entry.value);
+            if (not exists) entry.expires_at = 0;
+            ptr->request_arg = static_cast<uint64_t>(number);
+            updated = true;
+            return true;
+        });
+        return updated;
+    }
+
+    /* ASSUMED: ptr->key is correctly filled in ptr
+     * IMPORTANT: will calculate hash1 and hash2 here
+     *
+     * Read-modify-write of the Key done atomically, i.e. under the writer lock of its bucket. The Key is first
+     * brought in the cache (from the Persistent Storage, or as a deleted CacheNode if it does NOT exist), so that
+     * "update" always works on a CacheNode.
+     *
+     * "update(KVMessage &entry, bool exists)" gets the cached entry ("exists" is false if the Key is deleted or
+     * has expired) and returns true if it modified "entry.value"/"entry.expires_at". The modified entry gets a
+     * new version (stored in ptr->version as well) and is written back to the Persistent Storage on eviction.
+     *
+     * NOTE: the Persistent Storage is read by the calling thread (same as the eviction done by "cache_PUT(...)")
+     * */
+    template<typename UpdateFunction>
+    void cache_UPDATE(struct KVMessage *ptr, UpdateFunction update) {
+        ptr->calculate_key_hash();
+
+        while (true) {
+            uint64_t hashTableIdx;
+            auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+            struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+
+            if (cacheNodeIter != nullptr && cacheNodeIter->is_cache_node_pending()) {
+                // Fill it without waiting for the GET which is reading the Key, refer "cache_GET_fill(...)"
+                const CacheFillTicket ticket{Lookup_MISS, cacheNodeIter->fill_id, 0};
+                writer_lock1.unlock();
+
+                KVMessage stored;
+                stored.hash1 = ptr->hash1;
+                stored.hash2 = ptr->hash2;
+                stored.set_key_fast(ptr->key);
+                cache_GET_fill(&stored, kvPersistentStore.read_from_db(&stored), ticket);
+                continue;
+            }
+            if (cacheNodeIter != nullptr) {
+                std::unique_lock writer_lock2(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
+                while (cacheNodeIter->is_cache_node_pinned()) std::this_thread::yield();
+
+                const bool exists = (not cacheNodeIter->is_cache_node_deleted())
+                                    && (not cacheNodeIter->message.is_expired());
+                const uint64_t oldExpiresAt = cacheNodeIter->message.expires_at;
+                if (update(cacheNodeIter->message, exists)) {
+                    if ((not exists) || cacheNodeIter->message.expires_at != oldExpiresAt)
+                        kvKeyIndex.insert(&(cacheNodeIter->message));
+                    cacheNodeIter->dirty_bit = CacheNode::DirtyBit_DIRTY;
+                    cacheNodeIter->message.version = next_version(cacheNodeIter->message.version);
+                    ptr->version = cacheNodeIter->message.version;
+                    kvReplicationLog.append_PUT(&(cacheNodeIter->message));
+                    bump_write_version(ptr->hash1);
+                }
+                move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+                return;
+            }
+            writer_lock1.unlock();
+
+            log_info("cache_UPDATE(...) --> Cache MISS");
+            KVMessage stored;
+            stored.hash1 = ptr->hash1;
+            stored.hash2 = ptr->hash2;
+            stored.set_key_fast(ptr->key);
+            const bool exists = kvPersistentStore.read_from_db(&stored);
+
+            // An expired Key is kept as deleted, so that it is deleted from the Persistent Storage on eviction
+            cache_PUT_new_entry_if_absent(
+                    &stored, (exists) ? CacheNode::DirtyBit_ALLGOOD : CacheNode::DirtyBit_TODELETE
+            );
+        }
+    }
+
+    /* Same as "cache_PUT_new_entry(...)", but nothing is inserted if some other request brought the Key in the
+     * cache meanwhile (the evicted CacheNode, if any, is returned to the memory pool), or if the write version of
+     * the Key is NOT "*expectedWriteVersion" (unless it is nullptr) */
+    void cache_PUT_new_entry_if_absent(struct KVMessage *ptr, int dirtyBit,
+                                       const uint64_t *expectedWriteVersion = nullptr) {
+        CacheNode *new_cacheNode = acquire_cache_node();
+
+        uint64_t lru_insert_idx = get_next_lru_queue_idx();
+        new_cacheNode->set_all(ptr, nullptr, nullptr, lru_insert_idx, dirtyBit);
+
+        uint64_t hashTableIdx;
+        auto write_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+        if (find_in_bucket(get_bucket(hashTableIdx), ptr) != nullptr
+            || (expectedWriteVersion != nullptr && write_version(ptr->hash1) != *expectedWriteVersion)) {
+            write_lock1.unlock();
+            new_cacheNode->dirty_bit = CacheNode::DirtyBit_NOT_IN_CACHE;
+            cacheNodeMemoryPool.release_instance(new_cacheNode);
+            return;
+        }
+        std::unique_lock write_lock2(lruEvictionTable.at(lru_insert_idx).rw_lock);
+
+        get_bucket(hashTableIdx).push_back(new_cacheNode);
+        insert_to_head_LRU(&lruEvictionTable.at(lru_insert_idx), new_cacheNode);
+        ++hashTableEntries;
+
+        write_lock1.unlock();
+        write_lock2.unlock();
+        hash_table_split_if_required();
+    }
+
+    /* Returns: a free CacheNode, the LRU entry is evicted if the cache is full
+     * NOTE: if the cache is smaller than the number of threads, all of its CacheNodes may be in the middle of
+     *       being evicted and inserted again by other threads (i.e. "cache_eviction()" finds all the LRU lists
+     *       empty), so wait till one of them is inserted */
+    CacheNode *acquire_cache_node() {
+        while (true) {
+            CacheNode *cacheNode = (is_full()) ? cache_eviction() : cacheNodeMemoryPool.acquire_instance();
+            if (cacheNode != nullptr) return cacheNode;
+            std::this_thread::yield();
+        }
+    }
+
+    /* Returns: a version greater than "oldVersion" which has never been given to any entry before */
+    static inline uint64_t next_version(uint64_t oldVersion) {
+        return std::max(oldVersion + 1, versionClock.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    /* Returns: true if "value" is a decimal integer (optionally starting with '-') which fits in int64_t */
+    static bool parse_int64(const char *value, int64_t &number) {
+        const bool negative = (value[0] == '-');
+        int i = (negative) ? 1 : 0;
+        if (value[i] == '\0') return false;
+
+        number = 0;
+        for (; i < 256 && value[i] != '\0'; ++i) {
+            if (value[i] < '0' || value[i] > '9') return false;
+            const int64_t digit = value[i] - '0';
+            if (__builtin_mul_overflow(number, 10, &number)
+                || __builtin_add_overflow(number, (negative) ? -digit : digit, &number))
+                return false;
+        }
+        return true;
     }
 
     /* ASSUMED: ptr->key is correctly filled where all places after the first occurrence of '\0' have '\0'
      * IMPORTANT: will calculate hash1 and hash2 here
      * */
     bool cache_DELETE(struct KVMessage *ptr) {
+        const int lookupResult = cache_DELETE_cached(ptr);
+        if (lookupResult == Lookup_MISS) {
+            // NO MATCH FOUND
+            const bool res = kvPersistentStore.delete_from_db(ptr);
+            cache_DELETE_uncached(ptr);
+            return res;
+        }
+        return lookupResult == Lookup_HIT;
+
+        // *** ALTERNATIVE ***
+
+        // // Bring it back in cache
+        // CacheNode *new_cacheNodeIter = cache_GET_ptr(ptr);
+        // if (new_cacheNodeIter == nullptr)
+        //     return false;  // entry has been deleted from the storage as well
+        //
+        // reader_lock.unlock();
+        // std::unique_lock writer_lock1(hashTable.at(hashTableIdx).rw_lock);
+        // new_cacheNodeIter->dirty_bit = CacheNode::EnumDirtyBit::DirtyBit_TODELETE;
+        // return true;
+    }
+
+    /* Same as "cache_DELETE(...)", but the Persistent Storage is NOT touched on a cache miss
+     * Returns: Lookup_HIT if the Key was deleted, Lookup_NOT_FOUND if it was already deleted,
+     *          Lookup_MISS if the caller has to delete the Key from the Persistent Storage
+     * */
+    int cache_DELETE_cached(struct KVMessage *ptr) {
         ptr->calculate_key_hash();
         log_info(std::string() + "cache_DELETE(...) --> "
                  + std::to_string(ptr->hash1) + "," + std::to_string(ptr->hash2)
                  + "," + ptr->key + "," + ptr->value);
-        uint64_t hashTableIdx = (ptr->hash1) % CACHE_TABLE_LEN;
+        uint64_t hashTableIdx;
 
         // Search through the cache
         // a. entry found - then update the value in ptr->value and update the dirty bit
         // b. entry not found - do eviction if the cache is full and set the dirty bit
-        std::shared_lock reader_lock(hashTable.at(hashTableIdx).rw_lock);
+        auto reader_lock = lock_bucket<std::shared_lock<SharedLock>>(ptr->hash1, hashTableIdx);
 
-        struct CacheNode *cacheNodeIter = hashTable.at(hashTableIdx).head;
-
-        while (cacheNodeIter != nullptr) {
-            if (not entry_equals(&(cacheNodeIter->message), ptr)) {
-                cacheNodeIter = cacheNodeIter->l1_right;
-                continue;
-            }
+        struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
 
+        if (cacheNodeIter != nullptr) {
             // MATCH FOUND :)
             log_info("cache_DELETE(...) --> Cache HIT");
 
+            // NOTE: an expired entry is marked TODELETE below, so that it is deleted from the
+            //       Persistent Storage on eviction, but the DELETE request is reported as failed
             if (cacheNodeIter->is_cache_node_deleted()) {
                 log_info("    cache_DELETE(...) --> node already deleted");
-                return false;  // The Key has already been deleted
+                return Lookup_NOT_FOUND;  // The Key has already been deleted
             } else if (cacheNodeIter->is_cache_node_notInCache()) {
                 // This is un-expected because we are holding the reader lock.
                 // The question arises, how did someone modify the CacheNode ?
@@ -361,35 +1002,95 @@ struct KVCache {
                 log_info("    cache_DELETE(...) --> performing fast deletion");
                 reader_lock.unlock();
 
-                std::unique_lock writer_lock1(hashTable.at(hashTableIdx).rw_lock);
+                auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+
+                // Search again as the Key may have been evicted before the writer lock was acquired
+                cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+                if (cacheNodeIter == nullptr) {
+                    writer_lock1.unlock();
+                    log_info("    cache_DELETE(...) --> Cache entry evicted before acquiring the writer lock");
+                    return Lookup_MISS;
+                }
                 std::unique_lock writer_lock2(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
                 if (cacheNodeIter->is_cache_node_deleted()) {
-                    return false;
-                }
-                if (cacheNodeIter->is_cache_node_notInCache()) {
-                    log_error("    cache_DELETE(...) --> cacheNodeIter->is_cache_node_notInCache()");
-                    break;
+                    return Lookup_NOT_FOUND;
                 }
+                const bool pending = cacheNodeIter->is_cache_node_pending();
                 cacheNodeIter->dirty_bit = CacheNode::EnumDirtyBit::DirtyBit_TODELETE;
-                move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+                if (pending) insert_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+                else move_to_head_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+                kvKeyIndex.erase(ptr);
+                kvReplicationLog.append_DEL(ptr);
+                bump_write_version(ptr->hash1);
+                if (pending) {
+                    // Only the Persistent Storage knows if the Key existed, "cache_DELETE_uncached(...)" then
+                    // finds this CacheNode and does nothing
+                    settle_pending(cacheNodeIter, false);
+                    return Lookup_MISS;
+                }
+                if (cacheNodeIter->message.is_expired()) return Lookup_NOT_FOUND;
             }
-            return true;
+            return Lookup_HIT;
         }
 
         // NO MATCH FOUND
-        return kvPersistentStore.delete_from_db(ptr);
+        return Lookup_MISS;
+    }
 
-        // *** ALTERNATIVE ***
+    /* ASSUMED: "ptr" was deleted from the Persistent Storage after "cache_DELETE_cached(ptr)" returned Lookup_MISS
+     *
+     * Remove the Key from "kvKeyIndex" (and log the DELETE for the replicas), unless some other request has written it (i.e. brought it in the cache)
+     * while the Persistent Storage was being updated
+     * */
+    void cache_DELETE_uncached(struct KVMessage *ptr) {
+        uint64_t hashTableIdx;
+        auto reader_lock = lock_bucket<std::shared_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+        if (find_in_bucket(get_bucket(hashTableIdx), ptr) == nullptr) {
+            kvKeyIndex.erase(ptr);
+            kvReplicationLog.append_DEL(ptr);
+            bump_write_version(ptr->hash1);
+        }
+    }
 
-        // // Bring it back in cache
-        // CacheNode *new_cacheNodeIter = cache_GET_ptr(ptr);
-        // if (new_cacheNodeIter == nullptr)
-        //     return false;  // entry has been deleted from the storage as well
-        //
-        // reader_lock.unlock();
-        // std::unique_lock writer_lock1(hashTable.at(hashTableIdx).rw_lock);
-        // new_cacheNodeIter->dirty_bit = CacheNode::EnumDirtyBit::DirtyBit_TODELETE;
-        // return true;
+    /* ASSUMED: ptr->key is correctly filled
+     * IMPORTANT: will calculate hash1 and hash2 here
+     *
+     * Reclaim the Key if it has expired, both from the cache (the CacheNode is returned to the memory pool) and
+     * from the Persistent Storage. Nothing is done if the Key was written again after "ptr->expires_at" was
+     * scheduled, as its current expiry is checked here.
+     * */
+    void cache_EXPIRE(struct KVMessage *ptr) {
+        ptr->calculate_key_hash();
+
+        // The bucket is locked while the Persistent Storage is updated (same as "cache_eviction()"), so
+        // that a PUT of the same Key is either completely before or completely after the expiry
+        uint64_t hashTableIdx;
+        auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(ptr->hash1, hashTableIdx);
+
+        struct CacheNode *cacheNodeIter = find_in_bucket(get_bucket(hashTableIdx), ptr);
+        if (cacheNodeIter == nullptr) {
+            kvPersistentStore.expire_from_db(ptr);
+            kvKeyIndex.erase_if_expired(ptr);
+            return;
+        }
+        if (not cacheNodeIter->message.is_expired()) return;
+        kvKeyIndex.erase_if_expired(ptr);
+
+        log_info("cache_EXPIRE(...) --> reclaiming " + std::string(ptr->key));
+        std::unique_lock writer_lock2(lruEvictionTable.at(cacheNodeIter->lru_idx).rw_lock);
+        while (cacheNodeIter->is_cache_node_pinned()) std::this_thread::yield();
+
+        get_bucket(hashTableIdx).erase(cacheNodeIter);
+        remove_from_dll_LRU(&lruEvictionTable.at(cacheNodeIter->lru_idx), cacheNodeIter);
+        --hashTableEntries;
+
+        // The Persistent Storage may have an older Value of the Key (with or without TTL)
+        kvPersistentStore.delete_from_db(ptr);
+        cacheNodeIter->dirty_bit = CacheNode::DirtyBit_NOT_IN_CACHE;
+
+        writer_lock2.unlock();
+        writer_lock1.unlock();
+        cacheNodeMemoryPool.release_instance(cacheNodeIter);
     }
 
     /* ASSUMPTION: cache_eviction() will only be called when the cache is full
@@ -402,33 +1103,48 @@ struct KVCache {
         uint64_t eqIdx = get_next_eviction_queue_idx();
 
         uint64_t i = 0;
-        for (; i < CACHE_TABLE_LEN && lruEvictionTable.at(eqIdx).head == nullptr; ++i) {
+        for (; i < lruEvictionTable.size() && lruEvictionTable.at(eqIdx).head == nullptr; ++i) {
             eqIdx = get_next_eviction_queue_idx();
         }
-        if (i == CACHE_TABLE_LEN && lruEvictionTable.at(eqIdx).head == nullptr) {
+        if (i == lruEvictionTable.size() && lruEvictionTable.at(eqIdx).head == nullptr) {
             log_warning("cache_eviction(): cache is empty :)");
             return nullptr;
         }
 
         // find Hash Table Queue Index
-        uint64_t hqIdx = lruEvictionTable.at(eqIdx).tail->message.hash1 % CACHE_TABLE_LEN;
-        std::unique_lock writer_lock1(hashTable.at(hqIdx).rw_lock);
+        uint64_t hqIdx;
+        auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(
+                lruEvictionTable.at(eqIdx).tail->message.hash1, hqIdx);
         std::unique_lock writer_lock2(lruEvictionTable.at(eqIdx).rw_lock);
 
         CacheNode *ptrToRemove = lruEvictionTable.at(eqIdx).tail;
-        if (ptrToRemove->is_cache_node_notInCache()) {
+        if (ptrToRemove == nullptr || ptrToRemove->is_cache_node_notInCache()
+            || get_bucket_idx(ptrToRemove->message.hash1) != hqIdx) {
+            // The tail changed between reading it and acquiring the locks
             log_error("ptrToRemove->is_cache_node_notInCache(), trying recursive methodology");
 
             writer_lock1.unlock();
             writer_lock2.unlock();
             return cache_eviction();
         }
+        if (ptrToRemove->is_cache_node_pinned()) {
+            // A response is being sent from this CacheNode, i.e. it is being read, so treat it as recently used
+            log_info("cache_eviction(): LRU tail is pinned, trying the next one");
+            move_to_head_LRU(&lruEvictionTable.at(eqIdx), ptrToRemove);
 
-        remove_from_dll_HT(&hashTable.at(hqIdx), ptrToRemove);
+            writer_lock1.unlock();
+            writer_lock2.unlock();
+            std::this_thread::yield();
+            return cache_eviction();
+        }
+
+        get_bucket(hqIdx).erase(ptrToRemove);
         remove_from_dll_LRU(&lruEvictionTable.at(eqIdx), ptrToRemove);
+        --hashTableEntries;
 
-        if (ptrToRemove->is_cache_node_deleted()) {
+        if (ptrToRemove->is_cache_node_deleted() || ptrToRemove->message.is_expired()) {
             kvPersistentStore.delete_from_db(&(ptrToRemove->message));
+            kvKeyIndex.erase_if_expired(&(ptrToRemove->message));
         } else if (ptrToRemove->is_cache_node_dirty()) {
             kvPersistentStore.write_to_db(&(ptrToRemove->message));
         } else {
@@ -447,22 +1163,26 @@ struct KVCache {
             if (lruEvictionTable.at(eqIdx).head == nullptr) continue;
 
             // find Hash Table Queue Index
-            uint64_t hqIdx = lruEvictionTable.at(eqIdx).tail->message.hash1 % CACHE_TABLE_LEN;
-            std::unique_lock writer_lock1(hashTable.at(hqIdx).rw_lock);
+            uint64_t hqIdx;
+            auto writer_lock1 = lock_bucket<std::unique_lock<SharedLock>>(
+                    lruEvictionTable.at(eqIdx).tail->message.hash1, hqIdx);
             std::unique_lock writer_lock2(lruEvictionTable.at(eqIdx).rw_lock);
 
             CacheNode *ptrToRemove = lruEvictionTable.at(eqIdx).tail;
-            if (ptrToRemove->is_cache_node_notInCache()) {
+            if (ptrToRemove == nullptr || ptrToRemove->is_cache_node_notInCache()
+                || get_bucket_idx(ptrToRemove->message.hash1) != hqIdx || ptrToRemove->is_cache_node_pinned()) {
                 writer_lock1.unlock();
                 writer_lock2.unlock();
                 continue;
             }
 
-            remove_from_dll_HT(&hashTable.at(hqIdx), ptrToRemove);
+            get_bucket(hqIdx).erase(ptrToRemove);
             remove_from_dll_LRU(&lruEvictionTable.at(eqIdx), ptrToRemove);
+            --hashTableEntries;
 
-            if (ptrToRemove->is_cache_node_deleted()) {
+            if (ptrToRemove->is_cache_node_deleted() || ptrToRemove->message.is_expired()) {
                 kvPersistentStore.delete_from_db(&(ptrToRemove->message));
+                kvKeyIndex.erase_if_expired(&(ptrToRemove->message));
             } else if (ptrToRemove->is_cache_node_dirty()) {
                 kvPersistentStore.write_to_db(&(ptrToRemove->message));
             } else {
@@ -475,45 +1195,163 @@ struct KVCache {
         }
     }
 
+    /* ASSUMPTION: no other thread modifies the KVCache till this returns, refer "KVSnapshot"
+     * Copy the CacheNodes which are NOT yet in the Persistent Storage to "messages", and add one entry for each
+     * of them to "batch" (same as "cache_clean()", but nothing is written and the CacheNodes are unchanged)
+     *
+     * NOTE: "messages" is a std::deque so that the entries of "batch" still point to the right message after
+     *       more messages are added */
+    void cache_collect_unwritten(std::deque<KVMessage> &messages, std::vector<KVStoreBatchEntry> &batch) {
+        std::lock_guard split_lock(hashTableSplitMutex);
+        const uint64_t hashTableLen = get_bucket_count();
+        for (uint64_t i = 0; i < hashTableLen; ++i) {
+            CacheBucket &bucket = get_bucket(i);
+            std::shared_lock reader_lock(bucket.rw_lock);
+            for (uint32_t j = 0; j < bucket.size(); ++j) {
+                const CacheNode *ptr = bucket.node_at(j);
+                const bool toDelete = ptr->is_cache_node_deleted() || ptr->message.is_expired();
+                if (not (toDelete || ptr->is_cache_node_dirty())) continue;
+                messages.push_back(ptr->message);
+                batch.push_back({&messages.back(), toDelete});
+            }
+        }
+    }
+
     /* ASSUMPTION: this method will only be called when closing the KVServer
-     * Write all cached data to Persistent Storage */
+     *             i.e. no other thread is using the KVCache
+     * Write all cached data to Persistent Storage
+     *
+     * Dirty CacheNodes are grouped by the file they belong to (i.e. KVStoreGeometry::file_of(hash1)) and sorted on
+     * their slot index inside the file (i.e. KVStoreGeometry::slot_of(hash1)). Each file is then written in one
+     * pass using "KVStore::write_batch_to_db(...)", and the files are spread across a pool of threads. This is much
+     * faster than calling "cache_eviction()" for every entry, which locks, opens, seeks and closes a file per
+     * CacheNode
+     * */
     void cache_clean() {
-        // TODO: Mostly will just have to call "cache_eviction" for all cache entries
-        // while (not is_empty()) {
-        //     cache_eviction();
-        // }
-
-        // for (int32_t i = 0; i < this->nMax; ++i) {
-        //     cache_eviction();
-        //     cache_eviction();
-        //     cache_eviction();
-        // }
-
-        while(cache_eviction());
-        return;
+        const KVStoreGeometry geometry = kvPersistentStore.geometry();
+        std::vector<std::vector<KVStoreBatchEntry>> fileBatches(geometry.file_count());
 
         CacheNode *ptr;
-        for (int32_t i = 0; i < CACHE_TABLE_LEN; ++i) {
-            ptr = hashTable.at(i).head;
-            while (ptr != nullptr) {
+        const uint64_t hashTableLen = get_bucket_count();
+        for (uint64_t i = 0; i < hashTableLen; ++i) {
+            CacheBucket &bucket = get_bucket(i);
+            for (uint32_t j = 0; j < bucket.size(); ++j) {
+                ptr = bucket.node_at(j);
                 log_info("    Cache Node evicted = "
                          + std::to_string(ptr->message.hash1) + "," + std::to_string(ptr->message.hash2) + ","
                          + ptr->message.key + "," + ptr->message.value);
 
-                if (ptr->is_cache_node_deleted()) {
-                    kvPersistentStore.delete_from_db(&(ptr->message));
+                if (ptr->is_cache_node_deleted() || ptr->message.is_expired()) {
+                    fileBatches.at(geometry.file_of(ptr->message.hash1)).push_back({&(ptr->message), true});
+                    kvKeyIndex.erase_if_expired(&(ptr->message));
                 } else if (ptr->is_cache_node_dirty()) {
-                    kvPersistentStore.write_to_db(&(ptr->message));
+                    fileBatches.at(geometry.file_of(ptr->message.hash1)).push_back({&(ptr->message), false});
+                    ptr->dirty_bit = CacheNode::DirtyBit_ALLGOOD;
                 } else {
                     // the updated value is already present in the Persistent Storage
                     // OR, is_cache_node_notInCache
                 }
-                ptr = ptr->l1_right;
             }
         }
+
+        for (auto &batch: fileBatches) {
+            std::sort(batch.begin(), batch.end(), [&geometry](const KVStoreBatchEntry &a, const KVStoreBatchEntry &b) {
+                return geometry.slot_of(a.message->hash1) < geometry.slot_of(b.message->hash1);
+            });
+        }
+
+        // Each thread picks the next file to be written till all files are done
+        std::atomic_uint64_t nextFileIdx(0);
+        uint32_t threadCount = std::max(1U, std::min(std::thread::hardware_concurrency(), 32U));
+        std::vector<std::thread> threadPool;
+        threadPool.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; ++i) {
+            threadPool.emplace_back([&fileBatches, &nextFileIdx]() {
+                for (uint64_t fileIdx = nextFileIdx++; fileIdx < fileBatches.size(); fileIdx = nextFileIdx++) {
+                    kvPersistentStore.write_batch_to_db(fileIdx, fileBatches.at(fileIdx));
+                }
+            });
+        }
+        for (auto &i: threadPool) i.join();
     }
 
 private:
+    /* Mixes the bits of "hash1" as the lower bits of "hash1" are decided by the last few characters of the key */
+    static inline uint64_t get_bucket_hash(uint64_t hash1) {
+        hash1 *= 0x9E3779B97F4A7C15ULL;  // REFER: https://en.wikipedia.org/wiki/Hash_function#Fibonacci_hashing
+        return hash1 ^ (hash1 >> 32U);
+    }
+
+    [[nodiscard]] inline uint64_t get_bucket_idx(uint64_t hash1) const {
+        const uint64_t state = hashTableState.load(std::memory_order_acquire);
+        const uint64_t levelLen = (state >> 32U), splitIdx = (state & 0xFFFFFFFFULL);
+        const uint64_t h = get_bucket_hash(hash1);
+
+        uint64_t idx = h & (levelLen - 1);
+        if (idx < splitIdx) idx = h & (2 * levelLen - 1);
+        return idx;
+    }
+
+    [[nodiscard]] inline uint64_t get_bucket_count() const {
+        const uint64_t state = hashTableState.load(std::memory_order_acquire);
+        return (state >> 32U) + (state & 0xFFFFFFFFULL);
+    }
+
+    inline CacheBucket &get_bucket(uint64_t idx) {
+        return hashTableSegments[idx / HASH_TABLE_SEGMENT_LEN][idx % HASH_TABLE_SEGMENT_LEN];
+    }
+
+    /* Acquire the lock (std::shared_lock or std::unique_lock) of the bucket to which "hash1" belongs
+     * and store the index of the bucket in "hashTableIdx" */
+    template<typename LockType>
+    LockType lock_bucket(uint64_t hash1, uint64_t &hashTableIdx) {
+        while (true) {
+            hashTableIdx = get_bucket_idx(hash1);
+            LockType lock(get_bucket(hashTableIdx).rw_lock);
+
+            // Verify that the bucket was not split before the lock was acquired
+            if (hashTableIdx == get_bucket_idx(hash1)) return lock;
+        }
+    }
+
+    /* Split one bucket of the Hash Table if the average chain length has crossed "HASH_TABLE_LOAD_FACTOR"
+     * Only one thread splits at a time, others just skip the split */
+    void hash_table_split_if_required() {
+        if (hashTableEntries <= get_bucket_count() * HASH_TABLE_LOAD_FACTOR) return;
+
+        std::unique_lock split_lock(hashTableSplitMutex, std::try_to_lock);
+        if (not split_lock.owns_lock()) return;
+
+        const uint64_t state = hashTableState.load(std::memory_order_acquire);
+        const uint64_t levelLen = (state >> 32U), splitIdx = (state & 0xFFFFFFFFULL);
+        const uint64_t newIdx = levelLen + splitIdx;
+        if (newIdx >= hashTableMaxLen || hashTableEntries <= newIdx * HASH_TABLE_LOAD_FACTOR) return;
+
+        if (hashTableSegments.at(newIdx / HASH_TABLE_SEGMENT_LEN) == nullptr)
+            hashTableSegments.at(newIdx / HASH_TABLE_SEGMENT_LEN).reset(new CacheBucket[HASH_TABLE_SEGMENT_LEN]);
+
+        // Lock order: lower bucket index first
+        std::unique_lock writer_lock1(get_bucket(splitIdx).rw_lock);
+        std::unique_lock writer_lock2(get_bucket(newIdx).rw_lock);
+
+        // Move the CacheNodes which belong to the new bucket
+        // NOTE: "erase(i)" moves the last entry to index "i", so "i" is NOT incremented after an erase
+        CacheBucket &oldBucket = get_bucket(splitIdx), &newBucket = get_bucket(newIdx);
+        for (uint32_t i = 0; i < oldBucket.size();) {
+            CacheNode *ptr = oldBucket.node_at(i);
+            if ((get_bucket_hash(ptr->message.hash1) & (2 * levelLen - 1)) == newIdx) {
+                newBucket.push_back(ptr);
+                oldBucket.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        // Publish the split while both the bucket locks are held
+        if (splitIdx + 1 == levelLen) hashTableState.store(((2 * levelLen) << 32U), std::memory_order_release);
+        else hashTableState.store((levelLen << 32U) | (splitIdx + 1), std::memory_order_release);
+    }
+
     [[nodiscard]] inline bool is_not_full() const {
         return (
                        (cacheNodeMemoryPool.memoryBlockPointers.size() * cacheNodeMemoryPool.blockSize) -
@@ -636,39 +1474,48 @@ private:
         ptrQueue->head = ptr;
     }
 
-    static void remove_from_dll_HT(CacheNodeQueuePtr *ptrQueue, CacheNode *ptr) {
-        // remove the node from NON-Circular Doubly Linked List
-        if (ptr->l1_left == nullptr) {
-            // first node in the list
-            ptrQueue->head = ptr->l1_right;
-        } else {
-            ptr->l1_left->l1_right = ptr->l1_right;
+    /* ASSUMED: the writer lock of the bucket of "cacheNode" is held, and it is no longer pending
+     * Resume the GETs waiting for "cacheNode", its Value is given to them if "exists" */
+    void settle_pending(CacheNode *cacheNode, bool exists) {
+        CacheFillWaiter *waiter = cacheNode->fill_waiters;
+        cacheNode->fill_waiters = nullptr;
+        cacheNode->fill_id = 0;
+        --pendingNodes;
+        while (waiter != nullptr) {
+            // The waiter is part of a coroutine frame, which may be destroyed once the coroutine is posted
+            CacheFillWaiter *next = waiter->next;
+            const bool hit = exists && copy_if_alive(cacheNode, waiter->message);
+            waiter->ticket = {(hit) ? Lookup_HIT : Lookup_NOT_FOUND, 0, 0};
+            waiter->resume_queue->post(waiter->handle);
+            waiter = next;
         }
+    }
 
-        if (ptr->l1_right == nullptr) {
-            // case where ptr is the last node
-            ptrQueue->tail = ptr->l1_left;
-        } else {
-            // if ptr is not the last node
-            ptr->l1_right->l1_left = ptr->l1_left;
-        }
+    /* Returns: true if the Key of "cacheNode" exists, and its Value and version are then copied to "ptr" */
+    static bool copy_if_alive(const CacheNode *cacheNode, KVMessage *ptr) {
+        if (cacheNode->is_cache_node_deleted() || cacheNode->message.is_expired()) return false;
+        std::copy(cacheNode->message.value, cacheNode->message.value + 256, ptr->value);
+        ptr->version = cacheNode->message.version;
+        return true;
     }
 
-    /* ASSUMED: "ptrQueue" is a NON-Circular Doubly Linked List */
-    static void insert_to_head_HT(CacheNodeQueuePtr *ptrQueue, CacheNode *ptr) {
-        ptr->l1_left = nullptr;
-        ptr->l1_right = ptrQueue->head;
+    /* Return a CacheNode acquired by "join_fill(...)" but NOT used */
+    void release_reserved_node(CacheNode *cacheNode) {
+        if (cacheNode == nullptr) return;
+        --pendingNodes;
+        cacheNode->dirty_bit = CacheNode::DirtyBit_NOT_IN_CACHE;
+        cacheNodeMemoryPool.release_instance(cacheNode);
+    }
 
-        if (ptrQueue->head == nullptr) {
-            // As mentioned earlier, CacheNodeQueuePtr->tail is NOT used for Layer 1 Doubly Linked List
-            // i.e. TAIL is not used in list of "hashTable"
-            // list is empty
-            ptrQueue->tail = ptr;
-        } else {
-            // list is NON empty
-            ptrQueue->head->l1_left = ptr;
+    /* Returns: CacheNode* having the same Key as "ptr" if present in the bucket, otherwise nullptr
+     * The fingerprint (i.e. 32 bits of hash2) is compared first, so only the matching CacheNode is dereferenced */
+    static CacheNode *find_in_bucket(const CacheBucket &bucket, KVMessage *ptr) {
+        const uint32_t fingerprint = CacheBucket::fingerprint_of(ptr->hash2);
+        for (uint32_t i = 0; i < bucket.size(); ++i) {
+            if (bucket.fingerprint_at(i) == fingerprint && entry_equals(&(bucket.node_at(i)->message), ptr))
+                return bucket.node_at(i);
         }
-        ptrQueue->head = ptr;
+        return nullptr;
     }
 
     static bool entry_equals(KVMessage *a, KVMessage *b) {
@@ -676,8 +1523,6 @@ private:
                && (a->hash2 == b->hash2)
                && (std::equal(a->key, a->key + 256, b->key));
     }
-
-#undef CACHE_TABLE_LEN
 };
 
 #endif // PA_4_KEY_VALUE_STORE_KVCACHE_HPP
@@ -21,6 +21,21 @@ inline void press_enter_to_continue(const char *msg) {
 #endif
 }
 
+/* Get all the pages of the SCAN request "message", and returns the number of Keys */
+uint64_t scan_all_pages(ClientServerConnection &connection, const KVMessage &message) {
+    uint64_t keyCount = 0;
+    std::string token;
+    do {
+        connection.SCAN(message, token.c_str(), static_cast<uint32_t>(message.request_arg));
+        if (connection.resultStatusCode != KVMessage::StatusCodeValueSUCCESS) break;
+        // "log_info(...)" is compiled out unless DEBUGGING_ON is defined
+        for ([[maybe_unused]] const auto &key: connection.resultKeys) log_info(string("    ") + key);
+        keyCount += connection.resultKeys.size();
+        token = connection.resultToken;
+    } while (not token.empty());
+    return keyCount;
+}
+
 /* Used for load testing */
 void start_sending_requests(std::vector<KVMessage> &dataset, const char *server_ip = "127.0.0.1",
                             const char *server_port = "12345") {
@@ -32,7 +47,7 @@ void start_sending_requests(std::vector<KVMessage> &dataset, const char *server_
     log_info(dataset.size());
     for (auto &i : dataset) {
         log_info(string("") + to_string((int) i.status_code) + " " + i.key + " " +
-                 ((i.status_code == KVMessage::EnumPUT) ? i.value : " "));
+                 ((i.is_request_with_value()) ? i.value : " "));
     }
     log_info("-----+-----+-----");
 #endif
@@ -51,7 +66,7 @@ void start_sending_requests(std::vector<KVMessage> &dataset, const char *server_
         log_info(string("    ") + "Request code = " + to_string(i.status_code)
                  + " [" + i.status_code_to_string() + "]");
         log_info(string("    ") + "Key = " + i.key);
-        if (i.is_request_code_PUT()) log_info(string("    ") + "Message = " + i.value);
+        if (i.is_request_with_value()) log_info(string("    ") + "Message = " + i.value);
 
         // No other case is possible because they are handled while reading the dataset file
         switch (i.status_code) {
@@ -62,9 +77,39 @@ void start_sending_requests(std::vector<KVMessage> &dataset, const char *server_
             case KVMessage::EnumPUT:
                 connection.PUT(i);
                 break;
+            case KVMessage::EnumPUT_TTL:
+                connection.PUT_TTL(i);
+                break;
             case KVMessage::EnumDEL:
                 connection.DELETE(i);
                 break;
+            case KVMessage::EnumGETS:
+                connection.GETS(i);
+                log_info(string() + "Result of GETS = \"" + connection.resultValue + "\", version = "
+                         + to_string(connection.resultVersion));
+                break;
+            case KVMessage::EnumCAS:
+                connection.CAS(i, i.request_arg);
+                log_info(string() + "Result of CAS = version " + to_string(connection.resultVersion));
+                break;
+            case KVMessage::EnumINCR:
+            case KVMessage::EnumDECR:
+                if (i.status_code == KVMessage::EnumINCR) connection.INCR(i, static_cast<int64_t>(i.request_arg));
+                else connection.DECR(i, static_cast<int64_t>(i.request_arg));
+                log_info(string() + "Result of " + i.status_code_to_string() + " = "
+                         + to_string(connection.resultNumber));
+                break;
+            case KVMessage::EnumSCAN:
+                log_info(string() + "Result of SCAN = " + to_string(scan_all_pages(connection, i)) + " Keys");
+                break;
+            case KVMessage::EnumSTATS:
+                connection.STATS();
+                log_info(string() + "Result of STATS = \"" + connection.resultValue + "\"");
+                break;
+            case KVMessage::EnumSNAPSHOT:
+                connection.SNAPSHOT(i);
+                log_info(string() + "Result of SNAPSHOT = \"" + connection.resultValue + "\"");
+                break;
         }
     }
 }
@@ -80,7 +125,7 @@ void auto_testing(std::vector<KVMessage> &dataset, const char *server_ip,
     log_info(string() + "Dataset Size = " + to_string(dataset.size()));
     for (auto &i : dataset) {
         log_info(string("") + to_string((int) i.status_code) + " " + i.key + " " +
-                 ((i.status_code == KVMessage::EnumPUT) ? i.value : " "));
+                 ((i.is_request_with_value()) ? i.value : " "));
     }
     log_info("-----+-----+-----+-----");
 #endif
@@ -96,12 +141,14 @@ void auto_testing(std::vector<KVMessage> &dataset, const char *server_ip,
         KVMessage &kvMessage = dataset.at(i);
         kvMessage.fix_key_nulling();
 
-        if (kvMessage.is_request_code_PUT()) log_info(string("    ") + "Message = " + kvMessage.value);
+        if (kvMessage.is_request_with_value()) log_info(string("    ") + "Message = " + kvMessage.value);
 
         // No other case is possible because they are handled while reading the dataset file
         switch (kvMessage.status_code) {
             case KVMessage::EnumGET:
-                connection.GET(kvMessage);
+            case KVMessage::EnumGETS:
+                if (kvMessage.is_request_code_GETS()) connection.GETS(kvMessage);
+                else connection.GET(kvMessage);
                 if ((
                             connection.resultStatusCode == KVMessage::StatusCodeValueSUCCESS
                             && dataset_results.at(i) == std::string(connection.resultValue)
@@ -129,7 +176,9 @@ void auto_testing(std::vector<KVMessage> &dataset, const char *server_ip,
                 // }
                 break;
             case KVMessage::EnumPUT:
-                connection.PUT(kvMessage);
+            case KVMessage::EnumPUT_TTL:
+                if (kvMessage.is_request_code_PUT()) connection.PUT(kvMessage);
+                else connection.PUT_TTL(kvMessage);
                 if ((
                             connection.resultStatusCode == KVMessage::StatusCodeValueSUCCESS
                     ) || (
@@ -169,6 +218,86 @@ void auto_testing(std::vector<KVMessage> &dataset, const char *server_ip,
                     exit(1);
                 }
                 break;
+            case KVMessage::EnumCAS:
+            case KVMessage::EnumINCR:
+            case KVMessage::EnumDECR:
+                // The version is NOT known in advance, so only the success/failure of CAS is compared
+                if (kvMessage.is_request_code_CAS()) connection.CAS(kvMessage, kvMessage.request_arg);
+                else if (kvMessage.status_code == KVMessage::EnumINCR)
+                    connection.INCR(kvMessage, static_cast<int64_t>(kvMessage.request_arg));
+                else connection.DECR(kvMessage, static_cast<int64_t>(kvMessage.request_arg));
+                if ((
+                            connection.resultStatusCode == KVMessage::StatusCodeValueSUCCESS
+                            && dataset_results.at(i) != "-ERROR-"
+                            && (kvMessage.is_request_code_CAS()
+                                || dataset_results.at(i) == std::to_string(connection.resultNumber))
+                    ) || (
+                            connection.resultStatusCode == KVMessage::StatusCodeValueERROR
+                            && dataset_results.at(i) == "-ERROR-")
+                        ) {
+                    log_success("Request Number = " + std::to_string(i + 1) + " / " + std::to_string(dataset.size()));
+                } else {
+                    ++errorCount;
+                    log_error(string("Request Number = ") + to_string(request_number), true);
+                    log_error(string("    ") + "Request code = " + to_string(kvMessage.status_code) + " [" +
+                             kvMessage.status_code_to_string() + "]");
+                    log_error(string("    ") + "Key = " + kvMessage.key);
+                    log_error(string("    ") + "connection.resultStatusCode = " + to_string(connection.resultStatusCode));
+                    log_error(string("    ") + "connection.resultNumber = " + to_string(connection.resultNumber));
+                    log_error(string("    ") + "dataset_results.at(i) = " + dataset_results.at(i));
+                    exit(1);
+                }
+                break;
+            case KVMessage::EnumSCAN: {
+                // The expected result is the number of Keys having the prefix
+                const uint64_t keyCount = scan_all_pages(connection, kvMessage);
+                if (dataset_results.at(i) == std::to_string(keyCount)) {
+                    log_success("Request Number = " + std::to_string(i + 1) + " / " + std::to_string(dataset.size()));
+                } else {
+                    ++errorCount;
+                    log_error(string("Request Number = ") + to_string(request_number), true);
+                    log_error(string("    ") + "Request code = " + to_string(kvMessage.status_code) + " [" +
+                             kvMessage.status_code_to_string() + "]");
+                    log_error(string("    ") + "Key = " + kvMessage.key);
+                    log_error(string("    ") + "Keys found = " + to_string(keyCount));
+                    log_error(string("    ") + "dataset_results.at(i) = " + dataset_results.at(i));
+                    exit(1);
+                }
+                break;
+            }
+            case KVMessage::EnumSTATS:
+                // The expected result is the replication role of the server, e.g. "primary"
+                connection.STATS();
+                if (std::string(connection.resultValue).rfind("role=" + dataset_results.at(i) + " ", 0) == 0) {
+                    log_success("Request Number = " + std::to_string(i + 1) + " / " + std::to_string(dataset.size()));
+                } else {
+                    ++errorCount;
+                    log_error(string("Request Number = ") + to_string(request_number), true);
+                    log_error(string("    ") + "Request code = " + to_string(kvMessage.status_code) + " [" +
+                             kvMessage.status_code_to_string() + "]");
+                    log_error(string("    ") + "connection.resultValue = " + connection.resultValue);
+                    log_error(string("    ") + "dataset_results.at(i) = " + dataset_results.at(i));
+                    exit(1);
+                }
+                break;
+            case KVMessage::EnumSNAPSHOT:
+                // The expected result is "-ERROR-" or the directory of the snapshot, e.g. "snapshots/NAME"
+                connection.SNAPSHOT(kvMessage);
+                if ((connection.resultStatusCode == KVMessage::StatusCodeValueSUCCESS
+                     && dataset_results.at(i) == connection.resultValue)
+                    || (connection.resultStatusCode == KVMessage::StatusCodeValueERROR
+                        && dataset_results.at(i) == "-ERROR-")) {
+                    log_success("Request Number = " + std::to_string(i + 1) + " / " + std::to_string(dataset.size()));
+                } else {
+                    ++errorCount;
+                    log_error(string("Request Number = ") + to_string(request_number), true);
+                    log_error(string("    ") + "Request code = " + to_string(kvMessage.status_code) + " [" +
+                             kvMessage.status_code_to_string() + "]");
+                    log_error(string("    ") + "connection.resultValue = " + connection.resultValue);
+                    log_error(string("    ") + "dataset_results.at(i) = " + dataset_results.at(i));
+                    exit(1);
+                }
+                break;
         }
     }
 
@@ -211,7 +340,10 @@ std::vector<KVMessage> load_client_request_dataset(char *filename) {
     uint32_t request_type;
     struct KVMessage temp;
     for (uint32_t i = 0; i < requestCount; ++i) {
-        // Request Codes: 1=GET, 2=PUT, 3=DELETE
+        // Request Codes: 1=GET, 2=PUT, 3=DELETE, 4=PUT_TTL (i.e. "4 KEY VALUE TTL_SECONDS"),
+        //                5=GETS, 6=CAS (i.e. "6 KEY VALUE VERSION"), 7=INCR and 8=DECR (i.e. "7 KEY DELTA"),
+        //                9=SCAN (i.e. "9 PREFIX KEYS_PER_PAGE", all the pages are requested),
+        //                10=STATS (i.e. "10 ANY_KEY"), 11=SNAPSHOT (i.e. "11 NAME")
         fileReader >> request_type;
         if (not KVMessage::is_request_code_valid(request_type)) {
             log_error("Invalid value of Request Code = " + to_string(request_type));
@@ -221,8 +353,23 @@ std::vector<KVMessage> load_client_request_dataset(char *filename) {
 
         temp.status_code = request_type;
         fileReader >> temp.key;
-        if (KVMessage::is_request_code_PUT(request_type))
+        if (KVMessage::is_request_with_value(request_type))
             fileReader >> temp.value;  // "Value" is only required for PUT requests
+        temp.ttl_seconds = 0;
+        if (KVMessage::is_request_code_PUT_TTL(request_type))
+            fileReader >> temp.ttl_seconds;
+        temp.request_arg = 0;
+        if (KVMessage::is_request_code_CAS(request_type)) {
+            fileReader >> temp.request_arg;
+        } else if (KVMessage::is_request_code_INCR_DECR(request_type)) {
+            int64_t delta;
+            fileReader >> delta;
+            temp.request_arg = static_cast<uint64_t>(delta);
+        } else if (KVMessage::is_request_code_SCAN(request_type)) {
+            uint32_t keysPerPage;
+            fileReader >> keysPerPage;
+            temp.request_arg = keysPerPage;
+        }
         dataset.at(i) = temp;
     }
 
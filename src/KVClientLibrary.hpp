@@ -2,15 +2,19 @@
 #define PA_4_KEY_VALUE_STORE_KVCLIENTLIBRARY_HPP
 
 #include <string>
+#include <vector>
 #include <cstring>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <cctype>
 
 #include "MyDebugger.hpp"
 #include "KVMessage.hpp"
+#include "KVLocalSocket.hpp"
 
 // REFER: https://www.bogotobogo.com/cplusplus/sockets_server_client.php
 // REFER: https://stackoverflow.com/questions/1593946/what-is-af-inet-and-why-do-i-need-it
@@ -38,10 +42,22 @@ struct ClientServerConnection {
     int socketFD;  // used to communicated with the Server over the socket
     uint8_t resultStatusCode;
     char resultValue[256];
+    uint64_t resultVersion;  // GETS and CAS
+    int64_t resultNumber;  // INCR and DECR
+    std::vector<std::string> resultKeys;  // SCAN
+    char resultToken[256];  // SCAN
 
-    ClientServerConnection(const char *serverIP, const char *serverPort) : resultStatusCode{}, resultValue{} {
+    ClientServerConnection(const char *serverIP, const char *serverPort)
+            : resultStatusCode{}, resultValue{}, resultVersion{0}, resultNumber{0}, resultKeys(), resultToken{} {
         // REFERRED: B.E. Computer Network's file transfer program
 
+        // A server on the same host is connected using its Unix domain socket (if it has one), refer KVLocalSocket.hpp
+        socketFD = local_socket::connect_to_server(serverIP, serverPort);
+        if (socketFD >= 0) {
+            log_info("Connected using the Unix domain socket of the server");
+            return;
+        }
+
         // REFER: https://stackoverflow.com/questions/5815675/what-is-sock-dgram-and-sock-stream
         socketFD = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -69,6 +85,11 @@ struct ClientServerConnection {
             log_error("Connection with the server failed");
             exit(6);
         }
+
+        // Every request is written using one system call (refer "send_request()"), so Nagle's algorithm would only
+        // delay the next request till the server acknowledges the previous response (delayed ACK, ~40 ms)
+        const int one = 1;
+        setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
     }
 
     ~ClientServerConnection() {
@@ -89,8 +110,9 @@ struct ClientServerConnection {
 
     void GET(const struct KVMessage &message) {
         // 1 represents GET request
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueGET)), 1))
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(message.key), 256))
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueGET)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        ASSERT_SUCCESS(send_request())
 
         ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
         ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(resultValue), 256))
@@ -99,9 +121,10 @@ struct ClientServerConnection {
 
     void PUT(const struct KVMessage &message) {
         // 2 represents PUT request
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(&(KVMessage::StatusCodeValuePUT)), 1))
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(message.key), 256))
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(message.value), 256))
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValuePUT)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        add_to_request(reinterpret_cast<const void *>(message.value), 256);
+        ASSERT_SUCCESS(send_request())
 
         ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
         // NOTE: the below code will never run as server will always be able to successfully put/update the "Value"
@@ -112,10 +135,24 @@ struct ClientServerConnection {
         print_result_returned("PUT");
     }
 
+    /* Same as PUT, but the Key expires after "message.ttl_seconds" */
+    void PUT_TTL(const struct KVMessage &message) {
+        // 4 represents PUT_TTL request
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValuePUT_TTL)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        add_to_request(reinterpret_cast<const void *>(message.value), 256);
+        add_to_request(reinterpret_cast<const void *>(&(message.ttl_seconds)), sizeof(uint32_t));
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        print_result_returned("PUT_TTL");
+    }
+
     void DELETE(const struct KVMessage &message) {
         // 3 represents DELETE request
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueDEL)), 1))
-        ASSERT_SUCCESS(write(socketFD, reinterpret_cast<const void *>(message.key), 256))
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueDEL)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        ASSERT_SUCCESS(send_request())
 
         ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
         if (KVMessage::is_request_result_ERROR(resultStatusCode)) {
@@ -125,6 +162,97 @@ struct ClientServerConnection {
         print_result_returned("DELETE");
     }
 
+    /* Same as GET, and the version of the Key is stored in "resultVersion" (to be used with CAS) */
+    void GETS(const struct KVMessage &message) {
+        // 5 represents GETS request
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueGETS)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(resultValue), 256))
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultVersion), sizeof(uint64_t)))
+        print_result_returned("GETS");
+    }
+
+    /* PUT only if the version of the Key is "expectedVersion" (0 = the Key must NOT exist)
+     * "resultVersion" = new version if successful, otherwise the current version of the Key */
+    void CAS(const struct KVMessage &message, uint64_t expectedVersion) {
+        // 6 represents CAS request
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueCAS)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        add_to_request(reinterpret_cast<const void *>(message.value), 256);
+        add_to_request(reinterpret_cast<const void *>(&expectedVersion), sizeof(uint64_t));
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultVersion), sizeof(uint64_t)))
+        print_result_returned("CAS");
+    }
+
+    /* Add "delta" to the Value (a decimal integer, a missing Key is 0), the new Value is stored in "resultNumber" */
+    void INCR(const struct KVMessage &message, int64_t delta) {
+        increment(KVMessage::StatusCodeValueINCR, message, delta);
+        print_result_returned("INCR");
+    }
+
+    /* Subtract "delta" from the Value, refer "INCR(...)" */
+    void DECR(const struct KVMessage &message, int64_t delta) {
+        increment(KVMessage::StatusCodeValueDECR, message, delta);
+        print_result_returned("DECR");
+    }
+
+    /* One page of at most "maxKeys" Keys starting with "message.key" (the prefix) is stored in "resultKeys"
+     * "token" is empty for the first page, then pass "resultToken" to get the next page till it is empty */
+    void SCAN(const struct KVMessage &message, const char *token, uint32_t maxKeys) {
+        // 9 represents SCAN request
+        char tokenPadded[256] = {};
+        std::strncpy(tokenPadded, token, 255);
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueSCAN)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        add_to_request(reinterpret_cast<const void *>(tokenPadded), 256);
+        add_to_request(reinterpret_cast<const void *>(&maxKeys), sizeof(uint32_t));
+        ASSERT_SUCCESS(send_request())
+
+        uint32_t count = 0;
+        char key[256];
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read_fully(&count, sizeof(uint32_t)))
+        resultKeys.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            ASSERT_SUCCESS(read_fully(key, 256))
+            resultKeys.emplace_back(key, strnlen(key, 256));
+        }
+        ASSERT_SUCCESS(read_fully(resultToken, 256))
+        print_result_returned("SCAN");
+    }
+
+    /* Server statistics (e.g. replication role and lag) are stored in "resultValue" as "name=value" pairs */
+    void STATS() {
+        // 10 represents STATS request, the Key is ignored by the server
+        const char key[256] = {};
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueSTATS)), 1);
+        add_to_request(reinterpret_cast<const void *>(key), 256);
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read_fully(resultValue, 256))
+        print_result_returned("STATS");
+    }
+
+    /* Start an online snapshot named "message.key" (empty = current time), the directory of the snapshot (or the
+     * reason of failure) is stored in "resultValue", its progress is shown by STATS */
+    void SNAPSHOT(const struct KVMessage &message) {
+        // 11 represents SNAPSHOT request
+        add_to_request(reinterpret_cast<const void *>(&(KVMessage::StatusCodeValueSNAPSHOT)), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read_fully(resultValue, 256))
+        print_result_returned("SNAPSHOT");
+    }
+
     void print_result_returned(const char *operationName) {
         if (KVMessage::is_request_result_SUCCESS(resultStatusCode)) {
             log_info(std::string(operationName) + ": was successful");
@@ -136,6 +264,57 @@ struct ClientServerConnection {
         }
     }
 
+private:
+    // The largest request is CAS: request code + Key + Value + expected version
+    char request[sizeof(uint8_t) + 256 + 256 + sizeof(uint64_t)] = {};
+    size_t request_len = 0;
+
+    inline void add_to_request(const void *data, size_t len) {
+        std::memcpy(request + request_len, data, len);
+        request_len += len;
+    }
+
+    /* Write the fields added by "add_to_request(...)" as one segment, instead of one small segment per field
+     * Returns: number of bytes written if successful, -1 otherwise */
+    ssize_t send_request() {
+        size_t done = 0;
+        while (done < request_len) {
+            const ssize_t n = write(socketFD, request + done, request_len - done);
+            if (n <= 0) {
+                request_len = 0;
+                return -1;
+            }
+            done += n;
+        }
+        request_len = 0;
+        return static_cast<ssize_t>(done);
+    }
+
+    /* A SCAN response may be larger than one TCP segment, so "read(...)" is repeated till "len" bytes are read
+     * Returns: "len" if successful, -1 otherwise */
+    ssize_t read_fully(void *buf, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            const ssize_t n = read(socketFD, static_cast<char *>(buf) + done, len - done);
+            if (n <= 0) return -1;
+            done += n;
+        }
+        return static_cast<ssize_t>(len);
+    }
+
+    /* Body of "INCR(...)" and "DECR(...)" */
+    void increment(const uint8_t &requestCode, const struct KVMessage &message, int64_t delta) {
+        add_to_request(reinterpret_cast<const void *>(&requestCode), 1);
+        add_to_request(reinterpret_cast<const void *>(message.key), 256);
+        add_to_request(reinterpret_cast<const void *>(&delta), sizeof(int64_t));
+        ASSERT_SUCCESS(send_request())
+
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultStatusCode), 1))
+        ASSERT_SUCCESS(read(socketFD, reinterpret_cast<void *>(&resultNumber), sizeof(int64_t)))
+        if (KVMessage::is_request_result_ERROR(resultStatusCode))
+            std::strcpy(resultValue, "Value is not an integer or the result overflows");
+    }
+
 #undef ASSERT_SUCCESS
 
 };
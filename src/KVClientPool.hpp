@@ -0,0 +1,491 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVCLIENTPOOL_HPP
+#define PA_4_KEY_VALUE_STORE_KVCLIENTPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "MyDebugger.hpp"
+#include "KVMessage.hpp"
+#include "KVLocalSocket.hpp"
+
+/*
+ * Result of one request sent using KVClientPool
+ *
+ * "status_code" is the status returned by the server. If the request could not be completed (connection failure,
+ * timeout, ...), then "status_code" is ERROR and "failed" is true, "error" describes what went wrong.
+ * */
+struct KVResult {
+    uint8_t status_code{KVMessage::StatusCodeValueERROR};
+    bool failed{false};  // true = the server did NOT respond, so the request may or may NOT have been executed
+    std::string error;
+    std::string value;  // GET, GETS, and the error message of DELETE
+    uint64_t version{0};  // GETS and CAS
+    int64_t number{0};  // INCR and DECR
+    std::vector<std::string> keys;  // SCAN
+    std::string token;  // SCAN, continuation token for the next page (empty if there are no more Keys)
+
+    [[nodiscard]] bool is_success() const {
+        return (not failed) && KVMessage::is_request_result_SUCCESS(status_code);
+    }
+
+    static KVResult failure(const char *reason) {
+        KVResult result;
+        result.failed = true;
+        result.error = reason;
+        return result;
+    }
+};
+
+/*
+ * Thread safe client library with a pool of connections to one KVServer
+ *
+ * Unlike "ClientServerConnection" (one socket, blocking calls, exits on errors), any number of threads can send
+ * requests concurrently, and each call returns immediately with a "std::future<KVResult>" or invokes a callback
+ * once the response arrives. Errors are reported in KVResult, the process is never terminated.
+ *
+ *     - Pipelining: the KVServer serves the requests of one connection one after the other (refer
+ *       "rearm_client(...)"), so a request is written as soon as it is submitted, and the responses are
+ *       matched with the requests in FIFO order by one reader thread per connection. At most
+ *       "maxInFlight" requests are outstanding per connection, "submit(...)" waits if all of them are used.
+ *     - Requests are distributed round-robin over "poolSize" connections
+ *     - Timeouts: if the response to a request does not arrive within "requestTimeoutMs", the connection can
+ *       no longer be matched with its requests, so the connection is closed and all its outstanding requests
+ *       fail (KVResult::failed = true)
+ *     - Reconnection: a closed/broken connection is connected again by the next request which is sent on it,
+ *       after waiting for at least "reconnectDelayMs" since the last failed attempt
+ *
+ * NOTE: callbacks are invoked by the reader thread of the connection, so they must NOT block or wait for
+ *       another request sent using the same KVClientPool
+ *
+ * Usage:
+ *     KVClientPool pool("127.0.0.1", "8080", {.poolSize = 4});
+ *     std::future<KVResult> f = pool.GET("key");
+ *     pool.PUT("key", "value", [](KVResult r) { ... });
+ *     if (f.get().is_success()) ...
+ * */
+class KVClientPool {
+public:
+    using Callback = std::function<void(KVResult)>;
+
+    struct Options {
+        uint32_t poolSize = 4;
+        uint32_t maxInFlight = 64;  // per connection
+        uint32_t connectTimeoutMs = 2000;
+        uint32_t requestTimeoutMs = 5000;
+        uint32_t reconnectDelayMs = 100;
+    };
+
+    // NOTE: "Options" can NOT be a default argument, as its default member initializers are used before the end
+    //       of the enclosing class
+    KVClientPool(const char *serverIP, const char *serverPort) : KVClientPool(serverIP, serverPort, Options()) {}
+
+    KVClientPool(const char *serverIP, const char *serverPort, Options options)
+            : serverIP(serverIP), serverPort(serverPort), options(options) {
+        if (this->options.poolSize == 0) this->options.poolSize = 1;
+        if (this->options.maxInFlight == 0) this->options.maxInFlight = 1;
+        for (uint32_t i = 0; i < this->options.poolSize; ++i) {
+            connections.push_back(std::make_unique<Connection>(this));
+        }
+        // NOTE: the connections are established lazily, by the first request sent on each of them
+    }
+
+    ~KVClientPool() {
+        for (auto &connection: connections) connection->stop();
+    }
+
+    KVClientPool(const KVClientPool &) = delete;
+    KVClientPool &operator=(const KVClientPool &) = delete;
+
+    std::future<KVResult> GET(const std::string &key) { return submit(request(KVMessage::StatusCodeValueGET, key)); }
+    void GET(const std::string &key, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueGET, key), std::move(cb));
+    }
+
+    std::future<KVResult> PUT(const std::string &key, const std::string &value) {
+        return submit(request(KVMessage::StatusCodeValuePUT, key, &value));
+    }
+    void PUT(const std::string &key, const std::string &value, Callback cb) {
+        submit(request(KVMessage::StatusCodeValuePUT, key, &value), std::move(cb));
+    }
+
+    /* Same as PUT, but the Key expires after "ttlSeconds" */
+    std::future<KVResult> PUT_TTL(const std::string &key, const std::string &value, uint32_t ttlSeconds) {
+        return submit(request(KVMessage::StatusCodeValuePUT_TTL, key, &value, &ttlSeconds, sizeof(uint32_t)));
+    }
+    void PUT_TTL(const std::string &key, const std::string &value, uint32_t ttlSeconds, Callback cb) {
+        submit(request(KVMessage::StatusCodeValuePUT_TTL, key, &value, &ttlSeconds, sizeof(uint32_t)), std::move(cb));
+    }
+
+    std::future<KVResult> DELETE(const std::string &key) {
+        return submit(request(KVMessage::StatusCodeValueDEL, key));
+    }
+    void DELETE(const std::string &key, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueDEL, key), std::move(cb));
+    }
+
+    /* Same as GET, and "KVResult::version" is the version of the Key (to be used with CAS) */
+    std::future<KVResult> GETS(const std::string &key) {
+        return submit(request(KVMessage::StatusCodeValueGETS, key));
+    }
+    void GETS(const std::string &key, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueGETS, key), std::move(cb));
+    }
+
+    /* PUT only if the version of the Key is "expectedVersion" (0 = the Key must NOT exist), refer "KVMessage" */
+    std::future<KVResult> CAS(const std::string &key, const std::string &value, uint64_t expectedVersion) {
+        return submit(request(KVMessage::StatusCodeValueCAS, key, &value, &expectedVersion, sizeof(uint64_t)));
+    }
+    void CAS(const std::string &key, const std::string &value, uint64_t expectedVersion, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueCAS, key, &value, &expectedVersion, sizeof(uint64_t)),
+               std::move(cb));
+    }
+
+    /* "KVResult::number" is the Value after the update */
+    std::future<KVResult> INCR(const std::string &key, int64_t delta) {
+        return submit(request(KVMessage::StatusCodeValueINCR, key, nullptr, &delta, sizeof(int64_t)));
+    }
+    void INCR(const std::string &key, int64_t delta, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueINCR, key, nullptr, &delta, sizeof(int64_t)), std::move(cb));
+    }
+
+    std::future<KVResult> DECR(const std::string &key, int64_t delta) {
+        return submit(request(KVMessage::StatusCodeValueDECR, key, nullptr, &delta, sizeof(int64_t)));
+    }
+    void DECR(const std::string &key, int64_t delta, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueDECR, key, nullptr, &delta, sizeof(int64_t)), std::move(cb));
+    }
+
+    /* One page of at most "maxKeys" Keys starting with "prefix", "token" is empty for the first page, then
+     * "KVResult::token" of the previous page */
+    std::future<KVResult> SCAN(const std::string &prefix, const std::string &token, uint32_t maxKeys) {
+        return submit(request(KVMessage::StatusCodeValueSCAN, prefix, &token, &maxKeys, sizeof(uint32_t)));
+    }
+    void SCAN(const std::string &prefix, const std::string &token, uint32_t maxKeys, Callback cb) {
+        submit(request(KVMessage::StatusCodeValueSCAN, prefix, &token, &maxKeys, sizeof(uint32_t)), std::move(cb));
+    }
+
+    /* "KVResult::value" is a text of "name=value" pairs, e.g. the replication role and lag of the server */
+    std::future<KVResult> STATS() { return submit(request(KVMessage::StatusCodeValueSTATS, "")); }
+
+    /* Start an online snapshot of the server named "name" (empty = current time), "KVResult::value" is the
+     * directory of the snapshot, or the reason of failure */
+    std::future<KVResult> SNAPSHOT(const std::string &name) {
+        return submit(request(KVMessage::StatusCodeValueSNAPSHOT, name));
+    }
+
+private:
+    /* One request waiting for its response */
+    struct Pending {
+        uint8_t requestCode;
+        std::chrono::steady_clock::time_point deadline;
+        Callback callback;
+    };
+
+    /* Serialized request, refer the protocol in "KVMessage" */
+    struct Request {
+        uint8_t requestCode;
+        std::string bytes;
+    };
+
+    /* One socket, and the reader thread which receives its responses */
+    class Connection {
+    public:
+        explicit Connection(KVClientPool *pool) : pool(pool), reader(&Connection::reader_loop, this) {}
+
+        void stop() {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+                if (socketFD >= 0) shutdown(socketFD, SHUT_RDWR);
+            }
+            changed.notify_all();
+            if (reader.joinable()) reader.join();
+        }
+
+        ~Connection() {
+            if (socketFD >= 0) close(socketFD);
+        }
+
+        void send(Request &&req, Callback &&cb) {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this] { return stopping || (broken == false && inFlight.size() < pool->options.maxInFlight); });
+            if (stopping) {
+                lock.unlock();
+                cb(KVResult::failure("Client is closing"));
+                return;
+            }
+
+            if (socketFD < 0 && not reconnect()) {
+                lock.unlock();
+                cb(KVResult::failure("Unable to connect to the server"));
+                return;
+            }
+
+            // Queued before writing, so that if the write fails, the reader thread fails this request as well
+            const auto timeout = std::chrono::milliseconds(pool->options.requestTimeoutMs);
+            inFlight.push_back({req.requestCode, std::chrono::steady_clock::now() + timeout, std::move(cb)});
+            if (not write_fully(req.bytes.data(), req.bytes.size())) {
+                broken = true;
+                shutdown(socketFD, SHUT_RDWR);  // the reader thread closes the socket
+            }
+            lock.unlock();
+            changed.notify_all();
+        }
+
+    private:
+        KVClientPool *pool;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Pending> inFlight;
+        int socketFD = -1;
+        bool broken = false;  // the socket failed, and the reader thread has NOT yet closed it
+        bool stopping = false;
+        std::chrono::steady_clock::time_point nextConnectAttempt{};
+        std::thread reader;
+
+        /* ASSUMPTION: "mutex" is locked, and "socketFD" is -1
+         * Returns: true if connected */
+        bool reconnect() {
+            const auto now = std::chrono::steady_clock::now();
+            if (now < nextConnectAttempt) return false;
+
+            socketFD = connect_to_server(pool->serverIP.c_str(), pool->serverPort.c_str(),
+                                         pool->options.connectTimeoutMs, pool->options.requestTimeoutMs);
+            if (socketFD < 0) {
+                nextConnectAttempt = now + std::chrono::milliseconds(pool->options.reconnectDelayMs);
+                log_warning("KVClientPool: connection with the server failed");
+                return false;
+            }
+            changed.notify_all();  // wake up the reader thread
+            return true;
+        }
+
+        bool write_fully(const char *buf, size_t len) {
+            while (len > 0) {
+                // MSG_NOSIGNAL: a closed connection must NOT terminate the process with SIGPIPE
+                const ssize_t n = ::send(socketFD, buf, len, MSG_NOSIGNAL);
+                if (n <= 0) return false;
+                buf += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        /* Wait till "len" bytes are read, or "deadline" has passed
+         * Returns: nullptr if successful, otherwise the reason of failure */
+        static const char *read_fully(int fd, void *buf, size_t len, std::chrono::steady_clock::time_point deadline) {
+            char *ptr = static_cast<char *>(buf);
+            while (len > 0) {
+                const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) return "Request timed out";
+
+                struct pollfd pfd{fd, POLLIN, 0};
+                const int ready = poll(&pfd, 1, static_cast<int>(remaining));
+                if (ready < 0 && errno == EINTR) continue;
+                if (ready == 0) return "Request timed out";
+                if (ready < 0) return "Connection with the server failed";
+
+                const ssize_t n = read(fd, ptr, len);
+                if (n <= 0) return "Connection with the server failed";
+                ptr += n;
+                len -= n;
+            }
+            return nullptr;
+        }
+
+        /* Returns: nullptr if the response is read completely into "result", otherwise the reason of failure */
+        static const char *read_response(int fd, const Pending &pending, KVResult &result) {
+            const auto deadline = pending.deadline;
+            const char *err = read_fully(fd, &result.status_code, 1, deadline);
+            if (err) return err;
+
+            char buf[256];
+            const bool isError = KVMessage::is_request_result_ERROR(result.status_code);
+            switch (pending.requestCode) {
+                case KVMessage::EnumGET:
+                case KVMessage::EnumGETS:
+                case KVMessage::EnumSTATS:
+                case KVMessage::EnumSNAPSHOT:
+                    if ((err = read_fully(fd, buf, 256, deadline))) return err;
+                    result.value.assign(buf, strnlen(buf, 256));
+                    if (pending.requestCode == KVMessage::EnumGETS)
+                        err = read_fully(fd, &result.version, sizeof(uint64_t), deadline);
+                    return err;
+                case KVMessage::EnumDEL:
+                    if (isError && (err = read_fully(fd, buf, 256, deadline)) == nullptr)
+                        result.value.assign(buf, strnlen(buf, 256));
+                    return err;
+                case KVMessage::EnumCAS:
+                    return read_fully(fd, &result.version, sizeof(uint64_t), deadline);
+                case KVMessage::EnumINCR:
+                case KVMessage::EnumDECR:
+                    return read_fully(fd, &result.number, sizeof(int64_t), deadline);
+                case KVMessage::EnumSCAN: {
+                    uint32_t count = 0;
+                    if ((err = read_fully(fd, &count, sizeof(uint32_t), deadline))) return err;
+                    result.keys.reserve(count);
+                    for (uint32_t i = 0; i < count; ++i) {
+                        if ((err = read_fully(fd, buf, 256, deadline))) return err;
+                        result.keys.emplace_back(buf, strnlen(buf, 256));
+                    }
+                    if ((err = read_fully(fd, buf, 256, deadline))) return err;
+                    result.token.assign(buf, strnlen(buf, 256));
+                    return nullptr;
+                }
+                default:
+                    // PUT and PUT_TTL
+                    return nullptr;
+            }
+        }
+
+        /* Receive the responses in FIFO order, and complete the requests */
+        void reader_loop() {
+            std::unique_lock lock(mutex);
+            while (true) {
+                changed.wait(lock, [this] { return stopping || broken || not inFlight.empty(); });
+                if (stopping && inFlight.empty()) return;
+
+                const char *err = (broken || stopping) ? "Connection with the server failed" : nullptr;
+                KVResult result;
+                if (err == nullptr) {
+                    // Only this thread removes requests from the front, and the socket stays open till this thread
+                    // closes it, so the lock is NOT needed while reading
+                    const int fd = socketFD;
+                    const Pending &front = inFlight.front();
+                    lock.unlock();
+                    err = read_response(fd, front, result);
+                    lock.lock();
+                }
+
+                if (err == nullptr) {
+                    Callback cb = std::move(inFlight.front().callback);
+                    inFlight.pop_front();
+                    lock.unlock();
+                    changed.notify_all();
+                    cb(std::move(result));
+                    lock.lock();
+                    continue;
+                }
+
+                // The stream can no longer be matched with the requests, so fail all of them and drop the socket
+                std::deque<Pending> failed;
+                failed.swap(inFlight);
+                close(socketFD);
+                socketFD = -1;
+                broken = false;
+                lock.unlock();
+                changed.notify_all();
+                for (auto &pending: failed) pending.callback(KVResult::failure(err));
+                lock.lock();
+            }
+        }
+    };
+
+    std::string serverIP, serverPort;
+    Options options;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::atomic_uint32_t nextConnection{0};
+
+    std::future<KVResult> submit(Request &&req) {
+        auto promise = std::make_shared<std::promise<KVResult>>();
+        std::future<KVResult> future = promise->get_future();
+        submit(std::move(req), [promise](KVResult result) { promise->set_value(std::move(result)); });
+        return future;
+    }
+
+    void submit(Request &&req, Callback &&cb) {
+        const uint32_t idx = nextConnection.fetch_add(1, std::memory_order_relaxed) % connections.size();
+        connections[idx]->send(std::move(req), std::move(cb));
+    }
+
+    /* Key (and Value) are padded to 256 bytes, followed by "argLen" bytes of "arg" */
+    static Request request(uint8_t requestCode, const std::string &key, const std::string *value = nullptr,
+                           const void *arg = nullptr, size_t argLen = 0) {
+        Request req{requestCode, std::string(1 + 256 + ((value) ? 256 : 0) + argLen, '\0')};
+        char *ptr = req.bytes.data();
+        *ptr = static_cast<char>(requestCode);
+        std::memcpy(ptr + 1, key.data(), std::min<size_t>(key.size(), 255));
+        ptr += 1 + 256;
+        if (value) {
+            std::memcpy(ptr, value->data(), std::min<size_t>(value->size(), 255));
+            ptr += 256;
+        }
+        if (argLen) std::memcpy(ptr, arg, argLen);
+        return req;
+    }
+
+    /* Returns: connected socket, or -1 if the connection failed within "connectTimeoutMs"
+     * NOTE: "getaddrinfo(...)" is used instead of "gethostbyname(...)" as it is thread safe */
+    static int connect_to_server(const char *serverIP, const char *serverPort, uint32_t connectTimeoutMs,
+                                 uint32_t sendTimeoutMs) {
+        // A server on the same host is connected using its Unix domain socket (if it has one), refer KVLocalSocket.hpp
+        int localFd = local_socket::connect_to_server(serverIP, serverPort);
+        if (localFd >= 0) {
+            set_send_timeout(localFd, sendTimeoutMs);
+            return localFd;
+        }
+
+        struct addrinfo hints{}, *addresses = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(serverIP, serverPort, &hints, &addresses) != 0 || addresses == nullptr) return -1;
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0) {
+            // Non-blocking connect, so that an unreachable server does NOT block the caller indefinitely
+            const int flags = fcntl(fd, F_GETFL, 0);
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+            int res = connect(fd, addresses->ai_addr, addresses->ai_addrlen);
+            if (res < 0 && errno == EINPROGRESS) {
+                struct pollfd pfd{fd, POLLOUT, 0};
+                int soError = 0;
+                socklen_t len = sizeof(int);
+                res = (poll(&pfd, 1, static_cast<int>(connectTimeoutMs)) == 1
+                       && getsockopt(fd, SOL_SOCKET, SO_ERROR, &soError, &len) == 0 && soError == 0) ? 0 : -1;
+            }
+            fcntl(fd, F_SETFL, flags);
+
+            if (res == 0) {
+                // Requests are small and pipelined, so they must NOT be delayed by Nagle's algorithm
+                const int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+                set_send_timeout(fd, sendTimeoutMs);
+            } else {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+
+    /* A server which stops reading must NOT block "send(...)" forever */
+    static void set_send_timeout(int fd, uint32_t sendTimeoutMs) {
+        struct timeval tv{static_cast<time_t>(sendTimeoutMs / 1000),
+                          static_cast<suseconds_t>((sendTimeoutMs % 1000) * 1000)};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_KVCLIENTPOOL_HPP
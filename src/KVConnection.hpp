@@ -0,0 +1,314 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVCONNECTION_HPP
+#define PA_4_KEY_VALUE_STORE_KVCONNECTION_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "MyDebugger.hpp"
+#include "MyMemoryPool.hpp"
+#include "KVMessage.hpp"
+
+/*
+ * Buffered I/O of one client connection
+ *
+ * "fill()" reads as many bytes as the socket has available (up to the free space of the receive buffer) using
+ * one system call, and the requests are parsed from the buffer by "next_request(...)", instead of one "read(...)"
+ * for every field of a request. The responses are appended to the send buffer and written using one system call
+ * by "flush()". So, the requests which a client sends back to back (pipelining) cost one "read(...)" and one
+ * "send(...)" for all of them.
+ * A request which has NOT been received completely stays in the buffer till the socket is readable again, so a
+ * slow client does NOT block the worker serving it.
+ *
+ * A payload which lives in some other memory (e.g. the Value of a CacheNode) can be appended by reference, refer
+ * "append_pinned(...)". It is NOT copied to the send buffer, "flush()" writes it along with the send buffer using
+ * one "sendmsg(...)" (an iovec for every part of the send buffer between two such payloads). The memory is kept
+ * alive by a pin (a counter which the owner of the memory waits on before modifying it), released once sent.
+ *
+ * As every batch of responses is written at once, Nagle's algorithm has nothing left to coalesce, it only delays
+ * a response while the previous one is NOT acknowledged (up to the delayed ACK timeout of the client, ~40 ms).
+ * So, TCP_NODELAY is set on the client sockets, refer "KVConnectionTable::init(...)".
+ *     REFER: https://man7.org/linux/man-pages/man7/tcp.7.html
+ * */
+struct KVConnection {
+    static constexpr size_t RECV_BUFFER_LEN = 16 * 1024;
+    static constexpr size_t SEND_BUFFER_LEN = 16 * 1024;  // a larger send buffer (e.g. for SCAN) is NOT kept
+    static constexpr size_t MAX_PINNED_PAYLOADS = 64;  // refer "append_pinned(...)", well below IOV_MAX
+
+    enum RequestStatus {
+        Request_READY,  // a request has been stored in the message
+        Request_INCOMPLETE,  // the buffer does NOT have a complete request
+        Request_INVALID  // the request code is NOT valid, it has been skipped
+    };
+
+    /* A payload appended by "append_pinned(...)", it goes before send_buffer[offset] */
+    struct PinnedPayload {
+        size_t offset;
+        const char *data;
+        size_t len;
+        std::atomic_uint32_t *pin;
+    };
+
+    int fd;
+    bool cork_responses;  // refer "flush_early()"
+    std::unique_ptr<char[]> recv_buffer;
+    size_t recv_begin, recv_end;  // the bytes received but NOT yet parsed are recv_buffer[recv_begin...recv_end)
+    std::vector<char> send_buffer;
+    std::vector<PinnedPayload> pinned_payloads;  // in the order of "offset"
+
+    KVConnection() : fd{-1}, cork_responses{false}, recv_buffer(new char[RECV_BUFFER_LEN]), recv_begin{0},
+                     recv_end{0}, send_buffer(), pinned_payloads() {
+        send_buffer.reserve(SEND_BUFFER_LEN);
+        pinned_payloads.reserve(MAX_PINNED_PAYLOADS);
+    }
+
+    void reset(int clientFd, bool corkResponses) {
+        fd = clientFd;
+        cork_responses = corkResponses;
+        recv_begin = recv_end = 0;
+        send_buffer.clear();
+    }
+
+    /* ASSUMED: the socket is readable (else this blocks till it is)
+     * Returns: false if the connection was closed by the client, or it failed */
+    bool fill() {
+        if (recv_begin != 0) {
+            std::memmove(recv_buffer.get(), recv_buffer.get() + recv_begin, recv_end - recv_begin);
+            recv_end -= recv_begin;
+            recv_begin = 0;
+        }
+        if (recv_end == RECV_BUFFER_LEN) return true;  // NOT possible, as a request is much smaller
+
+        ssize_t bytesRead;
+        do {
+            bytesRead = read(fd, recv_buffer.get() + recv_end, RECV_BUFFER_LEN - recv_end);
+        } while (bytesRead < 0 && errno == EINTR);
+        if (bytesRead <= 0) return false;
+        recv_end += static_cast<size_t>(bytesRead);
+        return true;
+    }
+
+    /* Returns: number of bytes of a request (including the request code), refer "KVMessage" */
+    static size_t request_len(uint8_t requestCode) {
+        size_t len = sizeof(uint8_t) + KV_STR_LEN;
+        if (KVMessage::is_request_with_value(requestCode) || KVMessage::is_request_code_SCAN(requestCode))
+            len += KV_STR_LEN;
+        if (KVMessage::is_request_code_PUT_TTL(requestCode)) len += sizeof(uint32_t);
+        if (KVMessage::is_request_code_CAS(requestCode) || KVMessage::is_request_code_INCR_DECR(requestCode))
+            len += sizeof(uint64_t);
+        if (KVMessage::is_request_code_SCAN(requestCode)) len += sizeof(uint32_t);
+        return len;
+    }
+
+    /* Parse the next request from the receive buffer into "message"
+     * NOTE: the fields of "message" which the request does NOT have are reset, as the message may be reused
+     * Returns: refer "RequestStatus", "message->status_code" is set to the invalid request code for Request_INVALID */
+    RequestStatus next_request(KVMessage *message) {
+        if (recv_begin == recv_end) return Request_INCOMPLETE;
+
+        const char *src = recv_buffer.get() + recv_begin;
+        const auto requestCode = static_cast<uint8_t>(src[0]);
+        if (not KVMessage::is_request_code_valid(requestCode)) {
+            message->status_code = requestCode;
+            ++recv_begin;
+            return Request_INVALID;
+        }
+        const size_t len = request_len(requestCode);
+        if (recv_end - recv_begin < len) return Request_INCOMPLETE;
+        recv_begin += len;
+
+        message->status_code = requestCode;
+        message->expires_at = 0;
+        message->version = 0;
+        message->request_arg = 0;
+        ++src;
+        std::memcpy(message->key, src, KV_STR_LEN);
+        src += KV_STR_LEN;
+        if (message->is_request_with_value() || message->is_request_code_SCAN()) {
+            std::memcpy(message->value, src, KV_STR_LEN);
+            src += KV_STR_LEN;
+        }
+        if (message->is_request_code_PUT_TTL()) {
+            std::memcpy(&message->ttl_seconds, src, sizeof(uint32_t));
+            message->set_ttl(message->ttl_seconds);
+        }
+        if (message->is_request_code_CAS() || message->is_request_code_INCR_DECR())
+            std::memcpy(&message->request_arg, src, sizeof(uint64_t));
+        if (message->is_request_code_SCAN()) {
+            uint32_t maxKeys;
+            std::memcpy(&maxKeys, src, sizeof(uint32_t));
+            message->request_arg = maxKeys;
+        }
+        return Request_READY;
+    }
+
+    inline void append(const void *data, size_t len) {
+        const auto *src = static_cast<const char *>(data);
+        send_buffer.insert(send_buffer.end(), src, src + len);
+    }
+
+    /* ASSUMED: "*pin" has been incremented by the caller, and "data[0...len)" is NOT modified till it is decremented
+     * Append "data" by reference, "*pin" is decremented once it has been sent (or copied, refer "unpin_payloads()")
+     * NOTE: a thread which holds pins must NOT wait for anything which may wait for those pins to be released,
+     *       e.g. a PUT of the same Key, so "unpin_payloads()" is to be called before such a request */
+    inline void append_pinned(const char *data, size_t len, std::atomic_uint32_t *pin) {
+        pinned_payloads.push_back({send_buffer.size(), data, len, pin});
+        if (pinned_payloads.size() == MAX_PINNED_PAYLOADS) unpin_payloads();
+    }
+
+    [[nodiscard]] inline bool has_pinned_payloads() const {
+        return not pinned_payloads.empty();
+    }
+
+    /* Copy the pinned payloads to their place in the send buffer and release their pins */
+    void unpin_payloads() {
+        if (pinned_payloads.empty()) return;
+        size_t src = send_buffer.size(), dst = send_buffer.size();
+        for (const auto &i: pinned_payloads) dst += i.len;
+        send_buffer.resize(dst);
+
+        // From the last payload to the first, so that the bytes which are moved are NOT yet overwritten
+        char *buffer = send_buffer.data();
+        for (auto i = pinned_payloads.rbegin(); i != pinned_payloads.rend(); ++i) {
+            dst -= src - i->offset;
+            std::memmove(buffer + dst, buffer + i->offset, src - i->offset);
+            dst -= i->len;
+            std::memcpy(buffer + dst, i->data, i->len);
+            i->pin->fetch_sub(1, std::memory_order_release);
+            src = i->offset;
+        }
+        pinned_payloads.clear();
+    }
+
+    /* Called before a request waits (e.g. for the Persistent Storage), so that the responses ready so far are NOT
+     * held back. If "cork_responses" is set, they are held back (i.e. corked) and all the responses of the batch
+     * are written together by "flush()", i.e. fewer and fuller segments, but a later first response */
+    inline void flush_early() {
+        if (not cork_responses) flush();
+    }
+
+    /* Write the send buffer, using one system call unless the socket buffer gets full
+     * Returns: false if the connection failed, the client gets to know of it when it reads */
+    bool flush() {
+        size_t done = (pinned_payloads.empty()) ? 0 : send_pinned();
+        while (done < send_buffer.size()) {
+            // MSG_NOSIGNAL: a client which disconnects must NOT terminate the server with SIGPIPE
+            const ssize_t bytesSent = send(fd, send_buffer.data() + done, send_buffer.size() - done, MSG_NOSIGNAL);
+            if (bytesSent < 0 && errno == EINTR) continue;
+            if (bytesSent <= 0) break;
+            done += static_cast<size_t>(bytesSent);
+        }
+        const bool res = (done == send_buffer.size());
+        send_buffer.clear();
+        if (send_buffer.capacity() > SEND_BUFFER_LEN) {
+            std::vector<char>().swap(send_buffer);
+            send_buffer.reserve(SEND_BUFFER_LEN);
+        }
+        return res;
+    }
+
+private:
+    /* Write the send buffer along with the pinned payloads using one "sendmsg(...)", without waiting for space in
+     * the socket buffer. If all of it is NOT sent, the pinned payloads are copied (refer "unpin_payloads()"), so
+     * that no pin is held while "flush()" waits to send the rest
+     * Returns: number of bytes of the send buffer which have been sent */
+    size_t send_pinned() {
+        std::array<struct iovec, 2 * MAX_PINNED_PAYLOADS + 1> iov{};
+        size_t iovLen = 0, begin = 0, total = send_buffer.size();
+        char *buffer = send_buffer.data();
+        for (const auto &i: pinned_payloads) {
+            if (i.offset != begin) iov[iovLen++] = {buffer + begin, i.offset - begin};
+            iov[iovLen++] = {const_cast<char *>(i.data), i.len};
+            begin = i.offset;
+            total += i.len;
+        }
+        if (begin != send_buffer.size()) iov[iovLen++] = {buffer + begin, send_buffer.size() - begin};
+
+        struct msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = iovLen;
+        ssize_t bytesSent;
+        do {
+            bytesSent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (bytesSent < 0 && errno == EINTR);
+
+        if (bytesSent >= 0 && static_cast<size_t>(bytesSent) == total) {
+            for (const auto &i: pinned_payloads) i.pin->fetch_sub(1, std::memory_order_release);
+            pinned_payloads.clear();
+            return send_buffer.size();
+        }
+        unpin_payloads();
+        return (bytesSent > 0) ? static_cast<size_t>(bytesSent) : 0;
+    }
+};
+
+/*
+ * The KVConnection of every client socket, indexed by its file descriptor
+ *
+ * The connections are reused using a MemoryPool, so a new client does NOT allocate its buffers.
+ * A connection is opened by the Main Thread (after "accept(...)") and closed by the worker which finds that the
+ * client has disconnected. Only the worker serving the client (EPOLLONESHOT) uses its connection meanwhile.
+ * */
+class KVConnectionTable {
+public:
+    static constexpr size_t POOL_BLOCK_LEN = 64;
+
+    KVConnectionTable() : pool(true), max_fds{0}, tcp_no_delay{true}, cork_responses{false}, connections() {}
+
+    /* "tcpNoDelay": set TCP_NODELAY on the client sockets, refer "KVConnection"
+     * "corkResponses": refer "KVConnection::flush_early()"
+     * NOTE: it is important to call this before using other function of this class */
+    void init(bool tcpNoDelay, bool corkResponses) {
+        tcp_no_delay = tcpNoDelay;
+        cork_responses = corkResponses;
+        struct rlimit limit{};
+        max_fds = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+                  ? static_cast<size_t>(limit.rlim_cur) : 65536;
+        connections.reset(new std::atomic<KVConnection *>[max_fds]{});
+        pool.init(POOL_BLOCK_LEN, 4);
+    }
+
+    /* Returns: the connection of the new client "fd", nullptr if "fd" is NOT less than the limit of open files */
+    KVConnection *open(int fd) {
+        if (fd < 0 || static_cast<size_t>(fd) >= max_fds) return nullptr;
+        if (tcp_no_delay) {
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+        }
+        KVConnection *connection = pool.acquire_instance();
+        connection->reset(fd, cork_responses);
+        connections[fd].store(connection, std::memory_order_release);
+        return connection;
+    }
+
+    [[nodiscard]] inline KVConnection *get(int fd) const {
+        return connections[fd].load(std::memory_order_acquire);
+    }
+
+    /* NOTE: must be called before "close(fd)", as the file descriptor can be reused by the next "accept(...)" */
+    void close(KVConnection *connection) {
+        connections[connection->fd].store(nullptr, std::memory_order_release);
+        pool.release_instance(connection);
+    }
+
+private:
+    MemoryPool<KVConnection> pool;
+    size_t max_fds;
+    bool tcp_no_delay, cork_responses;
+    std::unique_ptr<std::atomic<KVConnection *>[]> connections;
+};
+
+KVConnectionTable kvConnections;
+
+#endif // PA_4_KEY_VALUE_STORE_KVCONNECTION_HPP
@@ -0,0 +1,163 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVHOTKEYS_HPP
+#define PA_4_KEY_VALUE_STORE_KVHOTKEYS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "KVMessage.hpp"
+#include "KVCache.hpp"
+
+/*
+ * Read cache of the hot Keys, one instance for each Worker Thread (default mode only)
+ *
+ * With skewed traffic, every worker serving a GET of the same Key locks the same bucket of the KVCache and the
+ * same LRU list (and bounces their cache lines between the CPUs). So, each worker keeps its own copy of the few
+ * Keys it reads the most, and a GET of such a Key touches no shared cache line except its write version:
+ *     1. Detection: one out of every "sample_period" GETs served from the KVCache is counted in a Count-Min sketch
+ *        of this worker, and all the counters are halved every "SKETCH_WINDOW" samples (i.e. recent popularity)
+ *        REFER: https://en.wikipedia.org/wiki/Count%E2%80%93min_sketch
+ *     2. Admission: a sampled Key whose estimate reaches "ADMIT_MIN_COUNT" is copied to the read cache (4-way set
+ *        associative), replacing the entry of its set with the fewest hits if the Key is read more than it
+ *        (i.e. the read cache keeps the top-K Keys of this worker)
+ *     3. Invalidation: every write to the KVCache increments the write version of the Key (refer
+ *        "KVCache::bump_write_version(...)") before its response is sent. An entry remembers the write version
+ *        read before its Value was copied, so an entry whose write version has changed is stale and is dropped
+ * Only the thread owning the instance uses it, except "hits" and "cached_keys" which are read by STATS.
+ * */
+struct HotKeyCache {
+    static constexpr uint32_t WAYS = 4;
+    static constexpr uint32_t SKETCH_DEPTH = 4;
+    static constexpr uint32_t SKETCH_WIDTH = 2048;  // power of 2
+    static constexpr uint32_t SKETCH_WINDOW = 16 * SKETCH_WIDTH;
+    static constexpr uint16_t ADMIT_MIN_COUNT = 8;
+
+    struct Entry {
+        uint64_t write_version;
+        uint64_t hits;  // halved along with the sketch
+        bool valid;
+        struct KVMessage message;  // Key, Value and hashes of the Key
+
+        Entry() : write_version{0}, hits{0}, valid{false}, message() {}
+    };
+
+    uint32_t set_count;
+    uint32_t sample_period;
+    uint32_t sample_countdown;
+    uint32_t samples_in_window;
+    bool refresh;  // the last "lookup(...)" dropped a stale entry, so the next GET is sampled to copy it again
+    std::unique_ptr<Entry[]> entries;
+    std::unique_ptr<uint16_t[]> sketch;
+    std::atomic_uint64_t hits;  // GETs served from this read cache
+    std::atomic_uint32_t cached_keys;  // valid entries
+
+    /* "capacity" is rounded down to a power of 2 (at least "WAYS") */
+    HotKeyCache(uint32_t capacity, uint32_t samplePeriod) :
+            set_count{1}, sample_period{std::max(1U, samplePeriod)}, sample_countdown{0}, samples_in_window{0},
+            refresh{false},
+            entries(), sketch(new uint16_t[SKETCH_DEPTH * SKETCH_WIDTH]{}), hits(0), cached_keys(0) {
+        while (set_count * 2 * WAYS <= capacity) set_count *= 2;
+        entries.reset(new Entry[set_count * WAYS]);
+        sample_countdown = sample_period;
+    }
+
+    /* ASSUMED: message->calculate_key_hash() has been called
+     * Returns: Value of the Key if it is in the read cache and is NOT stale, nullptr otherwise */
+    const char *lookup(const KVMessage *message, const KVCache *kvCache) {
+        Entry *entry = find(message);
+        if (entry == nullptr) return nullptr;
+        if (entry->write_version != kvCache->write_version(message->hash1)) {
+            entry->valid = false;
+            refresh = true;
+            cached_keys.store(cached_keys.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        ++entry->hits;
+        hits.store(hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return entry->message.value;
+    }
+
+    /* Returns: true if this GET is to be counted, i.e. "record(...)" is to be called if it is a cache HIT */
+    inline bool sample() {
+        if (refresh) {
+            refresh = false;
+            return true;
+        }
+        if (--sample_countdown != 0) return false;
+        sample_countdown = sample_period;
+        return true;
+    }
+
+    /* ASSUMED: "writeVersion" was read (i.e. "KVCache::write_version(...)") before "cached" was looked up, and
+     *          "cached" can NOT be modified till this returns (i.e. the CacheNode is pinned, refer
+     *          "KVCache::cache_GET_pinned(...)")
+     * Count a sampled GET of "cached", and copy it to the read cache if it is hot enough */
+    void record(const KVMessage *cached, uint64_t writeVersion) {
+        uint16_t estimate = UINT16_MAX;
+        uint64_t h = cached->hash1 ^ (cached->hash2 * 0x9E3779B97F4A7C15ULL);
+        for (uint32_t row = 0; row < SKETCH_DEPTH; ++row) {
+            h = mix(h + row);
+            uint16_t &counter = sketch[row * SKETCH_WIDTH + (h & (SKETCH_WIDTH - 1))];
+            if (counter != UINT16_MAX) ++counter;
+            estimate = std::min(estimate, counter);
+        }
+        if (++samples_in_window == SKETCH_WINDOW) age();
+        // A Key with a TTL is NOT copied, so that its expiry is only handled by the KVCache
+        if (estimate < ADMIT_MIN_COUNT || cached->expires_at != 0) return;
+
+        const uint64_t readsEstimate = static_cast<uint64_t>(estimate) * sample_period;
+        Entry *victim = find(cached);  // a stale copy of the same Key is replaced
+        if (victim == nullptr) {
+            Entry *set = get_set(cached->hash2);
+            victim = &set[0];
+            for (uint32_t i = 1; i < WAYS && victim->valid; ++i)
+                if ((not set[i].valid) || set[i].hits < victim->hits) victim = &set[i];
+            if (victim->valid && victim->hits >= readsEstimate) return;
+        }
+        if (not victim->valid)
+            cached_keys.store(cached_keys.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        victim->message.hash1 = cached->hash1;
+        victim->message.hash2 = cached->hash2;
+        victim->message.set_key_fast(cached->key);
+        victim->message.set_value_fast(cached->value);
+        victim->message.expires_at = 0;
+        victim->write_version = writeVersion;
+        victim->hits = readsEstimate;
+        victim->valid = true;
+    }
+
+private:
+    inline Entry *get_set(uint64_t hash2) const {
+        return &entries[(hash2 & (set_count - 1)) * WAYS];
+    }
+
+    /* Returns: the valid entry of the Key of "message", nullptr if it is NOT in the read cache */
+    Entry *find(const KVMessage *message) const {
+        Entry *set = get_set(message->hash2);
+        for (uint32_t i = 0; i < WAYS; ++i) {
+            Entry &entry = set[i];
+            if (entry.valid && entry.message.hash2 == message->hash2 && entry.message.hash1 == message->hash1
+                && std::equal(message->key, message->key + 256, entry.message.key))
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    /* REFER: https://prng.di.unimi.it/splitmix64.c (finalizer) */
+    static inline uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    /* Halve all the counters, so that the Keys which are no longer read lose their place */
+    void age() {
+        samples_in_window = 0;
+        for (uint32_t i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; ++i) sketch[i] >>= 1;
+        for (uint32_t i = 0; i < set_count * WAYS; ++i) entries[i].hits >>= 1;
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_KVHOTKEYS_HPP
@@ -0,0 +1,215 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVKEYINDEX_HPP
+#define PA_4_KEY_VALUE_STORE_KVKEYINDEX_HPP
+
+#include <array>
+#include <map>
+#include <shared_mutex>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#include "MyDebugger.hpp"
+#include "KVMessage.hpp"
+#include "KVStore.hpp"
+
+/*
+ * Ordered index of all the Keys in the Key-Value store, used by SCAN (refer "KVMessage::EnumSCAN")
+ *
+ * KVCache and KVStore are both hash based, so they can only look up a Key which is known in advance. This index
+ * keeps every Key (with its expiry) in sorted order, partitioned on the first byte of the Key into "SHARD_COUNT"
+ * shards. So, the shards are also in sorted order, a prefix scan touches one shard only (unless the prefix is
+ * empty), and the Keys with different first bytes never contend for the same lock.
+ *
+ *     - KVCache adds/removes a Key while holding the writer lock of the bucket of the Key, so the index is
+ *       updated in the same order as the cache. Only the writes which create/delete a Key or change its TTL
+ *       touch the index, updating the Value of an existing Key does NOT
+ *     - SCAN holds the reader lock of one shard only while copying at most "MAX_PAGE_LEN" Keys, so a point
+ *       operation waits at most for the copying of one page
+ *     - Expired Keys are skipped by SCAN, and removed once they are reclaimed, refer "erase_if_expired(...)"
+ *
+ * Saved as "key_index" in the "db" directory on a clean shutdown. The file is removed once it is loaded, so
+ * after a crash (i.e. no file) the index is rebuilt while verifying all the files of the Persistent Storage.
+ * */
+struct KVKeyIndex {
+    static constexpr uint32_t SHARD_COUNT = 256;
+    static constexpr uint32_t MAX_PAGE_LEN = 256;
+    static constexpr const char *FILE_NAME = "key_index";
+
+    struct Shard {
+        std::shared_mutex rw_lock;
+        std::map<std::string, uint64_t> keys;  // Key --> KVMessage::expires_at
+    };
+
+    std::array<Shard, SHARD_COUNT> shards;
+
+    KVKeyIndex() = default;
+
+    /* ASSUMED: called after "kvPersistentStore.init_kvstore()", i.e. the current directory is "db"
+     * If no index was saved (i.e. this is the first start or the server did not shut down cleanly) or
+     * "alwaysVerify" is true, the files of the Persistent Storage are verified using "scanThreads" threads
+     * (refer "KVStore::verify_and_repair_files(...)") and the index is rebuilt in the same pass */
+    void init(uint32_t scanThreads, bool alwaysVerify) {
+        if (alwaysVerify) {
+            std::remove(FILE_NAME);
+        } else if (load()) {
+            log_info("KVKeyIndex: loaded " + std::to_string(size()) + " Keys from \"" + FILE_NAME + "\"");
+            return;
+        }
+
+        const uint64_t nowMs = KVMessage::current_time_ms();
+        kvPersistentStore.verify_and_repair_files(scanThreads, [this, nowMs](const char *key,
+                                                                             const KVStoreValueHeader &header) {
+            if (header.expires_at != 0 && header.expires_at <= nowMs) return;
+            const std::string k(key, strnlen(key, 256));
+            Shard &shard = get_shard(k);
+            std::unique_lock writer_lock(shard.rw_lock);
+            shard.keys[k] = header.expires_at;
+        });
+        log_info("KVKeyIndex: rebuilt from the Persistent Storage, Keys = " + std::to_string(size()));
+    }
+
+    /* Add the Key of "ptr", or update its expiry if it is already present */
+    void insert(const KVMessage *ptr) {
+        std::string key = key_of(ptr);
+        Shard &shard = get_shard(key);
+        std::unique_lock writer_lock(shard.rw_lock);
+        shard.keys.insert_or_assign(std::move(key), ptr->expires_at);
+    }
+
+    void erase(const KVMessage *ptr) {
+        const std::string key = key_of(ptr);
+        Shard &shard = get_shard(key);
+        std::unique_lock writer_lock(shard.rw_lock);
+        shard.keys.erase(key);
+    }
+
+    /* Remove the Key of "ptr" ONLY if its expiry (as known to the index) has passed, refer "KVCache::cache_EXPIRE" */
+    void erase_if_expired(const KVMessage *ptr) {
+        const std::string key = key_of(ptr);
+        Shard &shard = get_shard(key);
+        std::unique_lock writer_lock(shard.rw_lock);
+        auto iter = shard.keys.find(key);
+        if (iter != shard.keys.end() && iter->second != 0 && iter->second <= KVMessage::current_time_ms())
+            shard.keys.erase(iter);
+    }
+
+    /* Append to "result" at most "maxKeys" Keys (in ascending order) which start with "prefix" and are greater
+     * than "after" ("after" is the continuation token, i.e. the last Key of the previous page, or empty)
+     *
+     * Returns: the continuation token for the next page, empty if there are no more Keys
+     * */
+    std::string scan(const std::string &prefix, const std::string &after, uint32_t maxKeys,
+                     std::vector<std::string> &result) {
+        const uint64_t nowMs = KVMessage::current_time_ms();
+        const bool resume = (not after.empty()) && after >= prefix;
+        const std::string &from = (resume) ? after : prefix;
+
+        // A non-empty prefix belongs to exactly one shard
+        const uint32_t firstShard = shard_idx(from);
+        const uint32_t lastShard = (prefix.empty()) ? (SHARD_COUNT - 1) : shard_idx(prefix);
+
+        bool prefixEnded = false;
+        for (uint32_t i = firstShard; i <= lastShard && (not prefixEnded) && result.size() < maxKeys; ++i) {
+            Shard &shard = shards[i];
+            std::shared_lock reader_lock(shard.rw_lock);
+
+            auto iter = (i != firstShard) ? shard.keys.begin()
+                                          : ((resume) ? shard.keys.upper_bound(from) : shard.keys.lower_bound(from));
+            for (; iter != shard.keys.end() && result.size() < maxKeys; ++iter) {
+                if (iter->first.compare(0, prefix.size(), prefix) != 0) {
+                    prefixEnded = true;
+                    break;
+                }
+                if (iter->second != 0 && iter->second <= nowMs) continue;
+                result.push_back(iter->first);
+            }
+        }
+
+        return (result.size() < maxKeys) ? std::string() : result.back();
+    }
+
+    [[nodiscard]] uint64_t size() {
+        uint64_t n = 0;
+        for (Shard &shard: shards) {
+            std::shared_lock reader_lock(shard.rw_lock);
+            n += shard.keys.size();
+        }
+        return n;
+    }
+
+    /* ASSUMPTION: called when closing the KVServer, i.e. no other thread modifies the index
+     * Format: uint64_t count, then for each Key: uint32_t length, Key, uint64_t expires_at */
+    void save() {
+        const std::string tempFileName = std::string(FILE_NAME) + ".tmp";
+        std::ofstream fs(tempFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (not fs.is_open()) {
+            log_error("KVKeyIndex: unable to create \"" + tempFileName + "\"");
+            return;
+        }
+
+        const uint64_t count = size();
+        fs.write(reinterpret_cast<const char *>(&count), sizeof(uint64_t));
+        for (Shard &shard: shards) {
+            for (const auto &[key, expiresAt]: shard.keys) {
+                const auto keyLen = static_cast<uint32_t>(key.size());
+                fs.write(reinterpret_cast<const char *>(&keyLen), sizeof(uint32_t));
+                fs.write(key.data(), keyLen);
+                fs.write(reinterpret_cast<const char *>(&expiresAt), sizeof(uint64_t));
+            }
+        }
+        fs.close();
+
+        // The old file (if any) is replaced only once the new one is complete
+        if (fs.fail() || std::rename(tempFileName.c_str(), FILE_NAME) != 0)
+            log_error("KVKeyIndex: unable to save \"" + std::string(FILE_NAME) + "\"");
+    }
+
+private:
+    /* Returns: false if there is no saved index, or it is corrupt */
+    bool load() {
+        std::ifstream fs(FILE_NAME, std::ios::in | std::ios::binary);
+        if (not fs.is_open()) return false;
+
+        uint64_t count = 0;
+        bool ok = static_cast<bool>(fs.read(reinterpret_cast<char *>(&count), sizeof(uint64_t)));
+        char key[256];
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            uint32_t keyLen = 0;
+            uint64_t expiresAt = 0;
+            ok = fs.read(reinterpret_cast<char *>(&keyLen), sizeof(uint32_t)) && keyLen <= 256
+                 && fs.read(key, keyLen) && fs.read(reinterpret_cast<char *>(&expiresAt), sizeof(uint64_t));
+            if (ok) {
+                const std::string k(key, keyLen);
+                get_shard(k).keys[k] = expiresAt;
+            }
+        }
+        fs.close();
+
+        // The saved index becomes stale as soon as a Key is written, so it must NOT be loaded after a crash
+        std::remove(FILE_NAME);
+        if (not ok) {
+            log_error("KVKeyIndex: \"" + std::string(FILE_NAME) + "\" is corrupt, it will be rebuilt");
+            for (Shard &shard: shards) shard.keys.clear();
+        }
+        return ok;
+    }
+
+    static inline std::string key_of(const KVMessage *ptr) {
+        return std::string(ptr->key, strnlen(ptr->key, 256));
+    }
+
+    static inline uint32_t shard_idx(const std::string &key) {
+        return (key.empty()) ? 0 : static_cast<uint8_t>(key[0]);
+    }
+
+    inline Shard &get_shard(const std::string &key) {
+        return shards[shard_idx(key)];
+    }
+};
+
+KVKeyIndex kvKeyIndex;
+
+#endif // PA_4_KEY_VALUE_STORE_KVKEYINDEX_HPP
@@ -0,0 +1,92 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVLOCALSOCKET_HPP
+#define PA_4_KEY_VALUE_STORE_KVLOCALSOCKET_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <ifaddrs.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Unix domain socket for the clients running on the same host as the KVServer
+ *
+ * The protocol is the same as over TCP, only the loopback TCP/IP stack (segmentation, ACKs, checksums, Nagle and
+ * delayed ACK) is skipped. The path is derived from the TCP port of the server, so a client which knows the
+ * "IP:PORT" of the server does NOT need any other configuration: if the server is on the same host and its Unix
+ * domain socket exists, it is used, otherwise TCP is used.
+ *     REFER: https://man7.org/linux/man-pages/man7/unix.7.html
+ * */
+namespace local_socket {
+    constexpr const char *SOCKET_DIR = "/tmp";
+
+    inline std::string path_of(int port) {
+        return std::string(SOCKET_DIR) + "/KVServer-" + std::to_string(port) + ".sock";
+    }
+
+    /* Returns: false if "path" does NOT fit in "sockaddr_un::sun_path" */
+    inline bool make_address(const std::string &path, struct sockaddr_un &address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) return false;
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    /* Returns: true if "serverIP" is a loopback address or an address of one of the interfaces of this host */
+    inline bool is_local_host(const char *serverIP) {
+        struct addrinfo hints{}, *addresses = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(serverIP, nullptr, &hints, &addresses) != 0 || addresses == nullptr) return false;
+        const in_addr_t serverAddr = reinterpret_cast<struct sockaddr_in *>(addresses->ai_addr)->sin_addr.s_addr;
+        freeaddrinfo(addresses);
+        if ((ntohl(serverAddr) >> 24) == 127) return true;
+
+        // REFER: https://man7.org/linux/man-pages/man3/getifaddrs.3.html
+        struct ifaddrs *interfaces = nullptr;
+        if (getifaddrs(&interfaces) != 0) return false;
+        bool res = false;
+        for (struct ifaddrs *i = interfaces; i != nullptr && (not res); i = i->ifa_next) {
+            if (i->ifa_addr == nullptr || i->ifa_addr->sa_family != AF_INET) continue;
+            res = (reinterpret_cast<struct sockaddr_in *>(i->ifa_addr)->sin_addr.s_addr == serverAddr);
+        }
+        freeifaddrs(interfaces);
+        return res;
+    }
+
+    /* Returns: connected socket, or -1 if the server is NOT on this host or does NOT listen on a Unix domain socket
+     * NOTE: a stale socket file (e.g. the server was killed) fails with ECONNREFUSED, so TCP is used */
+    inline int connect_to_server(const char *serverIP, const char *serverPort) {
+        struct sockaddr_un address{};
+        if ((not is_local_host(serverIP)) || (not make_address(path_of(std::atoi(serverPort)), address))) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /* Returns: listening socket, or -1 if it could NOT be created
+     * ASSUMED: the TCP port has already been bound, so a socket file at the path is stale and is replaced */
+    inline int listen_on(int port, int backlog) {
+        struct sockaddr_un address{};
+        const std::string path = path_of(port);
+        if (not make_address(path, address)) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, backlog) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+#endif // PA_4_KEY_VALUE_STORE_KVLOCALSOCKET_HPP
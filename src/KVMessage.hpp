@@ -3,26 +3,59 @@
 
 #include <cstdint>
 #include <string>
+#include <chrono>
 
 #define KV_STR_LEN 256
 
 struct KVMessage {
     // Everything depends on this enum about what value to use for each "status_code"
+    // Requests (all numbers are in host byte order):
+    //     PUT_TTL = PUT followed by "uint32_t ttl_seconds", the Key expires after "ttl_seconds"
+    //     GETS    = GET, the response is followed by "uint64_t version" of the Key
+    //     CAS     = PUT followed by "uint64_t version", the Value is written ONLY if the Key still has the given
+    //               version (0 = the Key must NOT exist), response = status + "uint64_t version" (the new version
+    //               on success, otherwise the current version, 0 if the Key does not exist)
+    //     INCR    = "Key" followed by "int64_t delta", the Value is a decimal integer (a missing Key is 0),
+    //     DECR      response = status + "int64_t" Value after the update
+    //     SCAN    = "Key" is the prefix, followed by "char token[256]" (empty for the first page) and
+    //               "uint32_t maxKeys", response = status + "uint32_t count" + "count" Keys of 256 bytes in
+    //               ascending order + "char token[256]" to get the next page (empty if there are no more Keys)
+    //     STATS   = "Key" is ignored, response = status + "char value[256]", i.e. same as GET, the Value is a
+    //               text of "name=value" pairs, e.g. the replication role and lag, refer "KVReplication.hpp"
+    //     SNAPSHOT = "Key" is the name of the snapshot (empty = current time), response = status + "char value[256]",
+    //               the directory of the snapshot, or the reason of failure, refer "KVSnapshot.hpp"
     enum StatusCodeEnum {
-        EnumGET = 1, EnumPUT = 2, EnumDEL = 3, EnumSUCCESS = 200, EnumERROR = 240
+        EnumGET = 1, EnumPUT = 2, EnumDEL = 3, EnumPUT_TTL = 4, EnumGETS = 5, EnumCAS = 6, EnumINCR = 7, EnumDECR = 8,
+        EnumSCAN = 9, EnumSTATS = 10, EnumSNAPSHOT = 11, EnumSUCCESS = 200, EnumERROR = 240
     };
     constexpr static const char ERROR_MESSAGE[256] = "Entry not found";
     static const uint8_t StatusCodeValueGET = EnumGET;
     static const uint8_t StatusCodeValuePUT = EnumPUT;
     static const uint8_t StatusCodeValueDEL = EnumDEL;
+    static const uint8_t StatusCodeValuePUT_TTL = EnumPUT_TTL;
+    static const uint8_t StatusCodeValueGETS = EnumGETS;
+    static const uint8_t StatusCodeValueCAS = EnumCAS;
+    static const uint8_t StatusCodeValueINCR = EnumINCR;
+    static const uint8_t StatusCodeValueDECR = EnumDECR;
+    static const uint8_t StatusCodeValueSCAN = EnumSCAN;
+    static const uint8_t StatusCodeValueSTATS = EnumSTATS;
+    static const uint8_t StatusCodeValueSNAPSHOT = EnumSNAPSHOT;
     static const uint8_t StatusCodeValueSUCCESS = EnumSUCCESS;
     static const uint8_t StatusCodeValueERROR = EnumERROR;
 
     uint8_t status_code;
     char key[256], value[256];
+    uint32_t ttl_seconds;  // PUT_TTL ONLY, as received from the client (fits in the padding before hash1)
     uint64_t hash1, hash2;
+    uint64_t expires_at;  // milliseconds since the Unix epoch, 0 = never expires
+    uint64_t version;  // changes on every write of the Key, refer "KVCache::next_version(...)"
 
-    KVMessage() : status_code{}, key{}, value{}, hash1{0}, hash2{0} {}
+    // CAS: the expected version, INCR/DECR: the delta (int64_t) as received and the Value after the update
+    // SCAN: maximum number of Keys in the page
+    uint64_t request_arg;
+
+    KVMessage() : status_code{}, key{}, value{}, ttl_seconds{0}, hash1{0}, hash2{0}, expires_at{0}, version{0},
+                  request_arg{0} {}
 
     /* "ptr" is a null terminated pointer to char array
      *
@@ -126,10 +159,39 @@ struct KVMessage {
         }
     }
 
+    /* Wall clock time is used as "expires_at" is also stored in the Persistent Storage */
+    static inline uint64_t current_time_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()
+        ).count();
+    }
+
+    [[nodiscard]] inline bool is_expired(uint64_t nowMs) const {
+        return expires_at != 0 && expires_at <= nowMs;
+    }
+
+    /* The clock is read only if the Key has a TTL */
+    [[nodiscard]] inline bool is_expired() const {
+        return expires_at != 0 && expires_at <= current_time_ms();
+    }
+
+    inline void set_ttl(uint32_t ttlSeconds) {
+        ttl_seconds = ttlSeconds;
+        expires_at = current_time_ms() + 1000ULL * ttlSeconds;
+    }
+
     inline std::string status_code_to_string() const {
         if(status_code == EnumGET) return "GET";
         if(status_code == EnumPUT) return "PUT";
         if(status_code == EnumDEL) return "DELETE";
+        if(status_code == EnumPUT_TTL) return "PUT_TTL";
+        if(status_code == EnumGETS) return "GETS";
+        if(status_code == EnumCAS) return "CAS";
+        if(status_code == EnumINCR) return "INCR";
+        if(status_code == EnumDECR) return "DECR";
+        if(status_code == EnumSCAN) return "SCAN";
+        if(status_code == EnumSTATS) return "STATS";
+        if(status_code == EnumSNAPSHOT) return "SNAPSHOT";
         if(status_code == EnumSUCCESS) return "SUCCESS";
         if(status_code == EnumERROR) return "ERROR";
         return "Invalid status code";
@@ -141,6 +203,26 @@ struct KVMessage {
 
     [[nodiscard]] inline bool is_request_code_DEL() const { return is_request_code_DEL(status_code); }
 
+    [[nodiscard]] inline bool is_request_code_PUT_TTL() const { return is_request_code_PUT_TTL(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_GETS() const { return is_request_code_GETS(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_CAS() const { return is_request_code_CAS(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_INCR_DECR() const { return is_request_code_INCR_DECR(status_code); }
+
+    [[nodiscard]] inline bool is_request_read() const { return is_request_read(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_SCAN() const { return is_request_code_SCAN(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_STATS() const { return is_request_code_STATS(status_code); }
+
+    [[nodiscard]] inline bool is_request_code_SNAPSHOT() const { return is_request_code_SNAPSHOT(status_code); }
+
+    [[nodiscard]] inline bool is_request_write() const { return is_request_write(status_code); }
+
+    [[nodiscard]] inline bool is_request_with_value() const { return is_request_with_value(status_code); }
+
     [[nodiscard]] inline bool is_request_code_valid() const { return is_request_code_valid(status_code); }
 
     [[nodiscard]] inline bool is_request_result_SUCCESS() const { return is_request_result_SUCCESS(status_code); }
@@ -159,8 +241,52 @@ struct KVMessage {
         return statusCode == StatusCodeValueDEL;
     }
 
+    [[nodiscard]] inline static bool is_request_code_PUT_TTL(const int statusCode) {
+        return statusCode == StatusCodeValuePUT_TTL;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_GETS(const int statusCode) {
+        return statusCode == StatusCodeValueGETS;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_CAS(const int statusCode) {
+        return statusCode == StatusCodeValueCAS;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_INCR_DECR(const int statusCode) {
+        return statusCode == StatusCodeValueINCR || statusCode == StatusCodeValueDECR;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_SCAN(const int statusCode) {
+        return statusCode == StatusCodeValueSCAN;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_STATS(const int statusCode) {
+        return statusCode == StatusCodeValueSTATS;
+    }
+
+    [[nodiscard]] inline static bool is_request_code_SNAPSHOT(const int statusCode) {
+        return statusCode == StatusCodeValueSNAPSHOT;
+    }
+
+    /* Returns: true if the request only reads the Value, i.e. GET or GETS */
+    [[nodiscard]] inline static bool is_request_read(const int statusCode) {
+        return statusCode == StatusCodeValueGET || statusCode == StatusCodeValueGETS;
+    }
+
+    /* Returns: true if the request carries a "Value" after the "Key" */
+    [[nodiscard]] inline static bool is_request_with_value(const int statusCode) {
+        return statusCode == StatusCodeValuePUT || statusCode == StatusCodeValuePUT_TTL || statusCode == StatusCodeValueCAS;
+    }
+
+    /* Returns: true if the request may modify the Key, i.e. NOT allowed on a replica */
+    [[nodiscard]] inline static bool is_request_write(const int statusCode) {
+        return is_request_with_value(statusCode) || is_request_code_DEL(statusCode)
+               || is_request_code_INCR_DECR(statusCode);
+    }
+
     [[nodiscard]] inline static bool is_request_code_valid(const int statusCode) {
-        return (1 <= statusCode && statusCode <= 3);
+        return (1 <= statusCode && statusCode <= 11);
     }
 
     [[nodiscard]] inline static bool is_request_result_SUCCESS(const int statusCode) {
@@ -182,6 +308,14 @@ struct KVMessage {
 const uint8_t KVMessage::StatusCodeValueGET;
 const uint8_t KVMessage::StatusCodeValuePUT;
 const uint8_t KVMessage::StatusCodeValueDEL;
+const uint8_t KVMessage::StatusCodeValuePUT_TTL;
+const uint8_t KVMessage::StatusCodeValueGETS;
+const uint8_t KVMessage::StatusCodeValueCAS;
+const uint8_t KVMessage::StatusCodeValueINCR;
+const uint8_t KVMessage::StatusCodeValueDECR;
+const uint8_t KVMessage::StatusCodeValueSCAN;
+const uint8_t KVMessage::StatusCodeValueSTATS;
+const uint8_t KVMessage::StatusCodeValueSNAPSHOT;
 const uint8_t KVMessage::StatusCodeValueSUCCESS;
 const uint8_t KVMessage::StatusCodeValueERROR;
 constexpr char KVMessage::ERROR_MESSAGE[256];
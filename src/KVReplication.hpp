@@ -0,0 +1,551 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVREPLICATION_HPP
+#define PA_4_KEY_VALUE_STORE_KVREPLICATION_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "MyDebugger.hpp"
+#include "KVMessage.hpp"
+#include "KVKeyIndex.hpp"
+
+/*
+ * Primary/replica asynchronous replication
+ *
+ * The primary ("REPLICATION_PORT" in KVServer.conf) appends every write to "kvReplicationLog" while holding the
+ * writer lock of the bucket of the Key in KVCache, so the log has the writes of each Key in the same order in
+ * which they were applied. Replicas ("REPLICA_OF IP:PORT") connect to the replication port, and the primary
+ * streams the log to each of them. A replica applies the writes to its own KVCache/KVStore (keeping the version
+ * of the primary, so GETS on a replica can be followed by CAS on the primary), serves GET/GETS/SCAN, and rejects
+ * the writes of its clients.
+ *
+ *     - The log is an in-memory ring of "REPLICATION_LOG_SIZE" records. A replica which connects for the first
+ *       time, was restarted, or has fallen behind the ring, gets a full sync: every Key of "kvKeyIndex" with its
+ *       current Value, followed by the log from where the full sync started. Keys present on the replica but
+ *       NOT sent in the full sync are deleted.
+ *     - Expiry is NOT replicated, the replica expires the Keys itself using "expires_at" of the primary
+ *     - The replica acknowledges the records it has applied, and both sides expose the lag using STATS
+ * */
+
+/* One message on the replication connection (primary -> replica), all numbers are in host byte order */
+struct ReplicationFrame {
+    enum FrameType : uint8_t {
+        TypeRECORD = 1, TypeFULL_SYNC_BEGIN = 2, TypeFULL_SYNC_END = 3, TypeHEARTBEAT = 4
+    };
+    enum RecordOp : uint8_t {
+        OpPUT = 1, OpDEL = 2
+    };
+
+    uint8_t type;
+    uint8_t op;  // RECORD ONLY
+    uint64_t seq;  // RECORD: sequence number (0 = part of a full sync), FULL_SYNC_BEGIN: seq of the next record
+    uint64_t head_seq;  // last seq in the log of the primary, used to calculate the lag of the replica
+    uint64_t time_ms;  // RECORD: time at which the primary applied it, FULL_SYNC_BEGIN: epoch of the primary
+    uint64_t expires_at, version;
+    char key[256], value[256];
+};
+
+/*
+ * Ordered log of all the writes applied by this server, refer the comment at the top
+ * NOTE: "append_PUT(...)" and "append_DEL(...)" do nothing unless "init(...)" was called
+ * */
+struct KVReplicationLog {
+    bool enabled;
+    uint64_t epoch;  // changes on every start, so a replica can tell that the sequence numbers restarted
+
+    KVReplicationLog() : enabled{false}, epoch{0}, mutex(), appended(), ring(), nextSeq{1} {}
+
+    void init(uint64_t capacity) {
+        ring.resize(std::max<uint64_t>(capacity, 1024));
+        epoch = (KVMessage::current_time_ms() << 16) ^ static_cast<uint64_t>(getpid());
+        enabled = true;
+    }
+
+    /* ASSUMED: the writer lock of the bucket of the Key is held, and "ptr" has the new Value and version */
+    inline void append_PUT(const KVMessage *ptr) {
+        if (enabled) append(ReplicationFrame::OpPUT, ptr);
+    }
+
+    /* ASSUMED: same as "append_PUT(...)" */
+    inline void append_DEL(const KVMessage *ptr) {
+        if (enabled) append(ReplicationFrame::OpDEL, ptr);
+    }
+
+    [[nodiscard]] uint64_t head() {
+        std::lock_guard lock(mutex);
+        return nextSeq - 1;
+    }
+
+    /* Copy the records from "fromSeq" onwards (at most "maxRecords") to "out", waiting at most "waitMs" for
+     * the first record if there are none
+     * Returns: false if "fromSeq" is no longer (or NOT yet) in the log, i.e. a full sync is required
+     * */
+    bool read(uint64_t fromSeq, std::vector<ReplicationFrame> &out, size_t maxRecords, uint32_t waitMs) {
+        out.clear();
+        std::unique_lock lock(mutex);
+        if (fromSeq > nextSeq || nextSeq - fromSeq > ring.size()) return false;
+        if (fromSeq == nextSeq) {
+            appended.wait_for(lock, std::chrono::milliseconds(waitMs));
+            if (nextSeq - fromSeq > ring.size()) return false;
+        }
+        for (uint64_t seq = fromSeq; seq < nextSeq && out.size() < maxRecords; ++seq) {
+            out.push_back(ring[seq % ring.size()]);
+            out.back().head_seq = nextSeq - 1;
+        }
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable appended;
+    std::vector<ReplicationFrame> ring;  // record "seq" is at "seq % ring.size()"
+    uint64_t nextSeq;
+
+    void append(uint8_t op, const KVMessage *ptr) {
+        {
+            std::lock_guard lock(mutex);
+            ReplicationFrame &frame = ring[nextSeq % ring.size()];
+            frame.type = ReplicationFrame::TypeRECORD;
+            frame.op = op;
+            frame.seq = nextSeq;
+            frame.time_ms = KVMessage::current_time_ms();
+            frame.expires_at = ptr->expires_at;
+            frame.version = ptr->version;
+            std::copy(ptr->key, ptr->key + 256, frame.key);
+            if (op == ReplicationFrame::OpPUT) std::copy(ptr->value, ptr->value + 256, frame.value);
+            else std::fill(frame.value, frame.value + 256, '\0');
+            ++nextSeq;
+        }
+        appended.notify_all();
+    }
+};
+
+KVReplicationLog kvReplicationLog;
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+namespace replication_io {
+    /* Returns: true if all "len" bytes were written */
+    inline bool write_fully(int fd, const void *buf, size_t len) {
+        auto ptr = static_cast<const char *>(buf);
+        while (len > 0) {
+            // MSG_NOSIGNAL: a replica which disconnects must NOT terminate the server with SIGPIPE
+            const ssize_t n = send(fd, ptr, len, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            ptr += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    /* Returns: true if all "len" bytes were read, false on error, EOF or timeout (SO_RCVTIMEO) */
+    inline bool read_fully(int fd, void *buf, size_t len) {
+        auto ptr = static_cast<char *>(buf);
+        while (len > 0) {
+            const ssize_t n = read(fd, ptr, len);
+            if (n <= 0) return false;
+            ptr += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    inline void set_timeouts(int fd, uint32_t timeoutMs) {
+        struct timeval tv{static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>((timeoutMs % 1000) * 1000)};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    /* SIGINT must be handled by some other thread, refer "ExpiryReaper::reaper_loop()" in KVServer.cpp */
+    inline void block_sigint() {
+        sigset_t signalSet;
+        sigemptyset(&signalSet);
+        sigaddset(&signalSet, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signalSet, nullptr);
+    }
+}
+
+/* Handshake sent by a replica once it connects */
+struct ReplicationHello {
+    uint64_t epoch;  // of the primary whose log was applied, 0 = none
+    uint64_t next_seq;  // first record which has NOT been applied
+};
+
+/*
+ * Primary side: accepts replicas on the replication port and streams "kvReplicationLog" to each of them
+ *
+ * "readKey(KVMessage *)" is used by the full sync, it fills the Value, "expires_at" and version of the Key
+ * (present in KVMessage::key) and returns false if the Key does NOT exist.
+ * */
+struct ReplicationPrimary {
+    static constexpr size_t BATCH_LEN = 256;
+    static constexpr uint32_t HEARTBEAT_MS = 1000;
+    static constexpr uint32_t ACK_POLL_MS = 100;  // acknowledgements are read at least this often
+
+    struct ReplicaInfo {
+        std::string address;
+        std::atomic_uint64_t acked_seq{0};
+    };
+
+    std::function<bool(KVMessage *)> readKey;
+
+    void start(int32_t port, std::function<bool(KVMessage *)> read_key) {
+        readKey = std::move(read_key);
+
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        const int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0
+            || listen(listenFd, 16) != 0) {
+            log_error("Replication: unable to listen on port number = " + std::to_string(port));
+            log_error("Exiting (status=67)");
+            exit(67);
+        }
+        log_success("Replication: primary waiting for replicas on port number = " + std::to_string(port));
+        std::thread([this]() { accept_loop(); }).detach();  // the server exits using "exit(...)"
+    }
+
+    /* Returns: text for the STATS request */
+    std::string stats() {
+        const uint64_t head = kvReplicationLog.head();
+        uint64_t maxLag = 0, count = 0;
+        {
+            std::lock_guard lock(mutex_replicas);
+            for (const auto &replica: replicas) {
+                const uint64_t acked = replica->acked_seq.load(std::memory_order_relaxed);
+                maxLag = std::max(maxLag, (head > acked) ? (head - acked) : 0);
+                ++count;
+            }
+        }
+        return "role=primary epoch=" + std::to_string(kvReplicationLog.epoch) + " head_seq=" + std::to_string(head)
+               + " replicas=" + std::to_string(count) + " max_lag_records=" + std::to_string(maxLag);
+    }
+
+private:
+    int listenFd = -1;
+    std::mutex mutex_replicas;
+    std::list<std::shared_ptr<ReplicaInfo>> replicas;
+
+    void accept_loop() {
+        replication_io::block_sigint();
+        while (true) {
+            struct sockaddr_in addr{};
+            socklen_t len = sizeof(addr);
+            const int fd = accept(listenFd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+            if (fd < 0) continue;
+
+            auto replica = std::make_shared<ReplicaInfo>();
+            replica->address = std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(ntohs(addr.sin_port));
+            std::thread([this, fd, replica]() { serve_replica(fd, replica); }).detach();
+        }
+    }
+
+    void serve_replica(int fd, const std::shared_ptr<ReplicaInfo> &replica) {
+        replication_io::block_sigint();
+        replication_io::set_timeouts(fd, 10 * HEARTBEAT_MS);
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+
+        ReplicationHello hello{};
+        if (not replication_io::read_fully(fd, &hello, sizeof(hello))) {
+            close(fd);
+            return;
+        }
+        log_success("Replication: replica connected = " + replica->address);
+        {
+            std::lock_guard lock(mutex_replicas);
+            replicas.push_back(replica);
+        }
+
+        uint64_t nextSeq = hello.next_seq;
+        bool ok = true;
+        bool fullSync = (hello.epoch != kvReplicationLog.epoch);
+        std::vector<ReplicationFrame> batch;
+        uint64_t ackBuffer = 0;
+        size_t ackBytes = 0;
+        uint64_t lastSendMs = 0;
+        while (ok) {
+            if (fullSync) {
+                ok = full_sync(fd, nextSeq);
+                fullSync = false;
+                continue;
+            }
+            if (not kvReplicationLog.read(nextSeq, batch, BATCH_LEN, ACK_POLL_MS)) {
+                log_warning("Replication: " + replica->address + " has fallen behind the log, full sync");
+                fullSync = true;
+                continue;
+            }
+
+            const uint64_t nowMs = KVMessage::current_time_ms();
+            if (batch.empty() && nowMs - lastSendMs < HEARTBEAT_MS) {
+                // Nothing to send, only the acknowledgements are read below
+            } else if (batch.empty()) {
+                ReplicationFrame heartbeat{};
+                heartbeat.type = ReplicationFrame::TypeHEARTBEAT;
+                heartbeat.head_seq = nextSeq - 1;
+                heartbeat.time_ms = nowMs;
+                ok = replication_io::write_fully(fd, &heartbeat, sizeof(heartbeat));
+                lastSendMs = nowMs;
+            } else {
+                ok = replication_io::write_fully(fd, batch.data(), batch.size() * sizeof(ReplicationFrame));
+                nextSeq = batch.back().seq + 1;
+                lastSendMs = nowMs;
+            }
+
+            // Acknowledgements (uint64_t seq of the last applied record) are read without blocking
+            while (ok) {
+                const ssize_t n = recv(fd, reinterpret_cast<char *>(&ackBuffer) + ackBytes,
+                                       sizeof(uint64_t) - ackBytes, MSG_DONTWAIT);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) ok = false;
+                if (n <= 0) break;
+                ackBytes += n;
+                if (ackBytes == sizeof(uint64_t)) {
+                    replica->acked_seq.store(ackBuffer, std::memory_order_relaxed);
+                    ackBytes = 0;
+                }
+            }
+        }
+
+        log_warning("Replication: replica disconnected = " + replica->address);
+        close(fd);
+        std::lock_guard lock(mutex_replicas);
+        replicas.remove(replica);
+    }
+
+    /* Send every Key of "kvKeyIndex", after which the log is streamed from "nextSeq"
+     * The writes done during the full sync are in the log after "nextSeq", so the replica converges to the
+     * primary even though the Keys are NOT read at one point in time */
+    bool full_sync(int fd, uint64_t &nextSeq) {
+        nextSeq = kvReplicationLog.head() + 1;
+        log_info("Replication: full sync started, next_seq = " + std::to_string(nextSeq));
+
+        ReplicationFrame frame{};
+        frame.type = ReplicationFrame::TypeFULL_SYNC_BEGIN;
+        frame.seq = nextSeq;
+        frame.head_seq = nextSeq - 1;
+        frame.time_ms = kvReplicationLog.epoch;
+        if (not replication_io::write_fully(fd, &frame, sizeof(frame))) return false;
+
+        std::vector<std::string> keys;
+        std::vector<ReplicationFrame> batch;
+        std::string token;
+        KVMessage message;
+        do {
+            keys.clear();
+            token = kvKeyIndex.scan("", token, KVKeyIndex::MAX_PAGE_LEN, keys);
+            batch.clear();
+            for (const std::string &key: keys) {
+                message.set_key(key.c_str());
+                if (not readKey(&message)) continue;  // deleted or expired meanwhile
+
+                ReplicationFrame &record = batch.emplace_back();
+                record = {};
+                record.type = ReplicationFrame::TypeRECORD;
+                record.op = ReplicationFrame::OpPUT;
+                record.head_seq = nextSeq - 1;
+                record.expires_at = message.expires_at;
+                record.version = message.version;
+                std::copy(message.key, message.key + 256, record.key);
+                std::copy(message.value, message.value + 256, record.value);
+            }
+            if (not replication_io::write_fully(fd, batch.data(), batch.size() * sizeof(ReplicationFrame)))
+                return false;
+        } while (not token.empty());
+
+        frame.type = ReplicationFrame::TypeFULL_SYNC_END;
+        return replication_io::write_fully(fd, &frame, sizeof(frame));
+    }
+};
+
+/*
+ * Replica side: connects to the primary, and applies its log using "apply(op, KVMessage *)"
+ * (op = ReplicationFrame::OpPUT or OpDEL, the KVMessage has the Key, Value, "expires_at" and version)
+ *
+ * "mutex_applying" is held while applying a record, the signal handler acquires it to stop the replica.
+ * */
+struct ReplicationReplica {
+    static constexpr uint32_t RECONNECT_MS = 1000;
+    static constexpr uint32_t ACK_EVERY = 256;  // records, an acknowledgement is also sent when idle
+
+    std::mutex mutex_applying;
+
+    void start(const std::string &primaryAddress, std::function<void(uint8_t, KVMessage *)> apply_record) {
+        const size_t colon = primaryAddress.rfind(':');
+        if (colon == std::string::npos) {
+            log_error("Replication: REPLICA_OF must be \"IP:PORT\", found \"" + primaryAddress + "\"");
+            log_error("Exiting (status=68)");
+            exit(68);
+        }
+        host = primaryAddress.substr(0, colon);
+        port = primaryAddress.substr(colon + 1);
+        apply = std::move(apply_record);
+        std::thread([this]() { replica_loop(); }).detach();  // the server exits using "exit(...)"
+    }
+
+    /* Returns: text for the STATS request */
+    std::string stats() {
+        const uint64_t applied = appliedSeq.load(std::memory_order_relaxed);
+        const uint64_t head = primaryHeadSeq.load(std::memory_order_relaxed);
+        const uint64_t lagRecords = (head > applied) ? (head - applied) : 0;
+        const uint64_t commitMs = lastCommitMs.load(std::memory_order_relaxed), nowMs = KVMessage::current_time_ms();
+        const uint64_t lagMs = (lagRecords == 0 || commitMs == 0 || nowMs < commitMs) ? 0 : (nowMs - commitMs);
+        return "role=replica connected=" + std::to_string(connected.load() ? 1 : 0)
+               + " applied_seq=" + std::to_string(applied) + " primary_seq=" + std::to_string(head)
+               + " lag_records=" + std::to_string(lagRecords) + " lag_ms=" + std::to_string(lagMs)
+               + " full_syncs=" + std::to_string(fullSyncs.load());
+    }
+
+private:
+    std::string host, port;
+    std::function<void(uint8_t, KVMessage *)> apply;
+
+    // Position in the log of the primary, kept across reconnections
+    uint64_t epoch = 0;
+    std::atomic_uint64_t appliedSeq{0}, primaryHeadSeq{0}, lastCommitMs{0}, fullSyncs{0};
+    std::atomic_bool connected{false};
+
+    int connect_to_primary() {
+        struct addrinfo hints{}, *addresses = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0 || addresses == nullptr) return -1;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, addresses->ai_addr, addresses->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+
+    void replica_loop() {
+        replication_io::block_sigint();
+        while (true) {
+            const int fd = connect_to_primary();
+            if (fd < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_MS));
+                continue;
+            }
+            // No frame (not even a heartbeat) for a long time means that the primary is gone
+            replication_io::set_timeouts(fd, 5 * ReplicationPrimary::HEARTBEAT_MS);
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+
+            log_success("Replication: connected to the primary " + host + ":" + port);
+            connected = true;
+            stream(fd);
+            connected = false;
+            close(fd);
+            log_warning("Replication: disconnected from the primary, reconnecting");
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_MS));
+        }
+    }
+
+    void stream(int fd) {
+        const ReplicationHello hello{epoch, appliedSeq.load() + 1};
+        if (not replication_io::write_fully(fd, &hello, sizeof(hello))) return;
+
+        ReplicationFrame frame{};
+        KVMessage message;
+        bool inFullSync = false;
+        std::unordered_set<std::string> staleKeys;  // Keys NOT (yet) sent by the full sync
+        uint32_t unacked = 0;
+        while (replication_io::read_fully(fd, &frame, sizeof(frame))) {
+            primaryHeadSeq.store(frame.head_seq, std::memory_order_relaxed);
+            switch (frame.type) {
+                case ReplicationFrame::TypeFULL_SYNC_BEGIN:
+                    log_info("Replication: full sync started");
+                    inFullSync = true;
+                    ++fullSyncs;
+                    staleKeys = all_keys();
+                    epoch = frame.time_ms;
+                    break;
+
+                case ReplicationFrame::TypeFULL_SYNC_END:
+                    for (const std::string &key: staleKeys) {
+                        message = KVMessage();
+                        message.set_key(key.c_str());
+                        apply_locked(ReplicationFrame::OpDEL, &message);
+                    }
+                    log_info("Replication: full sync complete, stale Keys deleted = "
+                             + std::to_string(staleKeys.size()));
+                    staleKeys.clear();
+                    inFullSync = false;
+                    appliedSeq = frame.seq - 1;
+                    break;
+
+                case ReplicationFrame::TypeRECORD:
+                    if (frame.seq != 0 && frame.seq != appliedSeq.load() + 1) {
+                        log_error("Replication: expected seq = " + std::to_string(appliedSeq.load() + 1)
+                                  + ", received = " + std::to_string(frame.seq));
+                        return;  // reconnect, and resume from the last applied record
+                    }
+                    message = KVMessage();
+                    message.set_key_fast(frame.key);
+                    message.set_value_fast(frame.value);
+                    message.expires_at = frame.expires_at;
+                    message.version = frame.version;
+                    if (inFullSync) staleKeys.erase(std::string(frame.key, strnlen(frame.key, 256)));
+                    apply_locked(frame.op, &message);
+                    if (frame.seq != 0) {
+                        appliedSeq = frame.seq;
+                        lastCommitMs = frame.time_ms;
+                    }
+                    break;
+
+                default:
+                    // HEARTBEAT, only "head_seq" is used
+                    break;
+            }
+
+            // Acknowledge once the received frames are applied, or every ACK_EVERY records
+            int pendingBytes = 0;
+            ioctl(fd, FIONREAD, &pendingBytes);
+            if ((++unacked >= ACK_EVERY || pendingBytes == 0) && (not inFullSync)) {
+                const uint64_t ack = appliedSeq.load();
+                if (not replication_io::write_fully(fd, &ack, sizeof(uint64_t))) return;
+                unacked = 0;
+            }
+        }
+    }
+
+    void apply_locked(uint8_t op, KVMessage *message) {
+        std::lock_guard lock(mutex_applying);
+        apply(op, message);
+    }
+
+    static std::unordered_set<std::string> all_keys() {
+        std::unordered_set<std::string> keys;
+        std::vector<std::string> page;
+        std::string token;
+        do {
+            page.clear();
+            token = kvKeyIndex.scan("", token, KVKeyIndex::MAX_PAGE_LEN, page);
+            keys.insert(page.begin(), page.end());
+        } while (not token.empty());
+        return keys;
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_KVREPLICATION_HPP
@@ -1,22 +1,38 @@
 #include <iostream>
 #include <cstdint>
 #include <cstring>
+#include <cstdlib>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <csignal>
 #include <vector>
 #include <list>
+#include <deque>
 #include <iterator>
+#include <memory>
+#include <thread>
 // ---------------------------------------------------------------------------------------------------------------------
 
 #include "MyDebugger.hpp"
 #include "MyMemoryPool.hpp"
+#include "MyNuma.hpp"
+#include "MySPSCQueue.hpp"
+#include "MyWorkStealingDeque.hpp"
+#include "MyCoroutine.hpp"
+#include "MyTimingWheel.hpp"
 #include "KVMessage.hpp"
+#include "KVConnection.hpp"
+#include "KVLocalSocket.hpp"
 #include "KVCache.hpp"
+#include "KVHotKeys.hpp"
+#include "KVSnapshot.hpp"
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "LocalValueEscapesScope"
@@ -26,6 +42,10 @@
 // ---------------------------------------------------------------------------------------------------------------------
 void *worker_thread(void *);
 
+void *worker_thread_per_core(void *);
+
+void schedule_expiry(const KVMessage *message);
+
 struct ServerConfig {
     // REFER: https://www.geeksforgeeks.org/enumeration-enum-c/
     enum CacheReplacementPolicyType {
@@ -35,10 +55,31 @@ struct ServerConfig {
 
     int32_t listening_port;  // the port number to bind the socket to
     int32_t socket_listen_n_limit;  // max number of connection the socket should listen to
-    int32_t thread_pool_size_initial;  // initial number of threads to be created
-    int32_t thread_pool_growth;  // the number of extra threads to be created if all threads have reached the client limits
-    int32_t clients_per_thread;  // number of clients that are to be served per thread
+    int32_t thread_pool_size_initial;  // number of worker threads, 0 = one per CPU core
+    int32_t thread_pool_growth;  // NOT used, the thread pool has a fixed size (kept for old config files)
+    int32_t clients_per_thread;  // NOT used, clients are balanced using work stealing (kept for old config files)
     int32_t cache_size;  // number of entries that can be kept in the cache
+    int32_t numa_aware;  // if 1, pin worker threads to CPUs and partition the cache across NUMA nodes
+    int32_t shared_nothing;  // if 1, each of the "thread_pool_size_initial" workers owns a shard of the Keys
+    int32_t storage_thread_pool_size;  // number of threads reading the Persistent Storage for cache misses
+    int32_t value_compression;  // if 1, Values are compressed (LZ4) in the Persistent Storage
+    int32_t value_compression_min_len;  // Values shorter than this are stored uncompressed
+    int32_t replication_port;  // if > 0, this server is a primary and replicas connect to this port
+    int32_t replication_log_size;  // number of writes kept in memory for the replicas, refer "KVReplicationLog"
+    std::string replica_of;  // "IP:PORT" (replication port of the primary), if set this server is a replica
+    int32_t startup_verify;  // if 1, the Persistent Storage is verified on every start, not only after a crash
+    int32_t startup_scan_threads;  // number of threads verifying the Persistent Storage, 0 = one per CPU core
+    int32_t compaction_interval_ms;  // the Persistent Storage is checked for compaction this often, 0 = never
+    int32_t compaction_min_free;  // a file is compacted only if it has at least these many free entries
+    int32_t store_hash_table_len;  // number of files of a new Persistent Storage, refer "KVStoreGeometry"
+    int32_t store_file_table_len;  // number of slots in each file of a new Persistent Storage
+    int32_t store_max_hash_table_len;  // the files are NOT split beyond these many files
+    int32_t store_split_load_percent;  // a file is split when there are more Keys than this % of slots, 0 = never
+    int32_t tcp_nodelay;  // if 1, Nagle's algorithm is disabled on the client sockets, refer KVConnection.hpp
+    int32_t response_cork;  // if 1, the responses to a batch of requests of a client are written together
+    int32_t unix_socket;  // if 1, the clients on the same host can also connect using a Unix domain socket
+    int32_t hot_key_cache_size;  // number of hot Keys copied by each worker (default mode only), 0 = none
+    int32_t hot_key_sample_period;  // one out of these many GETs is counted to find the hot Keys
 
     // Of NO use as only one Cache Replacement Policy will be implemented for the Assignment
     enum CacheReplacementPolicyType cache_replacement_policy;
@@ -50,6 +91,27 @@ struct ServerConfig {
         thread_pool_growth = 2;
         clients_per_thread = 5;
         cache_size = 5;
+        numa_aware = 0;
+        shared_nothing = 0;
+        storage_thread_pool_size = 16;
+        value_compression = 0;
+        value_compression_min_len = 64;
+        replication_port = 0;
+        replication_log_size = 65536;
+        replica_of = "";
+        startup_verify = 0;
+        startup_scan_threads = 0;
+        compaction_interval_ms = 10000;
+        compaction_min_free = 1024;
+        store_hash_table_len = 1021;
+        store_file_table_len = 8191;
+        store_max_hash_table_len = 65536;
+        store_split_load_percent = 75;
+        tcp_nodelay = 1;
+        response_cork = 0;
+        unix_socket = 1;
+        hot_key_cache_size = 64;
+        hot_key_sample_period = 16;
         cache_replacement_policy = CacheTypeLRU;
     }
 
@@ -60,7 +122,7 @@ struct ServerConfig {
         // Each Key-Value pair is newline ("\n") separated
         std::fstream conf_file;
         conf_file.open(configFile, std::ios::in);
-        std::string key;
+        std::string key, valStr;
         int32_t val;
 
         // LISTENING_PORT 12345
@@ -69,14 +131,57 @@ struct ServerConfig {
         // THREAD_POOL_GROWTH 2
         // CLIENTS_PER_THREAD 5
         // CACHE_SIZE 5
+        // NUMA_AWARE 0
+        // SHARED_NOTHING 0
+        // STORAGE_THREAD_POOL_SIZE 16
+        // VALUE_COMPRESSION 0
+        // VALUE_COMPRESSION_MIN_LEN 64
+        // REPLICATION_PORT 0
+        // REPLICATION_LOG_SIZE 65536
+        // REPLICA_OF 127.0.0.1:23456
+        // STARTUP_VERIFY 0
+        // STARTUP_SCAN_THREADS 0
+        // COMPACTION_INTERVAL_MS 10000
+        // COMPACTION_MIN_FREE 1024
+        // STORE_HASH_TABLE_LEN 1021
+        // STORE_FILE_TABLE_LEN 8191
+        // STORE_MAX_HASH_TABLE_LEN 65536
+        // STORE_SPLIT_LOAD_PERCENT 75
+        // TCP_NODELAY 1
+        // RESPONSE_CORK 0
+        // UNIX_SOCKET 1
+        // HOT_KEY_CACHE_SIZE 64
+        // HOT_KEY_SAMPLE_PERIOD 16
         while ((not conf_file.eof()) && conf_file.is_open()) {
-            conf_file >> key >> val;
+            if (not (conf_file >> key >> valStr)) break;
+            val = static_cast<int32_t>(std::strtol(valStr.c_str(), nullptr, 10));
             if (key == "LISTENING_PORT") listening_port = val;
             else if (key == "SOCKET_LISTEN_N_LIMIT") socket_listen_n_limit = val;
             else if (key == "THREAD_POOL_SIZE_INITIAL") thread_pool_size_initial = val;
             else if (key == "THREAD_POOL_GROWTH") thread_pool_growth = val;
             else if (key == "CLIENTS_PER_THREAD") clients_per_thread = val;
             else if (key == "CACHE_SIZE") cache_size = val;
+            else if (key == "NUMA_AWARE") numa_aware = val;
+            else if (key == "SHARED_NOTHING") shared_nothing = val;
+            else if (key == "STORAGE_THREAD_POOL_SIZE") storage_thread_pool_size = val;
+            else if (key == "VALUE_COMPRESSION") value_compression = val;
+            else if (key == "VALUE_COMPRESSION_MIN_LEN") value_compression_min_len = val;
+            else if (key == "REPLICATION_PORT") replication_port = val;
+            else if (key == "REPLICATION_LOG_SIZE") replication_log_size = val;
+            else if (key == "REPLICA_OF") replica_of = valStr;
+            else if (key == "STARTUP_VERIFY") startup_verify = val;
+            else if (key == "STARTUP_SCAN_THREADS") startup_scan_threads = val;
+            else if (key == "COMPACTION_INTERVAL_MS") compaction_interval_ms = val;
+            else if (key == "COMPACTION_MIN_FREE") compaction_min_free = val;
+            else if (key == "STORE_HASH_TABLE_LEN") store_hash_table_len = val;
+            else if (key == "STORE_FILE_TABLE_LEN") store_file_table_len = val;
+            else if (key == "STORE_MAX_HASH_TABLE_LEN") store_max_hash_table_len = val;
+            else if (key == "STORE_SPLIT_LOAD_PERCENT") store_split_load_percent = val;
+            else if (key == "TCP_NODELAY") tcp_nodelay = val;
+            else if (key == "RESPONSE_CORK") response_cork = val;
+            else if (key == "UNIX_SOCKET") unix_socket = val;
+            else if (key == "HOT_KEY_CACHE_SIZE") hot_key_cache_size = val;
+            else if (key == "HOT_KEY_SAMPLE_PERIOD") hot_key_sample_period = val;
             else log_warning("Invalid server config parameter = \"" + key + "\"");
         }
 
@@ -86,42 +191,82 @@ struct ServerConfig {
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+struct WorkerThreadInfo;
+
+/* A client connection which has a request ready to be read */
+struct ReadyClient {
+    int client_fd;
+    struct WorkerThreadInfo *owner;  // the worker in whose epoll instance "client_fd" is registered
+};
+
 /* One instance for each Worker Thread */
 struct WorkerThreadInfo {
     pthread_t thread_obj;
 
-    // Worker Thread will iterate through this vector for list of clients to serve using "epoll(...)"
-    int32_t client_fds_count;
+    // Number of clients registered in "epoll_fd"
+    std::atomic_int32_t client_fds_count;
 
-    // Main Thread will insert new client File Descriptors to this vector and then the Worker Thread
-    // will insert all the Client File Descriptors in this into "client_fds" at regular intervals.
-    std::vector<int> client_fds_new;
+    // Created by the Main Thread, so that it can register the new clients (EPOLLONESHOT) directly
+    int epoll_fd;
 
-    // Lock to ensure only one of Main Thread and Worker thread are working on "client_fds_new"
+    // Held by the Worker Thread while serving clients, the signal handler acquires it to stop the worker
     // std::mutex is faster than pthread_mutex_t when tested
-    std::mutex mutex_new_client_fds, mutex_serving_clients;
+    std::mutex mutex_serving_clients;
+
+    // Clients of this worker which are ready to be served, idle workers steal from here, refer "worker_thread(...)"
+    WorkStealingDeque<ReadyClient> ready_clients;
+
+    // Requests of this worker which were suspended on a cache miss and whose Persistent Storage access is done
+    CoroutineResumeQueue resume_queue;
 
     MemoryPool<KVMessage> *pool_manager;
-    KVCache *kv_cache;
+
+    // One KVCache per NUMA node (only one if NUMA_AWARE is 0), refer "get_kv_cache(...)"
+    std::vector<KVCache *> *kv_caches;
 
     uint32_t thread_id;
 
+    // NUMA node whose cache partition this thread serves best and the CPU it is pinned to (-1 = not pinned)
+    int32_t numa_node, cpu_id;
+
+    // SHARED_NOTHING mode ONLY: the shard of the cache owned by this thread, refer "worker_thread_per_core(...)"
+    std::unique_ptr<KVCache> owned_kv_cache;
+
+    // Default mode ONLY: copies of the Keys this thread reads the most, nullptr if disabled, refer KVHotKeys.hpp
+    // NOTE: NOT needed in SHARED_NOTHING mode, where a Key is only ever read by the thread owning it
+    std::unique_ptr<HotKeyCache> hot_keys;
+
     // REFER: https://stackoverflow.com/questions/30867779/correct-pthread-t-initialization-and-handling#:~:text=pthread_t%20is%20a%20C%20type,it%20true%20once%20pthread_create%20succeeds.
-    WorkerThreadInfo(int32_t clientsPerThread, MemoryPool<KVMessage> *poolManager, KVCache *kvCache,
-                     uint32_t threadId) :
+    WorkerThreadInfo(MemoryPool<KVMessage> *poolManager, std::vector<KVCache *> *kvCaches,
+                     uint32_t threadId, int32_t numaNode = 0, int32_t cpuId = -1) :
             thread_obj(),
             client_fds_count(0),
-            client_fds_new(),
-            mutex_new_client_fds(),
+            epoll_fd{epoll_create1(0)},
+            mutex_serving_clients(),
+            ready_clients(),
+            resume_queue(),
             pool_manager{poolManager},
-            kv_cache{kvCache},
-            thread_id{threadId} {
-        client_fds_new.reserve(clientsPerThread);
+            kv_caches{kvCaches},
+            thread_id{threadId},
+            numa_node{numaNode},
+            cpu_id{cpuId},
+            owned_kv_cache(),
+            hot_keys() {
     }
 
-    void start_thread() {
+    /* ASSUMED: message->calculate_key_hash() has been called
+     * Returns: the cache partition which owns the Key of "message"
+     *
+     * NOTE: hash2 is used to pick the partition because hash1 decides the bucket inside
+     *       the KVCache and the file inside the KVStore */
+    inline KVCache *get_kv_cache(const KVMessage *message) const {
+        return kv_caches->at(message->hash2 % kv_caches->size());
+    }
+
+    void start_thread(bool sharedNothing = false) {
         // Start the worker thread with "WorkerThreadInfo" pointer = ptr
-        pthread_create(&thread_obj, nullptr, worker_thread, reinterpret_cast<void *>(this));
+        pthread_create(&thread_obj, nullptr, (sharedNothing) ? worker_thread_per_core : worker_thread,
+                       reinterpret_cast<void *>(this));
     }
 
 };
@@ -129,150 +274,870 @@ struct WorkerThreadInfo {
 struct WorkerThreadInfo WorkerThreadInfo_DEFAULT();
 
 struct ServerConfig *global_server_config;
-struct KVCache *globalKVCache;
+std::vector<KVCache *> *globalKVCaches;
+
+// At most one of these is set, refer "KVReplication.hpp"
+ReplicationPrimary *globalReplicationPrimary = nullptr;
+ReplicationReplica *globalReplicationReplica = nullptr;
+
+KVSnapshotter *globalSnapshotter = nullptr;
+std::string globalUnixSocketPath;  // empty if the Unix domain socket is NOT used, it is removed on exit
 
+bool pause_cache_writers(const WorkerThreadInfo *self, bool pause);
+std::string hot_key_stats();
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/* CAS, INCR or DECR, refer "KVCache::cache_UPDATE(...)"
+ * Returns: true if successful */
+bool execute_update(KVCache *kvCache, KVMessage *message) {
+    if (message->is_request_code_CAS()) return kvCache->cache_CAS(message);
+
+    if (message->status_code == KVMessage::StatusCodeValueDECR) {
+        const auto delta = static_cast<int64_t>(message->request_arg);
+        if (delta == std::numeric_limits<int64_t>::min()) return false;  // can NOT be negated
+        message->request_arg = static_cast<uint64_t>(-delta);
+    }
+    return kvCache->cache_INCR(message);
+}
+
+/* Perform the request present in "message" and store the result in "message->status_code"
+ * ASSUMED: message->calculate_key_hash() has been called */
+void execute_request(KVCache *kvCache, KVMessage *message) {
+    bool res;
+    if (message->is_request_read()) {
+        // GET or GETS
+        res = kvCache->cache_GET(message);
+        // "expires_at" is set only if the Key was read from the Persistent Storage, refer "read_from_db(...)"
+        if (message->expires_at != 0) schedule_expiry(message);
+    } else if (message->is_request_code_CAS() || message->is_request_code_INCR_DECR()) {
+        res = execute_update(kvCache, message);
+    } else if (message->is_request_with_value()) {
+        // PUT or PUT_TTL
+        kvCache->cache_PUT(message);
+        if (message->expires_at != 0) schedule_expiry(message);
+        res = true;
+    } else {
+        // DELETE request code
+        res = kvCache->cache_DELETE(message);
+    }
+
+    if (res) message->set_request_code_SUCCESS();
+    else message->set_request_code_ERROR();
+}
+
+/* Append the status code followed by the 256 byte "payload" (if not nullptr) to the send buffer of the client
+ * The responses are written by "KVConnection::flush()"
+ *
+ * NOTE: MSG_ZEROCOPY is NOT used as it only pays off for payloads of ~10 KB and more, below that the page
+ *       pinning and the completion notifications cost more than copying the payload to the socket buffer
+ *     REFER: https://www.kernel.org/doc/html/latest/networking/msg_zerocopy.html
+ * */
+inline void write_status_and_payload(KVConnection *connection, const uint8_t *statusCode, const char *payload) {
+    connection->append(statusCode, sizeof(uint8_t));
+    if (payload != nullptr) connection->append(payload, 256);
+}
+
+/* Append the response of "execute_request(...)" to the send buffer of the client
+ * "requestCode" is required as "message->status_code" holds the result of the request */
+void write_response(KVConnection *connection, uint8_t requestCode, const KVMessage *message) {
+    const bool res = message->is_request_result_SUCCESS();
+    const uint8_t *statusCode = (res) ? (&KVMessage::StatusCodeValueSUCCESS) : (&KVMessage::StatusCodeValueERROR);
+
+    if (KVMessage::is_request_code_GET(requestCode)) {
+        write_status_and_payload(connection, statusCode, (res) ? (message->value) : (KVMessage::ERROR_MESSAGE));
+    } else if (KVMessage::is_request_code_DEL(requestCode) && (not res)) {
+        write_status_and_payload(connection, statusCode, KVMessage::ERROR_MESSAGE);
+    } else if (KVMessage::is_request_code_GETS(requestCode) || KVMessage::is_request_code_CAS(requestCode)
+               || KVMessage::is_request_code_INCR_DECR(requestCode)) {
+        // GETS = status, Value, version | CAS = status, version | INCR/DECR = status, new Value as int64_t
+        const uint64_t version = (res || KVMessage::is_request_code_CAS(requestCode)) ? message->version : 0;
+        const uint64_t number = (res) ? message->request_arg : 0;
+        connection->append(statusCode, sizeof(uint8_t));
+        if (KVMessage::is_request_code_GETS(requestCode)) {
+            connection->append((res) ? (message->value) : (KVMessage::ERROR_MESSAGE), 256);
+        }
+        if (KVMessage::is_request_code_INCR_DECR(requestCode)) {
+            connection->append(&number, sizeof(uint64_t));
+        } else {
+            connection->append(&version, sizeof(uint64_t));
+        }
+    } else {
+        write_status_and_payload(connection, statusCode, nullptr);
+    }
+}
+
+/* Respond to a SCAN request, refer "KVMessage::EnumSCAN"
+ * The Keys are read from "kvKeyIndex" which is shared by all the caches, so SCAN is served by the worker which
+ * received it (even in SHARED_NOTHING mode) */
+void serve_scan(KVConnection *connection, const KVMessage *message) {
+    const auto maxKeys = static_cast<uint32_t>(
+            std::clamp<uint64_t>(message->request_arg, 1, KVKeyIndex::MAX_PAGE_LEN)
+    );
+    std::vector<std::string> keys;
+    keys.reserve(maxKeys);
+    const std::string token = kvKeyIndex.scan(std::string(message->key, strnlen(message->key, 256)),
+                                              std::string(message->value, strnlen(message->value, 256)),
+                                              maxKeys, keys);
+
+    // Keys (256 bytes each, '\0' padded) followed by the token
+    const auto count = static_cast<uint32_t>(keys.size());
+    connection->append(&KVMessage::StatusCodeValueSUCCESS, sizeof(uint8_t));
+    connection->append(&count, sizeof(uint32_t));
+    std::vector<char> &out = connection->send_buffer;
+    const size_t payloadStart = out.size();
+    out.resize(payloadStart + (count + 1) * 256, '\0');
+    for (uint32_t i = 0; i < count; ++i) std::copy(keys[i].begin(), keys[i].end(), out.data() + payloadStart + i * 256);
+    std::copy(token.begin(), token.end(), out.data() + payloadStart + count * 256);
+}
+
+/* Respond to a STATS request, refer "KVMessage::EnumSTATS" */
+void serve_stats(KVConnection *connection) {
+    std::string stats = (globalReplicationPrimary != nullptr) ? globalReplicationPrimary->stats()
+                        : (globalReplicationReplica != nullptr) ? globalReplicationReplica->stats()
+                        : std::string("role=standalone");
+    stats += " keys=" + std::to_string(kvKeyIndex.size());
+    if (globalSnapshotter != nullptr) stats += " " + globalSnapshotter->stats();
+    stats += " compactions=" + std::to_string(kvPersistentStore.compactions.load());
+    stats += " store_files=" + std::to_string(kvPersistentStore.geometry().file_count());
+    stats += " " + hot_key_stats();
+    uint64_t coalescedMisses = 0;
+    for (const KVCache *kvCache: *globalKVCaches)
+        if (kvCache != nullptr) coalescedMisses += kvCache->coalescedMisses.load(std::memory_order_relaxed);
+    stats += " coalesced_misses=" + std::to_string(coalescedMisses);
+
+    char payload[256] = {};
+    std::copy_n(stats.begin(), std::min<size_t>(stats.size(), 255), payload);
+    write_status_and_payload(connection, &KVMessage::StatusCodeValueSUCCESS, payload);
+}
+
+/* Respond to a SNAPSHOT request, refer "KVMessage::EnumSNAPSHOT" and "KVSnapshotter"
+ * ASSUMED: "worker" is the calling thread and it holds its "mutex_serving_clients" */
+void serve_snapshot(KVConnection *connection, const KVMessage *message, const WorkerThreadInfo *worker) {
+    std::string result;
+    const bool res = globalSnapshotter->start(std::string(message->key, strnlen(message->key, 256)), globalKVCaches,
+                                              [worker](bool pause) { return pause_cache_writers(worker, pause); },
+                                              result);
+
+    char payload[256] = {};
+    std::copy_n(result.begin(), std::min<size_t>(result.size(), 255), payload);
+    write_status_and_payload(connection, (res) ? (&KVMessage::StatusCodeValueSUCCESS) : (&KVMessage::StatusCodeValueERROR),
+                             payload);
+}
+
+/* Serve the requests which do NOT go through the KVCache: SCAN, STATS, SNAPSHOT, and the writes sent to a replica
+ * (which are rejected, only the primary accepts writes)
+ * Returns: true if the response has been written */
+bool serve_without_cache(KVConnection *connection, KVMessage *message, const WorkerThreadInfo *worker) {
+    if (message->is_request_code_SCAN()) {
+        serve_scan(connection, message);
+        return true;
+    }
+    if (message->is_request_code_STATS()) {
+        serve_stats(connection);
+        return true;
+    }
+    if (message->is_request_code_SNAPSHOT()) {
+        serve_snapshot(connection, message, worker);
+        return true;
+    }
+    if (globalReplicationReplica != nullptr && message->is_request_write()) {
+        const uint8_t requestCode = message->status_code;
+        message->version = 0;
+        message->set_request_code_ERROR();
+        write_response(connection, requestCode, message);
+        return true;
+    }
+    return false;
+}
+
+/* Unregister the client from "epollFd" (by closing its socket) as it has disconnected */
+inline void close_client(WorkerThreadInfo *owner, KVConnection *connection) {
+    // REFER: https://stackoverflow.com/questions/8707601/is-it-necessary-to-deregister-a-socket-from-epoll-before-closing-it
+    // REFER: https://stackoverflow.com/questions/4724137/epoll-wait-receives-socket-closed-twice-read-recv-returns-0
+    const int clientFd = connection->fd;
+    log_info("FD closed: " + std::to_string(clientFd), true);
+    kvConnections.close(connection);
+    close(clientFd); // Will unregister the File Descriptor from epoll
+    --(owner->client_fds_count);
+}
+
+/* Register the client in "epollFd" again, as EPOLLONESHOT disables it once an event is reported */
+inline void rearm_client(int epollFd, int clientFd) {
+    struct epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = clientFd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, clientFd, &event);
+}
+
+void pin_worker_thread(const WorkerThreadInfo *thread_conf) {
+    if (thread_conf->cpu_id < 0) return;
+
+    // Pin before touching any memory so that the epoll instance and the stack are node local
+    if (NumaTopology::pin_current_thread_to_cpu(thread_conf->cpu_id)) {
+        log_info("Thread ID = " + std::to_string(thread_conf->thread_id) + " : pinned to CPU = "
+                 + std::to_string(thread_conf->cpu_id) + ", NUMA node = " + std::to_string(thread_conf->numa_node));
+    } else {
+        log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : failed to pin to CPU = "
+                  + std::to_string(thread_conf->cpu_id));
+    }
+}
+
+
+/*
+ * Default mode: fixed size pool of workers with work stealing
+ *
+ * Every client is registered (EPOLLONESHOT) in the epoll instance of one worker. A worker moves its ready
+ * clients to its WorkStealingDeque and serves one request of each ready client, after which the client is
+ * re-armed in the epoll instance of its owner. If a worker finds more ready clients than it can serve at
+ * once, it wakes up one idle worker using "globalStealEventFd" (registered with EPOLLEXCLUSIVE in every
+ * epoll instance) which then steals ready clients from the top of the deques of the other workers.
+ * So, the load is balanced no matter which client is busy, and the number of threads does not depend
+ * on the number of clients.
+ *
+ * Each request is served by a coroutine, refer "serve_ready_client(...)". On a cache miss, the coroutine
+ * is suspended while a thread of "globalStoragePool" accesses the Persistent Storage, and the worker serves
+ * other clients meanwhile. Once done, the coroutine is resumed by the worker which started it. So, the
+ * number of Persistent Storage accesses in progress is NOT limited to one per worker.
+ * */
+const int WORKER_MAX_EVENTS = 64;
+
+int globalStealEventFd = -1;
+std::list<WorkerThreadInfo> *global_thread_pool;
+AsyncBlockingPool *globalStoragePool;
+
+inline void notify_idle_worker() {
+    const uint64_t one = 1;
+    write(globalStealEventFd, &one, sizeof(uint64_t));
+}
+
+/* Read the requests of "client" which have been received, and respond to them one at a time (in order). The
+ * responses are written together once no complete request is left, refer "KVConnection"
+ *
+ * "worker" is the worker serving the request, which may NOT be the owner of the client (work stealing)
+ * NOTE: the arguments are taken by value as they are copied into the coroutine frame */
+DetachedTask serve_ready_client(ReadyClient client, WorkerThreadInfo *worker) {
+    KVConnection *connection = kvConnections.get(client.client_fd);
+    if (not connection->fill()) {
+        // Connection was closed
+        close_client(client.owner, connection);
+        co_return;
+    }
+
+    KVMessage message;  // part of the coroutine frame, so it stays alive while the coroutine is suspended
+    while (true) {
+        const int requestStatus = connection->next_request(&message);
+        if (requestStatus == KVConnection::Request_INCOMPLETE) break;
+        if (requestStatus == KVConnection::Request_INVALID) {
+            log_error("Thread ID = " + std::to_string(client.owner->thread_id)
+                      + " : Invalid request code = " + std::to_string(message.status_code));
+            connection->append(&KVMessage::StatusCodeValueERROR, sizeof(uint8_t));
+            continue;
+        }
+        // Only a GET may be served while this worker holds pins, refer "KVCache::cache_GET_pinned(...)"
+        if (not message.is_request_code_GET()) connection->unpin_payloads();
+        if (serve_without_cache(connection, &message, worker)) continue;
+        message.calculate_key_hash();  // This was to be done by CACHE, but CACHE is skipped
+
+        const uint8_t requestCode = message.status_code;
+        KVCache *kvCache = client.owner->get_kv_cache(&message);
+        bool res;
+        if (message.is_request_read()) {
+            // GET: on a cache HIT, the Value is sent directly from the CacheNode, refer "KVConnection::append_pinned"
+            // GETS: the Value and the version are copied, so that they are consistent with each other
+            CacheNode *cacheNode = nullptr;
+            int lookupResult;
+            if (message.is_request_code_GET()) {
+                // A hot Key is served from the read cache of this worker, refer "HotKeyCache"
+                HotKeyCache *hotKeys = worker->hot_keys.get();
+                const char *hotValue = (hotKeys != nullptr) ? hotKeys->lookup(&message, kvCache) : nullptr;
+                if (hotValue != nullptr) {
+                    write_status_and_payload(connection, &KVMessage::StatusCodeValueSUCCESS, hotValue);
+                    continue;
+                }
+                const bool sampled = (hotKeys != nullptr) && hotKeys->sample();
+                const uint64_t writeVersion = (sampled) ? kvCache->write_version(message.hash1) : 0;
+
+                lookupResult = kvCache->cache_GET_pinned(&message, &cacheNode, connection->has_pinned_payloads());
+                if (lookupResult == KVCache::Lookup_BUSY) {
+                    connection->unpin_payloads();
+                    lookupResult = kvCache->cache_GET_pinned(&message, &cacheNode, false);
+                }
+                if (lookupResult == KVCache::Lookup_HIT) {
+                    connection->append(&KVMessage::StatusCodeValueSUCCESS, sizeof(uint8_t));
+                    if (sampled) hotKeys->record(&(cacheNode->message), writeVersion);
+                    // The pin is released once the Value has been sent (or copied), refer "KVConnection::flush()"
+                    connection->append_pinned(cacheNode->message.value, 256, &(cacheNode->pin_count));
+                    continue;
+                }
+            } else {
+                lookupResult = kvCache->cache_GET_cached(&message);
+            }
+            if (lookupResult == KVCache::Lookup_MISS) {
+                // The responses ready so far are NOT held back for the Persistent Storage access, and the pins
+                // are NOT held while this coroutine is suspended
+                connection->flush_early();
+                connection->unpin_payloads();
+                // Only one of the GETs which miss on the same Key reads it, refer "KVCache::cache_GET_join(...)"
+                const CacheFillTicket ticket = co_await kvCache->cache_GET_join(&message, &(worker->resume_queue));
+                if (ticket.lookup_result == KVCache::Lookup_MISS) {
+                    res = co_await globalStoragePool->run(
+                            [&message]() { return kvPersistentStore.read_from_db(&message); },
+                            &(worker->resume_queue)
+                    );
+                    res = kvCache->cache_GET_fill(&message, res, ticket);
+                    // The Key has a TTL (it may have been written before a restart), or it has expired in the
+                    // Persistent Storage and has to be reclaimed
+                    if (message.expires_at != 0) schedule_expiry(&message);
+                } else {
+                    res = (ticket.lookup_result == KVCache::Lookup_HIT);
+                }
+            } else {
+                res = (lookupResult == KVCache::Lookup_HIT);
+            }
+        } else if (message.is_request_code_CAS() || message.is_request_code_INCR_DECR()) {
+            res = execute_update(kvCache, &message);
+        } else if (message.is_request_with_value()) {
+            // PUT or PUT_TTL
+            kvCache->cache_PUT(&message);
+            if (message.expires_at != 0) schedule_expiry(&message);
+            res = true;
+        } else {
+            // DELETE request code
+            const int lookupResult = kvCache->cache_DELETE_cached(&message);
+            if (lookupResult == KVCache::Lookup_MISS) {
+                connection->flush_early();
+                res = co_await globalStoragePool->run(
+                        [&message]() { return kvPersistentStore.delete_from_db(&message); }, &(worker->resume_queue)
+                );
+                kvCache->cache_DELETE_uncached(&message);
+            } else {
+                res = (lookupResult == KVCache::Lookup_HIT);
+            }
+        }
+
+        if (res) message.set_request_code_SUCCESS();
+        else message.set_request_code_ERROR();
+        write_response(connection, requestCode, &message);
+    }
+
+    connection->flush();
+    rearm_client(client.owner->epoll_fd, client.client_fd);
+}
 
 void *worker_thread(void *ptr) {
     auto thread_conf = static_cast<struct WorkerThreadInfo *>(ptr);
     log_info(std::string("Thread ID = ") + std::to_string(thread_conf->thread_id) + " : started");
+    pin_worker_thread(thread_conf);
 
-    /* Creating epoll instance */
-    int epollfd;
-    epollfd = epoll_create1(0);
-    if (epollfd < -1) {
-        log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : Failed to create epoll instance...");
-        thread_conf->client_fds_count = -1;
+    const int epollfd = thread_conf->epoll_fd;
+    struct epoll_event events[WORKER_MAX_EVENTS];
+
+    // EPOLLEXCLUSIVE: only one of the idle workers is woken up for each steal request
+    events[0].events = EPOLLIN | EPOLLEXCLUSIVE;
+    events[0].data.fd = globalStealEventFd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, globalStealEventFd, &events[0])) {
+        log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : epoll ctl failed...");
         return nullptr;
     }
 
-    /* Creating necessary fd in epoll */
-    int event_count;
-    struct epoll_event events[global_server_config->clients_per_thread];
+    const int resumeEventFd = thread_conf->resume_queue.event_fd;
+    events[0].events = EPOLLIN;
+    events[0].data.fd = resumeEventFd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, resumeEventFd, &events[0])) {
+        log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : epoll ctl failed...");
+        return nullptr;
+    }
 
-    struct KVMessage message;
+    int event_count;
+    ReadyClient client{};
 
     while (true) {
         // Use epoll and serve clients using KVCache/KVStore
         // REFER: https://suchprogramming.com/epoll-in-3-easy-steps/
         // REFER: https://stackoverflow.com/questions/46591671/epoll-wait-events-buffer-reset
-        // log_info("Calling \"epoll\"");
-        event_count = epoll_wait(epollfd, events, global_server_config->clients_per_thread, 3000);
+        event_count = epoll_wait(epollfd, events, WORKER_MAX_EVENTS, 3000);
+
+        bool stealRequested = false, resumeRequested = false;
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].data.fd == globalStealEventFd) {
+                uint64_t counter;
+                read(globalStealEventFd, &counter, sizeof(uint64_t));
+                stealRequested = true;
+                continue;
+            }
+            if (events[i].data.fd == resumeEventFd) {
+                resumeRequested = true;  // handled by "resume_all()" below
+                continue;
+            }
+            // NOTE: EPOLLERR and EPOLLHUP are also served, "read(...)" fails and the client is closed
+            thread_conf->ready_clients.push_bottom({events[i].data.fd, thread_conf});
+        }
+
+        // Ask one idle worker to help if more than one client is waiting
+        if (thread_conf->ready_clients.size() > 1) notify_idle_worker();
 
         thread_conf->mutex_serving_clients.lock();
-        if (event_count != -1) {
-            for (int i = 0; i < event_count; i++) {
-                // REFER: https://stackoverflow.com/questions/52976152/tcp-when-is-epollhup-generated
-                if (events[i].events & EPOLLERR || events[i].events & EPOLLHUP || (!(events[i].events & EPOLLIN))) {
-                    log_error(std::string() + "cerr: Epoll event error = \"" + std::to_string(events[i].events) + "\"");
-                    // close(events[i].data.fd);
-                    break;
-                }
 
-                // REFER: https://stackoverflow.com/questions/12340695/how-to-check-if-a-given-file-descriptor-stored-in-a-variable-is-still-valid
-                int bytesRead = read(events[i].data.fd, reinterpret_cast<void *>(&message.status_code),
-                                     sizeof(uint8_t));
-
-                if (bytesRead == 0) {
-                    // Connection was closed
-                    // REFER: https://stackoverflow.com/questions/8707601/is-it-necessary-to-deregister-a-socket-from-epoll-before-closing-it
-                    // REFER: https://stackoverflow.com/questions/4724137/epoll-wait-receives-socket-closed-twice-read-recv-returns-0
-                    log_info("FD closed: " + std::to_string(events[i].data.fd), true);
-                    close(events[i].data.fd); // Will unregister the File Descriptor from epoll
-                    --(thread_conf->client_fds_count);
-                    continue;
-                }
-                if (not message.is_request_code_valid()) {
-                    log_error("Thread ID = " + std::to_string(thread_conf->thread_id)
-                              + " : Invalid request code = " + std::to_string(message.status_code));
-                    write(events[i].data.fd, reinterpret_cast<const void *>(&KVMessage::StatusCodeValueERROR),
-                          sizeof(uint8_t));
-                    continue;
+        // Finish the requests whose Persistent Storage access is done before starting new ones
+        if (resumeRequested) thread_conf->resume_queue.resume_all();
+
+        while (thread_conf->ready_clients.pop_bottom(client)) {
+            serve_ready_client(client, thread_conf);
+        }
+
+        // Steal one ready client at a time from each of the other workers, till all of them are empty
+        bool stolen = stealRequested;
+        while (stolen) {
+            stolen = false;
+            for (auto &worker: *global_thread_pool) {
+                if (&worker == thread_conf) continue;
+                if (worker.ready_clients.steal_top(client)) {
+                    serve_ready_client(client, thread_conf);
+                    stolen = true;
                 }
+            }
+        }
+        thread_conf->mutex_serving_clients.unlock();
 
-                read(events[i].data.fd, reinterpret_cast<void *>(message.key), 256);
-                message.calculate_key_hash();  // This was to be done by CACHE, but CACHE is skipped
-                if (message.is_request_code_GET()) {
-                    // TODO: verify cache
-                    // bool res = kvPersistentStore.read_from_db(&message);
-                    bool res = thread_conf->kv_cache->cache_GET(&message);
-                    write(
-                            events[i].data.fd,
-                            reinterpret_cast<const void *>(
-                                    (res) ? (&KVMessage::StatusCodeValueSUCCESS)
-                                          : (&KVMessage::StatusCodeValueERROR)
-                            ),
-                            sizeof(uint8_t)
-                    );
-                    write(
-                            events[i].data.fd,
-                            reinterpret_cast<const void *>(
-                                    (res) ? (message.value) : (KVMessage::ERROR_MESSAGE)
-                            ),
-                            256
-                    );
-                } else if (message.is_request_code_PUT()) {
-                    read(events[i].data.fd, reinterpret_cast<void *>(message.value), 256);
-                    // TODO: verify cache
-                    // kvPersistentStore.write_to_db(&message);
-                    thread_conf->kv_cache->cache_PUT(&message);
-                    write(
-                            events[i].data.fd,
-                            reinterpret_cast<const void *>(&KVMessage::StatusCodeValueSUCCESS),
-                            sizeof(uint8_t)
-                    );
+        // break;  // This is only to be used for testing/debugging
+    }
+
+    // return nullptr;  // can modify this to return something else
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/*
+ * SHARED_NOTHING mode (thread-per-core)
+ *
+ * Every worker thread owns a shard of the Keys: its own KVCache, MemoryPool<KVMessage> and the KVStore
+ * files "(file_idx % hash_table_len) % n == worker_idx" (refer "KVStoreGeometry", a file and the files split
+ * from it have the same owner). A worker which reads a request
+ * for a Key owned by some other worker forwards it through a lock-free SPSC queue, the owner performs
+ * it on its own shard and sends it back through another SPSC queue. So, no two workers ever touch the
+ * same KVCache or the same KVStore file.
+ *
+ * Client sockets are registered with EPOLLONESHOT, and the requests received from a client are served one at
+ * a time till one of them is forwarded. The rest are served once its response is back, and the socket is NOT
+ * read again till then. This keeps the responses in the same order as the requests.
+ * */
+
+/* Sent to the owner of the Key with "is_response = false", and sent back to "origin" with
+ * "is_response = true" and the result of the request in "message->status_code" */
+struct ForwardedRequest {
+    KVMessage *message;  // acquired from the MemoryPool of "origin", and only "origin" releases it
+    int client_fd;
+    uint8_t request_code;
+    uint32_t origin;  // index of the worker which is serving "client_fd"
+    bool is_response;
+};
+
+struct SharedNothingRouter {
+    static constexpr uint64_t QUEUE_LEN = 4096;
+
+    uint32_t n;
+
+    // queues.at(from * n + to) is the SPSC queue from worker "from" to worker "to"
+    std::vector<std::unique_ptr<SPSCQueue<ForwardedRequest>>> queues;
+
+    // event_fds.at(i) is part of the epoll instance of worker "i", used to wake it up
+    std::vector<int> event_fds;
+
+    SharedNothingRouter() : n{0}, queues(), event_fds() {}
+
+    void init(uint32_t workerCount) {
+        n = workerCount;
+        queues.resize(n * n);
+        for (auto &i: queues) i = std::make_unique<SPSCQueue<ForwardedRequest>>(QUEUE_LEN);
+
+        event_fds.resize(n);
+        for (auto &i: event_fds) {
+            i = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (i < 0) {
+                log_error("EVENTFD creation failed...");
+                log_error("Exiting (status=65)");
+                exit(65);
+            }
+        }
+    }
+
+    inline SPSCQueue<ForwardedRequest> &get_queue(uint32_t from, uint32_t to) {
+        return *queues.at(from * n + to);
+    }
+
+    /* ASSUMED: message->calculate_key_hash() has been called
+     * Returns: index of the worker which owns the Key of "message" */
+    [[nodiscard]] inline uint32_t get_owner(const KVMessage *message) const {
+        return (message->hash1 % kvPersistentStore.geometry().hash_table_len) % n;
+    }
+
+    inline void notify(uint32_t to) const {
+        const uint64_t one = 1;
+        write(event_fds.at(to), &one, sizeof(uint64_t));
+    }
+};
+
+SharedNothingRouter *globalRouter;
+
+void *worker_thread_per_core(void *ptr) {
+    auto thread_conf = static_cast<struct WorkerThreadInfo *>(ptr);
+    const uint32_t coreIdx = thread_conf->thread_id - 1, coreCount = globalRouter->n;
+    log_info(std::string("Thread ID = ") + std::to_string(thread_conf->thread_id) + " : started (per core)");
+    pin_worker_thread(thread_conf);
+
+    const int epollfd = thread_conf->epoll_fd;
+    struct epoll_event events[WORKER_MAX_EVENTS];
+    struct epoll_event event{};
+
+    const int eventFd = globalRouter->event_fds.at(coreIdx);
+    event.events = EPOLLIN;
+    event.data.fd = eventFd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, eventFd, &event)) {
+        log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : epoll ctl failed...");
+        return nullptr;
+    }
+
+    // The shard is allocated by this thread so that it is in the memory of the NUMA node of this thread
+    MemoryPool<KVMessage> messagePool(true);
+    messagePool.init(1024, 2);
+    thread_conf->mutex_serving_clients.lock();
+    thread_conf->owned_kv_cache = std::make_unique<KVCache>(
+            std::max(1U, static_cast<uint32_t>(global_server_config->cache_size) / coreCount)
+    );
+    thread_conf->kv_caches->at(coreIdx) = thread_conf->owned_kv_cache.get();
+    thread_conf->mutex_serving_clients.unlock();
+    KVCache *kvCache = thread_conf->owned_kv_cache.get();
+
+    // Messages which did not fit in the SPSC queue of the destination, they are retried in every iteration
+    std::vector<std::deque<ForwardedRequest>> pendingOut(coreCount);
+    // Each destination is woken up only once per iteration
+    std::vector<bool> notifyCore(coreCount, false);
+
+    auto send_to_core = [&](uint32_t core, const ForwardedRequest &fr) {
+        if (pendingOut[core].empty() && globalRouter->get_queue(coreIdx, core).push(fr)) notifyCore[core] = true;
+        else pendingOut[core].push_back(fr);
+    };
+    // Serve the requests received from the client till one of them is forwarded to its owner, the rest are served
+    // by "reply_to_client(...)" once its response is back
+    auto serve_received_requests = [&](KVConnection *connection) {
+        while (true) {
+            KVMessage *message = messagePool.acquire_instance();
+            const int requestStatus = connection->next_request(message);
+            if (requestStatus == KVConnection::Request_INCOMPLETE) {
+                messagePool.release_instance(message);
+                break;
+            }
+            if (requestStatus == KVConnection::Request_INVALID) {
+                log_error("Thread ID = " + std::to_string(thread_conf->thread_id)
+                          + " : Invalid request code = " + std::to_string(message->status_code));
+                connection->append(&KVMessage::StatusCodeValueERROR, sizeof(uint8_t));
+                messagePool.release_instance(message);
+                continue;
+            }
+            if (serve_without_cache(connection, message, thread_conf)) {
+                messagePool.release_instance(message);
+                continue;
+            }
+            message->calculate_key_hash();
+
+            const uint8_t requestCode = message->status_code;
+            const uint32_t owner = globalRouter->get_owner(message);
+            if (owner != coreIdx) {
+                connection->flush_early();
+                send_to_core(owner, {message, connection->fd, requestCode, coreIdx, false});
+                return;
+            }
+            execute_request(kvCache, message);
+            write_response(connection, requestCode, message);
+            messagePool.release_instance(message);
+        }
+        connection->flush();
+        rearm_client(epollfd, connection->fd);
+    };
+    auto reply_to_client = [&](int clientFd, uint8_t requestCode, KVMessage *message) {
+        KVConnection *connection = kvConnections.get(clientFd);
+        write_response(connection, requestCode, message);
+        messagePool.release_instance(message);
+        serve_received_requests(connection);
+    };
+
+    int event_count;
+    ForwardedRequest fr{};
+    while (true) {
+        bool pendingExists = false;
+        for (auto &i: pendingOut) pendingExists = pendingExists || (not i.empty());
+        event_count = epoll_wait(epollfd, events, WORKER_MAX_EVENTS, (pendingExists) ? 1 : 3000);
+
+        thread_conf->mutex_serving_clients.lock();
+        for (int i = 0; i < event_count; i++) {
+            const int clientFd = events[i].data.fd;
+            if (clientFd == eventFd) {
+                // Other workers have sent messages, they are processed below
+                uint64_t counter;
+                read(eventFd, &counter, sizeof(uint64_t));
+                continue;
+            }
+
+            KVConnection *connection = kvConnections.get(clientFd);
+            if (events[i].events & EPOLLERR || events[i].events & EPOLLHUP || (!(events[i].events & EPOLLIN))) {
+                log_error(std::string() + "cerr: Epoll event error = \"" + std::to_string(events[i].events) + "\"");
+                close_client(thread_conf, connection);
+                continue;
+            }
+            if (not connection->fill()) {
+                // Connection was closed
+                close_client(thread_conf, connection);
+                continue;
+            }
+            serve_received_requests(connection);
+        }
+
+        // Serve the requests forwarded by other workers, and reply to the clients whose requests were forwarded
+        for (uint32_t src = 0; src < coreCount; ++src) {
+            if (src == coreIdx) continue;
+            SPSCQueue<ForwardedRequest> &queue = globalRouter->get_queue(src, coreIdx);
+            while (queue.pop(fr)) {
+                if (fr.is_response) {
+                    reply_to_client(fr.client_fd, fr.request_code, fr.message);
                 } else {
-                    // DELETE request code
-                    // TODO: verify cache
-                    // bool res = kvPersistentStore.delete_from_db(&message);
-                    bool res = thread_conf->kv_cache->cache_DELETE(&message);
-                    write(
-                            events[i].data.fd,
-                            reinterpret_cast<const void *>(
-                                    (res) ? (&KVMessage::StatusCodeValueSUCCESS)
-                                          : (&KVMessage::StatusCodeValueERROR)
-                            ),
-                            sizeof(uint8_t)
-                    );
-                    if (not res) {
-                        write(
-                                events[i].data.fd,
-                                reinterpret_cast<const void *>(KVMessage::ERROR_MESSAGE),
-                                256
-                        );
-                    }
+                    execute_request(kvCache, fr.message);
+                    fr.is_response = true;
+                    send_to_core(fr.origin, fr);
                 }
             }
         }
+
+        for (uint32_t core = 0; core < coreCount; ++core) {
+            while ((not pendingOut[core].empty()) && globalRouter->get_queue(coreIdx, core).push(pendingOut[core].front())) {
+                pendingOut[core].pop_front();
+                notifyCore[core] = true;
+            }
+            if (notifyCore[core]) {
+                globalRouter->notify(core);
+                notifyCore[core] = false;
+            }
+        }
         thread_conf->mutex_serving_clients.unlock();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/* Returns: the cache (NUMA partition or SHARED_NOTHING shard) which owns the Key of "message",
+ *          nullptr if the shard has not been created yet
+ * ASSUMED: message->calculate_key_hash() has been called */
+KVCache *get_owner_kv_cache(const KVMessage *message) {
+    if (globalRouter != nullptr) return globalKVCaches->at(globalRouter->get_owner(message));
+    return globalKVCaches->at(message->hash2 % globalKVCaches->size());
+}
+
+/*
+ * Reclaims the Keys whose TTL has expired, refer "KVMessage::EnumPUT_TTL"
+ *
+ * Each Key with a TTL is scheduled in a HierarchicalTimingWheel when it is written (or read from the Persistent
+ * Storage). The reaper thread advances the wheel once every tick and reclaims the expired Keys in batches using
+ * "KVCache::cache_EXPIRE(...)", which skips the Keys that were written again meanwhile. So, the cache is never
+ * scanned for expired Keys. Before the reaper gets to them, expired Keys are hidden from GET/DELETE lazily.
+ * */
+struct ExpiryReaper {
+    static constexpr uint64_t TICK_MS = 100;
+    static constexpr size_t BATCH_LEN = 1024;
+
+    std::mutex mutex_wheel;
+    HierarchicalTimingWheel<std::string> wheel;
+
+    // Held while reclaiming a batch, the signal handler acquires it to stop the reaper
+    std::mutex mutex_reaping;
+
+    ExpiryReaper() : mutex_wheel(), wheel(), mutex_reaping() {}
+
+    void start() {
+        wheel.init(TICK_MS, KVMessage::current_time_ms());
+        std::thread([this]() { reaper_loop(); }).detach();  // the server exits using "exit(...)"
+    }
+
+    /* ASSUMED: message->expires_at != 0 */
+    void schedule(const KVMessage *message) {
+        // Only the Key is kept, without its '\0' padding
+        size_t keyLen = 256;
+        while (keyLen > 0 && message->key[keyLen - 1] == '\0') --keyLen;
 
-        thread_conf->mutex_new_client_fds.lock();
-        if (!(thread_conf->client_fds_new).empty()) {
-            // New clients have been assigned to this thread by the Main Thread
-            for (uint32_t i = 0; i < (thread_conf->client_fds_new).size(); ++i) {
-                events[0].events = EPOLLIN;
-                events[0].data.fd = thread_conf->client_fds_new.at(i);
-                if (epoll_ctl(epollfd, EPOLL_CTL_ADD, thread_conf->client_fds_new.at(i),
-                              &events[0])) {
-                    log_error("Thread ID = " + std::to_string(thread_conf->thread_id) + " : epoll ctl failed...");
-                    return nullptr;
+        std::lock_guard lock(mutex_wheel);
+        wheel.add(std::string(message->key, keyLen), message->expires_at);
+    }
+
+private:
+    void reaper_loop() {
+        // SIGINT must be handled by some other thread, as the handler waits for "mutex_reaping"
+        sigset_t signalSet;
+        sigemptyset(&signalSet);
+        sigaddset(&signalSet, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signalSet, nullptr);
+
+        std::vector<std::string> expiredKeys;
+        KVMessage message;
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TICK_MS));
+
+            expiredKeys.clear();
+            mutex_wheel.lock();
+            wheel.advance(KVMessage::current_time_ms(), expiredKeys);
+            mutex_wheel.unlock();
+            if (expiredKeys.empty()) continue;
+            log_info("ExpiryReaper: Keys to reclaim = " + std::to_string(expiredKeys.size()));
+
+            for (size_t i = 0; i < expiredKeys.size(); ++i) {
+                if (i % BATCH_LEN == 0) {
+                    if (i != 0) mutex_reaping.unlock();
+                    mutex_reaping.lock();
                 }
-                // thread_conf->client_fds.push_back(thread_conf->client_fds_new.at(i));
-                ++(thread_conf->client_fds_count);
+                char key[256] = {};
+                std::copy(expiredKeys[i].begin(), expiredKeys[i].end(), key);
+                message.set_key_fast(key);
+                message.calculate_key_hash();
 
+                KVCache *kvCache = get_owner_kv_cache(&message);
+                if (kvCache != nullptr) kvCache->cache_EXPIRE(&message);
             }
-            thread_conf->client_fds_new.clear();
+            mutex_reaping.unlock();
         }
-        thread_conf->mutex_new_client_fds.unlock();
-
-        // break;  // This is only to be used for testing/debugging
     }
+};
 
-    // return nullptr;  // can modify this to return something else
+ExpiryReaper *globalExpiryReaper;
+
+void schedule_expiry(const KVMessage *message) {
+    globalExpiryReaper->schedule(message);
 }
 
+/*
+ * Background maintenance of the files of the Persistent Storage
+ *
+ * Splitting: while there are more Keys than "split_load_percent" % of the slots of all the files, the files are
+ * split one at a time, so the lists stay short as the Persistent Storage grows, refer
+ * "KVStore::split_file_if_required(...)". This is checked every "TICK_MS".
+ *
+ * Compaction: a DELETE only adds the freed overflow entry to the free list of its file, and the next write to the
+ * file reuses it, so a file does not grow under a steady mix of PUTs and DELETEs. But after many DELETEs, the lists
+ * are spread over a file which is larger than needed. Every "compaction_interval_ms", the files are checked one at a
+ * time, and each file with at least "compaction_min_free" free entries (and at least 1/4th of its overflow entries
+ * free) is rewritten, refer "KVStore::compact_file(...)"
+ * */
+struct StorageMaintainer {
+    static constexpr uint64_t TICK_MS = 100;
+
+    // Held while splitting or compacting a file, the signal handler acquires it to stop the maintainer
+    std::mutex mutex_maintaining;
+
+    StorageMaintainer() : mutex_maintaining() {}
+
+    void start(uint64_t splitLoadPercent, uint64_t compactionIntervalMs, uint64_t compactionMinFree) {
+        if (splitLoadPercent == 0 && compactionIntervalMs == 0) return;
+        std::thread([this, splitLoadPercent, compactionIntervalMs, compactionMinFree]() {
+            maintainer_loop(splitLoadPercent, compactionIntervalMs, compactionMinFree);
+        }).detach();
+    }
+
+private:
+    void maintainer_loop(uint64_t splitLoadPercent, uint64_t compactionIntervalMs, uint64_t compactionMinFree) {
+        // SIGINT must be handled by some other thread, as the handler waits for "mutex_maintaining"
+        sigset_t signalSet;
+        sigemptyset(&signalSet);
+        sigaddset(&signalSet, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signalSet, nullptr);
+
+        uint64_t sinceCompactionMs = 0;
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TICK_MS));
+            while (true) {
+                std::lock_guard lock(mutex_maintaining);
+                if (not kvPersistentStore.split_file_if_required(kvKeyIndex.size(), splitLoadPercent)) break;
+                log_info("StorageMaintainer: files = " + std::to_string(kvPersistentStore.geometry().file_count()));
+            }
+
+            sinceCompactionMs += TICK_MS;
+            if (compactionIntervalMs == 0 || sinceCompactionMs < compactionIntervalMs) continue;
+            sinceCompactionMs = 0;
+            for (uint64_t fileIdx = 0; fileIdx < kvPersistentStore.geometry().file_count(); ++fileIdx) {
+                if (not kvPersistentStore.needs_compaction(fileIdx, compactionMinFree)) continue;
+                std::lock_guard lock(mutex_maintaining);
+                if (kvPersistentStore.compact_file(fileIdx))
+                    log_info("StorageMaintainer: compacted file = " + std::to_string(fileIdx));
+            }
+        }
+    }
+};
+
+StorageMaintainer *globalStorageMaintainer;
+
 // ---------------------------------------------------------------------------------------------------------------------
 
-std::list<WorkerThreadInfo> *global_thread_pool;
+/* Primary: read the current state of a Key for the full sync of a replica, refer "ReplicationPrimary"
+ * Returns: false if the Key does NOT exist */
+bool replication_read_key(KVMessage *message) {
+    message->calculate_key_hash();
+    KVCache *kvCache = get_owner_kv_cache(message);
+    const int lookupResult = (kvCache != nullptr) ? kvCache->cache_GET_cached(message, &(message->expires_at))
+                                                  : KVCache::Lookup_MISS;
+    if (lookupResult == KVCache::Lookup_HIT) return true;
+    // NOTE: the Persistent Storage is NOT brought in the cache, so that a full sync does not evict the hot Keys
+    return lookupResult == KVCache::Lookup_MISS && kvPersistentStore.read_from_db(message);
+}
+
+/* Replica: apply one write received from the primary, refer "ReplicationReplica" */
+void replication_apply(uint8_t op, KVMessage *message) {
+    message->calculate_key_hash();
+    KVCache *kvCache;
+    // SHARED_NOTHING mode: the shard is created by its worker, once it starts
+    while ((kvCache = get_owner_kv_cache(message)) == nullptr) std::this_thread::yield();
+
+    if (op == ReplicationFrame::OpPUT) {
+        kvCache->cache_PUT(message, message->version);
+        if (message->expires_at != 0) schedule_expiry(message);
+    } else {
+        kvCache->cache_DELETE(message);
+    }
+}
+
+// Held while the threads are paused by "pause_cache_writers(...)". The signal handler acquires it before the locks
+// of the threads, so that the signal handler and a worker pausing the others never wait for each other
+std::mutex globalPausingMutex;
+
+/* Stop (pause = true) or resume (pause = false) all the threads, other than the worker "self" (which must be
+ * the calling thread), which modify the KVCache, refer "KVSnapshotter"
+ * Returns: false if they can NOT be paused as the server is closing */
+bool pause_cache_writers(const WorkerThreadInfo *self, bool pause) {
+    if (pause && (not globalPausingMutex.try_lock())) return false;
+    for (auto &i: *global_thread_pool) {
+        if (&i == self) continue;
+        if (pause) i.mutex_serving_clients.lock();
+        else i.mutex_serving_clients.unlock();
+    }
+    if (globalExpiryReaper != nullptr) {
+        if (pause) globalExpiryReaper->mutex_reaping.lock();
+        else globalExpiryReaper->mutex_reaping.unlock();
+    }
+    if (globalReplicationReplica != nullptr) {
+        if (pause) globalReplicationReplica->mutex_applying.lock();
+        else globalReplicationReplica->mutex_applying.unlock();
+    }
+    if (not pause) globalPausingMutex.unlock();
+    return true;
+}
+
+/* Returns: text for the STATS request, the hot Keys copied by the workers and the GETs served from the copies */
+std::string hot_key_stats() {
+    uint64_t cachedKeys = 0, hits = 0;
+    for (auto &i: *global_thread_pool) {
+        if (i.hot_keys == nullptr) continue;
+        cachedKeys += i.hot_keys->cached_keys.load(std::memory_order_relaxed);
+        hits += i.hot_keys->hits.load(std::memory_order_relaxed);
+    }
+    return "hot_keys=" + std::to_string(cachedKeys) + " hot_key_hits=" + std::to_string(hits);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
 
 void main_thread() {
     log_info("+ Server initialization started...");
@@ -281,38 +1146,155 @@ void main_thread() {
     ServerConfig serverConfig{};
     serverConfig.read_server_config();
     global_server_config = &serverConfig;
+    if (serverConfig.thread_pool_size_initial <= 0)
+        serverConfig.thread_pool_size_initial = static_cast<int32_t>(std::max(1U, std::thread::hardware_concurrency()));
 
     log_info("    [2/3] Initializing memory pool");
     MemoryPool<KVMessage> memPoolKVMessage(true);
     memPoolKVMessage.init(
-            serverConfig.thread_pool_size_initial * serverConfig.clients_per_thread,
+            serverConfig.thread_pool_size_initial,
             2
     );
+    // Receive/send buffers of the clients, refer KVConnection.hpp
+    kvConnections.init(serverConfig.tcp_nodelay != 0, serverConfig.response_cork != 0);
 
     log_info("    [3/4] Initializing Persistent Storage (Hard disk) helpers");
+    kvPersistentStore.set_value_compression(serverConfig.value_compression,
+                                            static_cast<uint32_t>(std::max(0, serverConfig.value_compression_min_len)));
+    kvPersistentStore.set_geometry(static_cast<uint64_t>(std::max(1, serverConfig.store_hash_table_len)),
+                                   static_cast<uint64_t>(std::max(1, serverConfig.store_file_table_len)),
+                                   static_cast<uint64_t>(std::max(1, serverConfig.store_max_hash_table_len)));
     kvPersistentStore.init_kvstore();  // This is present in KVStore.hpp
+    // Loaded, or rebuilt while verifying (and repairing) the Persistent Storage, refer KVKeyIndex.hpp
+    kvKeyIndex.init((serverConfig.startup_scan_threads > 0) ? static_cast<uint32_t>(serverConfig.startup_scan_threads)
+                                                            : std::thread::hardware_concurrency(),
+                    serverConfig.startup_verify != 0);
+    if (serverConfig.replication_port > 0 && (not serverConfig.replica_of.empty())) {
+        log_error("REPLICATION_PORT and REPLICA_OF can NOT be used together, chained replication is NOT supported");
+        log_error("Exiting (status=69)");
+        exit(69);
+    }
+    if (serverConfig.replication_port > 0)
+        kvReplicationLog.init(static_cast<uint64_t>(std::max(0, serverConfig.replication_log_size)));
 
     log_info("    [4/4] Initializing Cache");
-    KVCache kvCache(serverConfig.cache_size);
-    globalKVCache = &kvCache;
+    NumaTopology numaTopology;
+    const bool pinWorkers = serverConfig.numa_aware || serverConfig.shared_nothing;
+    if (pinWorkers) numaTopology.init();
+    const uint32_t numaNodeCount = (pinWorkers) ? numaTopology.node_count() : 1;
+
+    // In SHARED_NOTHING mode there is one cache shard per worker and each worker creates its own
+    // shard, refer "worker_thread_per_core(...)"
+    SharedNothingRouter router;
+    if (serverConfig.shared_nothing) {
+        router.init(serverConfig.thread_pool_size_initial);
+        globalRouter = &router;
+    }
+    const uint32_t cachePartitionCount = (serverConfig.shared_nothing) ? router.n : numaNodeCount;
+
+    // Each partition is constructed by a thread pinned to its NUMA node, so that the Hash Table and the
+    // MemoryPool<CacheNode> of the partition are placed in the memory of that node (first touch policy)
+    std::vector<std::unique_ptr<KVCache>> kvCachePartitions(cachePartitionCount);
+    std::vector<KVCache *> kvCaches(cachePartitionCount, nullptr);
+    if (not serverConfig.shared_nothing) {
+        std::vector<std::thread> initThreads;
+        for (uint32_t node = 0; node < cachePartitionCount; ++node) {
+            initThreads.emplace_back([&, node]() {
+                if (serverConfig.numa_aware) numaTopology.pin_current_thread_to_node(node);
+                kvCachePartitions.at(node) = std::make_unique<KVCache>(
+                        std::max(1U, static_cast<uint32_t>(serverConfig.cache_size) / cachePartitionCount)
+                );
+                kvCaches.at(node) = kvCachePartitions.at(node).get();
+            });
+        }
+        for (auto &i: initThreads) i.join();
+    }
+    globalKVCaches = &kvCaches;
+    if (pinWorkers) {
+        log_info("        NUMA nodes = " + std::to_string(numaNodeCount)
+                 + ", cache partitions = " + std::to_string(cachePartitionCount));
+    }
+
+    // Workers are spread across the NUMA nodes in Round Robin fashion, and so are the clients
+    // as the Main Thread assigns them to the workers in Round Robin fashion
+    auto new_worker = [&](std::list<WorkerThreadInfo> &threadPool) -> WorkerThreadInfo & {
+        const uint32_t threadId = threadPool.size() + 1;
+        int32_t numaNode = 0, cpuId = -1;
+        if (pinWorkers) {
+            numaNode = static_cast<int32_t>((threadId - 1) % numaNodeCount);
+            cpuId = numaTopology.get_cpu(numaNode, (threadId - 1) / numaNodeCount);
+        }
+        threadPool.emplace_back(&memPoolKVMessage, &kvCaches, threadId, numaNode, cpuId);
+        if (threadPool.back().epoll_fd < 0) {
+            log_error("Thread ID = " + std::to_string(threadId) + " : Failed to create epoll instance...");
+            log_error("Exiting (status=66)");
+            exit(66);
+        }
+        if (serverConfig.hot_key_cache_size > 0 && (not serverConfig.shared_nothing)) {
+            threadPool.back().hot_keys = std::make_unique<HotKeyCache>(
+                    static_cast<uint32_t>(serverConfig.hot_key_cache_size),
+                    static_cast<uint32_t>(std::max(1, serverConfig.hot_key_sample_period))
+            );
+        }
+        return threadPool.back();
+    };
 
     log_info("Server initialization finished :)", false, true);
 
     // ----------------------------------------------------
 
+    // NOTE: not a global object, as destroying it at "exit(...)" would block on the
+    //       condition variable which its threads are waiting on
+    AsyncBlockingPool storagePool;
+    globalStoragePool = &storagePool;
+
+    // NOTE: not a global object for the same reason as "storagePool"
+    ExpiryReaper expiryReaper;
+    globalExpiryReaper = &expiryReaper;
+    expiryReaper.start();
+
+    // NOTE: not a global object for the same reason as "storagePool"
+    StorageMaintainer storageMaintainer;
+    globalStorageMaintainer = &storageMaintainer;
+    storageMaintainer.start(std::max(0, serverConfig.store_split_load_percent),
+                            std::max(0, serverConfig.compaction_interval_ms),
+                            std::max(1, serverConfig.compaction_min_free));
+    if (not serverConfig.shared_nothing) {
+        storagePool.init(std::max(1, serverConfig.storage_thread_pool_size));
+        globalStealEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (globalStealEventFd < 0) {
+            log_error("EVENTFD creation failed...");
+            log_error("Exiting (status=65)");
+            exit(65);
+        }
+    }
+
     // Create "serverConfig.thread_pool_size_initial" threads
     // REFER: https://stackoverflow.com/questions/16465633/how-can-i-use-something-like-stdvectorstdmutex
     std::list<WorkerThreadInfo> thread_pool;
-    // thread_pool.reserve(serverConfig.thread_pool_size_initial);
     global_thread_pool = &thread_pool;
 
-    for (int32_t i = 0; i < serverConfig.thread_pool_size_initial; ++i) {
-        // WorkerThreadInfo worker(serverConfig.clients_per_thread, &memPoolKVMessage, &kvCache, i + 1);
-        // thread_pool.push_back(worker);
-        thread_pool.emplace_back(serverConfig.clients_per_thread, &memPoolKVMessage, &kvCache, i + 1);
-        thread_pool.rbegin()->start_thread();
+    // The pool has a fixed size, and all workers are created before starting any, as the
+    // workers iterate over "thread_pool" to steal work from each other
+    for (int32_t i = 0; i < serverConfig.thread_pool_size_initial; ++i) new_worker(thread_pool);
+    for (auto &worker: thread_pool) worker.start_thread(serverConfig.shared_nothing);
+
+    // NOTE: not global objects for the same reason as "storagePool"
+    ReplicationPrimary replicationPrimary;
+    ReplicationReplica replicationReplica;
+    if (serverConfig.replication_port > 0) {
+        replicationPrimary.start(serverConfig.replication_port, replication_read_key);
+        globalReplicationPrimary = &replicationPrimary;
+    } else if (not serverConfig.replica_of.empty()) {
+        replicationReplica.start(serverConfig.replica_of, replication_apply);
+        globalReplicationReplica = &replicationReplica;
+        log_info("Replication: replica of " + serverConfig.replica_of + ", writes of the clients are rejected");
     }
 
+    // NOTE: not a global object for the same reason as "storagePool"
+    KVSnapshotter snapshotter;
+    globalSnapshotter = &snapshotter;
+
     // REFER: https://stackoverflow.com/questions/16486361/creating-a-basic-c-c-tcp-socket-writer
     // Setup a listening socket on a port specified in the config file
 
@@ -346,75 +1328,69 @@ void main_thread() {
         exit(64);
     }
 
-    // rr_iter - is used just like "i" in a for loop only
-    size_t rr_iter;
-    int rr_success;
+    // The clients on the same host skip the loopback TCP/IP stack, refer KVLocalSocket.hpp
+    // NOTE: the TCP port has been bound above, so no other KVServer is using the path of the Unix domain socket
+    int unixSockfd = -1;
+    if (serverConfig.unix_socket) {
+        unixSockfd = local_socket::listen_on(serverConfig.listening_port, serverConfig.socket_listen_n_limit);
+        if (unixSockfd < 0) {
+            log_error("Unix domain socket \"" + local_socket::path_of(serverConfig.listening_port)
+                      + "\" failed, only TCP is used: " + strerror(errno));
+        } else {
+            globalUnixSocketPath = local_socket::path_of(serverConfig.listening_port);
+        }
+    }
 
+    struct pollfd listeners[2] = {{sockfd, POLLIN, 0}, {unixSockfd, POLLIN, 0}};  // a negative fd is ignored
     struct sockaddr_in client_addr{};
     unsigned int client_len;
     int client_fd_new;
+    struct epoll_event event{};
 
-    log_success("Server waiting for clients 😃 on port number = " + std::to_string(serverConfig.listening_port),
-                true, true);
+    log_success("Server waiting for clients 😃 on port number = " + std::to_string(serverConfig.listening_port)
+                + ((unixSockfd < 0) ? "" : " and \"" + globalUnixSocketPath + "\""), true, true);
 
     auto listIter = thread_pool.begin();
     while (true) {
-        // Perform accept() on the listening socket and pass each established connection
+        // Perform accept() on the listening sockets and pass each established connection
         // to one of the "thread_pool.n" threads using Round Robin fashion
+        if (poll(listeners, 2, -1) <= 0) continue;
+        const int listenerFd = (listeners[0].revents & POLLIN) ? sockfd : unixSockfd;
         client_len = sizeof(client_addr);
-        client_fd_new = accept(sockfd, reinterpret_cast<struct sockaddr *>(&client_addr), &client_len);
+        client_fd_new = accept(listenerFd, reinterpret_cast<struct sockaddr *>(&client_addr), &client_len);
         if (client_fd_new < 0) {
             log_error("Socket failed to ACCEPT client...wait for next client");
             continue;
         }
+        KVConnection *connection = kvConnections.open(client_fd_new);
+        if (connection == nullptr) {
+            log_error("Main Thread: too many clients, FD = " + std::to_string(client_fd_new));
+            close(client_fd_new);
+            continue;
+        }
 
         // REFER: https://stackoverflow.com/questions/4282369/determining-the-ip-address-of-a-connected-client-on-the-server
-        log_info(std::string("---> New Client IP = ") + inet_ntoa(client_addr.sin_addr)
-                 + ", Port = " + std::to_string(ntohs(client_addr.sin_port)));
-
-        // Assign the client to one of the threads in the "thread_pool"
-        rr_success = 0;
-
-        for (rr_iter = 0; rr_iter < thread_pool.size(); ++rr_iter, ++listIter) {
-            if (listIter == thread_pool.end()) listIter = thread_pool.begin();
-
-            std::mutex &mutex_to_test = listIter->mutex_new_client_fds;
-            mutex_to_test.lock();
-            if (listIter->client_fds_count < serverConfig.clients_per_thread) {
-                // Assign the client connection to the worker thread "thread_pool.arr[rr_idx_test]"
-                listIter->client_fds_new.push_back(client_fd_new);
-
-                // unlock the mutex and exit the loop
-                mutex_to_test.unlock();
-                rr_success = 1;
-                break;
-            }
-            mutex_to_test.unlock();
+        if (listenerFd == sockfd) {
+            log_info(std::string("---> New Client IP = ") + inet_ntoa(client_addr.sin_addr)
+                     + ", Port = " + std::to_string(ntohs(client_addr.sin_port)));
+        } else {
+            log_info("---> New Client on the Unix domain socket");
         }
 
-        if (rr_success) {
-            log_info("Main Thread: client assigned to thread_id = " + std::to_string(listIter->thread_id));
-            ++listIter;
-        } else {
-            // Add new "WorkerThreadInfo" object with default values to the vector
-            // Initialise the newly inserted "WorkerThreadInfo" object
-            // WorkerThreadInfo worker(serverConfig.clients_per_thread, &memPoolKVMessage, &kvCache, thread_pool.size() + 1);
-            // thread_pool.push_back(worker);
-            thread_pool.emplace_back(serverConfig.clients_per_thread, &memPoolKVMessage, &kvCache,
-                                     thread_pool.size() + 1);
-
-            // Insert the new client File Descriptor in "client_fds_new"
-            // No need to acquire the lock as the Worker Thread for this object is not running
-            auto templistIter = thread_pool.rbegin();
-            templistIter->client_fds_new.push_back(client_fd_new);
-            templistIter->start_thread();  // Start the Worker Thread
-            listIter = thread_pool.begin();
-
-            for (int32_t i = 1; i < serverConfig.thread_pool_growth; ++i) {
-                thread_pool.emplace_back(serverConfig.clients_per_thread, &memPoolKVMessage, &kvCache,
-                                         thread_pool.size() + 1);
-            }
+        // Register the client in the epoll instance of the next worker. In the default mode, the load is
+        // balanced later by work stealing, so the worker to which a client is assigned does not matter much
+        if (listIter == thread_pool.end()) listIter = thread_pool.begin();
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.fd = client_fd_new;
+        if (epoll_ctl(listIter->epoll_fd, EPOLL_CTL_ADD, client_fd_new, &event)) {
+            log_error("Main Thread: epoll ctl failed for the new client...");
+            kvConnections.close(connection);
+            close(client_fd_new);
+            continue;
         }
+        ++(listIter->client_fds_count);
+        log_info("Main Thread: client assigned to thread_id = " + std::to_string(listIter->thread_id));
+        ++listIter;
 
         // break;  // This is only to be used for testing/debugging
     }
@@ -424,6 +1400,7 @@ void main_thread() {
 
 void signal_callback_handler(int signalNumber) {
     log_warning("CTRL+C pressed. Closing the server...", true);
+    globalPausingMutex.lock();
     for (auto &i : *global_thread_pool) {
         // acquire mutex for all threads so that they stop after serving the clients
         // for that particular iteration
@@ -431,12 +1408,18 @@ void signal_callback_handler(int signalNumber) {
                  std::to_string(global_thread_pool->size()));
         i.mutex_serving_clients.lock();
     }
+    if (globalExpiryReaper != nullptr) globalExpiryReaper->mutex_reaping.lock();
+    if (globalStorageMaintainer != nullptr) globalStorageMaintainer->mutex_maintaining.lock();
+    if (globalReplicationReplica != nullptr) globalReplicationReplica->mutex_applying.lock();
 
-    if (globalKVCache != nullptr) {
+    if (globalKVCaches != nullptr) {
         log_info("Performing cache cleanup");
-        globalKVCache->cache_clean();
+        for (KVCache *kvCache: *globalKVCaches)
+            if (kvCache != nullptr) kvCache->cache_clean();
         log_success("Cache cleaning complete :)", true);
     }
+    kvKeyIndex.save();
+    if (not globalUnixSocketPath.empty()) unlink(globalUnixSocketPath.c_str());
 
     log_success("Server cleanup complete :)", true, true);
     exit(0);
@@ -0,0 +1,205 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVSHARDEDCLIENT_HPP
+#define PA_4_KEY_VALUE_STORE_KVSHARDEDCLIENT_HPP
+
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MyDebugger.hpp"
+#include "MyConsistentHashRing.hpp"
+#include "KVMessage.hpp"
+#include "KVClientPool.hpp"
+
+/*
+ * Client side sharding of the Keys over many KVServer instances
+ *
+ * Every server gets a KVClientPool, and a Key is routed to the server which owns it in a ConsistentHashRing.
+ * So, each KVServer (with its own KVCache and Persistent Storage) stores about "1/n" of the Keys, and adding or
+ * removing a server only moves about "1/n" of the Keys. The servers do NOT know about each other, and the Keys
+ * are NOT moved by the servers, i.e. after resharding, the Keys whose owner has changed have to be written again.
+ *
+ * Multi-Key requests (MGET, MPUT, MDELETE) are split per shard, the requests of every shard are pipelined on
+ * its KVClientPool, and the results are returned in the same order as the Keys.
+ * SCAN is per server, refer "shard_of(...)".
+ *
+ * Usage:
+ *     KVShardedClient client({{"127.0.0.1", "8080"}, {"127.0.0.1", "8081"}});
+ *     client.PUT("key", "value").get();
+ *     std::vector<KVResult> values = client.MGET({"key", "key2"}).get();
+ * */
+class KVShardedClient {
+public:
+    using Server = std::pair<std::string, std::string>;  // IP, PORT
+
+    explicit KVShardedClient(const std::vector<Server> &servers,
+                             KVClientPool::Options options = KVClientPool::Options(), uint32_t vnodes = 160)
+            : options(options), ring(vnodes) {
+        for (const auto &[ip, port]: servers) add_server(ip, port);
+    }
+
+    /* Returns: false if the server is already present */
+    bool add_server(const std::string &ip, const std::string &port) {
+        const std::string name = ip + ":" + port;
+        std::unique_lock writer_lock(rw_lock);
+        for (const auto &node: ring.nodes)
+            if (node == name) return false;
+        ring.add(name);
+        pools.push_back(std::make_shared<KVClientPool>(ip.c_str(), port.c_str(), options));
+        log_info("KVShardedClient: added server " + name);
+        return true;
+    }
+
+    /* The requests already sent to the server are completed, its Keys are owned by the other servers from now on
+     * Returns: false if the server is NOT present */
+    bool remove_server(const std::string &ip, const std::string &port) {
+        const std::string name = ip + ":" + port;
+        std::unique_lock writer_lock(rw_lock);
+        for (uint32_t i = 0; i < ring.nodes.size(); ++i) {
+            if (ring.nodes[i] != name) continue;
+            ring.remove(i);
+            pools[i].reset();  // the KVClientPool is destroyed once its last request is complete
+            log_info("KVShardedClient: removed server " + name);
+            return true;
+        }
+        return false;
+    }
+
+    /* Returns: KVClientPool of the server which owns "key", nullptr if there are no servers */
+    std::shared_ptr<KVClientPool> shard_of(const std::string &key) {
+        std::shared_lock reader_lock(rw_lock);
+        return (ring.empty()) ? nullptr : pools[ring.lookup(key.c_str(), key_length(key))];
+    }
+
+    std::future<KVResult> GET(const std::string &key) {
+        return route(key, [&](KVClientPool &pool) { return pool.GET(key); });
+    }
+
+    std::future<KVResult> PUT(const std::string &key, const std::string &value) {
+        return route(key, [&](KVClientPool &pool) { return pool.PUT(key, value); });
+    }
+
+    std::future<KVResult> PUT_TTL(const std::string &key, const std::string &value, uint32_t ttlSeconds) {
+        return route(key, [&](KVClientPool &pool) { return pool.PUT_TTL(key, value, ttlSeconds); });
+    }
+
+    std::future<KVResult> DELETE(const std::string &key) {
+        return route(key, [&](KVClientPool &pool) { return pool.DELETE(key); });
+    }
+
+    std::future<KVResult> GETS(const std::string &key) {
+        return route(key, [&](KVClientPool &pool) { return pool.GETS(key); });
+    }
+
+    std::future<KVResult> CAS(const std::string &key, const std::string &value, uint64_t expectedVersion) {
+        return route(key, [&](KVClientPool &pool) { return pool.CAS(key, value, expectedVersion); });
+    }
+
+    std::future<KVResult> INCR(const std::string &key, int64_t delta) {
+        return route(key, [&](KVClientPool &pool) { return pool.INCR(key, delta); });
+    }
+
+    std::future<KVResult> DECR(const std::string &key, int64_t delta) {
+        return route(key, [&](KVClientPool &pool) { return pool.DECR(key, delta); });
+    }
+
+    std::future<std::vector<KVResult>> MGET(const std::vector<std::string> &keys) {
+        return scatter(keys.size(), [&keys](size_t i) -> const std::string & { return keys[i]; },
+                       [&keys](KVClientPool &pool, size_t i, KVClientPool::Callback cb) {
+                           pool.GET(keys[i], std::move(cb));
+                       });
+    }
+
+    std::future<std::vector<KVResult>> MPUT(const std::vector<std::pair<std::string, std::string>> &entries) {
+        return scatter(entries.size(), [&entries](size_t i) -> const std::string & { return entries[i].first; },
+                       [&entries](KVClientPool &pool, size_t i, KVClientPool::Callback cb) {
+                           pool.PUT(entries[i].first, entries[i].second, std::move(cb));
+                       });
+    }
+
+    std::future<std::vector<KVResult>> MDELETE(const std::vector<std::string> &keys) {
+        return scatter(keys.size(), [&keys](size_t i) -> const std::string & { return keys[i]; },
+                       [&keys](KVClientPool &pool, size_t i, KVClientPool::Callback cb) {
+                           pool.DELETE(keys[i], std::move(cb));
+                       });
+    }
+
+private:
+    KVClientPool::Options options;
+    std::shared_mutex rw_lock;  // protects "ring" and "pools"
+    ConsistentHashRing ring;
+    std::vector<std::shared_ptr<KVClientPool>> pools;  // index = node index in "ring"
+
+    /* The server stores at most 255 characters of the Key, till the first '\0' (refer "KVMessage::set_key(...)"),
+     * so only those are hashed */
+    static inline size_t key_length(const std::string &key) {
+        return strnlen(key.c_str(), std::min<size_t>(key.size(), 255));
+    }
+
+    static std::future<KVResult> no_server() {
+        std::promise<KVResult> promise;
+        promise.set_value(KVResult::failure("No server is available"));
+        return promise.get_future();
+    }
+
+    template<typename Send>
+    std::future<KVResult> route(const std::string &key, Send send) {
+        std::shared_ptr<KVClientPool> pool = shard_of(key);
+        return (pool) ? send(*pool) : no_server();
+    }
+
+    /* Send request "i" (for i in [0, n)) to the shard of "keyOf(i)", the requests of each shard are sent together
+     * Returns: future of all the results, in the same order as the requests */
+    template<typename KeyOf, typename Send>
+    std::future<std::vector<KVResult>> scatter(size_t n, KeyOf keyOf, Send send) {
+        struct Gather {
+            std::promise<std::vector<KVResult>> promise;
+            std::vector<KVResult> results;
+            std::atomic_size_t remaining;
+
+            explicit Gather(size_t n) : results(n), remaining(n) {}
+
+            void complete(size_t i, KVResult &&result) {
+                results[i] = std::move(result);
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) promise.set_value(std::move(results));
+            }
+        };
+        auto gather = std::make_shared<Gather>(n);
+        std::future<std::vector<KVResult>> future = gather->promise.get_future();
+        if (n == 0) {
+            gather->promise.set_value({});
+            return future;
+        }
+
+        // Group the requests by shard using one snapshot of the ring
+        std::vector<std::shared_ptr<KVClientPool>> shardPools;
+        std::vector<std::vector<size_t>> shardRequests;
+        {
+            std::shared_lock reader_lock(rw_lock);
+            if (ring.empty()) {
+                for (size_t i = 0; i < n; ++i) gather->complete(i, KVResult::failure("No server is available"));
+                return future;
+            }
+            shardPools = pools;
+            shardRequests.resize(pools.size());
+            for (size_t i = 0; i < n; ++i) {
+                const std::string &key = keyOf(i);
+                shardRequests[ring.lookup(key.c_str(), key_length(key))].push_back(i);
+            }
+        }
+
+        for (size_t s = 0; s < shardRequests.size(); ++s) {
+            for (size_t i: shardRequests[s]) {
+                send(*shardPools[s], i, [gather, i](KVResult result) { gather->complete(i, std::move(result)); });
+            }
+        }
+        return future;
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_KVSHARDEDCLIENT_HPP
@@ -0,0 +1,210 @@
+#ifndef PA_4_KEY_VALUE_STORE_KVSNAPSHOT_HPP
+#define PA_4_KEY_VALUE_STORE_KVSNAPSHOT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MyDebugger.hpp"
+#include "KVMessage.hpp"
+#include "KVStore.hpp"
+#include "KVCache.hpp"
+
+/*
+ * Online point-in-time snapshot of the Persistent Storage, refer "KVMessage::EnumSNAPSHOT"
+ *
+ * The snapshot is the state of every Key at the instant the writers were paused (i.e. before the response to
+ * SNAPSHOT is sent, so it has every write acknowledged before it and none sent after it), and it is stored in
+ * "snapshots/<name>" (next to the "db" directory) in the same format as "db", i.e. it can be restored by
+ * replacing the files of "db" with it while the server is stopped ("key_index" is rebuilt on start).
+ *     1. The threads which modify the KVCache are paused only to copy the CacheNodes which are NOT yet in the
+ *        Persistent Storage (dirty or deleted), and to mark every file of the KVStore as pending
+ *     2. The writers are resumed. A pending file is copied to the snapshot by the first write to it (before the
+ *        write), or in the background, whichever comes first. The copy is a reflink where the filesystem supports
+ *        it (only the block map is copied). Otherwise, the live entries of the file are read in memory, and the
+ *        copy is written in the background. So, a write waits at most for reading one file (and never for
+ *        writing its copy), refer "KVStore::begin_snapshot(...)"
+ *     3. The CacheNodes copied in step 1 are written to the snapshot, and the file "SNAPSHOT_COMPLETE" is created
+ * Only one snapshot is taken at a time, and its progress is shown by STATS.
+ * */
+class KVSnapshotter {
+public:
+    static constexpr const char *SNAPSHOTS_DIR = "../snapshots";  // the current directory is "db"
+    static constexpr const char *COMPLETE_FILE_NAME = "SNAPSHOT_COMPLETE";
+    static constexpr size_t MAX_NAME_LEN = 64;
+    static constexpr int BACKGROUND_NICE = 10;
+
+    // pause_writers(true) returns once no other thread is modifying the KVCache (false if they can NOT be paused,
+    // e.g. the server is closing), and pause_writers(false) resumes them
+    using PauseFunction = std::function<bool(bool)>;
+
+    KVSnapshotter() : mutex_state(), running(false), state("none"), pause_us(0), duration_ms(0) {}
+
+    /* "name" may only have the characters [A-Za-z0-9._-] and must NOT start with '.', if it is empty, the
+     * current time is used
+     * The writers are paused by the calling thread (step 1), and the rest is done by a new thread
+     *
+     * Returns: true if the snapshot was taken (the files are still being copied in the background), "result" is
+     *          set to its directory (relative to the directory of the KVServer)
+     *        : false if it was NOT taken, "result" is set to the reason */
+    bool start(std::string name, std::vector<KVCache *> *kvCaches, const PauseFunction &pauseWriters,
+               std::string &result) {
+        if (name.empty()) name = "snapshot-" + std::to_string(KVMessage::current_time_ms());
+        if (not is_valid_name(name)) {
+            result = "Invalid snapshot name";
+            return false;
+        }
+
+        bool expected = false;
+        if (not running.compare_exchange_strong(expected, true)) {
+            result = "Another snapshot is in progress";
+            return false;
+        }
+
+        const std::string dir = std::string(SNAPSHOTS_DIR) + "/" + name;
+        if ((mkdir(SNAPSHOTS_DIR, 0755) != 0 && errno != EEXIST) || mkdir(dir.c_str(), 0755) != 0) {
+            result = (errno == EEXIST) ? "Snapshot already exists" : "Unable to create directory";
+            running = false;
+            return false;
+        }
+
+        // 1. Point-in-time
+        const auto startTime = std::chrono::steady_clock::now();
+        auto captured = std::make_shared<CapturedEntries>();
+        if (not pauseWriters(true)) {
+            rmdir(dir.c_str());
+            result = "Server is closing";
+            running = false;
+            return false;
+        }
+        kvPersistentStore.begin_snapshot(dir);
+        for (KVCache *kvCache: *kvCaches)
+            if (kvCache != nullptr) kvCache->cache_collect_unwritten(captured->messages, captured->batch);
+        captured->replication_seq = kvReplicationLog.head();
+        pauseWriters(false);
+        captured->pause_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - startTime).count());
+
+        set_state("running");
+        log_info("Snapshot: started \"" + dir + "\", writers paused for " + std::to_string(captured->pause_us) + " us");
+        std::thread([this, dir, captured, startTime]() {
+            // SIGINT must be handled by some other thread, same as "ExpiryReaper"
+            sigset_t signalSet;
+            sigemptyset(&signalSet);
+            sigaddset(&signalSet, SIGINT);
+            pthread_sigmask(SIG_BLOCK, &signalSet, nullptr);
+
+            // The copy is NOT urgent, the workers get the CPU first
+            // REFER: https://man7.org/linux/man-pages/man2/setpriority.2.html (NOTES: the nice value is per thread)
+            setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), BACKGROUND_NICE);
+
+            copy_snapshot(dir, *captured, startTime);
+            running = false;
+        }).detach();  // the server exits using "exit(...)"
+        result = dir.substr(3);  // without "../"
+        return true;
+    }
+
+    /* Returns: text for the STATS request */
+    std::string stats() {
+        std::lock_guard lock(mutex_state);
+        std::string res = "snapshot=" + state;
+        if (state != "none" && state != "running") {
+            res += " snapshot_ms=" + std::to_string(duration_ms) + " snapshot_pause_us=" + std::to_string(pause_us);
+        }
+        return res;
+    }
+
+private:
+    /* CacheNodes which were NOT in the Persistent Storage when the writers were paused */
+    struct CapturedEntries {
+        std::deque<KVMessage> messages;
+        std::vector<KVStoreBatchEntry> batch;  // points to "messages"
+        uint64_t replication_seq = 0, pause_us = 0;
+    };
+
+    std::mutex mutex_state;  // protects the members below "running"
+    std::atomic_bool running;
+    std::string state;  // none, running, done or failed (of the last snapshot)
+    uint64_t pause_us, duration_ms;
+
+    static bool is_valid_name(const std::string &name) {
+        if (name.size() > MAX_NAME_LEN || name[0] == '.') return false;
+        return std::all_of(name.begin(), name.end(), [](char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '_' || c == '-';
+        });
+    }
+
+    void set_state(const std::string &newState, uint64_t pauseUs = 0, uint64_t durationMs = 0) {
+        std::lock_guard lock(mutex_state);
+        state = newState;
+        pause_us = pauseUs;
+        duration_ms = durationMs;
+    }
+
+    /* Steps 2 and 3 */
+    void copy_snapshot(const std::string &dir, const CapturedEntries &captured,
+                       std::chrono::steady_clock::time_point startTime) {
+        using namespace std::chrono;
+        const std::vector<KVStoreBatchEntry> &batch = captured.batch;
+        const uint64_t pauseUs = captured.pause_us, replicationSeq = captured.replication_seq;
+
+        // 2. Files of the KVStore
+        kvPersistentStore.snapshot_remaining_files();
+
+        // 3. CacheNodes which were NOT in the KVStore, grouped by file (as per the geometry of the snapshot) as in
+        //    "KVCache::cache_clean()"
+        const KVStoreGeometry &geometry = kvPersistentStore.snapshot_geometry;
+        std::vector<std::vector<KVStoreBatchEntry>> fileBatches(geometry.file_count());
+        for (const KVStoreBatchEntry &i: batch) fileBatches.at(geometry.file_of(i.message->hash1)).push_back(i);
+        for (uint64_t fileIdx = 0; fileIdx < fileBatches.size(); ++fileIdx) {
+            auto &fileBatch = fileBatches.at(fileIdx);
+            std::sort(fileBatch.begin(), fileBatch.end(),
+                      [&geometry](const KVStoreBatchEntry &a, const KVStoreBatchEntry &b) {
+                          return geometry.slot_of(a.message->hash1) < geometry.slot_of(b.message->hash1);
+                      });
+            kvPersistentStore.write_batch_to_snapshot(fileIdx, fileBatch);
+        }
+
+        const auto durationMs = static_cast<uint64_t>(duration_cast<milliseconds>(steady_clock::now() - startTime).count());
+        const uint32_t reflinked = kvPersistentStore.snapshot_reflinked, copied = kvPersistentStore.snapshot_imaged;
+        if (kvPersistentStore.snapshot_failed != 0) {
+            log_error("Snapshot: \"" + dir + "\" failed, files not copied = "
+                      + std::to_string(kvPersistentStore.snapshot_failed));
+            set_state("failed", pauseUs, durationMs);
+            return;
+        }
+
+        std::ofstream fs(dir + "/" + COMPLETE_FILE_NAME, std::ios::out | std::ios::trunc);
+        fs << "files_reflinked " << reflinked << "\nfiles_copied " << copied
+           << "\ncache_entries " << batch.size() << "\nreplication_seq " << replicationSeq
+           << "\npause_us " << pauseUs << "\nduration_ms " << durationMs << "\n";
+        fs.close();
+        if (fs.fail()) {
+            log_error("Snapshot: unable to write \"" + dir + "/" + COMPLETE_FILE_NAME + "\"");
+            set_state("failed", pauseUs, durationMs);
+            return;
+        }
+
+        log_success("Snapshot: \"" + dir + "\" complete in " + std::to_string(durationMs) + " ms (writers paused for "
+                    + std::to_string(pauseUs) + " us), files reflinked = " + std::to_string(reflinked)
+                    + ", files copied = " + std::to_string(copied) + ", cache entries = " + std::to_string(batch.size()));
+        set_state("done", pauseUs, durationMs);
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_KVSNAPSHOT_HPP
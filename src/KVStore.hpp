@@ -2,33 +2,235 @@
 #define PA_4_KEY_VALUE_STORE_KVSTORE_HPP
 
 #include <shared_mutex>
+#include <atomic>
+#include <mutex>
+#include <deque>
 #include <fstream>
 #include <array>
-#include <bitset>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cstddef>
+#include <chrono>
+#include <thread>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "MyDebugger.hpp"
+#include "MyCompression.hpp"
+#include "MyCRC32C.hpp"
+#include "MyReflink.hpp"
 #include "KVMessage.hpp"
-#include "KVStoreFileNames.h"
 
-// Number of linked-lists that point to circular lists of "CacheNode"
-// The number of files in the Persistent Storage is equal to the below value
-const uint_fast32_t HASH_TABLE_LEN = 1021;  // REFER: http://www.factors-of.com/prime-numbers-before/Prime-numbers-from-1-to_1024_
-const uint_fast64_t FILE_TABLE_LEN = 8191;  // REFER:
+// Geometry of a new Persistent Storage (refer "KVStoreGeometry"), unless set by "KVStore::set_geometry(...)"
+// A Persistent Storage created before the MANIFEST existed has this geometry
+const uint_fast32_t DEFAULT_HASH_TABLE_LEN = 1021;  // REFER: http://www.factors-of.com/prime-numbers-before/Prime-numbers-from-1-to_1024_
+const uint_fast64_t DEFAULT_FILE_TABLE_LEN = 8191;  // REFER:
+const uint_fast32_t DEFAULT_MAX_HASH_TABLE_LEN = 65536;
 const uint_fast64_t MAX_UINT64 = std::numeric_limits<uint64_t>::max();
 const char EMPTY_STRING[256] = {};
 
+// Number of files (i.e. buckets) of the Persistent Storage and number of slots (i.e. circular doubly linked lists)
+// in each file. The number of files grows one file at a time using Linear Hashing, same as the Hash Table of
+// "KVCache", refer "KVStore::split_file_if_required(...)"
+//     REFER: https://en.wikipedia.org/wiki/Linear_hashing
+//     - Files [0, split_idx) and [level_len, level_len + split_idx) use "2 * level_len" as the modulo
+//     - Files [split_idx, level_len) use "level_len" as the modulo
+// "level_len" is always "hash_table_len" times a power of 2, so "file_of(hash1) % hash_table_len" never changes
+struct KVStoreGeometry {
+    uint64_t hash_table_len;  // number of files when the Persistent Storage was created
+    uint64_t file_table_len;  // number of slots in every file, never changes
+    uint64_t level_len;
+    uint64_t split_idx;
+
+    [[nodiscard]] inline uint64_t file_count() const {
+        return level_len + split_idx;
+    }
+
+    [[nodiscard]] inline uint64_t file_of(uint64_t hash1) const {
+        uint64_t idx = hash1 % level_len;
+        if (idx < split_idx) idx = hash1 % (2 * level_len);
+        return idx;
+    }
+
+    [[nodiscard]] inline uint64_t slot_of(uint64_t hash1) const {
+        return hash1 % file_table_len;
+    }
+
+    /* Returns: the geometry after the file "split_idx" is split into "split_idx" and "file_count()" */
+    [[nodiscard]] KVStoreGeometry after_split() const {
+        if (split_idx + 1 == level_len) return {hash_table_len, file_table_len, 2 * level_len, 0};
+        return {hash_table_len, file_table_len, level_len, split_idx + 1};
+    }
+};
+
+// One Key-Value pair to be written to (or deleted from) a file using "KVStore::write_batch_to_db(...)"
+struct KVStoreBatchEntry {
+    const struct KVMessage *message;
+    bool to_delete;
+};
+
+// Live (i.e. NOT blank) entries of one file at the time of a snapshot, written to the snapshot later
+// Used when the filesystem does NOT support reflink, refer "KVStore::begin_snapshot(...)"
+struct KVStoreFileImage {
+    uint64_t file_idx;
+    uint64_t entry_count;  // number of entries in the file, including the blank ones
+    std::vector<uint64_t> entry_indices;  // index of each live entry in the file
+    std::vector<char> entries;  // the live entries as stored in the file, in the same order as "entry_indices"
+};
+
+// Totals of "KVStore::verify_and_repair_files(...)"
+struct KVStoreVerifyResult {
+    uint64_t files = 0;  // files which exist
+    uint64_t bytes_read = 0;
+    uint64_t lists = 0;  // non-empty circular doubly linked lists, one per "inside_file_idx"
+    uint64_t entries = 0;  // live entries after the repair
+    uint64_t lists_repaired = 0;
+    uint64_t entries_relinked = 0;  // live entries which were NOT reachable from their list
+    uint64_t entries_dropped = 0;  // entries which can NOT belong to any list, and partially written entries
+    uint64_t entries_free = 0;  // blank overflow entries which can be reused, refer "KVStoreFreeList"
+    uint64_t bytes_reclaimed = 0;  // blank entries removed from the end of the files
+    uint64_t files_failed = 0;  // files which could NOT be read or written
+
+    KVStoreVerifyResult &operator+=(const KVStoreVerifyResult &other) {
+        files += other.files;
+        bytes_read += other.bytes_read;
+        lists += other.lists;
+        entries += other.entries;
+        lists_repaired += other.lists_repaired;
+        entries_relinked += other.entries_relinked;
+        entries_dropped += other.entries_dropped;
+        entries_free += other.entries_free;
+        bytes_reclaimed += other.bytes_reclaimed;
+        files_failed += other.files_failed;
+        return *this;
+    }
+};
+
+// Stored between the Key and the Value of every entry in file, tells how the Value is encoded, when it expires
+// and its version
+// NOTE: an all '\0' header is a RAW empty Value which never expires, so blank entries need no special handling
+struct KVStoreValueHeader {
+    enum EnumCodec : uint32_t {
+        Codec_RAW = 0,  // first "stored_len" bytes of the Value, the rest of the Value is '\0'
+        Codec_LZ4 = 1   // LZ4 block of "stored_len" bytes, refer "LZ4BlockCodec"
+    };
+
+    uint32_t codec;
+    uint32_t stored_len;  // number of bytes used in the 256 byte value area
+    uint64_t expires_at;  // same as "KVMessage::expires_at"
+    uint64_t version;  // same as "KVMessage::version"
+};
+
+// Blank overflow entries of a file which can be reused, refer "KVStore::pop_free_entry(...)"
+// The list is linked through the hash1 field of the blank entries
+struct KVStoreFreeList {
+    uint64_t head;  // index of the first free entry, MAX_UINT64 if there is none
+    uint64_t count;
+    uint32_t crc;  // CRC32C of {head, count}
+};
+
+// Layout of the entries of a file of the format version 0, i.e. without the file header and without CRCs in the
+// entries: leftIdx, rightIdx, hash1, hash2, Key[256], the first "value_header_len" bytes of "KVStoreValueHeader"
+// and Value[256]. The value header grew a field at a time, and the entries of the oldest files have none (i.e.
+// the Value is stored as is), refer "KVStore::LEGACY_LAYOUTS"
+struct KVStoreLegacyLayout {
+    uint32_t value_header_len;
+
+    [[nodiscard]] constexpr uint64_t entry_size() const {
+        return 4 * sizeof(uint64_t) + 256 + value_header_len + 256;
+    }
+};
+
+// Stored at the start of every file, the entries start after "KVStore::FILE_HEADER_LEN" bytes
+// A file without it has the format of version 0, refer "KVStoreLegacyLayout" and "KVStore::upgrade_file(...)"
+struct KVStoreFileHeader {
+    static constexpr char MAGIC[8] = "KVSTORE";
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    char magic[8];
+    uint32_t format_version;
+    uint32_t entry_size;  // same as "KVStore::SIZE_OF_ONE_ENTRY"
+    uint64_t file_table_len;  // same as "KVStoreGeometry::file_table_len"
+    uint32_t header_crc;  // CRC32C of the above fields
+
+    // Updated by every delete/insert of an overflow entry, so it has its own CRC. If the CRC does NOT match,
+    // the free list is treated as empty, refer "KVStore::read_free_list(...)"
+    KVStoreFreeList free_list;
+};
+
 // Single Entry in file:
 //     uint64_t leftIdx (64 bits), uint64_t rightIdx (64 bits),
+//     uint32_t linksCrc (32 bits), uint32_t recordCrc (32 bits),
 //     uint64_t hash1 (64 bits), uint64_t hash2 (64 bits),
-//     char Key[256], char Value[256]
+//     char Key[256], KVStoreValueHeader (192 bits), char Value[256] (encoded as per the header)
+// linksCrc is the CRC32C of {leftIdx, rightIdx}, and recordCrc is the CRC32C of the "record", i.e. from hash1 till
+// the used bytes of the Value (refer "KVStoreValueHeader::stored_len"). So, a partially written entry (or a
+// partially updated link) is detected on read, and the links are never followed unless they match their CRC.
+// The links and the record are checked separately as the links of an entry are also updated by its neighbours
 struct KVStore {
-    std::array<std::shared_mutex, HASH_TABLE_LEN> file_locks;
-    std::bitset<HASH_TABLE_LEN> file_exists_status;
+    // Value area = KVStoreValueHeader followed by the 256 bytes in which the encoded Value is stored
+    static const int_fast32_t SIZE_OF_VALUE_AREA = (sizeof(KVStoreValueHeader) + 256);
+
+    static constexpr const char *MANIFEST_FILE_NAME = "MANIFEST";
+
+    // Refer "KVStoreGeometry", the state is (level_len << 32) | split_idx same as "KVCache::hashTableState"
+    uint64_t hash_table_len = DEFAULT_HASH_TABLE_LEN, file_table_len = DEFAULT_FILE_TABLE_LEN;
+    std::atomic_uint64_t geometry_state{0};
+    std::mutex split_mutex;  // held while a file is split, and while a snapshot is started
+    std::atomic_bool split_disabled{false};
+    std::atomic_uint64_t splits{0};
+
+    // Allocated by "init_kvstore()" for "max_hash_table_len" files, as the number of files grows
+    uint64_t max_hash_table_len = DEFAULT_MAX_HASH_TABLE_LEN;
+    std::unique_ptr<std::shared_mutex[]> file_locks;
+    std::unique_ptr<std::atomic_bool[]> file_exists_status;
+
+    // Values whose length (excluding the trailing '\0's) is at least "value_compression_min_len" are
+    // compressed if "value_compression" is true. Smaller Values do not compress well, so they are stored RAW
+    bool value_compression = false;
+    uint32_t value_compression_min_len = 64;
+
+    // Point-in-time snapshot of the files, refer "begin_snapshot(...)"
+    // snapshot_pending[i] is true if file "i" has to be copied to "snapshot_dir" before it is modified
+    std::unique_ptr<std::atomic_bool[]> snapshot_pending;
+    std::string snapshot_dir;
+    KVStoreGeometry snapshot_geometry{};  // the files in "snapshot_dir" have this geometry
+    std::atomic_bool snapshot_reflink_supported{true};
+    std::mutex snapshot_images_mutex;
+    std::deque<KVStoreFileImage> snapshot_images;  // to be written to "snapshot_dir"
+    std::atomic_uint32_t snapshot_reflinked{0}, snapshot_imaged{0}, snapshot_failed{0};
+
+    // Totals of "compact_file(...)"
+    std::atomic_uint64_t compactions{0}, compaction_bytes_reclaimed{0};
 
     KVStore() = default;
 
+    /* NOTE: Values are decoded as per their own header, so this can be changed without rewriting the files */
+    void set_value_compression(bool enabled, uint32_t minLen) {
+        value_compression = enabled;
+        value_compression_min_len = std::max(1U, minLen);
+    }
+
+    /* Geometry of the Persistent Storage if it is created by "init_kvstore()", refer "KVStoreGeometry"
+     * NOTE: an existing Persistent Storage keeps the geometry in its MANIFEST, only "maxHashTableLen" (the number
+     *       of files beyond which no file is split) can be changed
+     * ASSUMED: called before "init_kvstore()" */
+    void set_geometry(uint64_t hashTableLen, uint64_t fileTableLen, uint64_t maxHashTableLen) {
+        hash_table_len = std::max<uint64_t>(1, hashTableLen);
+        file_table_len = std::max<uint64_t>(1, fileTableLen);
+        max_hash_table_len = maxHashTableLen;
+    }
+
+    [[nodiscard]] inline KVStoreGeometry geometry() const {
+        const uint64_t state = geometry_state.load(std::memory_order_acquire);
+        return {hash_table_len, file_table_len, (state >> 32U), (state & 0xFFFFFFFFULL)};
+    }
+
     /* NOTE: it is important to call this before using other function of this struct */
     void init_kvstore() {
         // REFER: https://www.tutorialspoint.com/system-function-in-c-cplusplus
@@ -47,10 +249,28 @@ struct KVStore {
             exit(65);
         }
 
-        for (uint32_t i = 0; i < HASH_TABLE_LEN; ++i) {
-            file_exists_status.set(
-                    i, does_file_exists(kvStoreFileNames[i])
-            );
+        if (not init_geometry()) {
+            log_error("Exiting (status=71)");
+            exit(71);
+        }
+        const uint64_t fileCount = geometry().file_count();
+        max_hash_table_len = std::max(max_hash_table_len, fileCount);
+        file_locks.reset(new std::shared_mutex[max_hash_table_len]);
+        file_exists_status.reset(new std::atomic_bool[max_hash_table_len]{});
+        snapshot_pending.reset(new std::atomic_bool[max_hash_table_len]{});
+
+        // Written by a split which did NOT reach the MANIFEST, refer "split_file_if_required(...)"
+        if (does_file_exists(file_name(fileCount).c_str())) {
+            log_error_warning("KVStore: removing \"" + file_name(fileCount) + "\" of an incomplete split");
+            std::remove(file_name(fileCount).c_str());
+        }
+
+        for (uint64_t i = 0; i < fileCount; ++i) {
+            file_exists_status[i] = does_file_exists(file_name(i).c_str());
+            if (file_exists_status[i] && (not check_file_format(i))) {
+                log_error("Exiting (status=70)");
+                exit(70);
+            }
         }
     }
 
@@ -58,14 +278,15 @@ struct KVStore {
      *
      * Returns: true if GET was successful (i.e. Key was either present in the Persistent Storage)
      *          The "Value" corresponding to "ptr->key" will be stored in "ptr->value"
-     *        : false if "Key" is not present
+     *        : false if "Key" is not present or it has expired
+     *          If the Key has expired, "ptr->expires_at" is set (i.e. non-zero) so that the caller can reclaim it
      * */
     bool read_from_db(struct KVMessage *ptr) {
         // REFER: https://en.cppreference.com/w/cpp/thread/shared_lock/shared_lock
         // Read lock is automatically acquired when the constructor is called
         // And, it is released as soon as the destructor is called
-        uint64_t file_idx = (ptr->hash1) % HASH_TABLE_LEN;
-        std::shared_lock read_lock(file_locks[file_idx]);
+        uint64_t file_idx;
+        auto read_lock = lock_file<std::shared_lock<std::shared_mutex>>(ptr->hash1, file_idx);
 
         log_info("read_from_db(...)", true);
         log_info(std::string() + "    hash1 = " + std::to_string(ptr->hash1));
@@ -74,30 +295,28 @@ struct KVStore {
         log_info(std::string() + "    FILE  = " + std::to_string(file_idx));
 
         // return false if file does not exists
-        if (not file_exists_status.test(file_idx)) {
+        if (not file_exists_status[file_idx]) {
             log_info("    File does not exists");
             return false;
         }
 
         std::fstream fs;
-        fs.open(kvStoreFileNames[file_idx], std::ios::in);
-        // fs.open(kvStoreFileNames[file_idx], std::ios::in | std::ios::binary);
+        fs.open(file_name(file_idx), std::ios::in);
+        // fs.open(file_name(file_idx), std::ios::in | std::ios::binary);
         if ((not fs.is_open()) || fs.fail()) {
-            log_error(std::string("") + "Unable to open Database File: \"" + kvStoreFileNames[file_idx] + "\"");
+            log_error(std::string("") + "Unable to open Database File: \"" + file_name(file_idx) + "\"");
             return false;
         }
 
         log_info("    File successfully opened");
 
         uint64_t leftIdx, rightIdx, hash1_file, hash2_file;
-        char key_file[256];
 
-        const uint64_t inside_file_idx = (ptr->hash1) % FILE_TABLE_LEN;
-        fs.seekg(get_seek_val(inside_file_idx));
-        fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
+        const uint64_t inside_file_idx = geometry().slot_of(ptr->hash1);
+        if (not read_entry_head(fs, inside_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) {
+            fs.close();
+            return false;
+        }
 
         if (is_file_entry_empty(leftIdx, rightIdx)) {
             // There is no entry for this "inside_file_idx" val
@@ -107,15 +326,12 @@ struct KVStore {
         }
 
         // First entry matches the "Key"
-        if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-            fs.read(reinterpret_cast<char *>(key_file), 256);
-            if (std::equal(key_file, key_file + 256, ptr->key)) {
-                // match found
-                log_info("    First entry matched");
-                fs.read(reinterpret_cast<char *>(ptr->value), 256);
-                fs.close();
-                return true;
-            }
+        if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+            // match found
+            log_info("    First entry matched");
+            const bool res = read_record(fs, inside_file_idx, ptr);
+            fs.close();
+            return res && (not ptr->is_expired());
         }
 
         log_info("    inside_file_idx = " + std::to_string(inside_file_idx));
@@ -125,20 +341,13 @@ struct KVStore {
         uint64_t current_file_idx = rightIdx;
         while (current_file_idx != inside_file_idx) {
             log_info("        Working on idx = " + std::to_string(current_file_idx));
-            fs.seekg(get_seek_val(current_file_idx));
-            fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
-
-            if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-                fs.read(reinterpret_cast<char *>(key_file), 256);
-                if (std::equal(key_file, key_file + 256, ptr->key)) {
-                    // match found
-                    fs.read(reinterpret_cast<char *>(ptr->value), 256);
-                    fs.close();
-                    return true;
-                }
+            if (not read_entry_head(fs, current_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) break;
+
+            if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+                // match found
+                const bool res = read_record(fs, current_file_idx, ptr);
+                fs.close();
+                return res && (not ptr->is_expired());
             }
 
             current_file_idx = rightIdx;
@@ -150,10 +359,14 @@ struct KVStore {
 
     /* ASSUMED: ptr has following values filled: {hash1, hash2, key, value}
      * */
-    void write_to_db(struct KVMessage *ptr) {
-        uint64_t file_idx = (ptr->hash1) % HASH_TABLE_LEN;
+    void write_to_db(const struct KVMessage *ptr) {
+        uint64_t file_idx;
         std::fstream fs;
 
+        // REFER: https://stackoverflow.com/questions/39185420/is-there-a-shared-lock-guard-and-if-not-what-would-it-look-like
+        auto write_lock = lock_file<std::unique_lock<std::shared_mutex>>(ptr->hash1, file_idx);
+        snapshot_file_if_pending(file_idx);
+
         log_info("write_to_db(...)", true);
         log_info(std::string() + "    hash1 = " + std::to_string(ptr->hash1));
         log_info(std::string() + "    hahs2 = " + std::to_string(ptr->hash2));
@@ -161,86 +374,1409 @@ struct KVStore {
         log_info(std::string() + "    value = " + ptr->value);
         log_info(std::string() + "    FILE  = " + std::to_string(file_idx));
 
+        if (not open_db_file_for_write(file_idx, fs)) return;
+        write_to_db_file(fs, ptr);
+        fs.close();
+    }
+
+    /* Returns: true if entry found in Persistent Storage and successfully deleted
+     *        : false if file does not exists or entry not found in Persistent Storage or it had expired
+     *          (an expired entry is deleted as well)
+     * */
+    bool delete_from_db(const struct KVMessage *ptr, bool onlyIfExpired = false) {
+        uint64_t file_idx;
+
         // REFER: https://stackoverflow.com/questions/39185420/is-there-a-shared-lock-guard-and-if-not-what-would-it-look-like
+        auto write_lock = lock_file<std::unique_lock<std::shared_mutex>>(ptr->hash1, file_idx);
+
+        if (not file_exists_status[file_idx]) {
+            // File does NOT exists
+            return false;
+        }
+        snapshot_file_if_pending(file_idx);
+
+        std::fstream fs;
+        fs.open(file_name(file_idx), std::ios::in | std::ios::out | std::ios::binary);
+        if ((not fs.is_open()) || fs.fail()) {
+            log_error(std::string("") + "Unable to open Database File: \"" + file_name(file_idx) + "\"");
+            return false;
+        }
+
+        const bool resultStatus = delete_from_db_file(fs, ptr, onlyIfExpired);
+        fs.close();
+        return resultStatus;
+    }
+
+    /* Delete the entry of "ptr->key" ONLY if it has expired, i.e. the Key was NOT written again with a new TTL */
+    void expire_from_db(const struct KVMessage *ptr) {
+        delete_from_db(ptr, true);
+    }
+
+    /* ASSUMED: all entries of "batch" belong to the same file "file_idx" (i.e. geometry().file_of(hash1))
+     *        : each entry has following values filled: {hash1, hash2, key} and "value" if it is not to be deleted
+     *
+     * The file is locked, opened and closed only once for the whole batch, instead of once per entry.
+     * Sorting "batch" on the slot index (i.e. geometry().slot_of(hash1)) before calling this makes the file
+     * pointer move in one direction over the file. The entries which moved to another file (i.e. the file was
+     * split after "batch" was made) are written one at a time after the file is done
+     * */
+    void write_batch_to_db(uint64_t file_idx, const std::vector<KVStoreBatchEntry> &batch) {
+        if (batch.empty()) return;
+
+        std::vector<KVStoreBatchEntry> moved;
+        {
+            std::unique_lock write_lock(file_locks[file_idx]);
+            const KVStoreGeometry geometry = this->geometry();
+            auto is_moved = [&geometry, file_idx](const KVStoreBatchEntry &i) {
+                return geometry.file_of(i.message->hash1) != file_idx;
+            };
+            std::copy_if(batch.begin(), batch.end(), std::back_inserter(moved), is_moved);
+
+            // Nothing to delete from a file which does not exists
+            if (file_exists_status[file_idx] || std::any_of(batch.begin(), batch.end(), [&](const KVStoreBatchEntry &i) {
+                return (not i.to_delete) && (not is_moved(i));
+            })) {
+                snapshot_file_if_pending(file_idx);
+
+                std::fstream fs;
+                if (open_db_file_for_write(file_idx, fs)) {
+                    for (const KVStoreBatchEntry &i: batch) {
+                        if (is_moved(i)) continue;
+                        if (i.to_delete) delete_from_db_file(fs, i.message);
+                        else write_to_db_file(fs, i.message);
+                    }
+                    fs.close();
+                }
+            }
+        }
+
+        for (const KVStoreBatchEntry &i: moved) {
+            if (i.to_delete) delete_from_db(i.message);
+            else write_to_db(i.message);
+        }
+    }
+
+    /* Verify (and repair if needed) every file of the Persistent Storage, refer "verify_and_repair_file(...)"
+     * Each of the "threadCount" threads picks the next file till all files are done, and the progress is reported
+     * after every 10 % of the files. "callback(const char *key, const KVStoreValueHeader &header)" is called for
+     * every live entry (after the repair) by several threads at a time, so that the in-memory indexes are built
+     * in the same pass over the files
+     * ASSUMED: called after "init_kvstore()" and before the files are used by any other thread
+     * */
+    template<typename Callback>
+    KVStoreVerifyResult verify_and_repair_files(uint32_t threadCount, Callback callback) {
+        using namespace std::chrono;
+        const auto startTime = steady_clock::now();
+        auto elapsed_ms = [&startTime]() {
+            return std::to_string(duration_cast<milliseconds>(steady_clock::now() - startTime).count());
+        };
+
+        // Same as "KVCache::cache_clean()"
+        threadCount = std::max(1U, std::min(threadCount, 32U));
+        const uint64_t fileCount = geometry().file_count();
+        std::atomic_uint64_t nextFileIdx(0), filesDone(0);
+        std::mutex mutexTotal;
+        KVStoreVerifyResult total{};
+        std::vector<std::thread> threadPool;
+        threadPool.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; ++i) {
+            threadPool.emplace_back([&]() {
+                KVStoreVerifyResult result{};
+                std::vector<char> data;  // reused for all the files of this thread
+                for (uint64_t fileIdx = nextFileIdx++; fileIdx < fileCount; fileIdx = nextFileIdx++) {
+                    verify_and_repair_file(fileIdx, data, result, callback);
+                    const uint64_t done = ++filesDone;
+                    if (done != fileCount && (done * 10 / fileCount) != ((done - 1) * 10 / fileCount)) {
+                        log_success("KVStore: verified " + std::to_string(done) + "/" + std::to_string(fileCount)
+                                    + " files in " + elapsed_ms() + " ms");
+                    }
+                }
+                std::lock_guard lock(mutexTotal);
+                total += result;
+            });
+        }
+        for (auto &i: threadPool) i.join();
+
+        log_success("KVStore: verified " + std::to_string(total.files) + " files ("
+                    + std::to_string(total.bytes_read >> 20U) + " MB) in " + elapsed_ms() + " ms using "
+                    + std::to_string(threadCount) + " threads, lists = " + std::to_string(total.lists)
+                    + ", entries = " + std::to_string(total.entries) + ", free entries = "
+                    + std::to_string(total.entries_free) + ", reclaimed = " + std::to_string(total.bytes_reclaimed >> 10U)
+                    + " KB");
+        if (total.lists_repaired != 0 || total.entries_dropped != 0 || total.files_failed != 0) {
+            log_error_warning("KVStore: lists repaired = " + std::to_string(total.lists_repaired)
+                              + ", entries relinked = " + std::to_string(total.entries_relinked)
+                              + ", entries dropped = " + std::to_string(total.entries_dropped)
+                              + ", files NOT verified = " + std::to_string(total.files_failed));
+        }
+        return total;
+    }
+
+    /* Returns: true if at least "minFree" overflow entries of the file "file_idx" are free, and they are at
+     *          least 1/4th of its overflow entries, i.e. "compact_file(...)" is worth it */
+    bool needs_compaction(uint64_t file_idx, uint64_t minFree) {
+        std::shared_lock read_lock(file_locks[file_idx]);
+        if (not file_exists_status[file_idx]) return false;
+
+        std::ifstream fs(file_name(file_idx), std::ios::in | std::ios::binary);
+        KVStoreFreeList freeList{};
+        if ((not fs.is_open()) || (not read_free_list(fs, freeList))) return false;
+        fs.seekg(0, std::ios::end);
+        const auto entryCount = (static_cast<uint64_t>(fs.tellg()) - FILE_HEADER_LEN) / SIZE_OF_ONE_ENTRY;
+        return freeList.count >= std::max<uint64_t>(minFree, 1)
+               && 4 * freeList.count >= entryCount - std::min<uint64_t>(entryCount, file_table_len);
+    }
+
+    /* Rewrite the file "file_idx" so that the overflow entries of every list are contiguous (in the order of the
+     * list) right after the first "file_table_len" entries, i.e. there are no free entries, refer
+     * "build_file_image(...)" and "write_file_image(...)"
+     * The write lock of the file is held till it is rewritten, so requests to this file wait for ~one read and one
+     * write of the file. The file is NOT compacted if any of its lists is broken, such a file is repaired by
+     * "verify_and_repair_files(...)" (refer "STARTUP_VERIFY")
+     *
+     * Returns: true if the file was compacted
+     * */
+    bool compact_file(uint64_t file_idx) {
+        std::unique_lock write_lock(file_locks[file_idx]);
+        if (not file_exists_status[file_idx]) return false;
+        snapshot_file_if_pending(file_idx);
+
+        std::vector<char> data, out;
+        std::vector<uint64_t> listEntries, listStart;
+        if (not read_file_lists(file_idx, data, listEntries, listStart)) return false;
+        build_file_image(data, listEntries, listStart, [](uint64_t) { return true; }, out);
+        if (not write_file_image(file_idx, out, &data)) return false;
+        ++compactions;
+        compaction_bytes_reclaimed += data.size() - out.size();
+        return true;
+    }
+
+    /* Split the file "split_idx" (refer "KVStoreGeometry") if the Persistent Storage has more than "loadPercent"
+     * entries per 100 slots, as "entryCount" entries. One file is split at a time while the others are in use:
+     *     1. The entries of the file which now belong to the new file "file_count()" are written to it, same as
+     *        "compact_file(...)"
+     *     2. The new geometry is written to the MANIFEST, this is when the split takes effect
+     *     3. The file is rewritten without the moved entries
+     * The write locks of both the files are held throughout. A crash before 2. leaves the new file, which is
+     * removed by "init_kvstore()". A crash before 3. leaves the moved entries in the old file as well, which can
+     * NOT be reached (the new file is looked up for them) and are removed by "verify_and_repair_files(...)".
+     * Splitting stops (till the next start) if a file can NOT be split as one of its lists is broken.
+     *
+     * Returns: true if a file was split
+     * */
+    bool split_file_if_required(uint64_t entryCount, uint64_t loadPercent) {
+        if (loadPercent == 0 || split_disabled) return false;
+
+        std::lock_guard split_lock(split_mutex);
+        const KVStoreGeometry before = geometry(), after = before.after_split();
+        const uint64_t oldIdx = before.split_idx, newIdx = before.file_count();
+        if (entryCount * 100 <= newIdx * file_table_len * loadPercent || newIdx >= max_hash_table_len) return false;
+
+        // Lock order: lower file index first, same as "KVCache::hash_table_split_if_required()"
+        std::unique_lock write_lock1(file_locks[oldIdx]);
+        std::unique_lock write_lock2(file_locks[newIdx]);
+        snapshot_file_if_pending(oldIdx);
+
+        std::vector<char> data, oldOut, newOut;
+        std::vector<uint64_t> listEntries, listStart;
+        if (file_exists_status[oldIdx] && (not read_file_lists(oldIdx, data, listEntries, listStart))) {
+            log_error("KVStore: file " + std::to_string(oldIdx) + " can NOT be split, splitting is stopped");
+            split_disabled = true;
+            return false;
+        }
+        auto is_moved = [&data, &after, newIdx](uint64_t idx) {
+            uint64_t hash1;
+            std::memcpy(&hash1, data.data() + get_seek_val(idx) + OFFSET_HASH1, sizeof(uint64_t));
+            return after.file_of(hash1) == newIdx;
+        };
+        const auto movedCount = std::count_if(listEntries.begin(), listEntries.end(), is_moved);
+
+        // 1.
+        if (movedCount != 0) {
+            build_file_image(data, listEntries, listStart, is_moved, newOut);
+            if (not write_file_image(newIdx, newOut, nullptr)) return false;
+        }
+
+        // 2.
+        if (not write_manifest(MANIFEST_FILE_NAME, after)) {
+            log_error(std::string("KVStore: unable to write \"") + MANIFEST_FILE_NAME + "\"");
+            std::remove(file_name(newIdx).c_str());
+            file_exists_status[newIdx] = false;
+            return false;
+        }
+        geometry_state.store((after.level_len << 32U) | after.split_idx, std::memory_order_release);
+        ++splits;
+
+        // 3. If it fails, the moved entries are left in the old file as if the server had crashed
+        if (movedCount != 0) {
+            build_file_image(data, listEntries, listStart, [&is_moved](uint64_t idx) { return not is_moved(idx); },
+                             oldOut);
+            write_file_image(oldIdx, oldOut, &data);
+        }
+        log_info("KVStore: split file " + std::to_string(oldIdx) + ", entries moved to file " + std::to_string(newIdx)
+                 + " = " + std::to_string(movedCount));
+        return true;
+    }
+
+    /* Start a point-in-time snapshot of the files into the directory "dir" (which must exist)
+     * ASSUMED: nothing is written to the files till this returns, and only one snapshot is in progress
+     *
+     * No file is copied here. A file which exists now is copied to "dir" either by the first write to it
+     * (before the write, refer "snapshot_file_if_pending(...)") or by "snapshot_remaining_files()", whichever
+     * comes first. The copy is a reflink if the filesystem supports it. Otherwise, only the live entries of the
+     * file are read in memory (as a KVStoreFileImage) while the lock of the file is held, and the file is written
+     * to "dir" later by "snapshot_remaining_files()" without holding any lock. So, a write is never blocked
+     * for writing a copy of the file.
+     * The MANIFEST of the current geometry is written to "dir", and no file is split till this returns (a split
+     * in progress is waited for)
+     * */
+    void begin_snapshot(const std::string &dir) {
+        std::lock_guard split_lock(split_mutex);
+        snapshot_dir = dir;
+        snapshot_geometry = geometry();
+        snapshot_reflink_supported = true;
+        snapshot_reflinked = snapshot_imaged = snapshot_failed = 0;
+        if (not write_manifest(dir + "/" + MANIFEST_FILE_NAME, snapshot_geometry)) {
+            ++snapshot_failed;
+            log_error("Snapshot: unable to write \"" + dir + "/" + MANIFEST_FILE_NAME + "\"");
+        }
+        for (uint64_t i = 0; i < snapshot_geometry.file_count(); ++i) {
+            std::shared_lock read_lock(file_locks[i]);
+            snapshot_pending[i].store(file_exists_status[i], std::memory_order_release);
+        }
+    }
+
+    /* Copy the files which have not been modified since "begin_snapshot(...)" one at a time, and write the
+     * KVStoreFileImage of every file to "snapshot_dir" */
+    void snapshot_remaining_files() {
+        for (uint64_t i = 0; i < snapshot_geometry.file_count(); ++i) {
+            if (snapshot_pending[i].load(std::memory_order_acquire)) {
+                std::shared_lock read_lock(file_locks[i]);
+                snapshot_file_if_pending(i);
+            }
+            write_snapshot_images();
+        }
+    }
+
+    /* ASSUMED: "snapshot_remaining_files()" has returned, so no one else uses the files in "snapshot_dir"
+     *        : all entries of "batch" belong to the file "file_idx" as per "snapshot_geometry"
+     *
+     * Same as "write_batch_to_db(...)", but the copy of the file in "snapshot_dir" is written
+     * */
+    void write_batch_to_snapshot(uint64_t file_idx, const std::vector<KVStoreBatchEntry> &batch) const {
+        if (batch.empty()) return;
+
+        const std::string fileName = snapshot_dir + "/" + file_name(file_idx);
+        std::fstream fs;
+        if (does_file_exists(fileName.c_str())) {
+            fs.open(fileName, std::ios::in | std::ios::out | std::ios::binary);
+        } else {
+            // The file did NOT exist when the snapshot was started
+            if (std::all_of(batch.begin(), batch.end(), [](const KVStoreBatchEntry &i) { return i.to_delete; }))
+                return;
+            fs.open(fileName, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            if (fs) write_new_file(fs, file_table_len);
+        }
+        if ((not fs.is_open()) || fs.fail()) {
+            log_error("Unable to open Snapshot File: \"" + fileName + "\"");
+            return;
+        }
+        for (const KVStoreBatchEntry &i: batch) {
+            if (i.to_delete) delete_from_db_file(fs, i.message);
+            else write_to_db_file(fs, i.message);
+        }
+        fs.close();
+    }
+
+    void read_db_file(const uint64_t num) const {
+        if (num >= geometry().file_count() || (not file_exists_status[num])) {
+            log_error("read_db_file(" + std::to_string(num) + ") file does not exists");
+            return;
+        }
+
+        log_success("READING: " + std::to_string(num), true);
+
+        std::fstream fs;
+        fs.open(file_name(num), std::ios::in | std::ios::binary);
+        if ((not fs.is_open()) || fs.fail()) {
+            log_error(std::string("") + "Unable to open Database File: \"" + file_name(num) + "\"");
+            return;
+        }
+
+        uint64_t leftIdx, rightIdx, hash1_file, hash2_file;
+        std::array<char, SIZE_OF_ONE_ENTRY> entry_file{};
+        KVMessage entry;
+
+        int32_t i = 0;
+        fs.seekg(get_seek_val(0));
+        while (fs.is_open() && fs.read(entry_file.data(), SIZE_OF_ONE_ENTRY)) {
+            ++i;
+            std::memcpy(&leftIdx, entry_file.data(), sizeof(uint64_t));
+            std::memcpy(&rightIdx, entry_file.data() + sizeof(uint64_t), sizeof(uint64_t));
+            if (leftIdx == rightIdx && leftIdx == MAX_UINT64) {
+                continue;
+            }
+            std::memcpy(&hash1_file, entry_file.data() + OFFSET_HASH1, sizeof(uint64_t));
+            std::memcpy(&hash2_file, entry_file.data() + OFFSET_HASH1 + sizeof(uint64_t), sizeof(uint64_t));
+            decode_value(entry_file.data() + OFFSET_VALUE_AREA, &entry);
+
+            log_info("tellg() = " + std::to_string(fs.tellg()), true);
+            log_info(std::to_string(i - 1) + " --> "
+                     + std::to_string(leftIdx) + "," + std::to_string(rightIdx)
+                     + "," + std::to_string(hash1_file) + "," + std::to_string(hash2_file)
+                     + "," + std::string(entry_file.data() + OFFSET_KEY, strnlen(entry_file.data() + OFFSET_KEY, 256))
+                     + "," + std::string(entry.value, strnlen(entry.value, 256))
+                     + "," + std::to_string(entry.expires_at)
+                     + ((is_entry_crc_valid(entry_file.data())) ? "" : ", CRC mismatch"));
+        }
+
+        log_info(std::string() + "File entries count = " + std::to_string(i), true);
+        fs.close();
+    }
+
+    // Offsets of the fields inside an entry, refer "Single Entry in file" above
+    static const int_fast32_t OFFSET_LINKS_CRC = 2 * sizeof(uint64_t);
+    static const int_fast32_t OFFSET_RECORD_CRC = OFFSET_LINKS_CRC + sizeof(uint32_t);
+    static const int_fast32_t OFFSET_HASH1 = OFFSET_RECORD_CRC + sizeof(uint32_t);
+    static const int_fast32_t OFFSET_KEY = OFFSET_HASH1 + 2 * sizeof(uint64_t);
+    static const int_fast32_t OFFSET_VALUE_AREA = OFFSET_KEY + 256;
+    static const int_fast32_t SIZE_OF_ONE_ENTRY = OFFSET_VALUE_AREA + SIZE_OF_VALUE_AREA;
+
+    // The header takes the space of one entry, so the entries stay aligned the same way as without it
+    static const int_fast32_t FILE_HEADER_LEN = SIZE_OF_ONE_ENTRY;
+    static_assert(sizeof(KVStoreFileHeader) <= FILE_HEADER_LEN);
+
+    // Layouts of the format version 0 which are upgraded on start, refer "check_file_format(...)"
+    //     - 544 byte entries, without a value header (the files of the first release)
+    //     - 552 byte entries, with {codec, stored_len}, i.e. since the compression of the Values
+    //     - 560 byte entries, with {codec, stored_len, expires_at}, i.e. since the TTL of the Keys
+    //     - 568 byte entries, with {codec, stored_len, expires_at, version}
+    static constexpr std::array<KVStoreLegacyLayout, 4> LEGACY_LAYOUTS{{
+            {0}, {offsetof(KVStoreValueHeader, expires_at)}, {offsetof(KVStoreValueHeader, version)},
+            {sizeof(KVStoreValueHeader)}
+    }};
+
+    // Version of the records upgraded from a layout without versions. It is less than every version given by
+    // "KVCache::next_version(...)", so a Key written again never gets it back
+    static constexpr uint64_t LEGACY_RECORD_VERSION = 1;
+
+    static inline uint64_t get_seek_val(uint64_t idx) {
+        // Division by 8 is necessary as file read/write pointer moves by bytes not bits
+        return FILE_HEADER_LEN + idx * SIZE_OF_ONE_ENTRY;
+    }
+
+private:
+    // REFER: https://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
+    static inline bool does_file_exists(const char *name) {
+        struct stat buffer{};
+        return (stat(name, &buffer) == 0);
+    }
+
+    static inline bool is_file_entry_empty(const uint64_t leftIdx, const uint64_t rightIdx) {
+        return (leftIdx == rightIdx && leftIdx == MAX_UINT64);
+    }
+
+    // Name of the file "file_idx" inside the "db" directory
+    static inline std::string file_name(uint64_t file_idx) {
+        return std::to_string(file_idx);
+    }
+
+    /* Acquire the lock (std::shared_lock or std::unique_lock) of the file to which "hash1" belongs and store the
+     * index of the file in "file_idx", same as "KVCache::lock_bucket(...)" */
+    template<typename LockType>
+    LockType lock_file(uint64_t hash1, uint64_t &file_idx) {
+        while (true) {
+            file_idx = geometry().file_of(hash1);
+            LockType lock(file_locks[file_idx]);
+
+            // Verify that the file was not split before the lock was acquired
+            if (file_idx == geometry().file_of(hash1)) return lock;
+        }
+    }
+
+    /* Set the geometry from the MANIFEST. If there is no MANIFEST, it is created with the geometry set by
+     * "set_geometry(...)", or with the default geometry if the files were created before the MANIFEST existed
+     * Returns: false if the MANIFEST is corrupt, or the geometry is NOT valid */
+    bool init_geometry() {
+        KVStoreGeometry geometry{hash_table_len, file_table_len, hash_table_len, 0};
+        if (does_file_exists(MANIFEST_FILE_NAME)) {
+            if (not read_manifest(MANIFEST_FILE_NAME, geometry)) {
+                log_error(std::string("Corrupt \"") + MANIFEST_FILE_NAME + "\" of the Persistent Storage");
+                return false;
+            }
+            if (geometry.hash_table_len != hash_table_len || geometry.file_table_len != file_table_len) {
+                log_warning(std::string("KVStore: the geometry of the existing \"") + MANIFEST_FILE_NAME
+                            + "\" is used, NOT the configured one");
+            }
+        } else {
+            for (uint64_t i = 0; i < DEFAULT_HASH_TABLE_LEN; ++i) {
+                if (not does_file_exists(file_name(i).c_str())) continue;
+                geometry = {DEFAULT_HASH_TABLE_LEN, DEFAULT_FILE_TABLE_LEN, DEFAULT_HASH_TABLE_LEN, 0};
+                break;
+            }
+            // Otherwise, all the Keys of a file would be in a few of its slots
+            if (std::gcd(geometry.file_table_len, 2 * geometry.hash_table_len) != 1) {
+                log_error("FILE_TABLE_LEN = " + std::to_string(geometry.file_table_len)
+                          + " must be odd, and have no common factor with HASH_TABLE_LEN = "
+                          + std::to_string(geometry.hash_table_len));
+                return false;
+            }
+            if (not write_manifest(MANIFEST_FILE_NAME, geometry)) {
+                log_error(std::string("Unable to write \"") + MANIFEST_FILE_NAME + "\"");
+                return false;
+            }
+        }
+
+        hash_table_len = geometry.hash_table_len;
+        file_table_len = geometry.file_table_len;
+        geometry_state = (geometry.level_len << 32U) | geometry.split_idx;
+        log_info("KVStore: files = " + std::to_string(geometry.file_count()) + ", slots per file = "
+                 + std::to_string(geometry.file_table_len), true);
+        return true;
+    }
+
+    /* MANIFEST has one "KEY VALUE" pair per line, same as "KVServer.conf"
+     * Returns: false if "fileName" could NOT be read, or it is NOT a valid geometry */
+    static bool read_manifest(const char *fileName, KVStoreGeometry &geometry) {
+        std::ifstream fs(fileName, std::ios::in);
+        std::string key;
+        uint64_t val, formatVersion = 0;
+        geometry = {0, 0, 0, 0};
+        while (fs >> key >> val) {
+            if (key == "FORMAT_VERSION") formatVersion = val;
+            else if (key == "HASH_TABLE_LEN") geometry.hash_table_len = val;
+            else if (key == "FILE_TABLE_LEN") geometry.file_table_len = val;
+            else if (key == "LEVEL_LEN") geometry.level_len = val;
+            else if (key == "SPLIT_IDX") geometry.split_idx = val;
+        }
+        if (formatVersion != KVStoreFileHeader::FORMAT_VERSION || geometry.hash_table_len == 0
+            || geometry.file_table_len == 0 || geometry.level_len % geometry.hash_table_len != 0
+            || geometry.split_idx >= geometry.level_len || geometry.level_len > 0xFFFFFFFFULL) {
+            return false;
+        }
+        const uint64_t levels = geometry.level_len / geometry.hash_table_len;
+        return (levels & (levels - 1)) == 0;  // power of 2
+    }
+
+    /* The MANIFEST is written next to "fileName" and renamed, so it is either the old or the new one
+     * Returns: false if it could NOT be written */
+    static bool write_manifest(const std::string &fileName, const KVStoreGeometry &geometry) {
+        const std::string tempFileName = fileName + ".tmp";
+        std::ofstream fs(tempFileName, std::ios::out | std::ios::trunc);
+        fs << "FORMAT_VERSION " << KVStoreFileHeader::FORMAT_VERSION
+           << "\nHASH_TABLE_LEN " << geometry.hash_table_len << "\nFILE_TABLE_LEN " << geometry.file_table_len
+           << "\nLEVEL_LEN " << geometry.level_len << "\nSPLIT_IDX " << geometry.split_idx << "\n";
+        fs.close();
+        if (fs.fail() || std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /* Encode "ptr->value" as the value area of an entry, i.e. KVStoreValueHeader followed by the encoded Value
+     * Returns: number of bytes of "area" which are used, the remaining bytes are left unchanged
+     * */
+    uint32_t encode_value(const struct KVMessage *ptr, char *area) const {
+        // Values are '\0' padded to 256 bytes, the padding is NOT stored
+        const char *value = ptr->value;
+        KVStoreValueHeader header{KVStoreValueHeader::Codec_RAW, 256, ptr->expires_at, ptr->version};
+        while (header.stored_len > 0 && value[header.stored_len - 1] == '\0') --header.stored_len;
+
+        char *payload = area + sizeof(KVStoreValueHeader);
+        if (value_compression && header.stored_len >= value_compression_min_len) {
+            // Keep the compressed Value only if it is smaller than the RAW Value
+            const uint32_t compressedLen = LZ4BlockCodec::compress(value, header.stored_len, payload,
+                                                                   header.stored_len - 1);
+            if (compressedLen != 0) header = {KVStoreValueHeader::Codec_LZ4, compressedLen, ptr->expires_at, ptr->version};
+        }
+        if (header.codec == KVStoreValueHeader::Codec_RAW) std::memcpy(payload, value, header.stored_len);
+
+        std::memcpy(area, &header, sizeof(KVStoreValueHeader));
+        return sizeof(KVStoreValueHeader) + header.stored_len;
+    }
+
+    /* Decode the value area "area" of an entry into "ptr->value" (256 bytes, '\0' padded) and set
+     * "ptr->expires_at", "ptr->version"
+     *
+     * Returns: false if the value area is corrupt
+     * */
+    static bool decode_value(const char *area, struct KVMessage *ptr) {
+        KVStoreValueHeader header{};
+        char *value = ptr->value;
+        std::memcpy(&header, area, sizeof(KVStoreValueHeader));
+        const char *payload = area + sizeof(KVStoreValueHeader);
+        ptr->expires_at = header.expires_at;
+        ptr->version = header.version;
+        if (header.stored_len > 256) {
+            log_error("    Corrupt value header, stored_len = " + std::to_string(header.stored_len));
+            return false;
+        }
+
+        int64_t valueLen = -1;
+        if (header.codec == KVStoreValueHeader::Codec_RAW) {
+            std::memcpy(value, payload, header.stored_len);
+            valueLen = header.stored_len;
+        } else if (header.codec == KVStoreValueHeader::Codec_LZ4) {
+            valueLen = LZ4BlockCodec::decompress(payload, header.stored_len, value, 256);
+        }
+        if (valueLen < 0) {
+            log_error("    Corrupt value, codec = " + std::to_string(header.codec));
+            return false;
+        }
+        std::memset(value + valueLen, 0, 256 - valueLen);
+        return true;
+    }
+
+    static inline uint32_t links_crc(uint64_t leftIdx, uint64_t rightIdx) {
+        const uint64_t links[2] = {leftIdx, rightIdx};
+        return CRC32C::compute(links, sizeof(links));
+    }
+
+    /* "record" is the part of an entry from hash1, refer "Single Entry in file" above
+     * NOTE: the unused bytes of the value area are NOT covered, as they are not written */
+    static inline uint32_t record_crc(const char *record) {
+        KVStoreValueHeader header{};
+        std::memcpy(&header, record + (OFFSET_VALUE_AREA - OFFSET_HASH1), sizeof(KVStoreValueHeader));
+        return CRC32C::compute(record, OFFSET_VALUE_AREA - OFFSET_HASH1 + sizeof(KVStoreValueHeader)
+                                       + std::min<uint32_t>(header.stored_len, 256));
+    }
+
+    /* "entry" is a complete entry in memory
+     * Returns: true if the links and the record of "entry" match their CRC (a blank entry always matches) */
+    static inline bool is_entry_crc_valid(const char *entry) {
+        uint64_t leftIdx, rightIdx;
+        uint32_t crc[2];
+        std::memcpy(&leftIdx, entry, sizeof(uint64_t));
+        std::memcpy(&rightIdx, entry + sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(crc, entry + OFFSET_LINKS_CRC, sizeof(crc));
+        return is_file_entry_empty(leftIdx, rightIdx)
+               || (crc[0] == links_crc(leftIdx, rightIdx) && crc[1] == record_crc(entry + OFFSET_HASH1));
+    }
+
+    /* Read {leftIdx, rightIdx, hash1, hash2} of the entry "idx", the get pointer of "fs" is left at its Key
+     * Returns: false if the entry could NOT be read or its links do NOT match their CRC (i.e. the links must NOT
+     *          be followed), the file has to be repaired by "verify_and_repair_files(...)"
+     * */
+    static bool read_entry_head(std::fstream &fs, uint64_t idx, uint64_t &leftIdx, uint64_t &rightIdx,
+                                uint64_t &hash1, uint64_t &hash2) {
+        char head[OFFSET_KEY];
+        fs.seekg(static_cast<std::streamoff>(get_seek_val(idx)));
+        if (not fs.read(head, OFFSET_KEY)) {
+            fs.clear();
+            log_error("    Unable to read entry = " + std::to_string(idx));
+            return false;
+        }
+        uint32_t linksCrc;
+        std::memcpy(&leftIdx, head, sizeof(uint64_t));
+        std::memcpy(&rightIdx, head + sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&linksCrc, head + OFFSET_LINKS_CRC, sizeof(uint32_t));
+        std::memcpy(&hash1, head + OFFSET_HASH1, sizeof(uint64_t));
+        std::memcpy(&hash2, head + OFFSET_HASH1 + sizeof(uint64_t), sizeof(uint64_t));
+        if (is_file_entry_empty(leftIdx, rightIdx) || linksCrc == links_crc(leftIdx, rightIdx)) return true;
+        log_error("    Corrupt links (CRC mismatch), entry = " + std::to_string(idx));
+        return false;
+    }
+
+    /* ASSUMED: the get pointer of "fs" is at the Key of an entry, i.e. "read_entry_head(...)" was just called
+     * Returns: true if the entry is of the Key "ptr->key", the get pointer of "fs" is left at its value area */
+    static inline bool is_key_at_entry(std::fstream &fs, const struct KVMessage *ptr,
+                                       uint64_t hash1_file, uint64_t hash2_file) {
+        if (hash1_file != ptr->hash1 || hash2_file != ptr->hash2) return false;
+        char key_file[256];
+        fs.read(reinterpret_cast<char *>(key_file), 256);
+        return std::equal(key_file, key_file + 256, ptr->key);
+    }
+
+    /* Read the Value of the entry "idx" into "ptr", refer "decode_value(...)"
+     * Returns: false if the record does NOT match its CRC, or the value area is corrupt */
+    static bool read_record(std::fstream &fs, uint64_t idx, struct KVMessage *ptr) {
+        char buffer[SIZE_OF_ONE_ENTRY - OFFSET_RECORD_CRC];
+        uint32_t crc;
+        fs.seekg(static_cast<std::streamoff>(get_seek_val(idx) + OFFSET_RECORD_CRC));
+        if (not fs.read(buffer, sizeof(buffer))) {
+            fs.clear();
+            log_error("    Unable to read entry = " + std::to_string(idx));
+            return false;
+        }
+        std::memcpy(&crc, buffer, sizeof(uint32_t));
+        const char *record = buffer + (OFFSET_HASH1 - OFFSET_RECORD_CRC);
+        if (crc != record_crc(record)) {
+            log_error("    Corrupt record (CRC mismatch), entry = " + std::to_string(idx));
+            return false;
+        }
+        return decode_value(record + (OFFSET_VALUE_AREA - OFFSET_HASH1), ptr);
+    }
+
+    /* Write {recordCrc, hash1, hash2, key, value area} of "ptr" to the entry "idx", in a single write
+     * "fullArea" has to be true if the entry is being appended to the file, so that the file always has
+     * complete entries. Otherwise, only the used bytes of the value area are written
+     * */
+    void write_record(std::fstream &fs, uint64_t idx, const struct KVMessage *ptr, bool fullArea) const {
+        char buffer[SIZE_OF_ONE_ENTRY - OFFSET_RECORD_CRC] = {};
+        char *record = buffer + (OFFSET_HASH1 - OFFSET_RECORD_CRC);
+        std::memcpy(record, &(ptr->hash1), sizeof(uint64_t));
+        std::memcpy(record + sizeof(uint64_t), &(ptr->hash2), sizeof(uint64_t));
+        std::memcpy(record + (OFFSET_KEY - OFFSET_HASH1), ptr->key, 256);
+        const uint32_t usedLen = encode_value(ptr, record + (OFFSET_VALUE_AREA - OFFSET_HASH1));
+        const uint32_t crc = record_crc(record);
+        std::memcpy(buffer, &crc, sizeof(uint32_t));
+
+        fs.seekp(static_cast<std::streamoff>(get_seek_val(idx) + OFFSET_RECORD_CRC));
+        fs.write(buffer, (fullArea) ? static_cast<std::streamsize>(sizeof(buffer))
+                                    : (OFFSET_VALUE_AREA - OFFSET_RECORD_CRC + usedLen));
+    }
+
+    /* Write {leftIdx, rightIdx, linksCrc} of the entry "idx", in a single write
+     * NOTE: MAX_UINT64 for both makes the entry blank */
+    static void write_links(std::fstream &fs, uint64_t idx, uint64_t leftIdx, uint64_t rightIdx) {
+        char buffer[OFFSET_RECORD_CRC];
+        const uint32_t crc = links_crc(leftIdx, rightIdx);
+        std::memcpy(buffer, &leftIdx, sizeof(uint64_t));
+        std::memcpy(buffer + sizeof(uint64_t), &rightIdx, sizeof(uint64_t));
+        std::memcpy(buffer + OFFSET_LINKS_CRC, &crc, sizeof(uint32_t));
+        fs.seekp(static_cast<std::streamoff>(get_seek_val(idx)));
+        fs.write(buffer, OFFSET_RECORD_CRC);
+    }
+
+    /* Set leftIdx (if "left" is true) or rightIdx of the entry "idx" to "val", the other link is kept */
+    static void update_link(std::fstream &fs, uint64_t idx, bool left, uint64_t val) {
+        uint64_t links[2];
+        fs.seekg(static_cast<std::streamoff>(get_seek_val(idx)));
+        fs.read(reinterpret_cast<char *>(links), sizeof(links));
+        links[(left) ? 0 : 1] = val;
+        write_links(fs, idx, links[0], links[1]);
+    }
+
+    static const std::array<char, SIZE_OF_ONE_ENTRY> &blank_entry() {
+        static const std::array<char, SIZE_OF_ONE_ENTRY> BLANK = []() {
+            std::array<char, SIZE_OF_ONE_ENTRY> entry{};
+            const uint32_t crc = links_crc(MAX_UINT64, MAX_UINT64);
+            std::fill_n(entry.data(), OFFSET_KEY, static_cast<char>(0xFF));
+            std::memcpy(entry.data() + OFFSET_LINKS_CRC, &crc, sizeof(uint32_t));
+            return entry;
+        }();
+        return BLANK;
+    }
+
+    /* Write "count" blank entries to "fs" at the current position, a chunk of entries at a time */
+    static void write_blank_entries(std::fstream &fs, uint64_t count) {
+        static constexpr uint64_t ENTRIES_PER_CHUNK = 64;
+        std::vector<char> chunk(ENTRIES_PER_CHUNK * SIZE_OF_ONE_ENTRY);
+        for (uint64_t i = 0; i < ENTRIES_PER_CHUNK; ++i)
+            std::copy(blank_entry().begin(), blank_entry().end(), chunk.data() + i * SIZE_OF_ONE_ENTRY);
+        for (uint64_t done = 0; done < count; done += ENTRIES_PER_CHUNK) {
+            const uint64_t n = std::min(ENTRIES_PER_CHUNK, count - done);
+            fs.write(chunk.data(), static_cast<std::streamsize>(n * SIZE_OF_ONE_ENTRY));
+        }
+    }
+
+    /* Write the header and "count" blank entries to the empty file "fs" */
+    void write_new_file(std::fstream &fs, uint64_t count) const {
+        char buffer[FILE_HEADER_LEN] = {};
+        KVStoreFileHeader header{};
+        std::copy_n(KVStoreFileHeader::MAGIC, sizeof(header.magic), header.magic);
+        header.format_version = KVStoreFileHeader::FORMAT_VERSION;
+        header.entry_size = SIZE_OF_ONE_ENTRY;
+        header.file_table_len = file_table_len;
+        header.header_crc = CRC32C::compute(&header, offsetof(KVStoreFileHeader, header_crc));
+        header.free_list = make_free_list(MAX_UINT64, 0);
+        std::memcpy(buffer, &header, sizeof(KVStoreFileHeader));
+        fs.write(buffer, FILE_HEADER_LEN);
+        write_blank_entries(fs, count);
+    }
+
+    static inline KVStoreFreeList make_free_list(uint64_t head, uint64_t count) {
+        KVStoreFreeList list{head, count, 0};
+        list.crc = CRC32C::compute(&list, offsetof(KVStoreFreeList, crc));
+        return list;
+    }
+
+    /* Returns: false if the free list in the header of "fs" could NOT be read or does NOT match its CRC */
+    static bool read_free_list(std::istream &fs, KVStoreFreeList &list) {
+        fs.seekg(offsetof(KVStoreFileHeader, free_list));
+        if (not fs.read(reinterpret_cast<char *>(&list), sizeof(KVStoreFreeList))) {
+            fs.clear();
+            return false;
+        }
+        return list.crc == make_free_list(list.head, list.count).crc;
+    }
+
+    static void write_free_list(std::fstream &fs, uint64_t head, uint64_t count) {
+        const KVStoreFreeList list = make_free_list(head, count);
+        fs.seekp(offsetof(KVStoreFileHeader, free_list));
+        fs.write(reinterpret_cast<const char *>(&list), sizeof(KVStoreFreeList));
+    }
+
+    /* Returns: index of a free overflow entry of "fs" which is removed from the free list, MAX_UINT64 if there
+     *          is none (i.e. the new entry has to be appended at the end of the file)
+     * NOTE: the free list is updated before the entry is used, so a crash in between only leaks the entry (till
+     *       the next "verify_and_repair_files(...)"), and the entry is checked to be blank before it is used, so
+     *       a stale free list never overwrites a live entry
+     * */
+    uint64_t pop_free_entry(std::fstream &fs) const {
+        KVStoreFreeList list{};
+        if ((not read_free_list(fs, list)) || list.head == MAX_UINT64) return MAX_UINT64;
+
+        fs.seekg(0, std::ios::end);
+        const auto entryCount = (static_cast<uint64_t>(fs.tellg()) - FILE_HEADER_LEN) / SIZE_OF_ONE_ENTRY;
+        uint64_t leftIdx = 0, rightIdx = 0, nextFree = MAX_UINT64;
+        if (list.head >= file_table_len && list.head < entryCount) {
+            fs.seekg(static_cast<std::streamoff>(get_seek_val(list.head)));
+            fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
+            fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
+            fs.seekg(static_cast<std::streamoff>(get_seek_val(list.head) + OFFSET_HASH1));
+            fs.read(reinterpret_cast<char *>(&nextFree), sizeof(uint64_t));
+        }
+        if ((not fs) || (not is_file_entry_empty(leftIdx, rightIdx))) {
+            fs.clear();
+            log_error("    Stale free list, head = " + std::to_string(list.head) + ", it is discarded");
+            write_free_list(fs, MAX_UINT64, 0);
+            return MAX_UINT64;
+        }
+        write_free_list(fs, nextFree, (list.count == 0) ? 0 : (list.count - 1));
+        return list.head;
+    }
+
+    /* Make the overflow entry "idx" of "fs" blank and add it to the free list */
+    static void push_free_entry(std::fstream &fs, uint64_t idx) {
+        KVStoreFreeList list{};
+        if (not read_free_list(fs, list)) list = make_free_list(MAX_UINT64, 0);
+
+        std::array<char, SIZE_OF_ONE_ENTRY> entry = blank_entry();
+        std::memcpy(entry.data() + OFFSET_HASH1, &list.head, sizeof(uint64_t));
+        fs.seekp(static_cast<std::streamoff>(get_seek_val(idx)));
+        fs.write(entry.data(), SIZE_OF_ONE_ENTRY);
+        write_free_list(fs, idx, list.count + 1);
+    }
+
+    /* Returns: true if the file "file_idx" has the header of the current format. A file of the format version 0
+     *          (i.e. without a header) is upgraded to the current format first, refer "upgrade_file(...)" */
+    bool check_file_format(uint64_t file_idx) const {
+        const std::string fileName = file_name(file_idx);
+        KVStoreFileHeader header{};
+        std::ifstream fs(fileName, std::ios::in | std::ios::binary);
+        fs.seekg(0, std::ios::end);
+        const auto fileBytes = static_cast<uint64_t>(fs.tellg());
+        fs.seekg(0);
+        fs.read(reinterpret_cast<char *>(&header), sizeof(KVStoreFileHeader));
+        fs.close();
+
+        if (std::equal(header.magic, header.magic + sizeof(header.magic), KVStoreFileHeader::MAGIC)) {
+            if (header.header_crc != CRC32C::compute(&header, offsetof(KVStoreFileHeader, header_crc))) {
+                log_error(std::string("Corrupt header of Database File: \"") + fileName + "\"");
+                return false;
+            }
+            if (header.format_version != KVStoreFileHeader::FORMAT_VERSION || header.entry_size != SIZE_OF_ONE_ENTRY
+                || header.file_table_len != file_table_len) {
+                log_error(std::string("Database File: \"") + fileName + "\" has format version "
+                          + std::to_string(header.format_version) + " (entry size = " + std::to_string(header.entry_size)
+                          + ", slots = " + std::to_string(header.file_table_len) + "), expected "
+                          + std::to_string(KVStoreFileHeader::FORMAT_VERSION) + " (entry size = "
+                          + std::to_string(SIZE_OF_ONE_ENTRY) + ", slots = " + std::to_string(file_table_len) + ")");
+                return false;
+            }
+            return true;
+        }
+
+        // The size of a file is NOT enough to tell its layout (e.g. 69 entries of 544 bytes = 68 entries of 552
+        // bytes), so every layout which fits the size is tried till the entries are valid for it
+        for (const auto &layout: LEGACY_LAYOUTS) {
+            if (fileBytes % layout.entry_size() != 0 || fileBytes < file_table_len * layout.entry_size()) continue;
+            const int res = upgrade_file(fileName.c_str(), fileBytes, layout);
+            if (res == Upgrade_DONE) return true;
+            if (res == Upgrade_FAILED) return false;
+        }
+        log_error(std::string("Unknown format of Database File: \"") + fileName + "\" (" + std::to_string(fileBytes)
+                  + " bytes, no header)");
+        return false;
+    }
+
+    enum EnumUpgradeResult {
+        Upgrade_DONE,
+        Upgrade_MISMATCH,  // the file does NOT have the given layout, it is left unchanged
+        Upgrade_FAILED
+    };
+
+    /* Rewrite the file "fileName" of the format version 0 with the entries of "layout" in the current format, the
+     * entries are at the same index and their CRCs are calculated. The new file replaces the old one only once it
+     * is complete
+     *
+     * Every entry is checked to be valid for "layout": it is blank, or its links are inside the file and (if it is
+     * a slot, i.e. a list head) the slot of its hash1 is its index
+     * Returns: refer "EnumUpgradeResult"
+     * */
+    int upgrade_file(const char *fileName, uint64_t fileBytes, const KVStoreLegacyLayout &layout) const {
+        const std::string tempFileName = std::string(fileName) + ".upgrade";
+        std::ifstream src(fileName, std::ios::in | std::ios::binary);
+        std::fstream dst(tempFileName, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        write_new_file(dst, 0);
+
+        static constexpr uint64_t ENTRIES_PER_CHUNK = 64;
+        const uint64_t oldSize = layout.entry_size(), count = fileBytes / oldSize;
+        std::vector<char> srcChunk(ENTRIES_PER_CHUNK * oldSize), dstChunk(ENTRIES_PER_CHUNK * SIZE_OF_ONE_ENTRY);
+        bool valid = true;
+        for (uint64_t done = 0; valid && done < count; done += ENTRIES_PER_CHUNK) {
+            const uint64_t n = std::min(ENTRIES_PER_CHUNK, count - done);
+            src.read(srcChunk.data(), static_cast<std::streamsize>(n * oldSize));
+            for (uint64_t i = 0; valid && i < n; ++i) {
+                const char *oldEntry = srcChunk.data() + i * oldSize;
+                char *entry = dstChunk.data() + i * SIZE_OF_ONE_ENTRY;
+                uint64_t leftIdx, rightIdx, hash1;
+                std::memcpy(&leftIdx, oldEntry, sizeof(uint64_t));
+                std::memcpy(&rightIdx, oldEntry + sizeof(uint64_t), sizeof(uint64_t));
+                std::memcpy(&hash1, oldEntry + OFFSET_LINKS_CRC, sizeof(uint64_t));
+                if (is_file_entry_empty(leftIdx, rightIdx)) {
+                    std::copy(blank_entry().begin(), blank_entry().end(), entry);
+                    continue;
+                }
+                valid = leftIdx < count && rightIdx < count
+                        && (done + i >= file_table_len || hash1 % file_table_len == done + i);
+                upgrade_entry(oldEntry, layout, entry);
+            }
+            dst.write(dstChunk.data(), static_cast<std::streamsize>(n * SIZE_OF_ONE_ENTRY));
+        }
+        dst.close();
+        if (not valid) {
+            std::remove(tempFileName.c_str());
+            return Upgrade_MISMATCH;
+        }
+        if (src.fail() || dst.fail() || std::rename(tempFileName.c_str(), fileName) != 0) {
+            log_error(std::string("Unable to upgrade Database File: \"") + fileName + "\"");
+            std::remove(tempFileName.c_str());
+            return Upgrade_FAILED;
+        }
+        log_success(std::string("KVStore: upgraded \"") + fileName + "\" from " + std::to_string(oldSize)
+                    + " byte entries to format version " + std::to_string(KVStoreFileHeader::FORMAT_VERSION));
+        return Upgrade_DONE;
+    }
+
+    /* Convert the live entry "oldEntry" of "layout" to "entry" of the current format, along with its CRCs
+     * The fields of the value header which "layout" does NOT have are set as for a RAW Value written without a TTL */
+    static void upgrade_entry(const char *oldEntry, const KVStoreLegacyLayout &layout, char *entry) {
+        const char *oldHeader = oldEntry + 4 * sizeof(uint64_t) + 256;
+        const char *oldValue = oldHeader + layout.value_header_len;
+        KVStoreValueHeader header{KVStoreValueHeader::Codec_RAW, 256, 0, 0};
+        std::memcpy(&header, oldHeader, layout.value_header_len);
+        if (layout.value_header_len == 0) {
+            // The Value is stored as is, its '\0' padding is NOT stored (same as "encode_value(...)")
+            while (header.stored_len > 0 && oldValue[header.stored_len - 1] == '\0') --header.stored_len;
+        }
+        if (header.version == 0) header.version = LEGACY_RECORD_VERSION;
+
+        std::fill_n(entry, SIZE_OF_ONE_ENTRY, 0);
+        std::memcpy(entry, oldEntry, OFFSET_LINKS_CRC);
+        std::memcpy(entry + OFFSET_HASH1, oldEntry + OFFSET_LINKS_CRC, OFFSET_VALUE_AREA - OFFSET_HASH1);
+        std::memcpy(entry + OFFSET_VALUE_AREA, &header, sizeof(KVStoreValueHeader));
+        std::memcpy(entry + OFFSET_VALUE_AREA + sizeof(KVStoreValueHeader), oldValue, 256);
+
+        uint64_t links[2];
+        std::memcpy(links, oldEntry, sizeof(links));
+        const uint32_t crc[2] = {links_crc(links[0], links[1]), record_crc(entry + OFFSET_HASH1)};
+        std::memcpy(entry + OFFSET_LINKS_CRC, crc, sizeof(crc));
+    }
+
+    /* ASSUMED: the caller holds the lock (reader or writer) "file_locks[file_idx]"
+     * Copy the file to "snapshot_dir" if it is pending, refer "begin_snapshot(...)"
+     * NOTE: only one thread gets "true" from the exchange, so a file is copied only once */
+    inline void snapshot_file_if_pending(uint64_t file_idx) {
+        if (not snapshot_pending[file_idx].load(std::memory_order_acquire)) return;
+        if (not snapshot_pending[file_idx].exchange(false, std::memory_order_acq_rel)) return;
+
+        if (snapshot_reflink_supported.load(std::memory_order_relaxed)) {
+            const std::string dst = snapshot_dir + "/" + file_name(file_idx);
+            if (reflink_file(file_name(file_idx).c_str(), dst.c_str())) {
+                ++snapshot_reflinked;
+                return;
+            }
+            snapshot_reflink_supported = false;
+            log_info("Snapshot: reflink is NOT supported, the live entries of the files will be copied");
+        }
+
+        KVStoreFileImage image{file_idx, 0, {}, {}};
+        std::ifstream fs(file_name(file_idx), std::ios::in | std::ios::binary);
+        fs.seekg(FILE_HEADER_LEN);
+        static constexpr int_fast32_t ENTRIES_PER_CHUNK = 64;
+        std::vector<char> chunk(ENTRIES_PER_CHUNK * SIZE_OF_ONE_ENTRY);
+        while (fs.read(chunk.data(), static_cast<std::streamsize>(chunk.size())) || fs.gcount() > 0) {
+            const int_fast32_t entryCount = fs.gcount() / SIZE_OF_ONE_ENTRY;
+            for (int_fast32_t i = 0; i < entryCount; ++i, ++image.entry_count) {
+                const char *entry = chunk.data() + i * SIZE_OF_ONE_ENTRY;
+                uint64_t leftIdx, rightIdx;
+                std::memcpy(&leftIdx, entry, sizeof(uint64_t));
+                std::memcpy(&rightIdx, entry + sizeof(uint64_t), sizeof(uint64_t));
+                if (is_file_entry_empty(leftIdx, rightIdx)) continue;
+                image.entry_indices.push_back(image.entry_count);
+                image.entries.insert(image.entries.end(), entry, entry + SIZE_OF_ONE_ENTRY);
+            }
+        }
+        if (fs.bad() || image.entry_count == 0) {
+            ++snapshot_failed;
+            log_error("Snapshot: unable to read \"" + std::string(file_name(file_idx)) + "\"");
+            return;
+        }
+        std::lock_guard lock(snapshot_images_mutex);
+        snapshot_images.push_back(std::move(image));
+    }
+
+    /* Write the KVStoreFileImages captured so far to "snapshot_dir", refer "begin_snapshot(...)" */
+    void write_snapshot_images() {
+        while (true) {
+            KVStoreFileImage image;
+            {
+                std::lock_guard lock(snapshot_images_mutex);
+                if (snapshot_images.empty()) return;
+                image = std::move(snapshot_images.front());
+                snapshot_images.pop_front();
+            }
+
+            const std::string fileName = snapshot_dir + "/" + file_name(image.file_idx);
+            std::fstream fs(fileName, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            write_new_file(fs, image.entry_count);
+            for (size_t i = 0; i < image.entry_indices.size(); ++i) {
+                fs.seekp(static_cast<std::streamoff>(get_seek_val(image.entry_indices[i])));
+                fs.write(image.entries.data() + i * SIZE_OF_ONE_ENTRY, SIZE_OF_ONE_ENTRY);
+            }
+            fs.close();
+            if (fs.fail()) {
+                ++snapshot_failed;
+                log_error("Snapshot: unable to write \"" + fileName + "\"");
+            } else {
+                ++snapshot_imaged;
+            }
+        }
+    }
+
+    /* ASSUMED: the caller holds the lock (reader or writer) "file_locks[file_idx]"
+     * Read the whole file "file_idx" (including its header) in "data", and walk all its lists. The entries of the
+     * list of slot "s" are listEntries[listStart[s]...listStart[s+1]) in the order of the list
+     *
+     * Returns: false if the file could NOT be read or one of its lists is broken, such a file is repaired by
+     *          "verify_and_repair_files(...)"
+     * */
+    bool read_file_lists(uint64_t file_idx, std::vector<char> &data, std::vector<uint64_t> &listEntries,
+                         std::vector<uint64_t> &listStart) const {
+        std::ifstream src(file_name(file_idx), std::ios::in | std::ios::binary);
+        src.seekg(0, std::ios::end);
+        data.resize((src.is_open()) ? static_cast<uint64_t>(src.tellg()) : 0);
+        const uint64_t entryCount =
+                (std::max<uint64_t>(data.size(), FILE_HEADER_LEN) - FILE_HEADER_LEN) / SIZE_OF_ONE_ENTRY;
+        src.seekg(0);
+        if ((not src.is_open()) || entryCount < file_table_len
+            || (not src.read(data.data(), static_cast<std::streamsize>(data.size())))) {
+            log_error("Unable to read Database File: \"" + file_name(file_idx) + "\"");
+            return false;
+        }
+
+        auto get_links = [&data](uint64_t idx, uint64_t &leftIdx, uint64_t &rightIdx) {
+            const char *entry = data.data() + get_seek_val(idx);
+            uint32_t crc;
+            std::memcpy(&leftIdx, entry, sizeof(uint64_t));
+            std::memcpy(&rightIdx, entry + sizeof(uint64_t), sizeof(uint64_t));
+            std::memcpy(&crc, entry + OFFSET_LINKS_CRC, sizeof(uint32_t));
+            return is_file_entry_empty(leftIdx, rightIdx) || crc == links_crc(leftIdx, rightIdx);
+        };
+
+        std::vector<bool> reached(entryCount, false);
+        listEntries.clear();
+        listStart.assign(file_table_len + 1, 0);
+        for (uint64_t s = 0; s < file_table_len; ++s) {
+            listStart[s] = listEntries.size();
+            uint64_t leftIdx, rightIdx;
+            bool broken = not get_links(s, leftIdx, rightIdx);
+            if ((not broken) && is_file_entry_empty(leftIdx, rightIdx)) continue;
+
+            uint64_t prev = s, current = rightIdx;
+            reached[s] = true;
+            listEntries.push_back(s);
+            while ((not broken) && current != s) {
+                broken = (current < file_table_len || current >= entryCount || reached[current]
+                          || (not get_links(current, leftIdx, rightIdx)) || is_file_entry_empty(leftIdx, rightIdx)
+                          || leftIdx != prev);
+                if (broken) break;
+                reached[current] = true;
+                listEntries.push_back(current);
+                prev = current;
+                current = rightIdx;
+            }
+            if (broken) {
+                log_error("Broken list in Database File: \"" + file_name(file_idx) + "\", slot = " + std::to_string(s));
+                return false;
+            }
+        }
+        listStart[file_table_len] = listEntries.size();
+        return true;
+    }
+
+    /* Lay out the entries of "data" (refer "read_file_lists(...)") for which "keep(idx)" is true as the new file
+     * "out": the first kept entry of every list is at its slot, the other kept entries are contiguous (in the order
+     * of the lists) after the first "file_table_len" entries, and the free list is empty
+     * NOTE: the records are copied as they are (along with their CRC), only the links are changed
+     * */
+    template<typename Filter>
+    void build_file_image(const std::vector<char> &data, const std::vector<uint64_t> &listEntries,
+                          const std::vector<uint64_t> &listStart, Filter keep, std::vector<char> &out) const {
+        out.assign(get_seek_val(file_table_len), 0);
+        std::copy_n(data.data(), FILE_HEADER_LEN, out.data());
+        const KVStoreFreeList freeList = make_free_list(MAX_UINT64, 0);
+        std::memcpy(out.data() + offsetof(KVStoreFileHeader, free_list), &freeList, sizeof(KVStoreFreeList));
+
+        std::vector<uint64_t> members, positions;
+        for (uint64_t s = 0; s < file_table_len; ++s) {
+            members.clear();
+            for (uint64_t i = listStart[s]; i < listStart[s + 1]; ++i)
+                if (keep(listEntries[i])) members.push_back(listEntries[i]);
+            if (members.empty()) {
+                std::copy(blank_entry().begin(), blank_entry().end(), out.data() + get_seek_val(s));
+                continue;
+            }
+
+            // The overflow entries of this list are appended to "out"
+            positions.assign(1, s);
+            for (uint64_t next = (out.size() - FILE_HEADER_LEN) / SIZE_OF_ONE_ENTRY; positions.size() < members.size();)
+                positions.push_back(next++);
+            if (members.size() > 1) out.resize(get_seek_val(positions.back() + 1));
+            for (size_t i = 0; i < members.size(); ++i) {
+                const uint64_t leftIdx = positions[(i + members.size() - 1) % members.size()];
+                const uint64_t rightIdx = positions[(i + 1) % members.size()];
+                const uint32_t crc = links_crc(leftIdx, rightIdx);
+                char *dst = out.data() + get_seek_val(positions[i]);
+                std::copy_n(data.data() + get_seek_val(members[i]), SIZE_OF_ONE_ENTRY, dst);
+                std::memcpy(dst, &leftIdx, sizeof(uint64_t));
+                std::memcpy(dst + sizeof(uint64_t), &rightIdx, sizeof(uint64_t));
+                std::memcpy(dst + OFFSET_LINKS_CRC, &crc, sizeof(uint32_t));
+            }
+        }
+    }
+
+    /* ASSUMED: the caller holds the write lock "file_locks[file_idx]"
+     * Replace the file "file_idx" with "out", which is written next to it and renamed once it is complete. If "old"
+     * is the current content of the file and the filesystem supports reflinks, the unchanged entries (most of the
+     * first "file_table_len") are shared with the old file, and only the changed entries are written
+     *
+     * Returns: false if the file could NOT be written, the old file is left as it was
+     * */
+    bool write_file_image(uint64_t file_idx, const std::vector<char> &out, const std::vector<char> *old) {
+        const std::string fileName = file_name(file_idx), tempFileName = fileName + ".rewrite";
+        const bool reflinked = (old != nullptr) && reflink_file(fileName.c_str(), tempFileName.c_str());
+        std::ofstream dst(tempFileName, std::ios::out | std::ios::binary | (reflinked ? std::ios::in : std::ios::trunc));
+        if (reflinked) {
+            dst.write(out.data(), FILE_HEADER_LEN);
+            for (uint64_t i = 0; i < file_table_len; ++i) {
+                const char *entry = out.data() + get_seek_val(i);
+                if (std::equal(entry, entry + SIZE_OF_ONE_ENTRY, old->data() + get_seek_val(i))) continue;
+                dst.seekp(static_cast<std::streamoff>(get_seek_val(i)));
+                dst.write(entry, SIZE_OF_ONE_ENTRY);
+            }
+            dst.seekp(static_cast<std::streamoff>(get_seek_val(file_table_len)));
+            dst.write(out.data() + get_seek_val(file_table_len),
+                      static_cast<std::streamsize>(out.size() - get_seek_val(file_table_len)));
+        } else {
+            dst.write(out.data(), static_cast<std::streamsize>(out.size()));
+        }
+        dst.close();
+        if (dst.fail() || (reflinked && truncate(tempFileName.c_str(), static_cast<off_t>(out.size())) != 0)
+            || std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+            log_error("Unable to write Database File: \"" + fileName + "\"");
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+        file_exists_status[file_idx] = true;
+        return true;
+    }
+
+    /* Verify the circular doubly linked list of every "inside_file_idx" of the file "file_idx", i.e.
+     *     - the list starts at "inside_file_idx", and every other entry of it is an overflow entry (i.e. its index
+     *       is at least "file_table_len") inside the file whose "slot_of(hash1)" is "inside_file_idx"
+     *     - "leftIdx" of every entry is the entry whose "rightIdx" leads to it, and no entry is visited twice
+     *     - every live overflow entry is reachable from its list
+     *     - the links and the record of every live entry match their CRC
+     * A crash in the middle of "write_to_db_file(...)" or "delete_from_db_file(...)" can break these, as an entry
+     * and the links to it are separate writes (and the stream is flushed in no particular order). A broken list is
+     * rebuilt from its entries which were reachable before the break, followed by its live entries which are NOT
+     * reachable (in the order of the file). An entry which can NOT belong to any list (wrong "inside_file_idx", or
+     * its Key is already reachable from the list) is cleared, a partially written entry at the end of the file is
+     * removed, and a file with less than "file_table_len" entries is extended with blank entries. An entry whose
+     * record does NOT match its CRC (or which belongs to some other file) is cleared, and the links which do NOT
+     * match their CRC are NOT followed.
+     * Finally, the blank entries at the end of the file are removed and the free list is rebuilt.
+     *
+     * NOTE: the whole file is read in "data" at once, and only the changed entries are written back
+     * */
+    template<typename Callback>
+    void verify_and_repair_file(uint64_t file_idx, std::vector<char> &data, KVStoreVerifyResult &result,
+                                Callback &callback) {
         std::unique_lock write_lock(file_locks[file_idx]);
+        if (not file_exists_status[file_idx]) return;
+
+        std::fstream fs;
+        fs.open(file_name(file_idx), std::ios::in | std::ios::out | std::ios::binary);
+        if ((not fs.is_open()) || fs.fail()) {
+            log_error(std::string("") + "Unable to open Database File: \"" + file_name(file_idx) + "\"");
+            ++result.files_failed;
+            return;
+        }
+        // NOTE: the header has been checked by "init_kvstore()"
+        fs.seekg(0, std::ios::end);
+        const auto fileBytes = static_cast<uint64_t>(fs.tellg());
+        const uint64_t entryBytes = std::max<uint64_t>(fileBytes, FILE_HEADER_LEN) - FILE_HEADER_LEN;
+        const uint64_t storedCount = entryBytes / SIZE_OF_ONE_ENTRY;
+        const uint64_t entryCount = std::max<uint64_t>(storedCount, file_table_len);
+        data.resize(entryCount * SIZE_OF_ONE_ENTRY);
+        fs.seekg(static_cast<std::streamoff>(get_seek_val(0)));
+        if (not fs.read(data.data(), static_cast<std::streamsize>(storedCount * SIZE_OF_ONE_ENTRY))) {
+            log_error(std::string("") + "Unable to read Database File: \"" + file_name(file_idx) + "\"");
+            ++result.files_failed;
+            return;
+        }
+        ++result.files;
+        result.bytes_read += fileBytes;
+        if (entryBytes % SIZE_OF_ONE_ENTRY != 0) ++result.entries_dropped;
+
+        // Fields of entry "idx": 0 = leftIdx, 1 = rightIdx
+        auto entry = [&data](uint64_t idx) { return data.data() + idx * SIZE_OF_ONE_ENTRY; };
+        auto get = [&entry](uint64_t idx, int_fast32_t field) {
+            uint64_t val;
+            std::memcpy(&val, entry(idx) + field * sizeof(uint64_t), sizeof(uint64_t));
+            return val;
+        };
+        const KVStoreGeometry geometry = this->geometry();
+        auto get_hash1 = [&entry](uint64_t idx) {
+            uint64_t hash1;
+            std::memcpy(&hash1, entry(idx) + OFFSET_HASH1, sizeof(uint64_t));
+            return hash1;
+        };
+        auto get_slot = [&geometry, &get_hash1](uint64_t idx) { return geometry.slot_of(get_hash1(idx)); };
+        auto set_links = [&entry](uint64_t idx, uint64_t leftIdx, uint64_t rightIdx) {
+            const uint32_t crc = links_crc(leftIdx, rightIdx);
+            std::memcpy(entry(idx), &leftIdx, sizeof(uint64_t));
+            std::memcpy(entry(idx) + sizeof(uint64_t), &rightIdx, sizeof(uint64_t));
+            std::memcpy(entry(idx) + OFFSET_LINKS_CRC, &crc, sizeof(uint32_t));
+        };
+        auto is_live = [&get](uint64_t idx) { return not is_file_entry_empty(get(idx, 0), get(idx, 1)); };
+        auto are_links_valid = [&get, &entry](uint64_t idx) {
+            uint32_t crc;
+            std::memcpy(&crc, entry(idx) + OFFSET_LINKS_CRC, sizeof(uint32_t));
+            return crc == links_crc(get(idx, 0), get(idx, 1));
+        };
+        auto is_same_key = [&entry](uint64_t a, uint64_t b) {
+            // hash1, hash2 and Key
+            return std::equal(entry(a) + OFFSET_HASH1, entry(a) + OFFSET_VALUE_AREA, entry(b) + OFFSET_HASH1);
+        };
+
+        std::vector<bool> dirty(entryCount, false);  // entries to be written back
+        auto clear = [&](uint64_t idx) {
+            std::copy(blank_entry().begin(), blank_entry().end(), entry(idx));
+            dirty[idx] = true;
+        };
+        for (uint64_t i = storedCount; i < entryCount; ++i) clear(i);
+
+        // 0. Entries whose record does NOT match its CRC (e.g. a partially written Value), and the entries moved
+        //    to another file by a split which did NOT complete, refer "split_file_if_required(...)"
+        for (uint64_t i = 0; i < storedCount; ++i) {
+            uint32_t crc;
+            std::memcpy(&crc, entry(i) + OFFSET_RECORD_CRC, sizeof(uint32_t));
+            if (is_live(i) && (crc != record_crc(entry(i) + OFFSET_HASH1)
+                               || geometry.file_of(get_hash1(i)) != file_idx)) {
+                clear(i);
+                ++result.entries_dropped;
+            }
+        }
+
+        // 1. Walk every list, the reachable entries of list "s" are listEntries[listStart[s]...listStart[s+1])
+        std::vector<bool> reached(entryCount, false), broken(file_table_len, false);
+        std::vector<uint64_t> listEntries, listStart(file_table_len + 1, 0);
+        for (uint64_t s = 0; s < file_table_len; ++s) {
+            listStart[s] = listEntries.size();
+            if (not is_live(s)) continue;
+            if (get_slot(s) != s) {
+                clear(s);
+                ++result.entries_dropped;
+                continue;
+            }
+
+            ++result.lists;
+            reached[s] = true;
+            listEntries.push_back(s);
+            if (not are_links_valid(s)) {
+                broken[s] = true;
+                continue;
+            }
+            uint64_t prev = s, next = get(s, 1);
+            while (next != s) {
+                if (next < file_table_len || next >= entryCount || reached[next] || (not is_live(next))
+                    || (not are_links_valid(next)) || get_slot(next) != s || get(next, 0) != prev) {
+                    broken[s] = true;
+                    break;
+                }
+                reached[next] = true;
+                listEntries.push_back(next);
+                prev = next;
+                next = get(next, 1);
+            }
+            if (get(s, 0) != prev) broken[s] = true;
+        }
+        listStart[file_table_len] = listEntries.size();
+
+        // 2. Live overflow entries which are NOT reachable from their list
+        std::vector<std::pair<uint64_t, uint64_t>> orphans;  // {inside_file_idx, idx}
+        for (uint64_t i = file_table_len; i < entryCount; ++i) {
+            if (reached[i] || (not is_live(i))) continue;
+            orphans.emplace_back(get_slot(i), i);
+            broken[orphans.back().first] = true;
+        }
+        std::stable_sort(orphans.begin(), orphans.end(),
+                         [](const auto &a, const auto &b) { return a.first < b.first; });
+
+        // 3. Rebuild the broken lists
+        std::vector<uint64_t> members;
+        auto orphanIter = orphans.begin();
+        for (uint64_t s = 0; s < file_table_len; ++s) {
+            if (not broken[s]) continue;
+            ++result.lists_repaired;
+            members.assign(listEntries.begin() + static_cast<int64_t>(listStart[s]),
+                           listEntries.begin() + static_cast<int64_t>(listStart[s + 1]));
+            for (; orphanIter != orphans.end() && orphanIter->first == s; ++orphanIter) {
+                const uint64_t idx = orphanIter->second;
+                if (std::any_of(members.begin(), members.end(), [&](uint64_t m) { return is_same_key(m, idx); })) {
+                    clear(idx);
+                    ++result.entries_dropped;
+                    continue;
+                }
+                ++result.entries_relinked;
+                if (members.empty()) {
+                    // The first entry of a list is always at "inside_file_idx"
+                    std::copy_n(entry(idx), SIZE_OF_ONE_ENTRY, entry(s));
+                    clear(idx);
+                    members.push_back(s);
+                    ++result.lists;
+                } else {
+                    members.push_back(idx);
+                }
+            }
+
+            for (size_t i = 0; i < members.size(); ++i) {
+                set_links(members[i], members[(i + members.size() - 1) % members.size()],
+                          members[(i + 1) % members.size()]);
+                dirty[members[i]] = true;
+            }
+        }
+
+        // 4. Feed the in-memory indexes
+        for (uint64_t i = 0; i < entryCount; ++i) {
+            if (not is_live(i)) continue;
+            ++result.entries;
+            KVStoreValueHeader header{};
+            std::memcpy(&header, entry(i) + OFFSET_VALUE_AREA, sizeof(KVStoreValueHeader));
+            callback(entry(i) + OFFSET_KEY, header);
+        }
+
+        // 5. The blank entries at the end of the file are removed, and the other blank overflow entries form the
+        //    free list (in the order of the file)
+        uint64_t keptCount = entryCount;
+        while (keptCount > file_table_len && (not is_live(keptCount - 1))) --keptCount;
+        uint64_t freeHead = MAX_UINT64, freeCount = 0;
+        for (uint64_t i = keptCount; i-- > file_table_len;) {
+            if (is_live(i)) continue;
+            if (std::memcmp(entry(i) + OFFSET_HASH1, &freeHead, sizeof(uint64_t)) != 0) {
+                std::memcpy(entry(i) + OFFSET_HASH1, &freeHead, sizeof(uint64_t));
+                dirty[i] = true;
+            }
+            freeHead = i;
+            ++freeCount;
+        }
+        result.entries_free += freeCount;
+        KVStoreFreeList freeList{};
+        if ((not read_free_list(fs, freeList)) || freeList.head != freeHead || freeList.count != freeCount)
+            write_free_list(fs, freeHead, freeCount);
+
+        // 6. Write back the changed entries, and truncate the file
+        for (uint64_t i = 0; i < keptCount;) {
+            if (not dirty[i]) {
+                ++i;
+                continue;
+            }
+            uint64_t runEnd = i;
+            while (runEnd < keptCount && dirty[runEnd]) ++runEnd;
+            fs.seekp(static_cast<std::streamoff>(get_seek_val(i)));
+            fs.write(entry(i), static_cast<std::streamsize>((runEnd - i) * SIZE_OF_ONE_ENTRY));
+            i = runEnd;
+        }
+        fs.close();
+        if (fileBytes > get_seek_val(keptCount)) result.bytes_reclaimed += fileBytes - get_seek_val(keptCount);
+        if (fs.fail() || (fileBytes > get_seek_val(keptCount)
+                          && truncate(file_name(file_idx).c_str(), static_cast<off_t>(get_seek_val(keptCount))) != 0)) {
+            log_error(std::string("") + "Unable to repair Database File: \"" + file_name(file_idx) + "\"");
+            ++result.files_failed;
+        }
+    }
 
-        if (not file_exists_status.test(file_idx)) {
+    /* ASSUMED: the caller holds the write lock "file_locks[file_idx]"
+     * Creates the file if it does not exists
+     *
+     * Returns: true if "fs" was successfully opened for reading and writing
+     * */
+    bool open_db_file_for_write(uint64_t file_idx, std::fstream &fs) {
+        if (not file_exists_status[file_idx]) {
             // File does NOT exists
             // Create the file
-            file_exists_status.set(file_idx);
+            file_exists_status[file_idx] = true;
 
             // REFER: https://www.geeksforgeeks.org/c-program-to-create-a-file/
             // std::ios::app causes the file to be created BUT will insert all content
             // to the end of the file even after performing seekp(...)
-            fs.open(kvStoreFileNames[file_idx], std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            fs.open(file_name(file_idx), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
 
             if (!fs) {
-                log_error(std::string() + "    Failed to create file: \"" + kvStoreFileNames[file_idx] + "\"");
+                log_error(std::string() + "    Failed to create file: \"" + file_name(file_idx) + "\"");
             } else {
-                log_info("    File successfully CREATED: " + std::string(kvStoreFileNames[file_idx]));
-
-                // IMPORTANT: insert "FILE_TABLE_LEN" number of blank entries
-                for (uint32_t i = 0; i < FILE_TABLE_LEN; ++i) {
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                    fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                }
+                log_info("    File successfully CREATED: " + std::string(file_name(file_idx)));
+
+                // IMPORTANT: insert the header and "file_table_len" number of blank entries
+                write_new_file(fs, file_table_len);
             }
             // fs.close();
         } else {
-            fs.open(kvStoreFileNames[file_idx], std::ios::in | std::ios::out | std::ios::binary);
+            fs.open(file_name(file_idx), std::ios::in | std::ios::out | std::ios::binary);
         }
 
         if ((not fs.is_open()) || fs.fail() || fs.eof()) {
             log_error("(not fs.is_open()) OR fs.fail() OR fs.eof() for file = " +
-                      std::string(kvStoreFileNames[file_idx]));
-            return;
+                      std::string(file_name(file_idx)));
+            return false;
         }
-        log_info(std::string() + "    File successfully OPENED: " + kvStoreFileNames[file_idx]);
+        log_info(std::string() + "    File successfully OPENED: " + file_name(file_idx));
+        return true;
+    }
 
-        const uint64_t inside_file_idx = (ptr->hash1) % FILE_TABLE_LEN;
+    /* ASSUMED: "fs" is the opened file "geometry().file_of(ptr->hash1)" and its write lock is held by the caller
+     *        : ptr has following values filled: {hash1, hash2, key, value}
+     * NOTE: nothing is written if a corrupt entry is found in the list of the Key, refer "read_entry_head(...)"
+     * */
+    void write_to_db_file(std::fstream &fs, const struct KVMessage *ptr) const {
+        const uint64_t inside_file_idx = geometry().slot_of(ptr->hash1);
 
         // NOTE: the initialization of "leftIdx" to "inside_file_idx" is VERY IMPORTANT
         uint64_t leftIdx = inside_file_idx, rightIdx = 0, hash1_file = 0, hash2_file = 0;
-        char key_file[256];
 
-        fs.seekg(get_seek_val(inside_file_idx));
-        fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
+        if (not read_entry_head(fs, inside_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) return;
 
         if (is_file_entry_empty(leftIdx, rightIdx)) {
-            log_info(std::string("    write_to_db [") + std::to_string(file_idx) + "] : is_file_entry_empty");
+            log_info(std::string("    write_to_db [") + std::to_string(geometry().file_of(ptr->hash1)) + "] : is_file_entry_empty");
             log_info(std::string() + "        inside_file_idx = " + std::to_string(inside_file_idx));
-            fs.seekp(get_seek_val(inside_file_idx));
-            leftIdx = rightIdx = inside_file_idx;
-            fs.write(reinterpret_cast<const char *>(&leftIdx), sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(&rightIdx), sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(&(ptr->hash1)), sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(&(ptr->hash2)), sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(ptr->key), 256);
-            fs.write(reinterpret_cast<const char *>(ptr->value), 256);
-
-            fs.close();
+            write_record(fs, inside_file_idx, ptr, false);
+            write_links(fs, inside_file_idx, inside_file_idx, inside_file_idx);
             return;
         }
 
         // SEARCH through the file and replace the the entry if found,
         // else create a new entry at the end of the file
 
-        if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-            fs.read(reinterpret_cast<char *>(key_file), 256);
-            if (std::equal(key_file, key_file + 256, ptr->key)) {
-                // match found
-                log_info("    First entry matched");
-                fs.write(reinterpret_cast<const char *>(ptr->value), 256);
-                fs.close();
-                return;
-            }
+        if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+            // match found
+            log_info("    First entry matched");
+            write_record(fs, inside_file_idx, ptr, false);
+            return;
         }
 
         log_info("    inside_file_idx = " + std::to_string(inside_file_idx));
@@ -250,20 +1786,12 @@ struct KVStore {
         uint64_t current_file_idx = rightIdx;
         while (current_file_idx != inside_file_idx) {
             log_info("        Working on idx = " + std::to_string(current_file_idx));
-            fs.seekg(get_seek_val(current_file_idx));
-            fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
-
-            if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-                fs.read(reinterpret_cast<char *>(key_file), 256);
-                if (std::equal(key_file, key_file + 256, ptr->key)) {
-                    // match found
-                    fs.write(reinterpret_cast<const char *>(ptr->value), 256);
-                    fs.close();
-                    return;
-                }
+            if (not read_entry_head(fs, current_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) return;
+
+            if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+                // match found
+                write_record(fs, current_file_idx, ptr, false);
+                return;
             }
 
             // This is useful when "ptr->key" is not present in the file.
@@ -275,261 +1803,143 @@ struct KVStore {
         }
 
         // No entry exists for the given key "ptr->key"
-        // So, we add a new entry at the end of the file
+        // So, we add a new entry at the end of the file (or in a free entry)
 
-        log_info("    No match found. Creating new entry at the EOF");
-        fs.seekp(0, std::ios::end);  // moves the write pointer to the end of the file
+        // A free entry (i.e. of a deleted Key) is reused if there is one
+        uint64_t new_entry_position = pop_free_entry(fs);
+        if (new_entry_position != MAX_UINT64) {
+            log_info("    No match found. Reusing free entry index = " + std::to_string(new_entry_position));
+        } else {
+            log_info("    No match found. Creating new entry at the EOF");
+            fs.seekp(0, std::ios::end);  // moves the write pointer to the end of the file
 
-        // REFER: https://www.tutorialspoint.com/tellp-in-file-handling-with-cplusplus
-        uint64_t new_entry_position = static_cast<uint64_t>(fs.tellp()) / SIZE_OF_ONE_ENTRY;
-        log_info("    EOF bytes = " + std::to_string(fs.tellp()));
-        log_info("    EOF entry index = " + std::to_string(new_entry_position));
+            // REFER: https://www.tutorialspoint.com/tellp-in-file-handling-with-cplusplus
+            new_entry_position = (static_cast<uint64_t>(fs.tellp()) - FILE_HEADER_LEN) / SIZE_OF_ONE_ENTRY;
+            log_info("    EOF bytes = " + std::to_string(fs.tellp()));
+            log_info("    EOF entry index = " + std::to_string(new_entry_position));
+        }
 
-        fs.write(reinterpret_cast<const char *>(&leftIdx), sizeof(uint64_t));
-        fs.write(reinterpret_cast<const char *>(&inside_file_idx), sizeof(uint64_t));
-        fs.write(reinterpret_cast<const char *>(&(ptr->hash1)), sizeof(uint64_t));
-        fs.write(reinterpret_cast<const char *>(&(ptr->hash2)), sizeof(uint64_t));
-        fs.write(reinterpret_cast<const char *>(ptr->key), 256);
-        fs.write(reinterpret_cast<const char *>(ptr->value), 256);
+        // The record is written before the links, and the links of the new entry before the links to it
+        write_record(fs, new_entry_position, ptr, true);
+        write_links(fs, new_entry_position, leftIdx, inside_file_idx);
 
         if (leftIdx == inside_file_idx) {
             // This was the 2nd entry inserted
             // So, leftIdx and rightIdx are to be updated for the first entry only
             log_info("        Updating leftIdx and rightIdx for the first entry with index = " +
                      std::to_string(inside_file_idx));
-
-            fs.seekp(get_seek_val(inside_file_idx));
-            fs.write(reinterpret_cast<const char *>(&new_entry_position), sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(&new_entry_position), sizeof(uint64_t));
+            write_links(fs, inside_file_idx, new_entry_position, new_entry_position);
         } else {
             // FOR the Left Hand Side entry, set pointer to FileEntry->rightIdx
-            fs.seekp(get_seek_val(leftIdx) + sizeof(uint64_t));
-            fs.write(reinterpret_cast<const char *>(&new_entry_position), sizeof(uint64_t));
+            update_link(fs, leftIdx, false, new_entry_position);
 
             // FOR the Right Hand Side entry, set pointer to FileEntry->leftIdx
-            fs.seekp(get_seek_val(inside_file_idx));
-            fs.write(reinterpret_cast<const char *>(&new_entry_position), sizeof(uint64_t));
+            update_link(fs, inside_file_idx, true, new_entry_position);
         }
-
-        fs.close();
     }
 
-    /* Returns: true if entry found in Persistent Storage and successfully deleted
-     *        : false if file does not exists or entry not found in Persistent Storage
+    /* ASSUMED: "fs" is the opened file "geometry().file_of(ptr->hash1)" and its write lock is held by the caller
+     *
+     * If "onlyIfExpired" is true, the entry is deleted ONLY if it has expired
+     * Returns: true if entry found and successfully deleted, and it had NOT expired
      * */
-    bool delete_from_db(struct KVMessage *ptr) {
-        uint64_t file_idx = (ptr->hash1) % HASH_TABLE_LEN;
-
-        // REFER: https://stackoverflow.com/questions/39185420/is-there-a-shared-lock-guard-and-if-not-what-would-it-look-like
-        std::unique_lock write_lock(file_locks[file_idx]);
-
-        if (not file_exists_status.test(file_idx)) {
-            // File does NOT exists
-            return false;
-        }
-
-        std::fstream fs;
-        fs.open(kvStoreFileNames[file_idx], std::ios::in | std::ios::out | std::ios::binary);
-        if ((not fs.is_open()) || fs.fail()) {
-            log_error(std::string("") + "Unable to open Database File: \"" + kvStoreFileNames[file_idx] + "\"");
-            return false;
-        }
-
-        uint64_t leftIdx, rightIdx, hash1_file, hash2_file, idx_of_key_to_delete;
-        char key_file[256], value_file[256];
+    bool delete_from_db_file(std::fstream &fs, const struct KVMessage *ptr, bool onlyIfExpired = false) const {
+        const uint64_t nowMs = KVMessage::current_time_ms();
+        KVStoreValueHeader header{};
+        uint64_t leftIdx, rightIdx, hash1_file, hash2_file;
 
-        const uint64_t inside_file_idx = (ptr->hash1) % FILE_TABLE_LEN;
-        fs.seekg(get_seek_val(inside_file_idx));
-        fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-        fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
+        const uint64_t inside_file_idx = geometry().slot_of(ptr->hash1);
+        if (not read_entry_head(fs, inside_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) return false;
 
         if (is_file_entry_empty(leftIdx, rightIdx)) {
-            fs.close();
             return false;
         }
 
         // First entry matches the "Key"
-        if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-            fs.read(reinterpret_cast<char *>(key_file), 256);
-            if (std::equal(key_file, key_file + 256, ptr->key)) {
-                // match found
-                fs.seekg(get_seek_val(inside_file_idx));
-
-                if (leftIdx == rightIdx && leftIdx == inside_file_idx) {
-                    // NOTE: this should be true if there is only one entry for this "inside_file_idx"
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    // NOTE: No need of clearing the key-value content as we know that the
-                    //       Doubly Linked List is empty from the value of leftIdx and rightIdx
-                    // fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                    // fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                } else if (rightIdx == MAX_UINT64) {
-                    log_error("delete_from_db(...) rightIdx==MAXUINT64 case should have been handled earlier, "
-                              "leftIdx = " + std::to_string(leftIdx) + ", rightIdx = " + std::to_string(rightIdx));
-                    return false;
+        if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+            // match found
+            fs.read(reinterpret_cast<char *>(&header), sizeof(KVStoreValueHeader));
+            const bool expired = (header.expires_at != 0 && header.expires_at <= nowMs);
+            if (onlyIfExpired && (not expired)) return false;
+
+            if (leftIdx == rightIdx && leftIdx == inside_file_idx) {
+                // NOTE: this should be true if there is only one entry for this "inside_file_idx"
+                // NOTE: No need of clearing the key-value content as we know that the
+                //       Doubly Linked List is empty from the value of leftIdx and rightIdx
+                write_links(fs, inside_file_idx, MAX_UINT64, MAX_UINT64);
+            } else if (rightIdx == MAX_UINT64) {
+                log_error("delete_from_db(...) rightIdx==MAXUINT64 case should have been handled earlier, "
+                          "leftIdx = " + std::to_string(leftIdx) + ", rightIdx = " + std::to_string(rightIdx));
+                return false;
+            } else {
+                // NOTE: More than ONE entry found
+                //       This will work even if there are only two entries
+                const uint64_t idx_of_key_to_delete = inside_file_idx, idx_of_2nd = rightIdx;
+
+                // read RHS entry of node to delete
+                uint64_t leftIdx2nd;
+                std::array<char, SIZE_OF_ONE_ENTRY> entry2nd{};
+                if (not read_entry_head(fs, idx_of_2nd, leftIdx2nd, rightIdx, hash1_file, hash2_file)) return false;
+                fs.seekg(static_cast<std::streamoff>(get_seek_val(idx_of_2nd)));
+                fs.read(entry2nd.data(), SIZE_OF_ONE_ENTRY);
+
+                // REPLACE the record of first node with the record of 2nd node (along with its CRC)
+                fs.seekp(static_cast<std::streamoff>(get_seek_val(idx_of_key_to_delete) + OFFSET_RECORD_CRC));
+                fs.write(entry2nd.data() + OFFSET_RECORD_CRC, SIZE_OF_ONE_ENTRY - OFFSET_RECORD_CRC);
+
+                // delete the RHS entry of the node to delete (i.e. idx_of_key_to_delete)
+                push_free_entry(fs, idx_of_2nd);
+
+                // update leftIdx of RHS of RHS of NodeToDelete, and rightIdx of the first node
+                // leftIdx remain unchanged for "idx_of_key_to_delete" unless it is the RHS of RHS
+                if (rightIdx == idx_of_key_to_delete) {
+                    write_links(fs, idx_of_key_to_delete, idx_of_key_to_delete, idx_of_key_to_delete);
                 } else {
-                    // NOTE: More than ONE entry found
-                    //       This will work even if there are only two entries
-                    idx_of_key_to_delete = inside_file_idx;
-
-                    // read RHS entry of node to delete
-                    fs.seekg(get_seek_val(rightIdx) + sizeof(uint64_t));
-                    fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-                    fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-                    fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
-                    fs.read(reinterpret_cast<char *>(key_file), 256);
-                    fs.read(reinterpret_cast<char *>(value_file), 256);
-
-                    // TODO: verity the below seek statement
-                    // delete the RHS entry of the node to delete (i.e. idx_of_key_to_delete)
-                    fs.seekg(-SIZE_OF_ONE_ENTRY, std::ios::cur);
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    // NOTE: No need of clearing the key-value content as we know that the
-                    //       Doubly Linked List is empty from the value of leftIdx and rightIdx
-                    // fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                    // fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-
-                    // update leftIdx of RHS of RHS of NodeToDelete
-                    fs.seekg(get_seek_val(rightIdx));
-                    fs.write(reinterpret_cast<const char *>(&idx_of_key_to_delete), sizeof(uint64_t));
-
-                    // REPLACE the content of first node with the content of 2nd node
-                    fs.seekg(get_seek_val(idx_of_key_to_delete) + sizeof(uint64_t));
-                    // leftIdx remain unchanged for "idx_of_key_to_delete"
-                    fs.write(reinterpret_cast<const char *>(&rightIdx), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&(hash1_file)), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&(hash2_file)), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(key_file), 256);
-                    fs.write(reinterpret_cast<const char *>(value_file), 256);
+                    update_link(fs, rightIdx, true, idx_of_key_to_delete);
+                    write_links(fs, idx_of_key_to_delete, leftIdx, rightIdx);
                 }
-
-                fs.close();
-                return true;
             }
+
+            return not expired;
         }
 
         uint64_t current_file_idx = rightIdx;
         while (current_file_idx != inside_file_idx) {
-            fs.seekg(get_seek_val(current_file_idx));
-            fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
-
-            if (hash1_file == ptr->hash1 && hash2_file == ptr->hash2) {
-                fs.read(reinterpret_cast<char *>(key_file), 256);
-                if (std::equal(key_file, key_file + 256, ptr->key)) {
-                    // match found
-
-                    // Works for both:
-                    // a. Last node of the Doubly Linked List is to be deleted
-                    // b. Node between head and tail of Doubly Linked List is to be deleted
-
-                    // Delete the node
-                    fs.seekg(get_seek_val(current_file_idx));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&MAX_UINT64), sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-                    fs.write(reinterpret_cast<const char *>(EMPTY_STRING), 256);
-
-                    // Update rightIdx of LHS of node to delete
-                    fs.seekg(get_seek_val(leftIdx) + sizeof(uint64_t));
-                    fs.write(reinterpret_cast<const char *>(&rightIdx), sizeof(uint64_t));
-
-                    // Update leftIdx of head node
-                    fs.seekg(get_seek_val(rightIdx));
-                    fs.write(reinterpret_cast<const char *>(&leftIdx), sizeof(uint64_t));
-
-                    fs.close();
-                    return true;
-                }
-            }
-
-            current_file_idx = rightIdx;
-        }
-
-        fs.close();
+            if (not read_entry_head(fs, current_file_idx, leftIdx, rightIdx, hash1_file, hash2_file)) return false;
 
-        // Entry not found
-        return false;
-    }
+            if (is_key_at_entry(fs, ptr, hash1_file, hash2_file)) {
+                // match found
+                fs.read(reinterpret_cast<char *>(&header), sizeof(KVStoreValueHeader));
+                const bool expired = (header.expires_at != 0 && header.expires_at <= nowMs);
+                if (onlyIfExpired && (not expired)) return false;
 
-    void read_db_file(const int32_t num) const {
-        if (not file_exists_status.test(num)) {
-            log_error("read_db_file(" + std::to_string(num) + ") file does not exists");
-            return;
-        }
+                // Works for both:
+                // a. Last node of the Doubly Linked List is to be deleted
+                // b. Node between head and tail of Doubly Linked List is to be deleted
 
-        log_success("READING: " + std::to_string(num), true);
+                // Delete the node
+                push_free_entry(fs, current_file_idx);
 
-        std::fstream fs;
-        fs.open(kvStoreFileNames[num], std::ios::in | std::ios::binary);
-        if ((not fs.is_open()) || fs.fail()) {
-            log_error(std::string("") + "Unable to open Database File: \"" + kvStoreFileNames[num] + "\"");
-            return;
-        }
+                // Update rightIdx of LHS of node to delete
+                update_link(fs, leftIdx, false, rightIdx);
 
-        uint64_t leftIdx, rightIdx, hash1_file, hash2_file;
-        char key_file[256], value_file[256];
-
-        int32_t i = 0;
-        // fs.seekg(get_seek_val(1000));
-        while (fs.is_open() && (not fs.eof())) {
-            fs.read(reinterpret_cast<char *>(&leftIdx), sizeof(uint64_t));
-            if (not(fs.is_open() && (not fs.eof()))) break;
+                // Update leftIdx of RHS of node to delete
+                update_link(fs, rightIdx, true, leftIdx);
 
-            fs.read(reinterpret_cast<char *>(&rightIdx), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash1_file)), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(&(hash2_file)), sizeof(uint64_t));
-            fs.read(reinterpret_cast<char *>(key_file), 256);
-            fs.read(reinterpret_cast<char *>(value_file), 256);
-            ++i;
-
-            if (leftIdx == rightIdx && leftIdx == MAX_UINT64) {
-                continue;
+                return not expired;
             }
 
-            log_info("tellg() = " + std::to_string(fs.tellg()), true);
-            log_info(std::to_string(i - 1) + " --> "
-                     + std::to_string(leftIdx) + "," + std::to_string(rightIdx)
-                     + "," + std::to_string(hash1_file) + "," + std::to_string(hash2_file)
-                     + "," + key_file + "," + value_file);
+            current_file_idx = rightIdx;
         }
 
-        log_info(std::string() + "File entries count = " + std::to_string(i), true);
-        fs.close();
-    }
-
-private:
-    static const int_fast32_t SIZE_OF_ONE_ENTRY = (4 * sizeof(uint64_t) + 256 + 256);
-
-    static inline uint64_t get_seek_val(uint64_t idx) {
-        // Division by 8 is necessary as file read/write pointer moves by bytes not bits
-        return idx * SIZE_OF_ONE_ENTRY;
-    }
-
-    // REFER: https://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
-    static inline bool does_file_exists(const char *name) {
-        struct stat buffer{};
-        return (stat(name, &buffer) == 0);
-    }
-
-    static inline bool is_file_entry_empty(const uint64_t leftIdx, const uint64_t rightIdx) {
-        return (leftIdx == rightIdx && leftIdx == MAX_UINT64);
+        // Entry not found
+        return false;
     }
 };
 
 KVStore kvPersistentStore = {};
 
 const int_fast32_t KVStore::SIZE_OF_ONE_ENTRY;
+const int_fast32_t KVStore::SIZE_OF_VALUE_AREA;
 
 #endif // PA_4_KEY_VALUE_STORE_KVSTORE_HPP
@@ -0,0 +1,68 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYCRC32C_HPP
+#define PA_4_KEY_VALUE_STORE_MYCRC32C_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * CRC32C (Castagnoli polynomial), used to detect the torn or corrupt entries of the Persistent Storage
+ *     REFER: https://datatracker.ietf.org/doc/html/rfc3720#appendix-B.4 (CRC32C of "123456789" is 0xE3069283)
+ *
+ * The SSE4.2 "crc32" instruction processes 8 bytes at a time, and is used if the CPU supports it. This is checked
+ * once at runtime, so the binary does NOT need "-msse4.2". Otherwise, a byte at a time table is used.
+ *     REFER: https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html#text=_mm_crc32_u64
+ *
+ * "compute(b, lenB, compute(a, lenA))" is the same as the CRC32C of "a" followed by "b"
+ * */
+struct CRC32C {
+    static uint32_t compute(const void *data, size_t len, uint32_t crc = 0) {
+        const auto *src = static_cast<const uint8_t *>(data);
+#if defined(__x86_64__)
+        static const bool hardwareSupported = __builtin_cpu_supports("sse4.2");
+        if (hardwareSupported) return ~compute_sse42(src, len, ~crc);
+#endif
+        return ~compute_table(src, len, ~crc);
+    }
+
+private:
+    static constexpr uint32_t POLYNOMIAL = 0x82F63B78U;  // 0x1EDC6F41 bit reversed
+
+    static constexpr std::array<uint32_t, 256> make_table() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j) crc = (crc & 1U) ? ((crc >> 1U) ^ POLYNOMIAL) : (crc >> 1U);
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    static uint32_t compute_table(const uint8_t *src, size_t len, uint32_t crc) {
+        static constexpr std::array<uint32_t, 256> TABLE = make_table();
+        for (size_t i = 0; i < len; ++i) crc = TABLE[(crc ^ src[i]) & 0xFFU] ^ (crc >> 8U);
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint32_t compute_sse42(const uint8_t *src, size_t len, uint32_t crc) {
+        uint64_t crc64 = crc;
+        for (; len >= sizeof(uint64_t); src += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, src, sizeof(uint64_t));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = static_cast<uint32_t>(crc64);
+        for (; len > 0; ++src, --len) crc = _mm_crc32_u8(crc, *src);
+        return crc;
+    }
+#endif
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYCRC32C_HPP
@@ -0,0 +1,148 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYCOMPRESSION_HPP
+#define PA_4_KEY_VALUE_STORE_MYCOMPRESSION_HPP
+
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Compressor/Decompressor for the LZ4 block format (no frame header, no checksum)
+ *     REFER: https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * Sequence = token (4 bits literal length, 4 bits match length - 4), extra literal length bytes, literals,
+ *            2 byte little endian offset, extra match length bytes
+ *
+ * Values of the Key-Value store are at most a few hundred bytes, so this is a simple single pass compressor
+ * with a small hash table of the 4 byte sequences seen so far (allocated on the stack, so it is thread safe).
+ * It does NOT try as hard as liblz4, but its output can be decompressed by liblz4 and vice-versa.
+ * */
+struct LZ4BlockCodec {
+    /* Returns: number of bytes written to "dst", 0 if the compressed data does not fit in "dstCapacity" */
+    static uint32_t compress(const char *src, uint32_t srcLen, char *dst, uint32_t dstCapacity) {
+        uint16_t table[HASH_TABLE_LEN];  // position + 1 of the last occurrence, 0 = empty
+        std::memset(table, 0, sizeof(table));
+
+        uint32_t ip = 0, anchor = 0, op = 0;
+        while (srcLen > MF_LIMIT && ip < srcLen - MF_LIMIT && ip < 0xFFFFU) {
+            const uint32_t seq = read_u32(src + ip);
+            const uint32_t h = hash(seq);
+            const uint32_t ref = table[h];
+            table[h] = ip + 1;
+
+            if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read_u32(src + ref - 1) != seq) {
+                ++ip;
+                continue;
+            }
+
+            // Extend the match, the last "LAST_LITERALS" bytes are always literals
+            const uint32_t matchPos = ref - 1;
+            uint32_t matchLen = MIN_MATCH;
+            while (ip + matchLen < srcLen - LAST_LITERALS && src[matchPos + matchLen] == src[ip + matchLen])
+                ++matchLen;
+
+            if (not write_sequence(src + anchor, ip - anchor, ip - matchPos, matchLen, dst, dstCapacity, op))
+                return 0;
+            ip += matchLen;
+            anchor = ip;
+        }
+
+        // Last sequence has literals only
+        if (not write_sequence(src + anchor, srcLen - anchor, 0, 0, dst, dstCapacity, op)) return 0;
+        return op;
+    }
+
+    /* Returns: number of bytes written to "dst", -1 if "src" is malformed or does not fit in "dstCapacity" */
+    static int64_t decompress(const char *src, uint32_t srcLen, char *dst, uint32_t dstCapacity) {
+        uint32_t ip = 0, op = 0;
+        while (ip < srcLen) {
+            const uint8_t token = static_cast<uint8_t>(src[ip++]);
+
+            uint32_t literalLen = token >> 4U;
+            if (literalLen == 15 && (not read_extra_len(src, srcLen, ip, literalLen))) return -1;
+            if (literalLen > srcLen - ip || literalLen > dstCapacity - op) return -1;
+            std::memcpy(dst + op, src + ip, literalLen);
+            ip += literalLen;
+            op += literalLen;
+
+            if (ip == srcLen) break;  // last sequence
+
+            if (srcLen - ip < 2) return -1;
+            const uint32_t offset = static_cast<uint8_t>(src[ip]) | (static_cast<uint8_t>(src[ip + 1]) << 8U);
+            ip += 2;
+            if (offset == 0 || offset > op) return -1;
+
+            uint32_t matchLen = token & 0x0FU;
+            if (matchLen == 15 && (not read_extra_len(src, srcLen, ip, matchLen))) return -1;
+            matchLen += MIN_MATCH;
+            if (matchLen > dstCapacity - op) return -1;
+
+            // Byte by byte, as the match may overlap the bytes being written (i.e. offset < matchLen)
+            for (uint32_t i = 0; i < matchLen; ++i, ++op) dst[op] = dst[op - offset];
+        }
+        return op;
+    }
+
+private:
+    static constexpr uint32_t MIN_MATCH = 4;
+    static constexpr uint32_t LAST_LITERALS = 5;  // block format: the last 5 bytes are always literals
+    static constexpr uint32_t MF_LIMIT = 12;  // block format: the last match starts at least 12 bytes before the end
+    static constexpr uint32_t MAX_OFFSET = 0xFFFFU;
+    static constexpr uint32_t HASH_LOG = 10;
+    static constexpr uint32_t HASH_TABLE_LEN = (1U << HASH_LOG);
+
+    static inline uint32_t read_u32(const char *p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(uint32_t));
+        return v;
+    }
+
+    static inline uint32_t hash(uint32_t seq) {
+        return (seq * 2654435761U) >> (32 - HASH_LOG);  // REFER: Knuth's multiplicative hashing
+    }
+
+    static inline bool write_extra_len(uint32_t len, char *dst, uint32_t dstCapacity, uint32_t &op) {
+        for (; len >= 255; len -= 255) {
+            if (op >= dstCapacity) return false;
+            dst[op++] = static_cast<char>(255);
+        }
+        if (op >= dstCapacity) return false;
+        dst[op++] = static_cast<char>(len);
+        return true;
+    }
+
+    static inline bool read_extra_len(const char *src, uint32_t srcLen, uint32_t &ip, uint32_t &len) {
+        uint8_t b;
+        do {
+            if (ip >= srcLen) return false;
+            b = static_cast<uint8_t>(src[ip++]);
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    /* "matchLen" = 0 for the last sequence (literals only) */
+    static bool write_sequence(const char *literals, uint32_t literalLen, uint32_t offset, uint32_t matchLen,
+                               char *dst, uint32_t dstCapacity, uint32_t &op) {
+        if (op >= dstCapacity) return false;
+        const uint32_t tokenIdx = op++;
+        uint8_t token = (literalLen >= 15) ? 0xF0U : (literalLen << 4U);
+        if (literalLen >= 15 && (not write_extra_len(literalLen - 15, dst, dstCapacity, op))) return false;
+
+        if (literalLen > dstCapacity - op) return false;
+        std::memcpy(dst + op, literals, literalLen);
+        op += literalLen;
+
+        if (matchLen != 0) {
+            if (dstCapacity - op < 2) return false;
+            dst[op++] = static_cast<char>(offset & 0xFFU);
+            dst[op++] = static_cast<char>(offset >> 8U);
+
+            const uint32_t len = matchLen - MIN_MATCH;
+            token |= (len >= 15) ? 0x0FU : len;
+            if (len >= 15 && (not write_extra_len(len - 15, dst, dstCapacity, op))) return false;
+        }
+        dst[tokenIdx] = static_cast<char>(token);
+        return true;
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYCOMPRESSION_HPP
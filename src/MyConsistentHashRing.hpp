@@ -0,0 +1,88 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYCONSISTENTHASHRING_HPP
+#define PA_4_KEY_VALUE_STORE_MYCONSISTENTHASHRING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Consistent Hashing with virtual nodes
+ *     REFER: https://www.cs.princeton.edu/courses/archive/fall09/cos518/papers/chash.pdf
+ *     REFER: https://www.allthingsdistributed.com/files/amazon-dynamo-sosp2007.pdf (section 4.2)
+ *
+ * Every node is placed at "vnodes" points on a ring of 2^64 hashes, and a Key belongs to the node of the first
+ * point at or after the hash of the Key (wrapping around). So, adding/removing one node of "n" only moves the
+ * Keys between that node and its neighbours, i.e. about "1/n" of all the Keys, and the virtual nodes spread the
+ * Keys (and the moved Keys) evenly over all the nodes.
+ *
+ * Nodes are identified by their name (e.g. "IP:PORT"), so the ring is the same on every client which uses the
+ * same set of nodes, no matter in which order they were added.
+ * NOT thread safe, the caller has to lock it.
+ * */
+struct ConsistentHashRing {
+    struct Point {
+        uint64_t hash;
+        uint32_t node;  // index in "nodes"
+
+        bool operator<(const Point &other) const {
+            return (hash != other.hash) ? (hash < other.hash) : (node < other.node);
+        }
+    };
+
+    uint32_t vnodes;
+    std::vector<std::string> nodes;  // removed nodes are left empty, so that the index of other nodes is unchanged
+    std::vector<Point> ring;  // sorted
+
+    explicit ConsistentHashRing(uint32_t vnodesPerNode = 160) : vnodes{std::max<uint32_t>(vnodesPerNode, 1)} {}
+
+    [[nodiscard]] inline bool empty() const { return ring.empty(); }
+
+    /* Returns: index of the node, to be used with "lookup(...)" and "remove(...)" */
+    uint32_t add(const std::string &name) {
+        const auto idx = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(name);
+        for (uint32_t i = 0; i < vnodes; ++i) {
+            ring.push_back({hash(name + "#" + std::to_string(i)), idx});
+        }
+        std::sort(ring.begin(), ring.end());
+        return idx;
+    }
+
+    void remove(uint32_t idx) {
+        if (idx >= nodes.size()) return;
+        nodes[idx].clear();
+        ring.erase(std::remove_if(ring.begin(), ring.end(), [idx](const Point &p) { return p.node == idx; }),
+                   ring.end());
+    }
+
+    /* ASSUMPTION: the ring is NOT empty
+     * Returns: index of the node which owns "key" */
+    [[nodiscard]] uint32_t lookup(const char *key, size_t len) const {
+        const Point p{hash(key, len), 0};
+        auto iter = std::lower_bound(ring.begin(), ring.end(), p);
+        if (iter == ring.end()) iter = ring.begin();
+        return iter->node;
+    }
+
+    /* FNV-1a followed by the finalizer of MurmurHash3, so that similar names/Keys are spread over the ring
+     *     REFER: http://www.isthe.com/chongo/tech/comp/fnv/index.html
+     *     REFER: https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp */
+    static uint64_t hash(const char *ptr, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= static_cast<uint8_t>(ptr[i]);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static inline uint64_t hash(const std::string &str) { return hash(str.data(), str.size()); }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYCONSISTENTHASHRING_HPP
@@ -0,0 +1,154 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYCOROUTINE_HPP
+#define PA_4_KEY_VALUE_STORE_MYCOROUTINE_HPP
+
+#include <coroutine>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "MyDebugger.hpp"
+
+/*
+ * C++20 coroutine helpers used to run blocking calls (i.e. Persistent Storage reads) without blocking
+ * the event loop of a worker thread
+ *     REFER: https://en.cppreference.com/w/cpp/language/coroutines
+ *     REFER: https://lewissbaker.github.io/2017/11/17/understanding-operator-co-await
+ *
+ * Flow:
+ *     1. The event loop starts a "DetachedTask" coroutine for a request
+ *     2. The coroutine does "co_await pool.run(blockingCall, &resumeQueue)", the blocking call is queued
+ *        in "AsyncBlockingPool" and the coroutine is suspended, so the event loop moves on to the next request
+ *     3. A thread of "AsyncBlockingPool" performs the blocking call, and posts the coroutine to "resumeQueue"
+ *     4. "resumeQueue" wakes up the event loop using an eventfd, and the event loop resumes the coroutine
+ *        on its own thread using "resume_all()"
+ * */
+
+/* Coroutine which starts running immediately and destroys itself once it finishes (fire and forget) */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/* Coroutines ready to be resumed by ONE event loop (one instance per worker thread) */
+struct CoroutineResumeQueue {
+    std::mutex m;
+    std::vector<std::coroutine_handle<>> handles, handlesToResume;
+
+    // Readable whenever "handles" is NOT empty, add it to the epoll instance of the event loop
+    int event_fd;
+
+    CoroutineResumeQueue() : m(), handles(), handlesToResume(), event_fd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {}
+
+    ~CoroutineResumeQueue() {
+        if (event_fd >= 0) close(event_fd);
+    }
+
+    /* Called by any thread */
+    void post(std::coroutine_handle<> handle) {
+        m.lock();
+        handles.push_back(handle);
+        m.unlock();
+
+        const uint64_t one = 1;
+        write(event_fd, &one, sizeof(uint64_t));
+    }
+
+    /* Called by the event loop ONLY */
+    void resume_all() {
+        uint64_t counter;
+        read(event_fd, &counter, sizeof(uint64_t));
+
+        m.lock();
+        handlesToResume.swap(handles);
+        m.unlock();
+
+        for (auto &handle: handlesToResume) handle.resume();
+        handlesToResume.clear();
+    }
+};
+
+/* Thread pool which performs blocking calls for coroutines */
+struct AsyncBlockingPool {
+    struct Job {
+        std::function<bool()> call;
+        bool *result;
+        std::coroutine_handle<> handle;
+        CoroutineResumeQueue *resumeQueue;
+    };
+
+    /* Returned by "run(...)", the coroutine is suspended till "call" has been performed */
+    struct Awaitable {
+        AsyncBlockingPool *pool;
+        CoroutineResumeQueue *resumeQueue;
+        std::function<bool()> call;
+        bool result;
+
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            pool->submit({std::move(call), &result, handle, resumeQueue});
+        }
+
+        [[nodiscard]] bool await_resume() const noexcept { return result; }
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    std::vector<std::thread> threads;
+
+    AsyncBlockingPool() : m(), cv(), jobs(), threads() {}
+
+    void init(uint32_t threadCount) {
+        for (uint32_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back([this]() { thread_loop(); });
+            threads.back().detach();  // the server exits using "exit(...)", so the threads are never joined
+        }
+        log_info("AsyncBlockingPool: threads = " + std::to_string(threadCount));
+    }
+
+    /* Usage (inside a coroutine): bool res = co_await pool.run([&]() { return blocking_call(); }, &resumeQueue);
+     * NOTE: "call" runs on a thread of the pool, so everything it captures by reference must stay alive
+     *       till the coroutine is resumed (i.e. use the variables of the coroutine frame) */
+    Awaitable run(std::function<bool()> call, CoroutineResumeQueue *resumeQueue) {
+        return {this, resumeQueue, std::move(call), false};
+    }
+
+    void submit(Job job) {
+        m.lock();
+        jobs.push_back(std::move(job));
+        m.unlock();
+        cv.notify_one();
+    }
+
+private:
+    void thread_loop() {
+        while (true) {
+            std::unique_lock lock(m);
+            cv.wait(lock, [this]() { return not jobs.empty(); });
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+
+            *(job.result) = job.call();
+            job.resumeQueue->post(job.handle);
+        }
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYCOROUTINE_HPP
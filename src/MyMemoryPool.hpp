@@ -38,14 +38,9 @@ struct MemoryPool {
     }
 
     ~MemoryPool() {
-        for (T *i: memoryBlockPointers) {
-            if (callConstructor) {
-                for (size_t j = 0; j < blockSize; ++j) {
-                    (i + j)->~T();
-                }
-            }
-            delete[] i;
-        }
+        // NOTE: "delete[]" calls the destructor of every object of the block, calling it here as well would
+        //       destroy the objects twice
+        for (T *i: memoryBlockPointers) delete[] i;
     }
 
     // size_t vec_at_rev(size_t idx) {
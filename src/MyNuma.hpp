@@ -0,0 +1,105 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYNUMA_HPP
+#define PA_4_KEY_VALUE_STORE_MYNUMA_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "MyDebugger.hpp"
+
+/*
+ * NUMA topology of the machine, read from sysfs so that no extra library (i.e. libnuma) is required
+ *     REFER: https://www.kernel.org/doc/html/latest/admin-guide/mm/numa_memory_policy.html
+ *     REFER: https://man7.org/linux/man-pages/man3/pthread_setaffinity_np.3.html
+ *
+ * Memory is placed on the NUMA node of the thread which touches it first (Linux default policy), so
+ * any structure which is allocated AND initialised by a thread pinned to a node lives on that node.
+ *
+ * If "/sys/devices/system/node" is not available, the whole machine is treated as a single node
+ * */
+struct NumaTopology {
+    // nodeCpus.at(i) = list of CPU ids which belong to the i'th NUMA node (only nodes having CPUs are kept)
+    std::vector<std::vector<int>> nodeCpus;
+
+    NumaTopology() : nodeCpus() {}
+
+    void init() {
+        nodeCpus.clear();
+        for (int node = 0; node < 1024; ++node) {
+            std::ifstream cpuListFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (not cpuListFile.is_open()) {
+                // Node ids are NOT guaranteed to be contiguous, but a gap this large means we are done
+                if (node >= 64) break;
+                continue;
+            }
+            std::string cpuList;
+            std::getline(cpuListFile, cpuList);
+            std::vector<int> cpus = parse_cpu_list(cpuList);
+            if (not cpus.empty()) nodeCpus.push_back(cpus);
+        }
+
+        if (nodeCpus.empty()) {
+            log_info("NumaTopology: sysfs NUMA information not found, assuming a single node");
+            std::vector<int> cpus;
+            for (int i = 0, n = static_cast<int>(std::max(1U, std::thread::hardware_concurrency())); i < n; ++i)
+                cpus.push_back(i);
+            nodeCpus.push_back(cpus);
+        }
+    }
+
+    [[nodiscard]] inline uint32_t node_count() const { return nodeCpus.size(); }
+
+    /* Returns: the CPU to which the "idx"th thread of "node" should be pinned, threads are spread
+     *          across all the CPUs of the node in Round Robin fashion */
+    [[nodiscard]] inline int get_cpu(uint32_t node, uint32_t idx) const {
+        const std::vector<int> &cpus = nodeCpus.at(node % nodeCpus.size());
+        return cpus.at(idx % cpus.size());
+    }
+
+    /* Pin the calling thread to a single CPU
+     * Returns: true on success */
+    static bool pin_current_thread_to_cpu(int cpu) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+    }
+
+    /* Pin the calling thread to all the CPUs of "node"
+     * Returns: true on success */
+    bool pin_current_thread_to_node(uint32_t node) const {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu: nodeCpus.at(node % nodeCpus.size())) CPU_SET(cpu, &cpuSet);
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) == 0;
+    }
+
+    /* Parse the kernel "cpulist" format, e.g. "0-3,8-11,16" */
+    static std::vector<int> parse_cpu_list(const std::string &cpuList) {
+        std::vector<int> cpus;
+        std::stringstream ss(cpuList);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            if (range.empty() || range == "\n") continue;
+            size_t dashPos = range.find('-');
+            try {
+                if (dashPos == std::string::npos) {
+                    cpus.push_back(std::stoi(range));
+                } else {
+                    int first = std::stoi(range.substr(0, dashPos)), last = std::stoi(range.substr(dashPos + 1));
+                    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+                }
+            } catch (const std::exception &) {
+                log_error("NumaTopology: failed to parse cpulist = \"" + cpuList + "\"");
+            }
+        }
+        return cpus;
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYNUMA_HPP
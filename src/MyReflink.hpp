@@ -0,0 +1,40 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYREFLINK_HPP
+#define PA_4_KEY_VALUE_STORE_MYREFLINK_HPP
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Copy the file "src" to "dst" (created, or truncated if it exists) using a reflink (FICLONE)
+ *
+ * Only the block map of "src" is copied, and the blocks are shared by both files till either of them is modified
+ * (copy-on-write by the filesystem), so the copy takes the same time no matter how large the file is.
+ * Supported by Btrfs, XFS (reflink=1), bcachefs, ... if both files are on the same filesystem.
+ *     REFER: https://man7.org/linux/man-pages/man2/ioctl_ficlone.2.html
+ *
+ * Returns: false if the reflink failed (e.g. NOT supported by the filesystem), "dst" may have been created
+ * */
+inline bool reflink_file(const char *src, const char *dst) {
+    const int srcFd = open(src, O_RDONLY | O_CLOEXEC);
+    if (srcFd < 0) return false;
+    struct stat srcStat{};
+    if (fstat(srcFd, &srcStat) != 0) {
+        close(srcFd);
+        return false;
+    }
+    const int dstFd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, srcStat.st_mode & 0777);
+    if (dstFd < 0) {
+        close(srcFd);
+        return false;
+    }
+
+    bool res = (ioctl(dstFd, FICLONE, srcFd) == 0);
+    if (close(dstFd) != 0) res = false;
+    close(srcFd);
+    return res;
+}
+
+#endif // PA_4_KEY_VALUE_STORE_MYREFLINK_HPP
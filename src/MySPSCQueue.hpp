@@ -0,0 +1,71 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYSPSCQUEUE_HPP
+#define PA_4_KEY_VALUE_STORE_MYSPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Bounded lock-free Single Producer Single Consumer queue (ring buffer)
+ *     REFER: https://rigtorp.se/ringbuffer/
+ *     REFER: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * ASSUMED: only ONE thread calls "push(...)" and only ONE (other) thread calls "pop(...)"
+ *        : type T is cheap to copy (e.g. a few pointers)
+ *
+ * "head" is written only by the consumer and "tail" only by the producer, so both are kept on separate
+ * cache lines. Each side also keeps a cached copy of the other side's index and reads the shared one
+ * only when the cached copy says that the queue is full/empty.
+ * */
+template<typename T>
+struct SPSCQueue {
+    static constexpr uint64_t CACHE_LINE_LEN = 64;
+
+    // Capacity is rounded up to a power of 2 so that "idx & mask" can be used instead of "idx % capacity"
+    explicit SPSCQueue(uint64_t capacity) : buffer(), mask{0}, head(0), tailCached{0}, tail(0), headCached{0} {
+        uint64_t len = 2;
+        while (len < capacity) len *= 2;
+        buffer.resize(len);
+        mask = len - 1;
+    }
+
+    /* Called by the producer ONLY
+     * Returns: false if the queue is full */
+    bool push(const T &item) {
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCached > mask) {
+            headCached = head.load(std::memory_order_acquire);
+            if (t - headCached > mask) return false;
+        }
+        buffer[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Called by the consumer ONLY
+     * Returns: false if the queue is empty */
+    bool pop(T &item) {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCached) {
+            tailCached = tail.load(std::memory_order_acquire);
+            if (h == tailCached) return false;
+        }
+        item = buffer[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> buffer;
+    uint64_t mask;
+
+    // Consumer side
+    alignas(CACHE_LINE_LEN) std::atomic_uint64_t head;
+    uint64_t tailCached;
+
+    // Producer side
+    alignas(CACHE_LINE_LEN) std::atomic_uint64_t tail;
+    uint64_t headCached;
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYSPSCQUEUE_HPP
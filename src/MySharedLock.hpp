@@ -0,0 +1,117 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYSHAREDLOCK_HPP
+#define PA_4_KEY_VALUE_STORE_MYSHAREDLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Reader-writer lock in 4 bytes, a drop-in replacement of std::shared_mutex (56 bytes) for the locks which are
+ * part of a compact structure (e.g. "CacheBucket")
+ *
+ * A waiting thread spins for a short while (the locks it is used for are mostly held for a few hundred
+ * nanoseconds), after which it sleeps on the lock word using "std::atomic::wait(...)" (i.e. futex on Linux).
+ * The unlock only calls "notify_all()" if some thread is sleeping, so an uncontended lock costs one atomic
+ * read-modify-write to lock and one to unlock.
+ *     REFER: https://en.cppreference.com/w/cpp/atomic/atomic/wait
+ *     REFER: https://eli.thegreenplace.net/2018/basics-of-futexes/
+ *
+ * Same as std::shared_mutex on glibc, readers are preferred (i.e. a reader never waits for a waiting writer),
+ * so a thread may take the reader lock again while holding it. It meets the requirements of SharedLockable, so
+ * it is used with std::shared_lock and std::unique_lock.
+ * */
+class SharedLock {
+public:
+    SharedLock() : state(0) {}
+
+    SharedLock(const SharedLock &) = delete;
+    SharedLock &operator=(const SharedLock &) = delete;
+
+    void lock() {
+        for (uint32_t attempt = 0;; ++attempt) {
+            uint32_t s = state.load(std::memory_order_relaxed);
+            if ((s & (WRITER | READERS_MASK)) == 0) {
+                if (state.compare_exchange_weak(s, s | WRITER, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            wait_for_change(s, attempt);
+        }
+    }
+
+    bool try_lock() {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        return (s & (WRITER | READERS_MASK)) == 0
+               && state.compare_exchange_strong(s, s | WRITER, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        if (state.fetch_and(~WRITER, std::memory_order_release) & SLEEPERS) wake_all();
+    }
+
+    void lock_shared() {
+        for (uint32_t attempt = 0;; ++attempt) {
+            uint32_t s = state.load(std::memory_order_relaxed);
+            if ((s & WRITER) == 0) {
+                if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            wait_for_change(s, attempt);
+        }
+    }
+
+    bool try_lock_shared() {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        while ((s & WRITER) == 0) {
+            if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    void unlock_shared() {
+        const uint32_t s = state.fetch_sub(1, std::memory_order_release);
+        if ((s & READERS_MASK) == 1 && (s & SLEEPERS)) wake_all();
+    }
+
+private:
+    static constexpr uint32_t WRITER = (1U << 31U);
+    static constexpr uint32_t SLEEPERS = (1U << 30U);  // some thread is (or is about to be) sleeping on "state"
+    static constexpr uint32_t READERS_MASK = SLEEPERS - 1;
+    static constexpr uint32_t SPIN_ATTEMPTS = 64;
+
+    // WRITER | SLEEPERS | number of readers
+    std::atomic_uint32_t state;
+
+    /* Wait till "state" is NOT "s" any more, "attempt" is the number of times the caller has waited so far */
+    void wait_for_change(uint32_t s, uint32_t attempt) {
+        if (attempt < SPIN_ATTEMPTS) {
+#if defined(__x86_64__)
+            if (attempt < SPIN_ATTEMPTS / 2) {
+                _mm_pause();
+                return;
+            }
+#endif
+            std::this_thread::yield();
+            return;
+        }
+        // The thread which unlocks sees SLEEPERS and wakes up every sleeping thread. If "state" changes between
+        // setting SLEEPERS and "wait(...)", then "wait(...)" returns immediately
+        if ((s & SLEEPERS) == 0
+            && (not state.compare_exchange_strong(s, s | SLEEPERS, std::memory_order_relaxed)))
+            return;
+        state.wait(s | SLEEPERS, std::memory_order_relaxed);
+    }
+
+    void wake_all() {
+        state.fetch_and(~SLEEPERS, std::memory_order_relaxed);
+        state.notify_all();
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYSHAREDLOCK_HPP
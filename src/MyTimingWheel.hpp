@@ -0,0 +1,102 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYTIMINGWHEEL_HPP
+#define PA_4_KEY_VALUE_STORE_MYTIMINGWHEEL_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Hierarchical Timing Wheel
+ *     REFER: http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+ *     REFER: https://lwn.net/Articles/646950/ (Linux kernel timer wheel)
+ *
+ * Time is divided into ticks of "tickMs" milliseconds. Level "i" has "SLOTS" slots of "SLOTS^i" ticks each,
+ * so an item which expires within "SLOTS^(i+1)" ticks is kept in level "i". Whenever the lower level completes
+ * one round, the next slot of the upper level is cascaded (i.e. its items are re-inserted in the lower levels).
+ * So, adding an item is O(1) and "advance(...)" only touches the items which expire, plus the cascaded ones.
+ *
+ * Items which expire beyond the range of the wheel are kept in the farthest slot and re-inserted when it expires.
+ * NOT thread safe, the caller has to lock it.
+ * */
+template<typename T>
+struct HierarchicalTimingWheel {
+    static constexpr uint32_t LEVELS = 4;
+    static constexpr uint32_t SLOT_BITS = 6;
+    static constexpr uint64_t SLOTS = (1ULL << SLOT_BITS);
+    static constexpr uint64_t MAX_TICKS = (1ULL << (SLOT_BITS * LEVELS));  // range of the wheel
+
+    // Each item is stored with its expiry time (in milliseconds)
+    using Entry = std::pair<uint64_t, T>;
+
+    uint64_t tickMs;
+    uint64_t currentTick;  // all ticks before this have been processed
+    uint64_t n;  // number of items in the wheel
+    std::vector<Entry> slots[LEVELS][SLOTS];
+
+    HierarchicalTimingWheel() : tickMs{100}, currentTick{0}, n{0}, slots() {}
+
+    void init(uint64_t tick_ms, uint64_t nowMs) {
+        tickMs = tick_ms;
+        currentTick = nowMs / tickMs;
+    }
+
+    [[nodiscard]] inline uint64_t size() const { return n; }
+
+    /* An item which has already expired is returned by the next call to "advance(...)" */
+    void add(const T &item, uint64_t expiresAtMs) {
+        ++n;
+        place({expiresAtMs, item}, to_tick(expiresAtMs));
+    }
+
+    /* Move all the items which expire at or before "nowMs" to "expired" */
+    void advance(uint64_t nowMs, std::vector<T> &expired) {
+        const uint64_t nowTick = nowMs / tickMs;
+        std::vector<Entry> due;
+        for (; currentTick <= nowTick; ++currentTick) {
+            cascade();
+
+            due.clear();
+            due.swap(slots[0][currentTick & (SLOTS - 1)]);
+            for (Entry &entry: due) {
+                if (to_tick(entry.first) > currentTick) {
+                    place(std::move(entry), to_tick(entry.first));  // was beyond the range of the wheel
+                } else {
+                    expired.push_back(std::move(entry.second));
+                    --n;
+                }
+            }
+        }
+    }
+
+private:
+    /* Rounded up, so that an item is never returned before it expires */
+    [[nodiscard]] inline uint64_t to_tick(uint64_t timeMs) const {
+        return (timeMs + tickMs - 1) / tickMs;
+    }
+
+    void place(Entry &&entry, uint64_t tick) {
+        if (tick < currentTick) tick = currentTick;
+        if (tick - currentTick >= MAX_TICKS) tick = currentTick + MAX_TICKS - 1;
+
+        const uint64_t delta = tick - currentTick;
+        uint32_t level = 0;
+        while (level + 1 < LEVELS && delta >= (1ULL << (SLOT_BITS * (level + 1)))) ++level;
+        slots[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(std::move(entry));
+    }
+
+    /* When "currentTick" is the first tick of a slot of level "i", that slot of level "i" is
+     * cascaded to the lower levels. The upper levels are cascaded first */
+    void cascade() {
+        uint32_t top = 0;
+        while (top + 1 < LEVELS && (currentTick & ((1ULL << (SLOT_BITS * (top + 1))) - 1)) == 0) ++top;
+
+        std::vector<Entry> moving;
+        for (uint32_t level = top; level >= 1; --level) {
+            moving.clear();
+            moving.swap(slots[level][(currentTick >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+            for (Entry &entry: moving) place(std::move(entry), to_tick(entry.first));
+        }
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYTIMINGWHEEL_HPP
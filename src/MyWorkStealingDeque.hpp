@@ -0,0 +1,62 @@
+#ifndef PA_4_KEY_VALUE_STORE_MYWORKSTEALINGDEQUE_HPP
+#define PA_4_KEY_VALUE_STORE_MYWORKSTEALINGDEQUE_HPP
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+/*
+ * Work Stealing Deque
+ *     REFER: https://en.wikipedia.org/wiki/Work_stealing
+ *     REFER: https://www.dre.vanderbilt.edu/~schmidt/PDF/work-stealing-dequeue.pdf
+ *
+ * The owner thread pushes and pops at the bottom (LIFO, i.e. the most recent and cache warm work), and
+ * other threads steal from the top (i.e. the oldest work). The items stored here are ready connections,
+ * and serving one of them costs a few system calls, so a mutex is used instead of a lock-free
+ * (Chase-Lev) deque. "size()" is lock free so that thieves can skip empty deques without locking them.
+ * */
+template<typename T>
+struct WorkStealingDeque {
+    std::mutex m;
+    std::deque<T> items;
+    std::atomic_size_t n;
+
+    WorkStealingDeque() : m(), items(), n(0) {}
+
+    void push_bottom(const T &item) {
+        std::lock_guard lock(m);
+        items.push_back(item);
+        n.store(items.size(), std::memory_order_relaxed);
+    }
+
+    /* Called by the owner ONLY
+     * Returns: false if the deque is empty */
+    bool pop_bottom(T &item) {
+        if (size() == 0) return false;
+        std::lock_guard lock(m);
+        if (items.empty()) return false;
+        item = items.back();
+        items.pop_back();
+        n.store(items.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    /* Called by the thieves
+     * Returns: false if the deque is empty */
+    bool steal_top(T &item) {
+        if (size() == 0) return false;
+        std::lock_guard lock(m);
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        n.store(items.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    /* NOTE: the value may be stale by the time it is used */
+    [[nodiscard]] inline size_t size() const {
+        return n.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // PA_4_KEY_VALUE_STORE_MYWORKSTEALINGDEQUE_HPP
@@ -5,11 +5,31 @@
 #include <vector>
 #include <chrono>
 #include <mutex>
+#include <limits>
+#include <set>
+#include <string>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 
 #include "MyDebugger.hpp"
 #include "KVMessage.hpp"
-// #include "KVStore.hpp"
+#include "KVCache.hpp"
+#include "KVConnection.hpp"
+#include "KVHotKeys.hpp"
+#include "KVSnapshot.hpp"
+#include "MyCoroutine.hpp"
+#include "MyCompression.hpp"
+#include "MyTimingWheel.hpp"
+#include "MyConsistentHashRing.hpp"
+#include "MySPSCQueue.hpp"
+#include "MyWorkStealingDeque.hpp"
 
 using namespace std;
 using namespace std::chrono;
@@ -148,7 +168,1241 @@ int main_mutex_speed(){
     return 0;
 }
 
-int main() {
+// ---------------------------------------------------------------------------------------------------------------------
+// Tests of the KVCache, run as "./Testing TEST_NAME" (refer "run_test(...)"), also registered with CTest
+// Every test uses a new Persistent Storage in a directory under /tmp, which is removed if the test passes
+
+uint32_t failedChecks = 0;
+
+void check(bool condition, const string &what) {
+    if (condition) return;
+    ++failedChecks;
+    log_error("CHECK FAILED: " + what);
+}
+
+/* Create the directory of the test and "chdir" to it, the Persistent Storage is created inside it
+ * Returns: path of the directory */
+string enter_test_dir() {
+    char dir[] = "/tmp/KVTest-XXXXXX";
+    if (mkdtemp(dir) == nullptr || chdir(dir) != 0) {
+        log_error("Unable to create the test directory");
+        exit(1);
+    }
+    return dir;
+}
+
+KVMessage make_message(const string &key, const string &value = "") {
+    KVMessage message;
+    message.set_key(key.c_str());
+    message.set_value(value.c_str());
+    message.calculate_key_hash();
+    return message;
+}
+
+/* Returns: Value of "key", or "<NOT FOUND>" */
+string cache_value(KVCache &kvCache, const string &key) {
+    KVMessage message = make_message(key);
+    if (not kvCache.cache_GET(&message)) return "<NOT FOUND>";
+    return string(message.value, strnlen(message.value, 256));
+}
+
+/* CAS: version mismatch, Key which does NOT exist, and Key which is only in the Persistent Storage
+ * INCR/DECR (i.e. negative delta): overflow at the int64_t limits, Values which are NOT decimal integers */
+int test_cache_cas_incr() {
+    KVCache kvCache(1);  // every new Key evicts the previous one to the Persistent Storage
+
+    KVMessage message = make_message("cas");
+    message.request_arg = 5;
+    check(not kvCache.cache_CAS(&message), "CAS of a missing Key with expected version 5 must fail");
+    check(message.version == 0, "CAS of a missing Key must report version 0");
+    check(cache_value(kvCache, "cas") == "<NOT FOUND>", "failed CAS must NOT create the Key");
+
+    message = make_message("cas", "first");
+    message.request_arg = 0;
+    check(kvCache.cache_CAS(&message), "CAS of a missing Key with expected version 0 must create it");
+    const uint64_t firstVersion = message.version;
+    check(firstVersion != 0, "created Key must have a version");
+
+    message = make_message("cas", "second");
+    message.request_arg = firstVersion + 1;
+    check(not kvCache.cache_CAS(&message), "CAS with a wrong version must fail");
+    check(message.version == firstVersion, "failed CAS must report the current version");
+    message.request_arg = 0;
+    check(not kvCache.cache_CAS(&message), "CAS with expected version 0 must fail if the Key exists");
+    check(cache_value(kvCache, "cas") == "first", "failed CAS must NOT change the Value");
+
+    // The Key is evicted, so the version is read back from the Persistent Storage
+    KVMessage other = make_message("other", "x");
+    kvCache.cache_PUT(&other);
+    message = make_message("cas", "third");
+    message.request_arg = firstVersion;
+    check(kvCache.cache_CAS(&message), "CAS with the version stored in the Persistent Storage must succeed");
+    check(message.version > firstVersion, "successful CAS must give a new version");
+    check(cache_value(kvCache, "cas") == "third", "successful CAS must write the Value");
+
+    auto incr = [&kvCache](const string &key, int64_t delta, int64_t &result) {
+        KVMessage m = make_message(key);
+        m.request_arg = static_cast<uint64_t>(delta);
+        const bool res = kvCache.cache_INCR(&m);
+        result = static_cast<int64_t>(m.request_arg);
+        return res;
+    };
+    auto put = [&kvCache](const string &key, const string &value) {
+        KVMessage m = make_message(key, value);
+        kvCache.cache_PUT(&m);
+    };
+    int64_t result;
+    constexpr int64_t INT64_MAX_VALUE = numeric_limits<int64_t>::max(), INT64_MIN_VALUE = numeric_limits<int64_t>::min();
+
+    check(incr("counter", 5, result) && result == 5, "INCR of a missing Key must start from 0");
+    check(incr("counter", -7, result) && result == -2, "DECR must go below 0");
+
+    put("max", to_string(INT64_MAX_VALUE - 1));
+    check(incr("max", 1, result) && result == INT64_MAX_VALUE, "INCR up to INT64_MAX must succeed");
+    check(not incr("max", 1, result), "INCR beyond INT64_MAX must fail");
+    check(cache_value(kvCache, "max") == to_string(INT64_MAX_VALUE), "failed INCR must NOT change the Value");
+
+    put("min", to_string(INT64_MIN_VALUE + 1));
+    check(incr("min", -1, result) && result == INT64_MIN_VALUE, "DECR down to INT64_MIN must succeed");
+    check(not incr("min", -1, result), "DECR beyond INT64_MIN must fail");
+    check(cache_value(kvCache, "min") == to_string(INT64_MIN_VALUE), "failed DECR must NOT change the Value");
+
+    put("big", "9223372036854775808");  // INT64_MAX + 1
+    check(not incr("big", 0, result), "INCR of a Value beyond INT64_MAX must fail");
+    for (const string value: {"abc", "12a", "-", "1.5", " 1", ""}) {
+        put("text", value);
+        check(not incr("text", 1, result), "INCR of \"" + value + "\" must fail");
+        check(cache_value(kvCache, "text") == value, "failed INCR must NOT change \"" + value + "\"");
+    }
+    return 0;
+}
+
+/* Same as the GET of "serve_ready_client(...)" in KVServer.cpp: the read cache of the worker first, then the KVCache
+ * whose CacheNode is pinned while it is recorded and copied
+ * Returns: Value of "key", or "<NOT FOUND>", and "*fromHotKeys" tells if it was served by the read cache */
+string hot_GET(KVCache &kvCache, HotKeyCache &hotKeys, const string &key, bool *fromHotKeys = nullptr) {
+    KVMessage message = make_message(key);
+    const char *hotValue = hotKeys.lookup(&message, &kvCache);
+    if (fromHotKeys != nullptr) *fromHotKeys = (hotValue != nullptr);
+    if (hotValue != nullptr) return string(hotValue, strnlen(hotValue, 256));
+
+    const bool sampled = hotKeys.sample();
+    const uint64_t writeVersion = (sampled) ? kvCache.write_version(message.hash1) : 0;
+    CacheNode *cacheNode = nullptr;
+    if (kvCache.cache_GET_pinned(&message, &cacheNode, false) != KVCache::Lookup_HIT) return "<NOT FOUND>";
+    if (sampled) hotKeys.record(&(cacheNode->message), writeVersion);
+    const string value(cacheNode->message.value, strnlen(cacheNode->message.value, 256));
+    cacheNode->pin_count.fetch_sub(1, std::memory_order_release);
+    return value;
+}
+
+/* HotKeyCache (refer KVHotKeys.hpp), every GET is sampled:
+ *     1. a Key read "ADMIT_MIN_COUNT" times is copied to the read cache, and served from it
+ *     2. every kind of write (PUT, PUT of a TTL, CAS, INCR, DELETE) changes the write version of the Key, so the
+ *        copy is dropped and the next GET gets the new Value from the KVCache (and copies it again)
+ *     3. a copy recorded with a write version read before a write landed is never served
+ *     4. a Key with a TTL is NOT copied */
+int test_hot_keys() {
+    KVCache kvCache(64);
+    HotKeyCache hotKeys(64, 1);
+
+    auto put = [&kvCache](const string &key, const string &value, uint64_t expiresAt = 0) {
+        KVMessage m = make_message(key, value);
+        m.expires_at = expiresAt;
+        kvCache.cache_PUT(&m);
+    };
+    // Returns: true if the Key is served by the read cache after at most "ADMIT_MIN_COUNT" GETs of the KVCache
+    auto admit = [&kvCache, &hotKeys](const string &key, const string &value) {
+        bool fromHotKeys = false;
+        for (uint32_t i = 0; i <= HotKeyCache::ADMIT_MIN_COUNT && (not fromHotKeys); ++i) {
+            check(hot_GET(kvCache, hotKeys, key, &fromHotKeys) == value, "GET of \"" + key + "\" must be " + value);
+        }
+        return fromHotKeys;
+    };
+    auto served_after_write = [&kvCache, &hotKeys, &admit](const string &key, const string &value, const string &write) {
+        bool fromHotKeys = true;
+        const string got = hot_GET(kvCache, hotKeys, key, &fromHotKeys);
+        check(not fromHotKeys, write + ": stale copy of \"" + key + "\" must NOT be served");
+        check(got == value, write + ": GET of \"" + key + "\" must be \"" + value + "\", got \"" + got + "\"");
+        check(admit(key, value), write + ": GET after the refresh must copy \"" + key + "\" again");
+    };
+
+    // 1.
+    put("hot", "v1");
+    check(admit("hot", "v1"), "Key read often must be copied to the read cache");
+    check(hotKeys.cached_keys == 1 && hotKeys.hits == 1, "read cache must have served the Key once");
+
+    // 2.
+    put("hot", "v2");
+    served_after_write("hot", "v2", "PUT");
+    put("hot", "v2");
+    bool fromHotKeys = false;
+    check(hot_GET(kvCache, hotKeys, "hot", &fromHotKeys) == "v2" && fromHotKeys,
+          "PUT of the same Value does NOT change the version, the copy must stay");
+
+    KVMessage message = make_message("hot", "v3");
+    KVMessage current = make_message("hot");
+    kvCache.cache_GET(&current);
+    message.request_arg = current.version;
+    check(kvCache.cache_CAS(&message), "CAS with the current version must succeed");
+    served_after_write("hot", "v3", "CAS");
+
+    put("counter", "41");
+    check(admit("counter", "41"), "counter must be copied to the read cache");
+    message = make_message("counter");
+    message.request_arg = 1;
+    check(kvCache.cache_INCR(&message), "INCR must succeed");
+    served_after_write("counter", "42", "INCR");
+
+    message = make_message("hot");
+    check(kvCache.cache_DELETE(&message), "DELETE must succeed");
+    check(hot_GET(kvCache, hotKeys, "hot", &fromHotKeys) == "<NOT FOUND>" && (not fromHotKeys),
+          "deleted Key must NOT be served by the read cache");
+
+    // 3.
+    put("raced", "old");
+    const uint32_t cachedKeys = hotKeys.cached_keys;
+    message = make_message("raced");
+    const uint64_t writeVersion = kvCache.write_version(message.hash1);
+    put("raced", "new");
+    CacheNode *cacheNode = nullptr;
+    for (uint32_t i = 0; i < HotKeyCache::ADMIT_MIN_COUNT; ++i) {
+        message = make_message("raced");
+        if (kvCache.cache_GET_pinned(&message, &cacheNode, false) != KVCache::Lookup_HIT) return 1;
+        hotKeys.record(&(cacheNode->message), writeVersion);
+        cacheNode->pin_count.fetch_sub(1, std::memory_order_release);
+    }
+    check(hotKeys.cached_keys == cachedKeys + 1, "raced Key must be copied");
+    check(hot_GET(kvCache, hotKeys, "raced", &fromHotKeys) == "new" && (not fromHotKeys),
+          "copy recorded with a write version older than the last write must NOT be served");
+
+    // 4.
+    put("ttl", "expiring", KVMessage::current_time_ms() + 3'600'000);
+    check(not admit("ttl", "expiring"), "Key with a TTL must NOT be copied to the read cache");
+    return 0;
+}
+
+/* KVSnapshotter (refer KVSnapshot.hpp) while writer threads PUT and DELETE their own Keys through a small KVCache
+ * (so most writes also evict a Key to the Persistent Storage, i.e. the files are modified during the copy)
+ * Each writer holds its mutex while serving a request (same as "mutex_serving_clients" of a worker), which is what
+ * "pause_cache_writers(...)" locks. The state acknowledged to the writers is noted once they are all paused, and
+ * the snapshot, restored as the "db" of a new KVStore, must have exactly that state: every write acknowledged
+ * before the SNAPSHOT, and none after it */
+int test_snapshot_concurrent_writes() {
+    static constexpr uint32_t WRITERS = 4, KEYS_PER_WRITER = 200;
+    // A Persistent Storage of a few small files, so that the copy is quick (the one of "run_test(...)" is NOT used)
+    if (chdir("..") != 0 || mkdir("snapshot-test", 0755) != 0 || chdir("snapshot-test") != 0) return 1;
+    kvPersistentStore.set_geometry(8, 1021, 8);
+    kvPersistentStore.init_kvstore();
+    KVCache kvCache(64);
+
+    struct Writer {
+        std::mutex mutex_serving;
+        vector<string> acknowledged = vector<string>(KEYS_PER_WRITER, "<NOT FOUND>");  // Value as per the responses
+        std::thread thread;
+    };
+    Writer writers[WRITERS];
+    std::atomic_bool stop(false);
+    std::atomic_uint64_t writes(0);
+    for (uint32_t w = 0; w < WRITERS; ++w) {
+        writers[w].thread = std::thread([&kvCache, &writer = writers[w], &stop, &writes, w]() {
+            std::mt19937 rng(w);
+            for (uint64_t seq = 0; not stop; ++seq) {
+                const uint32_t k = rng() % KEYS_PER_WRITER;
+                const string key = "w" + to_string(w) + "-" + to_string(k);
+                std::lock_guard lock(writer.mutex_serving);
+                KVMessage message = make_message(key, to_string(seq));
+                if (rng() % 5 != 0) {
+                    kvCache.cache_PUT(&message);
+                    writer.acknowledged[k] = to_string(seq);
+                } else {
+                    kvCache.cache_DELETE(&message);
+                    writer.acknowledged[k] = "<NOT FOUND>";
+                }
+                ++writes;
+            }
+        });
+    }
+    auto wait_for_writes = [&writes](uint64_t count) {
+        const uint64_t target = writes + count;
+        while (writes < target) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+    wait_for_writes(5000);
+
+    vector<string> expected[WRITERS];
+    vector<KVCache *> kvCaches = {&kvCache};
+    KVSnapshotter snapshotter;
+    string result;
+    const bool started = snapshotter.start("during-writes", &kvCaches, [&writers, &expected](bool pause) {
+        for (uint32_t w = 0; w < WRITERS; ++w) {
+            if (pause) writers[w].mutex_serving.lock();
+            else writers[w].mutex_serving.unlock();
+        }
+        if (pause) for (uint32_t w = 0; w < WRITERS; ++w) expected[w] = writers[w].acknowledged;
+        return true;
+    }, result);
+    check(started, "snapshot must start, got \"" + result + "\"");
+
+    // The files are copied while the writers go on
+    const uint64_t writesAtStart = writes;
+    while (snapshotter.stats().starts_with("snapshot=running")) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    check(writes != writesAtStart, "writes must go on while the files are copied");
+    wait_for_writes(2000);
+    stop = true;
+    for (Writer &writer: writers) writer.thread.join();
+    check(snapshotter.stats().starts_with("snapshot=done"), "snapshot must complete, " + snapshotter.stats());
+
+    for (uint32_t w = 0; w < WRITERS; ++w) {
+        for (uint32_t k = 0; k < KEYS_PER_WRITER; ++k) {
+            const string key = "w" + to_string(w) + "-" + to_string(k);
+            check(cache_value(kvCache, key) == writers[w].acknowledged[k], "live store must have the last write of "
+                                                                           + key);
+        }
+    }
+
+    // Restore the snapshot as the "db" of a new KVStore
+    if (chdir("..") != 0 || mkdir("restore", 0755) != 0 || rename(("snapshots/during-writes"), "restore/db") != 0
+        || chdir("restore") != 0) {
+        check(false, "unable to restore the snapshot");
+        return 1;
+    }
+    KVStore restored;
+    restored.init_kvstore();
+    uint32_t mismatches = 0;
+    for (uint32_t w = 0; w < WRITERS; ++w) {
+        for (uint32_t k = 0; k < KEYS_PER_WRITER; ++k) {
+            KVMessage message = make_message("w" + to_string(w) + "-" + to_string(k));
+            const string value = restored.read_from_db(&message)
+                                 ? string(message.value, strnlen(message.value, 256)) : "<NOT FOUND>";
+            if (value == expected[w][k]) continue;
+            if (++mismatches <= 5) {
+                check(false, "snapshot must have the state acknowledged before it, " + string(message.key)
+                             + " = \"" + value + "\", expected \"" + expected[w][k] + "\"");
+            }
+        }
+    }
+    check(mismatches == 0, "Keys of the snapshot NOT matching the acknowledged state = " + to_string(mismatches));
+    return 0;
+}
+
+/* Suspends the coroutine till the test resumes "*handle" */
+struct ParkAwaitable {
+    std::coroutine_handle<> *handle;
+
+    [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) noexcept { *handle = h; }
+
+    void await_resume() const noexcept {}
+};
+
+/* GETs of one Key run by "cold_GET(...)", all of them on the thread of the test (i.e. the event loop) */
+struct ColdGets {
+    string key;
+    CoroutineResumeQueue resumeQueue;
+    uint32_t storageReads = 0;
+    std::coroutine_handle<> parkedReader;  // the GET which read the Persistent Storage, before "cache_GET_fill(...)"
+};
+
+struct ColdGetResult {
+    bool done = false, found = false;
+    string value;
+};
+
+/* Same as the GET of "serve_ready_client(...)" in KVServer.cpp, except that the Persistent Storage is read on this
+ * thread. The GET which reads the Persistent Storage is then parked, so the test decides when its fill lands */
+DetachedTask cold_GET(KVCache *kvCache, ColdGets *gets, ColdGetResult *result) {
+    KVMessage message = make_message(gets->key);
+    const int lookupResult = kvCache->cache_GET_cached(&message);
+    bool res = (lookupResult == KVCache::Lookup_HIT);
+    if (lookupResult == KVCache::Lookup_MISS) {
+        const CacheFillTicket ticket = co_await kvCache->cache_GET_join(&message, &(gets->resumeQueue));
+        if (ticket.lookup_result == KVCache::Lookup_MISS) {
+            ++gets->storageReads;
+            res = kvPersistentStore.read_from_db(&message);
+            co_await ParkAwaitable{&(gets->parkedReader)};
+            res = kvCache->cache_GET_fill(&message, res, ticket);
+        } else {
+            res = (ticket.lookup_result == KVCache::Lookup_HIT);
+        }
+    }
+    result->done = true;
+    result->found = res;
+    result->value = string(message.value, strnlen(message.value, 256));
+}
+
+struct PooledCallResult {
+    bool done = false;
+    uint32_t wrongResults = 0, resumedElsewhere = 0;
+};
+
+/* Two blocking calls of "pool" one after the other, same as a GET which misses on the event loop of a worker */
+DetachedTask pooled_calls(AsyncBlockingPool *pool, CoroutineResumeQueue *resumeQueue, uint32_t i,
+                          PooledCallResult *result) {
+    const std::thread::id eventLoop = std::this_thread::get_id();
+    for (uint32_t call = 0; call < 2; ++call) {
+        const bool expected = ((i + call) % 2 == 0);
+        const bool res = co_await pool->run([expected]() { return expected; }, resumeQueue);
+        result->wrongResults += (res != expected);
+        result->resumedElsewhere += (std::this_thread::get_id() != eventLoop);
+    }
+    result->done = true;
+}
+
+/* CoroutineResumeQueue and AsyncBlockingPool (refer MyCoroutine.hpp): 1000 coroutines, each of which waits twice
+ * for a call performed by the pool, are resumed by an event loop on this thread which waits on the eventfd of the
+ * queue using epoll (same as a worker). Every coroutine must complete with the results of its own calls, and be
+ * resumed on this thread only. Once they are all done, the eventfd must NOT be readable */
+int test_coroutine_resume_queue() {
+    static constexpr uint32_t COROUTINES = 1000;
+    // NOT destroyed, as the threads of the pool never exit (the server exits using "exit(...)")
+    auto *pool = new AsyncBlockingPool();
+    pool->init(4);
+    CoroutineResumeQueue resumeQueue;
+
+    const int epollFd = epoll_create1(0);
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, resumeQueue.event_fd, &event) != 0) return 1;
+
+    vector<PooledCallResult> results(COROUTINES);
+    for (uint32_t i = 0; i < COROUTINES; ++i) pooled_calls(pool, &resumeQueue, i, &results[i]);
+
+    const auto deadline = steady_clock::now() + seconds(30);
+    auto all_done = [&results]() {
+        return std::all_of(results.begin(), results.end(), [](const PooledCallResult &r) { return r.done; });
+    };
+    uint32_t wakeUps = 0;
+    while ((not all_done()) && steady_clock::now() < deadline) {
+        if (epoll_wait(epollFd, &event, 1, 100) != 1) continue;
+        ++wakeUps;
+        resumeQueue.resume_all();
+    }
+    check(all_done(), "every coroutine must complete");
+    uint32_t wrongResults = 0, resumedElsewhere = 0;
+    for (const PooledCallResult &r: results) {
+        wrongResults += r.wrongResults;
+        resumedElsewhere += r.resumedElsewhere;
+    }
+    check(wrongResults == 0, "coroutines must get the results of their own calls, wrong = " + to_string(wrongResults));
+    check(resumedElsewhere == 0, "coroutines must be resumed on the event loop only, elsewhere = "
+                                 + to_string(resumedElsewhere));
+    check(wakeUps <= 2 * COROUTINES, "event loop must NOT wake up more than once per post");
+    check(epoll_wait(epollFd, &event, 1, 0) == 0, "eventfd must NOT be readable once every coroutine is resumed");
+    close(epollFd);
+    return 0;
+}
+
+/* Single flight of the cache misses (refer "KVCache::cache_GET_join(...)"):
+ *     1. concurrent GETs of a cold Key read it once, and insert one CacheNode
+ *     2. a PUT of the Key which lands while the Persistent Storage is read is NOT overwritten by the fill */
+int test_cache_single_flight() {
+    static constexpr uint32_t GETS = 8;
+    KVCache kvCache(16);
+
+    for (const string key: {"cold-1", "cold-2"}) {
+        KVMessage message = make_message(key, "disk");
+        kvPersistentStore.write_to_db(&message);
+    }
+
+    // 1.
+    ColdGets gets1;
+    gets1.key = "cold-1";
+    vector<ColdGetResult> results1(GETS);
+    for (ColdGetResult &result: results1) cold_GET(&kvCache, &gets1, &result);
+    check(gets1.storageReads == 1, "cold Key must be read once, reads = " + to_string(gets1.storageReads));
+    check(kvCache.coalescedMisses == GETS - 1, "all but one GET must wait for the read, coalesced = "
+                                               + to_string(kvCache.coalescedMisses));
+    check(kvCache.hashTableEntries == 1, "cold Key must have one CacheNode");
+    check(std::none_of(results1.begin(), results1.end(), [](const ColdGetResult &r) { return r.done; }),
+          "no GET may complete before the read");
+    if (not gets1.parkedReader) return 1;
+
+    gets1.parkedReader.resume();
+    gets1.resumeQueue.resume_all();
+    for (const ColdGetResult &result: results1) {
+        check(result.done && result.found && result.value == "disk", "every GET must get the Value, got \""
+                                                                     + result.value + "\"");
+    }
+    check(kvCache.pendingNodes == 0, "CacheNode must NOT be pending after the fill");
+    check(kvCache.hashTableEntries == 1, "fill must NOT insert another CacheNode");
+    check(cache_value(kvCache, "cold-1") == "disk", "filled Key must be cached");
+
+    // 2.
+    ColdGets gets2;
+    gets2.key = "cold-2";
+    vector<ColdGetResult> results2(GETS);
+    for (ColdGetResult &result: results2) cold_GET(&kvCache, &gets2, &result);
+    check(gets2.storageReads == 1 && gets2.parkedReader, "cold Key must be read once");
+    if (not gets2.parkedReader) return 1;
+
+    KVMessage message = make_message("cold-2", "put");
+    kvCache.cache_PUT(&message);
+    gets2.parkedReader.resume();
+    gets2.resumeQueue.resume_all();
+    for (const ColdGetResult &result: results2) {
+        check(result.done && result.found && result.value == "put", "GET must get the Value of the PUT, got \""
+                                                                    + result.value + "\"");
+    }
+    check(cache_value(kvCache, "cold-2") == "put", "fill must NOT overwrite the Value of the PUT");
+    check(kvCache.pendingNodes == 0 && kvCache.hashTableEntries == 2, "PUT must fill the pending CacheNode");
+    return 0;
+}
+
+/* Returns: all the Keys of "index" which start with "prefix", read in pages of "maxKeys" Keys using the
+ *          continuation tokens, every page is checked to be full (except the last one) and in order */
+vector<string> scan_all(KVKeyIndex &index, const string &prefix, uint32_t maxKeys) {
+    vector<string> keys;
+    string token;
+    for (uint32_t pages = 0; pages <= 10000; ++pages) {
+        vector<string> page;
+        const string next = index.scan(prefix, token, maxKeys, page);
+        const string what = "SCAN \"" + prefix + "\" page of " + to_string(maxKeys) + " after \"" + token + "\"";
+        check(page.size() <= maxKeys, what + " must NOT exceed the page length");
+        check(next.empty() || (page.size() == maxKeys && next == page.back()), what + " must end at the token");
+        check(page.empty() || token < page.front(), what + " must start after the token");
+        keys.insert(keys.end(), page.begin(), page.end());
+        if (next.empty()) return keys;
+        token = next;
+    }
+    check(false, "SCAN \"" + prefix + "\" with pages of " + to_string(maxKeys) + " must end");
+    return keys;
+}
+
+/* KVKeyIndex and SCAN (refer KVKeyIndex.hpp), the index is shared by all the caches, i.e. it is "kvKeyIndex":
+ *     1. paging over an empty prefix (i.e. all the shards, refer "KVKeyIndex::shard_idx(...)") with every page
+ *        length up to more than the largest shard, so the pages end on the edges of the shards, including the
+ *        empty shards, and the shards whose last Key has expired
+ *     2. paging over prefixes which are within one shard, and tokens which are before or after the prefix
+ *     3. deleted Keys leave the index, the index is saved and loaded, and it is rebuilt from the Persistent
+ *        Storage after a crash (i.e. the saved index was loaded, so there is no "key_index" file any more) */
+int test_key_index_scan() {
+    KVCache kvCache(16);  // most of the Keys are evicted to the Persistent Storage
+
+    set<string> expected;
+    auto put = [&kvCache, &expected](const string &key) {
+        KVMessage m = make_message(key, "v");
+        kvCache.cache_PUT(&m);
+        expected.insert(key);
+    };
+    // Shards of 10, 10, 7, 1 and 3 live Keys, the ones from 0x80 onwards are sorted after ASCII
+    for (uint32_t i = 0; i < 10; ++i) put("a" + to_string(i));
+    for (uint32_t i = 0; i < 10; ++i) put("b" + to_string(i));
+    // The last Key of its shard has expired, but it is NOT reclaimed yet
+    KVMessage expiredMessage = make_message("b~expired");
+    expiredMessage.expires_at = KVMessage::current_time_ms() - 1000;
+    kvKeyIndex.insert(&expiredMessage);
+    for (uint32_t i = 0; i < 7; ++i) put("c" + to_string(i));
+    put("\x80");
+    for (const string key: {"\xff", "\xff\x01", "\xff\xff"}) put(key);
+    put("ab");
+    put("ab-0");
+    put("ab-1");
+    // "a1" and "a10" differ only in length, "a" itself is also a Key
+    put("a");
+    put("a10");
+
+    // 1.
+    const vector<string> all(expected.begin(), expected.end());
+    for (uint32_t maxKeys = 1; maxKeys <= 40; ++maxKeys) {
+        check(scan_all(kvKeyIndex, "", maxKeys) == all, "SCAN of all the Keys in pages of " + to_string(maxKeys));
+    }
+    vector<string> page;
+    const string token = kvKeyIndex.scan("", "ab-1", 10, page);
+    check(page.size() == 10 && page.front() == "b0" && token == "b9",
+          "page after the last Key of shard 'a' must be shard 'b', without its expired Key");
+    page.clear();
+    check(kvKeyIndex.scan("", "b9", 7, page) == "c6" && page.front() == "c0",
+          "page after the last live Key of shard 'b' must be shard 'c'");
+
+    // 2.
+    auto with_prefix = [&all](const string &prefix) {
+        vector<string> keys;
+        for (const string &key: all) if (key.compare(0, prefix.size(), prefix) == 0) keys.push_back(key);
+        return keys;
+    };
+    for (const string prefix: {"a", "ab", "ab-", "b", "b~", "c", "d", "\xff", "\xff\xff", "a10"}) {
+        for (uint32_t maxKeys = 1; maxKeys <= 16; ++maxKeys) {
+            check(scan_all(kvKeyIndex, prefix, maxKeys) == with_prefix(prefix),
+                  "SCAN of prefix \"" + prefix + "\" in pages of " + to_string(maxKeys));
+        }
+    }
+    page.clear();
+    check(kvKeyIndex.scan("b", "a5", 3, page) == "b2" && page.front() == "b0", "token before the prefix");
+    page.clear();
+    check(kvKeyIndex.scan("b", "c", 3, page).empty() && page.empty(), "token after the prefix");
+
+    // 3.
+    for (const string key: {"a0", "b9", "\xff\xff"}) {
+        KVMessage m = make_message(key);
+        check(kvCache.cache_DELETE(&m), "DELETE of \"" + key + "\" must succeed");
+        expected.erase(key);
+    }
+    const vector<string> live(expected.begin(), expected.end());
+    check(scan_all(kvKeyIndex, "", 7) == live, "deleted Keys must leave the index");
+
+    kvCache.cache_clean();  // same as the shutdown of the server, the dirty Keys are written
+    kvKeyIndex.save();
+    auto loaded = make_unique<KVKeyIndex>();
+    loaded->init(2, false);
+    check(scan_all(*loaded, "", 7) == live, "saved index must be loaded");
+    check(access(KVKeyIndex::FILE_NAME, F_OK) != 0, "saved index must be removed once it is loaded");
+
+    auto rebuilt = make_unique<KVKeyIndex>();
+    rebuilt->init(2, false);
+    check(scan_all(*rebuilt, "", 7) == live, "index must be rebuilt from the Persistent Storage after a crash");
+    for (uint32_t maxKeys = 1; maxKeys <= 12; ++maxKeys) {
+        check(scan_all(*rebuilt, "", maxKeys) == live, "SCAN of the rebuilt index in pages of " + to_string(maxKeys));
+    }
+    return 0;
+}
+
+/* ConsistentHashRing (refer MyConsistentHashRing.hpp), which the clients use to pick the server of a Key:
+ *     1. the owner of every Key is the same on rings with the same servers added in a different order, and
+ *        the Keys after the last point of the ring belong to the first point
+ *     2. adding a 4th server moves about 1/4th of the Keys, and all of them to the new server
+ *     3. removing a server moves only its own Keys, about 1/n of them each, and spreads them over the others
+ *     4. removing the added server gives back the exact owners of the ring before it was added */
+int test_hash_ring() {
+    static constexpr uint32_t KEYS = 100'000;
+    const vector<string> servers = {"10.0.0.1:8080", "10.0.0.2:8080", "10.0.0.3:8080", "10.0.0.4:8080"};
+    vector<string> keys(KEYS);
+    for (uint32_t i = 0; i < KEYS; ++i) keys[i] = "key-" + to_string(i);
+
+    auto owners = [&keys](const ConsistentHashRing &ring) {
+        vector<string> names(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) names[i] = ring.nodes[ring.lookup(keys[i].data(), keys[i].size())];
+        return names;
+    };
+    auto share = [](uint64_t count) { return static_cast<double>(count) / KEYS; };
+
+    // 1.
+    ConsistentHashRing ring, reversed;
+    for (uint32_t i = 0; i < 3; ++i) ring.add(servers[i]);
+    for (uint32_t i = 3; i-- > 0;) reversed.add(servers[i]);
+    const vector<string> before = owners(ring);
+    check(before == owners(reversed), "owners must NOT depend on the order in which the servers are added");
+    for (uint32_t i = 0; i < 3; ++i) {
+        const auto count = static_cast<uint64_t>(std::count(before.begin(), before.end(), servers[i]));
+        check(share(count) > 0.25 && share(count) < 0.42, servers[i] + " must own about 1/3rd of the Keys, owns "
+                                                          + to_string(share(count)));
+    }
+
+    uint64_t wrapped = 0;
+    for (const string &key: keys) {
+        if (ConsistentHashRing::hash(key) <= ring.ring.back().hash) continue;
+        ++wrapped;
+        check(ring.lookup(key.data(), key.size()) == ring.ring.front().node,
+              "\"" + key + "\" is after the last point, it must wrap around to the first point");
+    }
+    check(wrapped != 0, "some Keys must be after the last point of the ring");
+
+    // 2.
+    const uint32_t added = ring.add(servers[3]);
+    reversed.add(servers[3]);
+    const vector<string> after = owners(ring);
+    check(after == owners(reversed), "owners must NOT depend on the order in which the servers are added");
+    uint64_t moved = 0, movedElsewhere = 0;
+    for (uint32_t i = 0; i < KEYS; ++i) {
+        if (before[i] == after[i]) continue;
+        ++moved;
+        if (after[i] != servers[3]) ++movedElsewhere;
+    }
+    check(share(moved) > 0.18 && share(moved) < 0.32, "adding a 4th server must move about 1/4th of the Keys, moved "
+                                                      + to_string(share(moved)));
+    check(movedElsewhere == 0, "Keys must only move to the added server, " + to_string(movedElsewhere) + " did NOT");
+
+    // 3.
+    ConsistentHashRing removed;
+    for (const string &server: servers) removed.add(server);
+    removed.remove(1);
+    const vector<string> afterRemove = owners(removed);
+    uint64_t movedOfOthers = 0, toEach[4] = {};
+    for (uint32_t i = 0; i < KEYS; ++i) {
+        if (after[i] != servers[1]) {
+            movedOfOthers += (afterRemove[i] != after[i]);
+            continue;
+        }
+        for (uint32_t j = 0; j < 4; ++j) toEach[j] += (afterRemove[i] == servers[j]);
+    }
+    check(movedOfOthers == 0, "removing a server must NOT move the Keys of the others, moved "
+                              + to_string(movedOfOthers));
+    check(toEach[1] == 0, "no Key may belong to the removed server");
+    for (const uint32_t j: {0, 2, 3}) {
+        check(share(toEach[j]) > 0.03 && share(toEach[j]) < 0.15, "Keys of the removed server must be spread over "
+                                                                  "the others, " + servers[j] + " got "
+                                                                  + to_string(share(toEach[j])));
+    }
+
+    // 4.
+    ring.remove(added);
+    check(owners(ring) == before, "removing the added server must give back the previous owners");
+    return 0;
+}
+
+/* HierarchicalTimingWheel (refer MyTimingWheel.hpp), which schedules the expiry of the Keys in KVServer.cpp
+ * Items expiring in every level (and on the edges of the levels) and beyond the range of the wheel must be
+ * returned once, by the first "advance(...)" at or after their expiry, i.e. the upper levels cascade in time */
+int test_timing_wheel() {
+    using Wheel = HierarchicalTimingWheel<uint32_t>;
+    static constexpr uint64_t TICK_MS = 10, START_MS = 1'000'003;  // the start is NOT on a tick
+    const uint64_t S = Wheel::SLOTS;
+
+    vector<uint64_t> expiresAt = {START_MS - 500, START_MS, START_MS + 1};  // already expired, and the first tick
+    for (const uint64_t ticks: {S - 1, S, S + 1, 2 * S - 1, S * S - 1, S * S, S * S + 1, S * S * S - 1, S * S * S,
+                                S * S * S + 1, 5 * S * S * S / 2, Wheel::MAX_TICKS - 1, Wheel::MAX_TICKS,
+                                Wheel::MAX_TICKS + 5000}) {
+        expiresAt.push_back(START_MS + ticks * TICK_MS);
+        expiresAt.push_back(START_MS + ticks * TICK_MS + 7);  // NOT on a tick
+    }
+    std::mt19937_64 rng(7);
+    for (uint32_t i = 0; i < 2000; ++i) expiresAt.push_back(START_MS + rng() % (Wheel::MAX_TICKS * TICK_MS));
+
+    Wheel wheel;
+    wheel.init(TICK_MS, START_MS);
+    for (uint32_t i = 0; i < expiresAt.size(); ++i) wheel.add(i, expiresAt[i]);
+    check(wheel.size() == expiresAt.size(), "every item must be counted");
+
+    const uint64_t lastMs = *std::max_element(expiresAt.begin(), expiresAt.end()) + 2 * TICK_MS;
+    vector<uint64_t> returnedAt(expiresAt.size(), 0);
+    vector<uint32_t> expired;
+    for (uint64_t nowMs = START_MS; nowMs <= lastMs; nowMs += TICK_MS) {
+        expired.clear();
+        wheel.advance(nowMs, expired);
+        for (const uint32_t i: expired) {
+            check(returnedAt[i] == 0, "item " + to_string(i) + " must be returned once");
+            returnedAt[i] = nowMs;
+        }
+    }
+    check(wheel.size() == 0, "wheel must be empty, items left = " + to_string(wheel.size()));
+    for (uint32_t i = 0; i < expiresAt.size(); ++i) {
+        const string what = "item " + to_string(i) + " expiring at " + to_string(expiresAt[i]) + " returned at "
+                            + to_string(returnedAt[i]);
+        if (expiresAt[i] < START_MS) check(returnedAt[i] == START_MS, what + ", must be returned by the first advance");
+        else check(returnedAt[i] >= expiresAt[i] && returnedAt[i] < expiresAt[i] + 2 * TICK_MS, what);
+    }
+    return 0;
+}
+
+/* TTL of the Keys, "expires_at" is set directly as the tests can NOT wait for whole seconds:
+ *     1. an expired Key is hidden from GET before it is reclaimed, and "cache_EXPIRE(...)" reclaims it
+ *     2. a Key rewritten without TTL before its expiry survives the scheduled "cache_EXPIRE(...)", whether it is
+ *        in the cache or only in the Persistent Storage at that time
+ *     3. lazy expiry of the records of the Persistent Storage: GET reports "expires_at" (so that the server
+ *        schedules it) and DELETE of an expired record reports NOT found, and removes the record
+ *     4. "expires_at" is read back by a KVStore started again on the same files */
+int test_cache_ttl() {
+    static constexpr uint64_t TTL_MS = 200;
+    KVCache kvCache(1);  // every new Key evicts the previous one to the Persistent Storage
+
+    auto put = [&kvCache](const string &key, const string &value, uint64_t expiresAt) {
+        KVMessage m = make_message(key, value);
+        m.expires_at = expiresAt;
+        kvCache.cache_PUT(&m);
+    };
+    auto expire = [&kvCache](const string &key) {
+        KVMessage m = make_message(key);
+        kvCache.cache_EXPIRE(&m);
+    };
+    auto stored_expires_at = [](KVStore &store, const string &key) {
+        KVMessage m = make_message(key);
+        store.read_from_db(&m);
+        return m.expires_at;
+    };
+
+    // 1. and 2., "in-cache" is the last Key written, so it is the one in the cache after the sleep
+    const uint64_t expiresAt = KVMessage::current_time_ms() + TTL_MS;
+    put("ttl", "short lived", expiresAt);
+    check(cache_value(kvCache, "ttl") == "short lived", "Key must be readable before its expiry");
+    put("on-disk", "v1", expiresAt);
+    put("on-disk", "v2", 0);
+    put("in-cache", "v1", expiresAt);
+    put("in-cache", "v2", 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(TTL_MS + 50));
+
+    expire("in-cache");
+    expire("on-disk");
+    check(cache_value(kvCache, "in-cache") == "v2", "Key rewritten without TTL in the cache must survive");
+    check(cache_value(kvCache, "on-disk") == "v2", "Key rewritten without TTL in the Persistent Storage must survive");
+
+    check(cache_value(kvCache, "ttl") == "<NOT FOUND>", "expired Key must be hidden from GET");
+    check(stored_expires_at(kvPersistentStore, "ttl") == expiresAt, "expired record must stay till it is reclaimed");
+    expire("ttl");
+    check(stored_expires_at(kvPersistentStore, "ttl") == 0, "expired Key must be reclaimed");
+
+    // 3.
+    const uint64_t pastMs = KVMessage::current_time_ms() - 1000;
+    for (const string key: {"expired-get", "expired-delete"}) {
+        KVMessage m = make_message(key, "stale");
+        m.expires_at = pastMs;
+        kvPersistentStore.write_to_db(&m);
+    }
+    KVMessage message = make_message("expired-get");
+    check(not kvCache.cache_GET(&message), "GET of an expired record must report NOT found");
+    check(message.expires_at == pastMs, "GET of an expired record must report its expiry to be reclaimed");
+    message = make_message("expired-delete");
+    check(not kvCache.cache_DELETE(&message), "DELETE of an expired record must report NOT found");
+    check(stored_expires_at(kvPersistentStore, "expired-delete") == 0, "DELETE must remove the expired record");
+    check(cache_value(kvCache, "expired-delete") == "<NOT FOUND>", "deleted expired Key must stay NOT found");
+
+    // 4.
+    const uint64_t farMs = KVMessage::current_time_ms() + 3'600'000, nearMs = KVMessage::current_time_ms() + TTL_MS;
+    put("far", "an hour", farMs);
+    put("near", "soon", nearMs);
+    put("evictor", "x", 0);
+    if (chdir("..") != 0) return 1;
+    KVStore restarted;
+    restarted.init_kvstore();
+    message = make_message("far");
+    check(restarted.read_from_db(&message) && message.expires_at == farMs, "TTL must persist across a restart");
+    check(stored_expires_at(restarted, "near") == nearMs, "TTL must persist across a restart");
+    std::this_thread::sleep_for(std::chrono::milliseconds(TTL_MS + 50));
+    message = make_message("near");
+    check(not restarted.read_from_db(&message), "Key must expire after a restart");
+    restarted.expire_from_db(&message);
+    check(stored_expires_at(restarted, "near") == 0 && stored_expires_at(restarted, "far") == farMs,
+          "only the expired Key must be reclaimed after a restart");
+    return 0;
+}
+
+/* A request as sent by a client, refer "KVMessage::StatusCodeEnum" for the format */
+struct WireRequest {
+    uint8_t code;
+    string key, value;
+    uint64_t arg;  // ttl_seconds (PUT_TTL), version (CAS), delta (INCR/DECR) or maxKeys (SCAN), otherwise 0
+
+    bool operator==(const WireRequest &other) const = default;
+
+    [[nodiscard]] string encode() const {
+        string bytes(1, static_cast<char>(code));
+        if (not KVMessage::is_request_code_valid(code)) return bytes;
+        const size_t valueLen = (KVMessage::is_request_with_value(code) || KVMessage::is_request_code_SCAN(code))
+                                ? KV_STR_LEN : 0;
+        bytes += key + string(KV_STR_LEN - key.size(), '\0');
+        if (valueLen != 0) bytes += value + string(KV_STR_LEN - value.size(), '\0');
+        const size_t argLen = KVConnection::request_len(code) - bytes.size();
+        bytes.append(reinterpret_cast<const char *>(&arg), argLen);  // little endian, i.e. the first "argLen" bytes
+        return bytes;
+    }
+};
+
+/* Write "stream" to a KVConnection in pieces which end at "cuts", and parse the requests after each piece
+ * Returns: the requests parsed */
+vector<WireRequest> parse_in_pieces(const string &stream, const vector<size_t> &cuts) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        log_error("socketpair(...) failed");
+        exit(1);
+    }
+    KVConnection connection;
+    connection.reset(fds[0], false);
+
+    vector<WireRequest> parsed;
+    KVMessage message;
+    size_t begin = 0;
+    for (const size_t end: cuts) {
+        check(write(fds[1], stream.data() + begin, end - begin) == static_cast<ssize_t>(end - begin), "write failed");
+        begin = end;
+        // A piece larger than the receive buffer needs more than one "fill()"
+        struct pollfd readable{fds[0], POLLIN, 0};
+        while (poll(&readable, 1, 0) == 1) {
+            if (not connection.fill()) break;
+            KVConnection::RequestStatus status;
+            while ((status = connection.next_request(&message)) != KVConnection::Request_INCOMPLETE) {
+                WireRequest request{message.status_code, "", "", 0};
+                if (status == KVConnection::Request_READY) {
+                    request.key = string(message.key, strnlen(message.key, KV_STR_LEN));
+                    if (message.is_request_with_value() || message.is_request_code_SCAN())
+                        request.value = string(message.value, strnlen(message.value, KV_STR_LEN));
+                    request.arg = message.is_request_code_PUT_TTL() ? message.ttl_seconds : message.request_arg;
+                    check((message.expires_at != 0) == message.is_request_code_PUT_TTL(),
+                          "only PUT_TTL may set expires_at");
+                }
+                parsed.push_back(request);
+            }
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return parsed;
+}
+
+/* Returns: all the bytes sent by "connection.flush()", read from "fd" (the other end of its socket) by another
+ * thread, so that "flush()" finds the socket buffer full if "expectedLen" is large */
+string flush_and_receive(KVConnection &connection, int fd, size_t expectedLen) {
+    string received;
+    std::thread reader([fd, expectedLen, &received]() {
+        char buffer[4096];
+        while (received.size() < expectedLen) {
+            const ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            received.append(buffer, n);
+        }
+    });
+    check(connection.flush(), "flush must send everything");
+    reader.join();
+    return received;
+}
+
+/* KVConnection (refer KVConnection.hpp):
+ *     1. the requests of every kind (and an invalid request code) are parsed the same, no matter how the stream is
+ *        split across the reads: at every byte for two reads, in pieces of various lengths, and all at once when
+ *        the stream is larger than the receive buffer. The fields which a request does NOT have are reset
+ *     2. pinned payloads are sent in their place among the other responses and their pins are released, also when
+ *        "sendmsg(...)" sends only a part (i.e. the payloads are copied), and when too many are pinned */
+int test_connection_split_reads() {
+    // 1.
+    const vector<WireRequest> requests = {
+            {KVMessage::StatusCodeValuePUT,     "key-1", "value-1",     0},
+            {KVMessage::StatusCodeValueGET,     "key-1", "",            0},
+            {KVMessage::StatusCodeValueCAS,     "key-1", "value-2",     0x1122334455667788ULL},
+            {KVMessage::StatusCodeValueGETS,    "key-1", "",            0},
+            {99,                                "",      "",            0},
+            {KVMessage::StatusCodeValuePUT_TTL, "key-2", "expiring",    3600},
+            {KVMessage::StatusCodeValueINCR,    "count", "",            static_cast<uint64_t>(-5)},
+            {KVMessage::StatusCodeValueDECR,    "count", "",            7},
+            {KVMessage::StatusCodeValueSCAN,    "key-",  "key-1",       100},
+            {KVMessage::StatusCodeValueDEL,     "key-1", "",            0},
+            {KVMessage::StatusCodeValuePUT,     string(KV_STR_LEN - 1, 'k'), string(KV_STR_LEN - 1, 'v'), 0},
+            {KVMessage::StatusCodeValueSTATS,   "",      "",            0},
+            {KVMessage::StatusCodeValueSNAPSHOT, "snap", "",            0},
+    };
+    string stream;
+    for (const WireRequest &request: requests) stream += request.encode();
+
+    check(parse_in_pieces(stream, {stream.size()}) == requests, "requests read at once");
+    for (size_t cut = 1; cut < stream.size(); ++cut) {
+        if (parse_in_pieces(stream, {cut, stream.size()}) != requests) {
+            check(false, "requests split across two reads at byte " + to_string(cut));
+            break;
+        }
+    }
+    for (const size_t pieceLen: {1, 2, 3, 255, 256, 257, 511, 513, 1000}) {
+        vector<size_t> cuts;
+        for (size_t end = pieceLen; end < stream.size(); end += pieceLen) cuts.push_back(end);
+        cuts.push_back(stream.size());
+        check(parse_in_pieces(stream, cuts) == requests, "requests read in pieces of " + to_string(pieceLen));
+    }
+    vector<WireRequest> many;
+    string manyStream;
+    for (uint32_t i = 0; manyStream.size() < 3 * KVConnection::RECV_BUFFER_LEN; ++i) {
+        many.push_back(requests[i % requests.size()]);
+        manyStream += many.back().encode();
+    }
+    check(parse_in_pieces(manyStream, {manyStream.size()}) == many, "requests larger than the receive buffer");
+    check(parse_in_pieces(manyStream, {1, KVConnection::RECV_BUFFER_LEN + 1, manyStream.size()}) == many,
+          "requests larger than the receive buffer, split at its length");
+
+    // 2.
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return 1;
+    const int sendBufferLen = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sendBufferLen, sizeof(sendBufferLen));
+    KVConnection connection;
+    connection.reset(fds[0], false);
+
+    std::atomic_uint32_t pins[KVConnection::MAX_PINNED_PAYLOADS] = {};
+    char payloads[KVConnection::MAX_PINNED_PAYLOADS][256];
+    for (uint32_t i = 0; i < KVConnection::MAX_PINNED_PAYLOADS; ++i) memset(payloads[i], 'A' + i % 26, 256);
+    for (const size_t copiedLen: {1, 10'000}) {
+        // 10'000 bytes between the payloads do NOT fit in the socket buffer, so only a part is sent at once
+        string expected;
+        for (uint32_t i = 0; i < 8; ++i) {
+            const string copied(copiedLen, static_cast<char>('0' + i));
+            connection.append(copied.data(), copied.size());
+            pins[i].fetch_add(1);
+            connection.append_pinned(payloads[i], 256, &pins[i]);
+            expected += copied + string(payloads[i], 256);
+        }
+        connection.append("end", 3);
+        expected += "end";
+        check(flush_and_receive(connection, fds[1], expected.size()) == expected,
+              "pinned payloads must be sent in their place, " + to_string(copiedLen) + " bytes between them");
+        check(std::all_of(pins, pins + 8, [](const std::atomic_uint32_t &pin) { return pin == 0; }),
+              "pins must be released once sent, " + to_string(copiedLen) + " bytes between them");
+        check(not connection.has_pinned_payloads(), "no payload may stay pinned after flush");
+    }
+
+    string expected;
+    for (uint32_t i = 0; i < KVConnection::MAX_PINNED_PAYLOADS; ++i) {
+        connection.append(&i, sizeof(uint32_t));
+        pins[i].fetch_add(1);
+        connection.append_pinned(payloads[i], 256, &pins[i]);
+        expected += string(reinterpret_cast<const char *>(&i), sizeof(uint32_t)) + string(payloads[i], 256);
+    }
+    check(not connection.has_pinned_payloads() && pins[0] == 0, "too many pinned payloads must be copied");
+    check(flush_and_receive(connection, fds[1], expected.size()) == expected, "copied payloads must be in place");
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+/* SPSCQueue (refer MySPSCQueue.hpp):
+ *     1. the capacity is rounded up to a power of 2, a full queue rejects the push, and the items come out in order
+ *        after the indexes wrap around the buffer many times
+ *     2. a producer and a consumer thread pass millions of items through a small queue (i.e. it is full or empty
+ *        most of the time), and every item arrives exactly once and in order */
+int test_spsc_queue() {
+    // 1.
+    SPSCQueue<uint64_t> queue(5);
+    uint64_t item = 0;
+    check(not queue.pop(item), "new queue must be empty");
+    for (uint64_t round = 0; round < 100; ++round) {
+        for (uint64_t i = 0; i < 8; ++i) check(queue.push(round * 8 + i), "queue of capacity 5 must hold 8 items");
+        check(not queue.push(0), "full queue must reject the push");
+        for (uint64_t i = 0; i < 8; ++i) check(queue.pop(item) && item == round * 8 + i, "items must be in order");
+        check(not queue.pop(item), "queue must be empty after popping everything");
+    }
+
+    // 2.
+    static constexpr uint64_t ITEMS = 2'000'000;
+    SPSCQueue<uint64_t> shared(16);
+    std::thread producer([&shared]() {
+        for (uint64_t i = 1; i <= ITEMS; ++i) {
+            while (not shared.push(i)) std::this_thread::yield();
+        }
+    });
+    uint64_t expected = 1, outOfOrder = 0;
+    while (expected <= ITEMS) {
+        if (not shared.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (item != expected) ++outOfOrder;
+        expected = item + 1;
+    }
+    producer.join();
+    check(outOfOrder == 0, "items must arrive exactly once and in order, out of order = " + to_string(outOfOrder));
+    check(not shared.pop(item), "queue must be empty once every item arrived");
+    return 0;
+}
+
+/* WorkStealingDeque (refer MyWorkStealingDeque.hpp):
+ *     1. the owner pops the newest item (LIFO) and the thieves steal the oldest one (FIFO)
+ *     2. the owner pushes and pops while 3 thieves steal, and every item is taken exactly once */
+int test_work_stealing_deque() {
+    // 1.
+    WorkStealingDeque<uint32_t> deque;
+    uint32_t item = 0;
+    check(not deque.pop_bottom(item) && (not deque.steal_top(item)), "new deque must be empty");
+    for (uint32_t i = 1; i <= 4; ++i) deque.push_bottom(i);
+    check(deque.size() == 4, "deque must have 4 items");
+    check(deque.pop_bottom(item) && item == 4, "owner must pop the newest item");
+    check(deque.steal_top(item) && item == 1, "thief must steal the oldest item");
+    check(deque.pop_bottom(item) && item == 3 && deque.steal_top(item) && item == 2, "middle items in order");
+    check(deque.size() == 0 && (not deque.pop_bottom(item)) && (not deque.steal_top(item)), "deque must be empty");
+
+    // 2.
+    static constexpr uint32_t ITEMS = 200'000, THIEVES = 3;
+    vector<std::atomic_uint32_t> taken(ITEMS);
+    std::atomic_bool ownerDone(false);
+    vector<std::thread> thieves;
+    for (uint32_t t = 0; t < THIEVES; ++t) {
+        thieves.emplace_back([&deque, &taken, &ownerDone]() {
+            uint32_t stolen;
+            while (not ownerDone || deque.size() != 0) {
+                if (deque.steal_top(stolen)) ++taken[stolen];
+                else std::this_thread::yield();
+            }
+        });
+    }
+    for (uint32_t i = 0; i < ITEMS; ++i) {
+        deque.push_bottom(i);
+        if (i % 3 == 0 && deque.pop_bottom(item)) ++taken[item];
+    }
+    while (deque.pop_bottom(item)) ++taken[item];
+    ownerDone = true;
+    for (std::thread &thief: thieves) thief.join();
+
+    uint32_t lost = 0, duplicated = 0;
+    for (const std::atomic_uint32_t &count: taken) {
+        lost += (count == 0);
+        duplicated += (count > 1);
+    }
+    check(lost == 0 && duplicated == 0, "every item must be taken exactly once, lost = " + to_string(lost)
+                                        + ", taken more than once = " + to_string(duplicated));
+    return 0;
+}
+
+/* Buffer of "len" bytes between two inaccessible pages, so any read or write beyond either end of the buffer
+ * crashes the test with SIGSEGV instead of going unnoticed */
+class GuardedBuffer {
+public:
+    explicit GuardedBuffer(uint32_t len) : len(len) {
+        const size_t pageLen = sysconf(_SC_PAGESIZE);
+        const size_t dataPages = (len + pageLen - 1) / pageLen;
+        mapLen = (dataPages + 2) * pageLen;
+        base = static_cast<char *>(mmap(nullptr, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (base == MAP_FAILED || mprotect(base, pageLen, PROT_NONE) != 0
+            || mprotect(base + (dataPages + 1) * pageLen, pageLen, PROT_NONE) != 0) {
+            log_error("Unable to map the guarded buffer");
+            exit(1);
+        }
+        // The end of the buffer touches the guard page after it, which is where the overflows happen
+        data = base + (dataPages + 1) * pageLen - len;
+    }
+
+    GuardedBuffer(const GuardedBuffer &) = delete;
+    GuardedBuffer &operator=(const GuardedBuffer &) = delete;
+
+    ~GuardedBuffer() { munmap(base, mapLen); }
+
+    char *data;
+    const uint32_t len;
+
+private:
+    char *base;
+    size_t mapLen;
+};
+
+/* Returns: "src" compressed into a buffer of exactly the compressed length, empty if it does NOT fit in "dstCapacity" */
+string lz4_compress(const string &src, uint32_t dstCapacity) {
+    GuardedBuffer in(src.size()), out(dstCapacity);
+    memcpy(in.data, src.data(), src.size());
+    const uint32_t compressedLen = LZ4BlockCodec::compress(in.data, in.len, out.data, out.len);
+    return string(out.data, compressedLen);
+}
+
+/* Returns: length written by "LZ4BlockCodec::decompress(...)", and the output in "dst" */
+int64_t lz4_decompress(const string &src, uint32_t dstCapacity, string &dst) {
+    GuardedBuffer in(src.size()), out(dstCapacity);
+    memcpy(in.data, src.data(), src.size());
+    const int64_t len = LZ4BlockCodec::decompress(in.data, in.len, out.data, out.len);
+    dst = (len < 0) ? "" : string(out.data, len);
+    return len;
+}
+
+/* LZ4BlockCodec (refer MyCompression.hpp), every input and output is a "GuardedBuffer" of the exact length:
+ *     1. round trips of empty, short, incompressible, highly repetitive and 256 byte (i.e. largest) Values
+ *     2. compression into a buffer which is too small fails instead of writing beyond it
+ *     3. every truncation of valid compressed data, and every single byte corruption of it, is either rejected
+ *        or decompressed within the capacity, without reading or writing out of bounds
+ *     4. decompression of random bytes, and of sequences whose lengths or offsets point outside the buffers */
+int test_codec_lz4() {
+    std::mt19937 rng(42);
+    auto random_bytes = [&rng](uint32_t len) {
+        string s(len, '\0');
+        for (char &c: s) c = static_cast<char>(rng() & 0xFFU);
+        return s;
+    };
+
+    // 1.
+    string words;
+    while (words.size() < 256) words += "key-value store ";
+    const vector<pair<string, string>> values = {
+            {"empty",          ""},
+            {"one byte",       "x"},
+            {"12 bytes",       "abcdabcdabcd"},
+            {"13 bytes",       "abcdabcdabcda"},
+            {"incompressible", random_bytes(256)},
+            {"repetitive",     string(256, 'a')},
+            {"words",          words.substr(0, 256)},
+            {"255 bytes",      words.substr(0, 255)},
+            {"257 bytes",      words.substr(0, 257)},
+            {"2 byte period",  [] { string s; while (s.size() < 256) s += "ab"; return s; }()},
+    };
+    vector<string> compressedValues;
+    for (const auto &[name, value]: values) {
+        // Worst case of the block format: 1 token + 1 extra length byte per 255 literals + the literals
+        const string compressed = lz4_compress(value, value.size() + value.size() / 255 + 16);
+        check(not compressed.empty(), name + ": compression must fit in the worst case bound");
+        string decompressed;
+        const int64_t len = lz4_decompress(compressed, value.size(), decompressed);
+        check(len == static_cast<int64_t>(value.size()) && decompressed == value,
+              name + ": round trip must give back the Value, length = " + to_string(len));
+        compressedValues.push_back(compressed);
+    }
+    check(compressedValues[5].size() < 16, "256 repeated bytes must compress to a few bytes, got "
+                                           + to_string(compressedValues[5].size()));
+    check(compressedValues[4].size() > 256, "random bytes must NOT compress");
+
+    // 2.
+    for (size_t i = 0; i < values.size(); ++i) {
+        const uint32_t compressedLen = compressedValues[i].size();
+        for (uint32_t capacity = 1; capacity < compressedLen; ++capacity) {
+            check(lz4_compress(values[i].second, capacity).empty(),
+                  values[i].first + ": compression must fail with capacity " + to_string(capacity));
+        }
+        if (values[i].second.empty()) continue;
+        string decompressed;
+        check(lz4_decompress(compressedValues[i], values[i].second.size() - 1, decompressed) < 0,
+              values[i].first + ": decompression must fail if the Value does NOT fit");
+    }
+
+    // 3.
+    for (size_t i = 0; i < values.size(); ++i) {
+        const string &compressed = compressedValues[i];
+        string decompressed;
+        for (uint32_t len = 0; len < compressed.size(); ++len) {
+            const int64_t res = lz4_decompress(compressed.substr(0, len), 256, decompressed);
+            check(res <= static_cast<int64_t>(values[i].second.size()),
+                  values[i].first + ": truncation to " + to_string(len) + " bytes must NOT grow the Value");
+        }
+        for (uint32_t pos = 0; pos < compressed.size(); ++pos) {
+            for (const uint8_t flip: {0x01, 0x0F, 0x80, 0xFF}) {
+                string corrupt = compressed;
+                corrupt[pos] = static_cast<char>(corrupt[pos] ^ flip);
+                check(lz4_decompress(corrupt, 256, decompressed) <= 256, "corrupt output must fit in 256 bytes");
+            }
+        }
+    }
+
+    // 4.
+    string decompressed;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        const string garbage = random_bytes(1 + rng() % 64);
+        check(lz4_decompress(garbage, 256, decompressed) <= 256, "random input must fit in 256 bytes");
+    }
+    const vector<pair<string, string>> malformed = {
+            {"literals beyond the input",     string("\x50" "abc", 4)},
+            {"extra length beyond the input", string("\xF0", 1)},
+            {"missing offset",                string("\x14" "a" "\x01", 3)},
+            {"offset 0",                      string("\x10" "a" "\x00\x00", 4)},
+            {"offset before the output",      string("\x10" "a" "\x02\x00", 4)},
+            {"match beyond the capacity",     string("\x1F" "a" "\x01\x00" "\xFF\xFF\x00", 7)},
+            {"literals beyond the capacity",  string("\xF0" "\xFF\x01", 3) + string(271, 'a')},
+    };
+    for (const auto &[name, input]: malformed) {
+        check(lz4_decompress(input, 256, decompressed) < 0, name + ": must be rejected");
+    }
+    return 0;
+}
+
+/* Returns: 0 if all the checks of the test "testName" passed */
+int run_test(const string &testName) {
+    const string dir = enter_test_dir();
+    kvPersistentStore.init_kvstore();
+
+    if (testName == "cache_cas_incr") test_cache_cas_incr();
+    else if (testName == "cache_single_flight") test_cache_single_flight();
+    else if (testName == "coroutine_resume_queue") test_coroutine_resume_queue();
+    else if (testName == "cache_ttl") test_cache_ttl();
+    else if (testName == "hot_keys") test_hot_keys();
+    else if (testName == "snapshot_concurrent_writes") test_snapshot_concurrent_writes();
+    else if (testName == "key_index_scan") test_key_index_scan();
+    else if (testName == "timing_wheel") test_timing_wheel();
+    else if (testName == "hash_ring") test_hash_ring();
+    else if (testName == "spsc_queue") test_spsc_queue();
+    else if (testName == "work_stealing_deque") test_work_stealing_deque();
+    else if (testName == "codec_lz4") test_codec_lz4();
+    else if (testName == "connection_split_reads") test_connection_split_reads();
+    else {
+        log_error("Unknown test = " + testName);
+        return 2;
+    }
+
+    if (failedChecks != 0) {
+        log_error(testName + ": " + to_string(failedChecks) + " checks failed, files are in " + dir);
+        return 1;
+    }
+    log_success(testName + ": passed");
+    if (system(("rm -rf " + dir).c_str()) != 0) log_error("Unable to remove " + dir);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2) return run_test(argv[1]);
+
     // return main_kv_message();
     // return main_file_io();
     // vector<int> arr1;
@@ -1,4 +1,12 @@
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
 
 using namespace std;
 
@@ -7,15 +15,15 @@ using namespace std;
 #include "KVClientLibrary.hpp"
 
 void read_all_db() {
-    for (uint_fast32_t i = 0; i < HASH_TABLE_LEN; ++i) {
-        if (not kvPersistentStore.file_exists_status.test(i)) continue;
+    for (uint64_t i = 0; i < kvPersistentStore.geometry().file_count(); ++i) {
+        if (not kvPersistentStore.file_exists_status[i]) continue;
         kvPersistentStore.read_db_file(i);
     }
 }
 
 /*
 
-g++ TestingDatabase.cpp KVStoreFileNames_FINAL.obj -o TestingDatabase
+g++ -std=c++20 TestingDatabase.cpp -o TestingDatabase
 
 ./TestingDatabase 123
 ./TestingDatabase . w ABCD 1234 123
@@ -79,6 +87,532 @@ g++ TestingDatabase.cpp KVStoreFileNames_FINAL.obj -o TestingDatabase
 
 
  * */
+// ---------------------------------------------------------------------------------------------------------------------
+// Tests of the file format of KVStore, run as "./TestingDatabase test NAME" (refer CMakeLists.txt)
+
+uint32_t failedChecks = 0;
+
+void check(bool condition, const string &what) {
+    if (condition) return;
+    ++failedChecks;
+    log_error("CHECK FAILED: " + what);
+}
+
+/* Create the directory of the test, the "db" directory of every KVStore of the test is created inside it
+ * Returns: path of the directory */
+string make_test_dir() {
+    char dir[] = "/tmp/KVTest-XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        log_error("Unable to create the test directory");
+        exit(1);
+    }
+    return dir;
+}
+
+/* Start a new KVStore on "dir/db", as if the server was (re)started with the given geometry
+ * NOTE: "init_kvstore()" does chdir("db"), so the files are accessed by their index after this */
+unique_ptr<KVStore> start_store(const string &dir, uint64_t hashTableLen, uint64_t fileTableLen,
+                                uint64_t maxHashTableLen) {
+    if (chdir(dir.c_str()) != 0) {
+        log_error("chdir(\"" + dir + "\") failed");
+        exit(1);
+    }
+    auto store = make_unique<KVStore>();
+    store->set_geometry(hashTableLen, fileTableLen, maxHashTableLen);
+    store->init_kvstore();
+    return store;
+}
+
+KVMessage make_message(const string &key, const string &value = "") {
+    KVMessage message;
+    message.set_key(key.c_str());
+    message.set_value(value.c_str());
+    message.calculate_key_hash();
+    return message;
+}
+
+void store_write(KVStore &store, const string &key, const string &value) {
+    KVMessage message = make_message(key, value);
+    store.write_to_db(&message);
+}
+
+bool store_delete(KVStore &store, const string &key) {
+    const KVMessage message = make_message(key);
+    return store.delete_from_db(&message);
+}
+
+/* Returns: Value of "key", or "<NOT FOUND>" */
+string store_value(KVStore &store, const string &key) {
+    KVMessage message = make_message(key);
+    if (not store.read_from_db(&message)) return "<NOT FOUND>";
+    return string(message.value, strnlen(message.value, 256));
+}
+
+/* Returns: content of the file "fileName" */
+vector<char> read_file(const string &fileName) {
+    ifstream fs(fileName, ios::in | ios::binary);
+    return {istreambuf_iterator<char>(fs), istreambuf_iterator<char>()};
+}
+
+void write_file(const string &fileName, const vector<char> &data) {
+    ofstream fs(fileName, ios::out | ios::binary | ios::trunc);
+    fs.write(data.data(), static_cast<streamsize>(data.size()));
+    check(fs.good(), "unable to write \"" + fileName + "\"");
+}
+
+/* Returns: index of the live entry of "key" in the file "file_idx", or MAX_UINT64 */
+uint64_t find_entry(const KVStore &store, const string &key) {
+    const KVMessage message = make_message(key);
+    const uint64_t fileIdx = store.geometry().file_of(message.hash1);
+    const vector<char> data = read_file(to_string(fileIdx));
+    for (uint64_t idx = 0; KVStore::get_seek_val(idx + 1) <= data.size(); ++idx) {
+        const char *entry = data.data() + KVStore::get_seek_val(idx);
+        uint64_t links[2];
+        memcpy(links, entry, sizeof(links));
+        if (links[0] == MAX_UINT64 && links[1] == MAX_UINT64) continue;
+        if (equal(message.key, message.key + 256, entry + KVStore::OFFSET_KEY)) return idx;
+    }
+    return MAX_UINT64;
+}
+
+/* Returns: rightIdx of the entry "idx" of the file "file_idx" */
+uint64_t entry_right_idx(uint64_t fileIdx, uint64_t idx) {
+    const vector<char> data = read_file(to_string(fileIdx));
+    uint64_t rightIdx;
+    memcpy(&rightIdx, data.data() + KVStore::get_seek_val(idx) + sizeof(uint64_t), sizeof(uint64_t));
+    return rightIdx;
+}
+
+void flip_byte(uint64_t fileIdx, uint64_t offset) {
+    fstream fs(to_string(fileIdx), ios::in | ios::out | ios::binary);
+    char byte = 0;
+    fs.seekg(static_cast<streamoff>(offset));
+    fs.read(&byte, 1);
+    byte = static_cast<char>(byte ^ 0x5A);
+    fs.seekp(static_cast<streamoff>(offset));
+    fs.write(&byte, 1);
+    check(fs.good(), "unable to corrupt file " + to_string(fileIdx));
+}
+
+/* A byte of a record and a byte of the links of a list head are flipped. The Keys whose entries can NOT be
+ * trusted must read as missing (never as some other Value), and "verify_and_repair_files(...)" must drop the
+ * corrupt record and bring back every Key of the list with the corrupt links */
+void test_store_crc(const string &dir) {
+    static constexpr uint64_t SLOTS = 7, KEYS = 40;  // ~6 entries in the list of every slot
+    auto store = start_store(dir, 1, SLOTS, 1);
+    vector<string> keys;
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        keys.push_back("key-" + to_string(i));
+        store_write(*store, keys.back(), "value-" + to_string(i));
+    }
+
+    // "linkKey" is a list head with overflow entries, "recordKey" is an overflow entry of some other list
+    string linkKey, recordKey;
+    uint64_t linkIdx = MAX_UINT64, recordIdx = MAX_UINT64;
+    for (const string &key: keys) {
+        const uint64_t idx = find_entry(*store, key);
+        if (idx < SLOTS && linkKey.empty() && entry_right_idx(0, idx) != idx) {
+            linkKey = key;
+            linkIdx = idx;
+        }
+    }
+    for (const string &key: keys) {
+        const uint64_t idx = find_entry(*store, key);
+        if (idx >= SLOTS && recordKey.empty() && make_message(key).hash1 % SLOTS != linkIdx) {
+            recordKey = key;
+            recordIdx = idx;
+        }
+    }
+    check(linkIdx != MAX_UINT64 && recordIdx != MAX_UINT64, "test Keys must be found in the file");
+    if (failedChecks != 0) return;
+
+    // The first byte of the Value is covered by the record CRC, the links by the links CRC
+    flip_byte(0, KVStore::get_seek_val(recordIdx) + KVStore::OFFSET_VALUE_AREA + sizeof(KVStoreValueHeader));
+    flip_byte(0, KVStore::get_seek_val(linkIdx));
+
+    check(store_value(*store, recordKey) == "<NOT FOUND>", "Key with a corrupt record must read as missing");
+    check(store_value(*store, linkKey) == "<NOT FOUND>", "Key with corrupt links must read as missing");
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        const string value = store_value(*store, keys[i]);
+        check(value == "value-" + to_string(i) || value == "<NOT FOUND>",
+              "Key \"" + keys[i] + "\" must NOT read a wrong Value, got \"" + value + "\"");
+    }
+
+    // A write to the list with the corrupt links is NOT done, instead of following the links
+    store_write(*store, linkKey, "new-value");
+    check(store_value(*store, linkKey) == "<NOT FOUND>", "write to a list with corrupt links must NOT be done");
+
+    const KVStoreVerifyResult result = store->verify_and_repair_files(1, [](const char *, const KVStoreValueHeader &) {});
+    check(result.lists_repaired >= 1, "list with corrupt links must be repaired");
+    check(result.entries_dropped >= 1, "entry with a corrupt record must be dropped");
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        const string expected = (keys[i] == recordKey) ? "<NOT FOUND>" : "value-" + to_string(i);
+        check(store_value(*store, keys[i]) == expected, "after the repair, Key \"" + keys[i] + "\" must read \"" + expected + "\"");
+    }
+    store_write(*store, recordKey, "rewritten");
+    check(store_value(*store, recordKey) == "rewritten", "dropped Key must be written again");
+}
+
+/* Write the file "file_idx" (with "fileTableLen" slots) in the format version 0, i.e. without a header and
+ * without CRCs in the entries. The entries have "entrySize" bytes, i.e. the first "entrySize - 544" bytes of
+ * KVStoreValueHeader between the Key and the Value (refer "KVStoreLegacyLayout"). The Keys of a slot are linked
+ * in the order of "keys", the Key "i" has the version "i + 1" and the first one expires at "FAR_EXPIRY"
+ * The file is padded with blank entries till it has "minEntries" entries */
+static constexpr uint64_t FAR_EXPIRY = 4102444800000;  // 2100-01-01, in ms
+
+void write_legacy_file(uint64_t fileIdx, uint64_t fileTableLen, const vector<string> &keys, uint64_t entrySize,
+                       uint64_t minEntries) {
+    const uint64_t headerLen = entrySize - (4 * sizeof(uint64_t) + 256 + 256);
+    const KVStoreGeometry geometry{DEFAULT_HASH_TABLE_LEN, fileTableLen, DEFAULT_HASH_TABLE_LEN, 0};
+    map<uint64_t, vector<uint64_t>> slotKeys;
+    for (uint64_t i = 0; i < keys.size(); ++i) slotKeys[geometry.slot_of(make_message(keys[i]).hash1)].push_back(i);
+
+    // A blank entry of the first release is all 0xFF till the Key
+    vector<char> data(fileTableLen * entrySize, 0);
+    for (uint64_t idx = 0; idx < fileTableLen; ++idx) fill_n(data.data() + idx * entrySize, 4 * sizeof(uint64_t), static_cast<char>(0xFF));
+    for (const auto &[slot, members]: slotKeys) {
+        vector<uint64_t> positions(1, slot);
+        while (positions.size() < members.size()) {
+            positions.push_back(data.size() / entrySize);
+            data.resize(data.size() + entrySize, 0);
+        }
+        for (uint64_t i = 0; i < members.size(); ++i) {
+            const string value = "value-" + to_string(members[i]);
+            const KVMessage message = make_message(keys[members[i]], value);
+            const uint64_t links[2] = {positions[(i + members.size() - 1) % members.size()],
+                                       positions[(i + 1) % members.size()]};
+            const KVStoreValueHeader header{KVStoreValueHeader::Codec_RAW, static_cast<uint32_t>(value.size()),
+                                            (members[i] == 0) ? FAR_EXPIRY : 0, members[i] + 1};
+            char *entry = data.data() + positions[i] * entrySize;
+            memcpy(entry, links, sizeof(links));
+            memcpy(entry + sizeof(links), &message.hash1, sizeof(uint64_t));
+            memcpy(entry + sizeof(links) + sizeof(uint64_t), &message.hash2, sizeof(uint64_t));
+            memcpy(entry + sizeof(links) + 2 * sizeof(uint64_t), message.key, 256);
+            memcpy(entry + sizeof(links) + 2 * sizeof(uint64_t) + 256, &header, headerLen);
+            memcpy(entry + sizeof(links) + 2 * sizeof(uint64_t) + 256 + headerLen, message.value, 256);
+        }
+    }
+    while (data.size() < minEntries * entrySize) {
+        data.resize(data.size() + entrySize, 0);
+        fill_n(data.end() - static_cast<int64_t>(entrySize), 4 * sizeof(uint64_t), static_cast<char>(0xFF));
+    }
+    write_file(to_string(fileIdx), data);
+}
+
+/* A Persistent Storage of the format version 0 (created before the MANIFEST, so it has the default geometry)
+ * is upgraded on start, for every layout of the entries it had. Every Key must keep its Value, including the
+ * Keys in an overflow entry, and its expiry time and version if the layout had them */
+void test_store_upgrade(const string &dir) {
+    // Entry size, the fields of KVStoreValueHeader which the layout has, and the number of entries in the file
+    struct Layout {
+        uint64_t entry_size;
+        bool has_expiry, has_version;
+        uint64_t min_entries;
+    };
+    static constexpr Layout LAYOUTS[] = {
+            {544, false, false, 0},  // the first release, the files are 4455904 bytes
+            {552, false, false, 0},  // {codec, stored_len}
+            {560, true, false, 0},   // {codec, stored_len, expires_at}
+            // {codec, stored_len, expires_at, version}, 8228 entries of 568 bytes = 8591 entries of 544 bytes, so
+            // the size of the file fits two layouts
+            {568, true, true, 8228}
+    };
+
+    // Keys of the file 0 till two of them share a slot
+    const KVStoreGeometry geometry{DEFAULT_HASH_TABLE_LEN, DEFAULT_FILE_TABLE_LEN, DEFAULT_HASH_TABLE_LEN, 0};
+    vector<string> keys;
+    map<uint64_t, uint64_t> slotCount;
+    for (uint64_t i = 0; slotCount.size() == keys.size(); ++i) {
+        const string key = "key-" + to_string(i);
+        const uint64_t hash1 = make_message(key).hash1;
+        if (geometry.file_of(hash1) != 0) continue;
+        keys.push_back(key);
+        ++slotCount[geometry.slot_of(hash1)];
+    }
+
+    for (const Layout &layout: LAYOUTS) {
+        const string layoutDir = dir + "/" + to_string(layout.entry_size);
+        if (system(("mkdir -p " + layoutDir + "/db").c_str()) != 0 || chdir((layoutDir + "/db").c_str()) != 0) {
+            check(false, "unable to create " + layoutDir + "/db");
+            return;
+        }
+        write_legacy_file(0, DEFAULT_FILE_TABLE_LEN, keys, layout.entry_size, layout.min_entries);
+        const string what = " (" + to_string(layout.entry_size) + " byte entries)";
+
+        // The configured geometry is NOT used, as the files were created with the default one
+        for (int start = 0; start < 2; ++start) {
+            auto store = start_store(layoutDir, 1, 7, 1);
+            check(store->geometry().file_table_len == DEFAULT_FILE_TABLE_LEN, "default geometry must be used" + what);
+            check(read_file("0").size() >= KVStore::get_seek_val(DEFAULT_FILE_TABLE_LEN + 1)
+                  && (read_file("0").size() - KVStore::FILE_HEADER_LEN) % KVStore::SIZE_OF_ONE_ENTRY == 0,
+                  "file must have the entries of the current format" + what);
+            check(read_file("0.upgrade").empty(), "temporary file of the upgrade must NOT be left" + what);
+            for (uint64_t i = 0; i < keys.size(); ++i) {
+                KVMessage message = make_message(keys[i]);
+                const uint64_t version = (layout.has_version) ? (i + 1) : KVStore::LEGACY_RECORD_VERSION;
+                const uint64_t expiresAt = (layout.has_expiry && i == 0) ? FAR_EXPIRY : 0;
+                check(store->read_from_db(&message) && string(message.value) == "value-" + to_string(i)
+                      && message.version == version && message.expires_at == expiresAt,
+                      "Key \"" + keys[i] + "\" must keep its Value, version and expiry" + what);
+            }
+        }
+    }
+}
+
+/* PUT/DELETE churn over a fixed number of live Keys must reuse the freed overflow entries, i.e. the file stops
+ * growing. Once most Keys are deleted, "compact_file(...)" must shrink the file to its live entries, and every
+ * surviving Key (including the ones in overflow entries) must read back, before and after a restart */
+void test_store_churn(const string &dir) {
+    static constexpr uint64_t SLOTS = 7, LIVE = 60, ROUNDS = 20;  // every list has overflow entries
+    auto store = start_store(dir, 1, SLOTS, 1);
+    auto key_of = [](uint64_t i) { return "churn-" + to_string(i); };
+    auto value_of = [](uint64_t i) { return "value-" + to_string(i); };
+    for (uint64_t i = 0; i < LIVE; ++i) store_write(*store, key_of(i), value_of(i));
+    const uint64_t initialBytes = read_file("0").size();
+
+    // Every round deletes the oldest half of the live Keys and writes as many new Keys
+    uint64_t firstLive = 0, nextKey = LIVE;
+    for (uint64_t round = 0; round < ROUNDS; ++round) {
+        for (const uint64_t end = firstLive + LIVE / 2; firstLive < end; ++firstLive)
+            check(store_delete(*store, key_of(firstLive)), "Key \"" + key_of(firstLive) + "\" must be deleted");
+        for (; nextKey < firstLive + LIVE; ++nextKey) store_write(*store, key_of(nextKey), value_of(nextKey));
+        const uint64_t bytes = read_file("0").size();
+        check(bytes <= initialBytes, "file must NOT grow in round " + to_string(round) + ": " + to_string(bytes)
+                                     + " > " + to_string(initialBytes) + " bytes");
+    }
+
+    // Leave a few Keys, so that most of the overflow entries are free
+    static constexpr uint64_t SURVIVORS = 12;
+    for (; firstLive < nextKey - SURVIVORS; ++firstLive) store_delete(*store, key_of(firstLive));
+    check(store->needs_compaction(0, 1), "file with mostly free entries must need a compaction");
+    bool overflowSurvivor = false;
+    map<uint64_t, uint64_t> slotCount;
+    for (uint64_t i = firstLive; i < nextKey; ++i) {
+        overflowSurvivor = overflowSurvivor || find_entry(*store, key_of(i)) >= SLOTS;
+        ++slotCount[make_message(key_of(i)).hash1 % SLOTS];
+    }
+    check(overflowSurvivor, "a surviving Key must be in an overflow entry");
+
+    check(store->compact_file(0), "file must be compacted");
+    check(read_file("0").size() == KVStore::get_seek_val(SLOTS + SURVIVORS - slotCount.size()),
+          "compacted file must have only the live overflow entries");
+    check(not store->needs_compaction(0, 1), "compacted file must NOT need a compaction");
+    for (int start = 0; start < 2; ++start) {
+        if (start == 1) store = start_store(dir, 1, SLOTS, 1);
+        for (uint64_t i = 0; i < nextKey; ++i) {
+            const string expected = (i < firstLive) ? "<NOT FOUND>" : value_of(i);
+            check(store_value(*store, key_of(i)) == expected,
+                  "after the compaction, Key \"" + key_of(i) + "\" must read \"" + expected + "\"");
+        }
+    }
+
+    // New overflow entries are appended, as the compacted file has no free entries
+    store_write(*store, key_of(nextKey), value_of(nextKey));
+    check(store_value(*store, key_of(nextKey)) == value_of(nextKey), "Key written after the compaction must read back");
+}
+
+/* Returns: number of live entries which are in a file other than "file_of(hash1)", or at a slot other than
+ *          "slot_of(hash1)" */
+uint64_t count_misplaced(const KVStore &store) {
+    const KVStoreGeometry geometry = store.geometry();
+    uint64_t misplaced = 0;
+    for (uint64_t fileIdx = 0; fileIdx < geometry.file_count(); ++fileIdx) {
+        const vector<char> data = read_file(to_string(fileIdx));
+        for (uint64_t idx = 0; KVStore::get_seek_val(idx + 1) <= data.size(); ++idx) {
+            const char *entry = data.data() + KVStore::get_seek_val(idx);
+            uint64_t links[2], hash1;
+            memcpy(links, entry, sizeof(links));
+            memcpy(&hash1, entry + KVStore::OFFSET_HASH1, sizeof(uint64_t));
+            if (links[0] == MAX_UINT64 && links[1] == MAX_UINT64) continue;
+            if (geometry.file_of(hash1) != fileIdx || (idx < geometry.file_table_len && geometry.slot_of(hash1) != idx))
+                ++misplaced;
+        }
+    }
+    return misplaced;
+}
+
+/* Several files are split online, every Key must read back before and after a restart. Then a crash is simulated
+ * after each step of a split (refer "KVStore::split_file_if_required(...)"):
+ *     1. only the new file was written: the restart must remove it, and the old geometry is used
+ *     2. the MANIFEST was written too: the moved entries left in the old file are removed by the repair
+ * In both cases every Key must read back and no entry may be left in a file (or slot) it does NOT belong to */
+void test_store_split(const string &dir) {
+    static constexpr uint64_t HASH_TABLE_LEN = 2, SLOTS = 7, MAX_FILES = 64, LOAD_PERCENT = 50;
+    static constexpr uint64_t KEYS = 60, MORE_KEYS = 100;
+    auto store = start_store(dir, HASH_TABLE_LEN, SLOTS, MAX_FILES);
+    auto key_of = [](uint64_t i) { return "split-" + to_string(i); };
+    auto value_of = [](uint64_t i) { return "value-" + to_string(i); };
+    auto check_all_keys = [&store, &key_of, &value_of](uint64_t count, const string &when) {
+        for (uint64_t i = 0; i < count; ++i) {
+            check(store_value(*store, key_of(i)) == value_of(i), when + ", Key \"" + key_of(i) + "\" must read back");
+        }
+        check(count_misplaced(*store) == 0, when + ", no entry may be misplaced");
+    };
+
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        store_write(*store, key_of(i), value_of(i));
+        store->split_file_if_required(i + 1, LOAD_PERCENT);
+    }
+    const uint64_t fileCount = store->geometry().file_count();
+    check(store->splits >= 3 && fileCount == HASH_TABLE_LEN + store->splits, "several files must be split, splits = "
+                                                                              + to_string(store->splits));
+    check_all_keys(KEYS, "after the splits");
+    store = start_store(dir, HASH_TABLE_LEN, SLOTS, MAX_FILES);
+    check(store->geometry().file_count() == fileCount, "restart must use the geometry of the MANIFEST");
+    check_all_keys(KEYS, "after the restart");
+
+    // Split once more, and keep the files of each step. The split has to move some entries to the new file
+    for (uint64_t i = KEYS; i < MORE_KEYS; ++i) store_write(*store, key_of(i), value_of(i));
+    string newFile;
+    vector<char> newFileData, manifestData;
+    for (uint64_t attempt = 0; attempt < 8 && newFileData.empty(); ++attempt) {
+        newFile = to_string(store->geometry().file_count());
+        if (system("rm -rf ../before && cp -r ../db ../before") != 0) check(false, "unable to copy the files");
+        check(store->split_file_if_required(MORE_KEYS, LOAD_PERCENT), "file must be split");
+        newFileData = read_file(newFile);
+    }
+    manifestData = read_file(KVStore::MANIFEST_FILE_NAME);
+    check(not newFileData.empty(), "split must move entries to a new file");
+    check_all_keys(MORE_KEYS, "after the last split");
+    if (failedChecks != 0) return;
+
+    // 1. Crash after the new file was written
+    auto restore_files_before_split = []() {
+        if (system("rm -rf ../db && cp -r ../before ../db") != 0) check(false, "unable to restore the files");
+    };
+    store.reset();
+    restore_files_before_split();
+    write_file("../db/" + newFile, newFileData);
+    store = start_store(dir, HASH_TABLE_LEN, SLOTS, MAX_FILES);
+    check(read_file(newFile).empty(), "new file of an incomplete split must be removed");
+    check(to_string(store->geometry().file_count()) == newFile, "geometry before the incomplete split must be used");
+    check_all_keys(MORE_KEYS, "after a crash in step 1");
+
+    // 2. Crash after the MANIFEST was written
+    store.reset();
+    restore_files_before_split();
+    write_file("../db/" + newFile, newFileData);
+    write_file(string("../db/") + KVStore::MANIFEST_FILE_NAME, manifestData);
+    store = start_store(dir, HASH_TABLE_LEN, SLOTS, MAX_FILES);
+    check(to_string(store->geometry().file_count() - 1) == newFile, "geometry of the MANIFEST must be used");
+    check(count_misplaced(*store) != 0, "moved entries must still be in the old file before the repair");
+    store->verify_and_repair_files(1, [](const char *, const KVStoreValueHeader &) {});
+    check_all_keys(MORE_KEYS, "after a crash in step 2 and the repair");
+
+    // Splitting goes on from the recovered geometry
+    check(store->split_file_if_required(MORE_KEYS, LOAD_PERCENT), "file must be split after the recovery");
+    check_all_keys(MORE_KEYS, "after a split following the recovery");
+}
+
+/* Startup repair of several files by several threads: in every file the links of a list head are corrupt, in some
+ * files a record is corrupt too, and one file ends with a partially written entry. Every list must be repaired, the
+ * corrupt records and the partial entry dropped, and the callback must see every live Key exactly once (i.e. the
+ * in-memory indexes are built from the repaired files). A second pass must find nothing to repair */
+void test_store_startup_repair(const string &dir) {
+    static constexpr uint64_t FILES = 8, SLOTS = 7, KEYS = 320, THREADS = 4;  // ~6 entries in the list of every slot
+    auto store = start_store(dir, FILES, SLOTS, FILES);
+    auto key_of = [](uint64_t i) { return "repair-" + to_string(i); };
+    for (uint64_t i = 0; i < KEYS; ++i) store_write(*store, key_of(i), "value-" + to_string(i));
+
+    // Per file: a list head with overflow entries, and an overflow entry of some other list
+    const KVStoreGeometry geometry = store->geometry();
+    vector<uint64_t> linkIdx(FILES, MAX_UINT64), recordIdx(FILES, MAX_UINT64);
+    vector<string> recordKey(FILES);
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        const uint64_t fileIdx = geometry.file_of(make_message(key_of(i)).hash1);
+        const uint64_t idx = find_entry(*store, key_of(i));
+        if (idx < SLOTS && linkIdx[fileIdx] == MAX_UINT64 && entry_right_idx(fileIdx, idx) != idx) linkIdx[fileIdx] = idx;
+    }
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        const KVMessage message = make_message(key_of(i));
+        const uint64_t fileIdx = geometry.file_of(message.hash1);
+        const uint64_t idx = find_entry(*store, key_of(i));
+        if (idx >= SLOTS && recordIdx[fileIdx] == MAX_UINT64 && geometry.slot_of(message.hash1) != linkIdx[fileIdx]) {
+            recordIdx[fileIdx] = idx;
+            recordKey[fileIdx] = key_of(i);
+        }
+    }
+
+    set<string> expectedKeys;
+    for (uint64_t i = 0; i < KEYS; ++i) expectedKeys.insert(key_of(i));
+    uint64_t corruptLists = 0, corruptRecords = 0;
+    for (uint64_t fileIdx = 0; fileIdx < FILES; ++fileIdx) {
+        check(linkIdx[fileIdx] != MAX_UINT64, "file " + to_string(fileIdx) + " must have a list with overflow entries");
+        if (linkIdx[fileIdx] == MAX_UINT64) continue;
+        flip_byte(fileIdx, KVStore::get_seek_val(linkIdx[fileIdx]) + sizeof(uint64_t));
+        ++corruptLists;
+        if (fileIdx % 2 == 0 || recordIdx[fileIdx] == MAX_UINT64) continue;
+        flip_byte(fileIdx, KVStore::get_seek_val(recordIdx[fileIdx]) + KVStore::OFFSET_VALUE_AREA
+                           + sizeof(KVStoreValueHeader));
+        expectedKeys.erase(recordKey[fileIdx]);
+        ++corruptRecords;
+    }
+    if (failedChecks != 0) return;
+
+    // Crash while an entry was being appended to the file 0
+    static constexpr uint64_t PARTIAL_LEN = 100;
+    vector<char> data = read_file("0");
+    const uint64_t fileBytes = data.size();
+    data.resize(fileBytes + PARTIAL_LEN, 'x');
+    write_file("0", data);
+
+    // Restart, as the server does it: verify the files and build the in-memory indexes in the same pass
+    store = start_store(dir, FILES, SLOTS, FILES);
+    mutex mutexSeen;
+    multiset<string> seen;
+    auto collect_keys = [&mutexSeen, &seen](const char *key, const KVStoreValueHeader &) {
+        lock_guard lock(mutexSeen);
+        seen.insert(string(key, strnlen(key, 256)));
+    };
+    const KVStoreVerifyResult result = store->verify_and_repair_files(THREADS, collect_keys);
+    check(result.files == FILES && result.files_failed == 0, "every file must be verified");
+    check(result.lists_repaired >= corruptLists, "every list with corrupt links must be repaired, repaired = "
+                                                 + to_string(result.lists_repaired));
+    check(result.entries_dropped == corruptRecords + 1, "corrupt records and the partial entry must be dropped, "
+                                                        "dropped = " + to_string(result.entries_dropped));
+    check(result.bytes_reclaimed >= PARTIAL_LEN, "partial entry must be removed from the end of the file");
+    check(read_file("0").size() <= fileBytes, "file with a partial entry must be truncated");
+    check(result.entries == expectedKeys.size() && seen.size() == expectedKeys.size()
+          && set<string>(seen.begin(), seen.end()) == expectedKeys,
+          "callback must see every live Key exactly once, entries = " + to_string(result.entries) + ", seen = "
+          + to_string(seen.size()) + ", expected = " + to_string(expectedKeys.size()));
+    for (uint64_t i = 0; i < KEYS; ++i) {
+        const string expected = expectedKeys.count(key_of(i)) ? "value-" + to_string(i) : "<NOT FOUND>";
+        check(store_value(*store, key_of(i)) == expected, "after the repair, Key \"" + key_of(i) + "\" must read \""
+                                                          + expected + "\"");
+    }
+
+    // Nothing is left to repair after a restart
+    store = start_store(dir, FILES, SLOTS, FILES);
+    seen.clear();
+    const KVStoreVerifyResult again = store->verify_and_repair_files(THREADS, collect_keys);
+    check(again.lists_repaired == 0 && again.entries_dropped == 0 && again.entries_relinked == 0
+          && again.bytes_reclaimed == 0, "second repair must find nothing to repair");
+    check(again.entries == expectedKeys.size() && seen.size() == expectedKeys.size(),
+          "second repair must see the same Keys");
+}
+
+int run_test(const string &testName) {
+    const string dir = make_test_dir();
+    if (testName == "store_crc") test_store_crc(dir);
+    else if (testName == "store_upgrade") test_store_upgrade(dir);
+    else if (testName == "store_churn") test_store_churn(dir);
+    else if (testName == "store_split") test_store_split(dir);
+    else if (testName == "store_startup_repair") test_store_startup_repair(dir);
+    else {
+        log_error("Unknown test = " + testName);
+        return 2;
+    }
+
+    if (failedChecks != 0) {
+        log_error(testName + ": " + to_string(failedChecks) + " checks failed, files are in " + dir);
+        return 1;
+    }
+    log_success(testName + ": passed");
+    if (system(("rm -rf " + dir).c_str()) != 0) log_error("Unable to remove " + dir);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if (argc == 1) {
         cout << "Usage:"
@@ -90,11 +624,13 @@ int main(int argc, char *argv[]) {
              << "\n./a.out . send IP PORT d KEY                     Make DELETE request to the server"
              << "\n./a.out . send IP PORT r KEY                     Make READ request to the server"
              << "\n./a.out .                                        This will READ ALL DATABASE entries"
-             << "\n./a.out DB_FILE_NAME [DB_FILE_NAME [...]]        Read database with name DB_FILE_NAME\n";
+             << "\n./a.out DB_FILE_NAME [DB_FILE_NAME [...]]        Read database with name DB_FILE_NAME"
+             << "\n./a.out test NAME                                Run the test NAME in a new directory inside /tmp\n";
         return 0;
     }
+    if (argc == 3 && string(argv[1]) == "test") return run_test(argv[2]);
     // Compiled using:
-    //     g++ -O3 TestingDatabase.cpp KVStoreFileNames_FINAL.obj -o TestingDatabase
+    //     g++ -std=c++20 -O3 TestingDatabase.cpp -o TestingDatabase
     kvPersistentStore.init_kvstore();  // This is present in KVStore.hpp
 
     cout << "\n-----------------\n";
@@ -110,9 +646,12 @@ int main(int argc, char *argv[]) {
         message.calculate_key_hash();
         log_info("Hash1 for \"" + string(argv[2]) + "\"= " + to_string(message.hash1));
         log_info("Hash2 for \"" + string(argv[2]) + "\"= " + to_string(message.hash2));
-        log_info("File Name  = Hash1 % " + to_string(HASH_TABLE_LEN) + " = " +
-                 to_string(message.hash1 % HASH_TABLE_LEN));
-        log_info("File Index = Hash1 % " + to_string(FILE_TABLE_LEN) + " = " + to_string(message.hash1 % FILE_TABLE_LEN));
+        // "log_info(...)" is compiled out unless DEBUGGING_ON is defined
+        [[maybe_unused]] const KVStoreGeometry geometry = kvPersistentStore.geometry();
+        log_info("File Name  = " + to_string(geometry.file_of(message.hash1)) + " (files = "
+                 + to_string(geometry.file_count()) + ")");
+        log_info("File Index = Hash1 % " + to_string(geometry.file_table_len) + " = "
+                 + to_string(geometry.slot_of(message.hash1)));
     } else if (argc >= 4 && argv[1][0] == '.') {
         KVMessage message;
         message.set_key(argv[3]);